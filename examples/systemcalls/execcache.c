@@ -0,0 +1,705 @@
+#define _GNU_SOURCE
+#include "execcache.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+// Number of hash chains for the in memory index
+#define CACHE_CHAINS 256
+
+// Read size used when hashing input files
+#define CACHE_READ_SIZE (64 * 1024)
+
+/**
+ * One cached output, on an intrusive least recently used list (head is the newest)
+ */
+struct cache_entry
+{
+	struct cache_entry *chain_next;
+	struct cache_entry *newer;
+	struct cache_entry *older;
+	char key[EXEC_CACHE_KEY_LEN];
+	size_t size;
+};
+
+/**
+ * Streaming 128 bit hash state, two independently mixed 64 bit lanes over 8 byte words
+ */
+struct key_hash
+{
+	uint64_t a;
+	uint64_t b;
+	uint64_t length;
+	unsigned char tail[8];
+	size_t tail_len;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool cache_enabled = false;
+static int cache_dir_fd = -1;
+static size_t cache_max_bytes;
+static char **cache_env;
+static struct cache_entry *cache_table[CACHE_CHAINS];
+static struct cache_entry *cache_newest;
+static struct cache_entry *cache_oldest;
+static struct exec_cache_counters cache_counters;
+
+// Bumped by every exec_cache_enable(), a store started before it is not indexed after it
+static unsigned long cache_generation;
+
+// Makes the temporary names of concurrent stores in this process unique
+static unsigned long cache_store_sequence;
+
+//--------------------------------------HASH--------------------------------------
+
+static uint64_t rotl64(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static void hash_word(struct key_hash *hash, uint64_t word)
+{
+	hash->a = rotl64((hash->a ^ word) * 0x9E3779B97F4A7C15ULL, 31);
+	hash->b = (rotl64(hash->b + word, 27) * 0xC2B2AE3D27D4EB4FULL) ^ (hash->b >> 29);
+}
+
+static void hash_init(struct key_hash *hash)
+{
+	memset(hash, 0, sizeof(*hash));
+	hash->a = 0x243F6A8885A308D3ULL;
+	hash->b = 0x13198A2E03707344ULL;
+}
+
+static void hash_update(struct key_hash *hash, const void *data, size_t length)
+{
+	const unsigned char *bytes = data;
+	uint64_t word;
+
+	hash->length += length;
+
+	// Top up a partial word left over from the previous update first
+	while(hash->tail_len > 0 && hash->tail_len < 8 && length > 0)
+	{
+		hash->tail[hash->tail_len++] = *bytes++;
+		length--;
+	}
+	if(hash->tail_len == 8)
+	{
+		memcpy(&word, hash->tail, 8);
+		hash_word(hash, word);
+		hash->tail_len = 0;
+	}
+
+	for(; length >= 8; bytes += 8, length -= 8)
+	{
+		memcpy(&word, bytes, 8);
+		hash_word(hash, word);
+	}
+
+	memcpy(hash->tail, bytes, length);
+	hash->tail_len = length;
+}
+
+/**
+* Feed one length prefixed field, so ("ab","c") and ("a","bc") hash differently
+*/
+static void hash_field(struct key_hash *hash, const void *data, size_t length)
+{
+	uint64_t prefix = length;
+	hash_update(hash, &prefix, sizeof(prefix));
+	hash_update(hash, data, length);
+}
+
+static uint64_t hash_avalanche(uint64_t value)
+{
+	value ^= value >> 33;
+	value *= 0xFF51AFD7ED558CCDULL;
+	value ^= value >> 33;
+	value *= 0xC4CEB9FE1A85EC53ULL;
+	value ^= value >> 33;
+	return value;
+}
+
+static void hash_final(struct key_hash *hash, char key[EXEC_CACHE_KEY_LEN])
+{
+	uint64_t word = 0;
+	memcpy(&word, hash->tail, hash->tail_len);
+	hash_word(hash, word ^ ((uint64_t)hash->tail_len << 56));
+	hash_word(hash, hash->length);
+
+	uint64_t a = hash_avalanche(hash->a ^ hash->b);
+	uint64_t b = hash_avalanche(hash->b + a);
+	snprintf(key, EXEC_CACHE_KEY_LEN, "%016llx%016llx", (unsigned long long)a, (unsigned long long)b);
+}
+
+/**
+* @return true if the whole contents of path were fed to hash, false on any error
+*/
+static bool hash_file(struct key_hash *hash, const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return false;
+
+	char *buffer = malloc(CACHE_READ_SIZE);
+	if(buffer == NULL)
+	{
+		close(fd);
+		return false;
+	}
+
+	bool success = true;
+	for(;;)
+	{
+		ssize_t got = read(fd, buffer, CACHE_READ_SIZE);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got < 0)
+			success = false;
+		if(got <= 0)
+			break;
+		hash_update(hash, buffer, (size_t)got);
+	}
+
+	// Terminate the contents so the next field cannot run into them
+	uint64_t end = ~(uint64_t)0;
+	hash_update(hash, &end, sizeof(end));
+
+	free(buffer);
+	close(fd);
+	return success;
+}
+
+//--------------------------------------FILES-------------------------------------
+
+/**
+* Make dst_fd an exact copy of src_fd: share extents with FICLONE where the filesystem
+* supports reflinks, otherwise copy kernel side with copy_file_range(), and as a last
+* resort through a user space buffer.
+* @return true if dst_fd now holds the contents of src_fd
+*/
+static bool clone_fd(int src_fd, int dst_fd)
+{
+	struct stat st;
+
+	if(ioctl(dst_fd, FICLONE, src_fd) == 0)
+		return true;
+
+	if(fstat(src_fd, &st) < 0 || ftruncate(dst_fd, 0) < 0)
+		return false;
+
+	off_t remaining = st.st_size;
+	loff_t in_off = 0;
+	loff_t out_off = 0;
+	while(remaining > 0)
+	{
+		ssize_t copied = copy_file_range(src_fd, &in_off, dst_fd, &out_off, (size_t)remaining, 0);
+		if(copied < 0 && errno == EINTR)
+			continue;
+		if(copied <= 0)
+			break;
+		remaining -= copied;
+	}
+	if(remaining == 0)
+		return true;
+
+	// copy_file_range() refused (cross filesystem on older kernels), finish with read/write
+	char buffer[CACHE_READ_SIZE];
+	while(remaining > 0)
+	{
+		ssize_t got = pread(src_fd, buffer, sizeof(buffer), in_off);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got <= 0)
+			return false;
+		ssize_t put = pwrite(dst_fd, buffer, (size_t)got, out_off);
+		if(put < 0 && errno == EINTR)
+			continue;
+		if(put <= 0)
+			return false;
+		in_off += put;
+		out_off += put;
+		remaining -= put;
+	}
+	return true;
+}
+
+//--------------------------------------INDEX-------------------------------------
+
+static unsigned int key_chain(const char *key)
+{
+	// The key is already a good hash, its first hex digits pick the chain
+	return (unsigned int)strtoul((char[]){ key[0], key[1], key[2], '\0' }, NULL, 16) % CACHE_CHAINS;
+}
+
+/**
+* @return the entry for key, or NULL.  Call with cache_lock held.
+*/
+static struct cache_entry *index_find(const char *key)
+{
+	struct cache_entry *entry;
+	for(entry = cache_table[key_chain(key)]; entry != NULL; entry = entry->chain_next)
+	{
+		if(strcmp(entry->key, key) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+static void lru_unlink(struct cache_entry *entry)
+{
+	if(entry->newer != NULL)
+		entry->newer->older = entry->older;
+	else
+		cache_newest = entry->older;
+	if(entry->older != NULL)
+		entry->older->newer = entry->newer;
+	else
+		cache_oldest = entry->newer;
+	entry->newer = entry->older = NULL;
+}
+
+static void lru_push_newest(struct cache_entry *entry)
+{
+	entry->older = cache_newest;
+	entry->newer = NULL;
+	if(cache_newest != NULL)
+		cache_newest->newer = entry;
+	cache_newest = entry;
+	if(cache_oldest == NULL)
+		cache_oldest = entry;
+}
+
+/**
+* Remove entry from the index and the list and free it.  Call with cache_lock held.
+*/
+static void index_remove(struct cache_entry *entry)
+{
+	struct cache_entry **link = &cache_table[key_chain(entry->key)];
+	while(*link != entry)
+		link = &(*link)->chain_next;
+	*link = entry->chain_next;
+
+	lru_unlink(entry);
+	cache_counters.bytes -= entry->size;
+	cache_counters.entries--;
+	free(entry);
+}
+
+/**
+* Add (or refresh) key as the newest entry.  Call with cache_lock held.
+*/
+static void index_insert(const char *key, size_t size)
+{
+	struct cache_entry *entry = index_find(key);
+	if(entry != NULL)
+		index_remove(entry);
+
+	entry = calloc(1, sizeof(*entry));
+	if(entry == NULL)
+		return;
+	strcpy(entry->key, key);
+	entry->size = size;
+
+	unsigned int chain = key_chain(key);
+	entry->chain_next = cache_table[chain];
+	cache_table[chain] = entry;
+	lru_push_newest(entry);
+	cache_counters.bytes += size;
+	cache_counters.entries++;
+}
+
+/**
+* Drop least recently used entries until the cache fits.  Call with cache_lock held.
+*/
+static void index_evict(void)
+{
+	while(cache_counters.bytes > cache_max_bytes && cache_oldest != NULL)
+	{
+		unlinkat(cache_dir_fd, cache_oldest->key, 0);
+		index_remove(cache_oldest);
+		cache_counters.evictions++;
+	}
+}
+
+static void index_clear(void)
+{
+	while(cache_oldest != NULL)
+		index_remove(cache_oldest);
+}
+
+/**
+* @return true if name looks like one of our keys
+*/
+static bool is_key(const char *name)
+{
+	size_t i;
+	for(i = 0; i < EXEC_CACHE_KEY_LEN - 1; i++)
+	{
+		if(!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f')))
+			return false;
+	}
+	return name[i] == '\0';
+}
+
+/**
+ * An entry found on disk when the cache is enabled
+ */
+struct found_entry
+{
+	char key[EXEC_CACHE_KEY_LEN];
+	size_t size;
+	struct timespec used;
+};
+
+static int found_compare(const void *left, const void *right)
+{
+	const struct found_entry *a = left;
+	const struct found_entry *b = right;
+	if(a->used.tv_sec != b->used.tv_sec)
+		return a->used.tv_sec < b->used.tv_sec ? -1 : 1;
+	if(a->used.tv_nsec != b->used.tv_nsec)
+		return a->used.tv_nsec < b->used.tv_nsec ? -1 : 1;
+	return 0;
+}
+
+/**
+* @return true if name is the temporary file of a store by a process that no longer exists
+*/
+static bool is_stale_temporary(const char *name)
+{
+	size_t length = strlen(name);
+	if(length < EXEC_CACHE_KEY_LEN + 4 || name[EXEC_CACHE_KEY_LEN - 1] != '.' ||
+			strcmp(name + length - 4, ".tmp") != 0)
+		return false;
+
+	char key[EXEC_CACHE_KEY_LEN];
+	memcpy(key, name, EXEC_CACHE_KEY_LEN - 1);
+	key[EXEC_CACHE_KEY_LEN - 1] = '\0';
+	char *end;
+	long pid = strtol(name + EXEC_CACHE_KEY_LEN, &end, 10);
+	if(!is_key(key) || pid <= 0 || *end != '.')
+		return false;
+
+	// A store still running in another process keeps its file
+	return kill((pid_t)pid, 0) < 0 && errno == ESRCH;
+}
+
+/**
+* Load the entries already in the cache directory, oldest modification (last use) first,
+* and remove the temporary files of stores that crashed.  Call with cache_lock held.
+*/
+static void index_load(void)
+{
+	int fd = dup(cache_dir_fd);
+	DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+	struct found_entry *found = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	struct dirent *dirent;
+
+	if(dir == NULL)
+	{
+		if(fd >= 0)
+			close(fd);
+		return;
+	}
+
+	while((dirent = readdir(dir)) != NULL)
+	{
+		struct stat st;
+		if(is_stale_temporary(dirent->d_name))
+		{
+			unlinkat(cache_dir_fd, dirent->d_name, 0);
+			continue;
+		}
+		if(!is_key(dirent->d_name) || fstatat(cache_dir_fd, dirent->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		if(count == capacity)
+		{
+			size_t grown_capacity = capacity ? capacity * 2 : 64;
+			struct found_entry *grown = realloc(found, grown_capacity * sizeof(*found));
+			if(grown == NULL)
+				break;
+			found = grown;
+			capacity = grown_capacity;
+		}
+		strcpy(found[count].key, dirent->d_name);
+		found[count].size = (size_t)st.st_size;
+		found[count].used = st.st_mtim;
+		count++;
+	}
+	closedir(dir);
+
+	qsort(found, count, sizeof(*found), found_compare);
+	size_t i;
+	for(i = 0; i < count; i++)
+		index_insert(found[i].key, found[i].size);
+	free(found);
+}
+
+//--------------------------------------PUBLIC------------------------------------
+
+bool exec_cache_enable(const char *directory, size_t max_bytes, const char * const *env_allowlist)
+{
+	size_t count = 0;
+	size_t i;
+
+	if(directory == NULL)
+		return false;
+
+	int fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(fd < 0)
+		return false;
+
+	// Take our own copy of the allowlist
+	while(env_allowlist != NULL && env_allowlist[count] != NULL)
+		count++;
+	char **env = calloc(count + 1, sizeof(*env));
+	if(env == NULL)
+	{
+		close(fd);
+		return false;
+	}
+	for(i = 0; i < count; i++)
+	{
+		env[i] = strdup(env_allowlist[i]);
+		if(env[i] == NULL)
+		{
+			while(i > 0)
+				free(env[--i]);
+			free(env);
+			close(fd);
+			return false;
+		}
+	}
+
+	exec_cache_disable();
+
+	pthread_mutex_lock(&cache_lock);
+	cache_dir_fd = fd;
+	cache_max_bytes = max_bytes;
+	cache_env = env;
+	memset(&cache_counters, 0, sizeof(cache_counters));
+	cache_generation++;
+	index_load();
+	index_evict();
+	cache_enabled = true;
+	pthread_mutex_unlock(&cache_lock);
+	return true;
+}
+
+void exec_cache_disable(void)
+{
+	pthread_mutex_lock(&cache_lock);
+	if(cache_enabled)
+	{
+		index_clear();
+		close(cache_dir_fd);
+		cache_dir_fd = -1;
+
+		char **env;
+		for(env = cache_env; *env != NULL; env++)
+			free(*env);
+		free(cache_env);
+		cache_env = NULL;
+		cache_enabled = false;
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+bool exec_cache_enabled(void)
+{
+	pthread_mutex_lock(&cache_lock);
+	bool enabled = cache_enabled;
+	pthread_mutex_unlock(&cache_lock);
+	return enabled;
+}
+
+bool exec_cache_key(char * const argv[], const char * const inputs[], char key[EXEC_CACHE_KEY_LEN])
+{
+	struct key_hash hash;
+	struct stat st;
+	char cwd[4096];
+	size_t i;
+
+	if(argv == NULL || argv[0] == NULL || key == NULL || stat(argv[0], &st) < 0)
+		return false;
+
+	// Relative arguments and inputs mean something else from another directory
+	if(getcwd(cwd, sizeof(cwd)) == NULL)
+		return false;
+
+	hash_init(&hash);
+
+	// Executable identity, a rebuilt or replaced binary gets a new key
+	uint64_t identity[5] = { (uint64_t)st.st_dev, (uint64_t)st.st_ino, (uint64_t)st.st_size,
+		(uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec };
+	hash_field(&hash, identity, sizeof(identity));
+	hash_field(&hash, cwd, strlen(cwd));
+
+	for(i = 0; argv[i] != NULL; i++)
+		hash_field(&hash, argv[i], strlen(argv[i]));
+	hash_field(&hash, NULL, 0);
+
+	// Allowlisted environment, an unset variable hashes differently from an empty one
+	pthread_mutex_lock(&cache_lock);
+	for(i = 0; cache_env != NULL && cache_env[i] != NULL; i++)
+	{
+		const char *value = getenv(cache_env[i]);
+		hash_field(&hash, cache_env[i], strlen(cache_env[i]));
+		if(value != NULL)
+			hash_field(&hash, value, strlen(value));
+		else
+			hash_field(&hash, "\xff", 1);
+	}
+	pthread_mutex_unlock(&cache_lock);
+	hash_field(&hash, NULL, 0);
+
+	for(i = 0; inputs != NULL && inputs[i] != NULL; i++)
+	{
+		hash_field(&hash, inputs[i], strlen(inputs[i]));
+		if(!hash_file(&hash, inputs[i]))
+			return false;
+	}
+
+	hash_final(&hash, key);
+	return true;
+}
+
+bool exec_cache_lookup(const char *key, const char *outputfile)
+{
+	bool hit = false;
+
+	if(key == NULL || outputfile == NULL)
+		return false;
+
+	pthread_mutex_lock(&cache_lock);
+	if(!cache_enabled)
+	{
+		pthread_mutex_unlock(&cache_lock);
+		return false;
+	}
+
+	struct cache_entry *entry = index_find(key);
+	int src_fd = entry != NULL ? openat(cache_dir_fd, key, O_RDONLY | O_CLOEXEC) : -1;
+	if(src_fd >= 0)
+	{
+		// Most recently used now, and record that on disk for the next index_load()
+		lru_unlink(entry);
+		lru_push_newest(entry);
+		futimens(src_fd, NULL);
+	}
+	else if(entry != NULL)
+	{
+		// Someone removed the file behind our back
+		index_remove(entry);
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	if(src_fd >= 0)
+	{
+		int dst_fd = open(outputfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if(dst_fd >= 0)
+		{
+			hit = clone_fd(src_fd, dst_fd);
+			close(dst_fd);
+		}
+		close(src_fd);
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	if(hit)
+		cache_counters.hits++;
+	else
+		cache_counters.misses++;
+	pthread_mutex_unlock(&cache_lock);
+	return hit;
+}
+
+bool exec_cache_store(const char *key, const char *outputfile)
+{
+	struct stat st;
+	bool stored = false;
+
+	if(key == NULL || outputfile == NULL)
+		return false;
+
+	int src_fd = open(outputfile, O_RDONLY | O_CLOEXEC);
+	if(src_fd < 0)
+		return false;
+	if(fstat(src_fd, &st) < 0)
+	{
+		close(src_fd);
+		return false;
+	}
+
+	// Only the index is touched under the lock, the copy runs on a descriptor of our own so
+	// other execs are not held up behind the disk
+	pthread_mutex_lock(&cache_lock);
+	if(!cache_enabled || (size_t)st.st_size > cache_max_bytes)
+	{
+		pthread_mutex_unlock(&cache_lock);
+		close(src_fd);
+		return false;
+	}
+	int dir_fd = fcntl(cache_dir_fd, F_DUPFD_CLOEXEC, 0);
+	unsigned long generation = cache_generation;
+	unsigned long sequence = cache_store_sequence++;
+	pthread_mutex_unlock(&cache_lock);
+	if(dir_fd < 0)
+	{
+		close(src_fd);
+		return false;
+	}
+
+	// Write to a temporary name and rename, so a reader never sees a partial entry
+	char temporary[EXEC_CACHE_KEY_LEN + 48];
+	snprintf(temporary, sizeof(temporary), "%s.%ld.%lu.tmp", key, (long)getpid(), sequence);
+	int dst_fd = openat(dir_fd, temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(dst_fd >= 0)
+	{
+		stored = clone_fd(src_fd, dst_fd);
+		close(dst_fd);
+		if(stored)
+			stored = renameat(dir_fd, temporary, dir_fd, key) == 0;
+		if(!stored)
+			unlinkat(dir_fd, temporary, 0);
+	}
+	close(dir_fd);
+	close(src_fd);
+
+	// Disabled or moved to another directory meanwhile, the file is picked up by whoever
+	// enables the cache on this directory next
+	pthread_mutex_lock(&cache_lock);
+	if(stored && cache_enabled && cache_generation == generation)
+	{
+		index_insert(key, (size_t)st.st_size);
+		cache_counters.stores++;
+		index_evict();
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	return stored;
+}
+
+void exec_cache_get_counters(struct exec_cache_counters *counters)
+{
+	if(counters == NULL)
+		return;
+
+	pthread_mutex_lock(&cache_lock);
+	*counters = cache_counters;
+	pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,85 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Opt-in result cache for deterministic commands run with do_exec_redirect_cached().
+ * A run is identified by the executable (path, inode, size, mtime), the working directory,
+ * its argv, the values of an allowlist of environment variables and the contents of the
+ * declared input files.
+ * On a hit the cached output is cloned (FICLONE) or copied with copy_file_range() into
+ * the output file and no process is spawned.  Entries are evicted least recently used
+ * first once the cache grows past its size limit.
+ *
+ * The key is a 128 bit non-cryptographic hash, it guards against accidents, not attackers.
+ */
+
+// Length of a key as hex, including the terminating NUL
+#define EXEC_CACHE_KEY_LEN 33
+
+/**
+ * Cache counters, see exec_cache_get_counters()
+ */
+struct exec_cache_counters
+{
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long stores;
+	unsigned long evictions;
+
+	/**
+	 * Bytes of cached output currently held
+	 */
+	size_t bytes;
+
+	/**
+	 * Number of entries currently held
+	 */
+	size_t entries;
+};
+
+/**
+* Enable the cache.  Entries already present in directory are picked up, oldest first.
+* @param directory - Existing directory to hold cached outputs, owned by the cache
+* @param max_bytes - Evict least recently used entries once the cache holds more than this
+* @param env_allowlist - NULL terminated list of environment variable names that are part
+*   of the key, NULL for none
+* @return true if the cache is enabled, false otherwise
+*/
+bool exec_cache_enable(const char *directory, size_t max_bytes, const char * const *env_allowlist);
+
+/**
+* Disable the cache, the files in its directory are left in place.
+*/
+void exec_cache_disable(void);
+
+/**
+* @return true if exec_cache_enable() succeeded and exec_cache_disable() has not been called
+*/
+bool exec_cache_enabled(void);
+
+/**
+* @param argv - NULL terminated argument vector, argv[0] is the full path to the command
+* @param inputs - NULL terminated list of files the command reads, NULL for none
+* @param key - Filled with the hex key for this run
+* @return true if a key could be computed (the executable, the working directory and every
+*   input exist), false otherwise
+*/
+bool exec_cache_key(char * const argv[], const char * const inputs[], char key[EXEC_CACHE_KEY_LEN]);
+
+/**
+* @param key - Key from exec_cache_key()
+* @param outputfile - On a hit, replaced with the cached output
+* @return true on a hit, false on a miss (counted)
+*/
+bool exec_cache_lookup(const char *key, const char *outputfile);
+
+/**
+* Store a copy of outputfile under key, evicting old entries as needed.
+* @return true if the output was stored
+*/
+bool exec_cache_store(const char *key, const char *outputfile);
+
+/**
+* @param counters - Filled with a snapshot of the cache counters
+*/
+void exec_cache_get_counters(struct exec_cache_counters *counters);
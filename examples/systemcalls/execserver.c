@@ -0,0 +1,527 @@
+#define _GNU_SOURCE
+#include "execserver.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+// Largest request we will send over the control socket, anything bigger runs locally
+#define EXEC_SERVER_MAX_REQUEST (128 * 1024)
+
+// File descriptors passed with every request: reply socket, stdin, stdout, stderr
+#define EXEC_SERVER_FDS 4
+
+extern char **environ;
+
+/**
+ * Request header, followed by length bytes of NUL separated strings:
+ * the working directory, argc arguments, then envc environment entries
+ */
+struct exec_request
+{
+	uint32_t argc;
+	uint32_t envc;
+	uint32_t length;
+};
+
+/**
+ * Reply messages sent back on the per request socket
+ */
+struct exec_reply
+{
+	/**
+	 * 0 once the command was started (pid valid, status holds the errno of a failed execve(),
+	 * 0 if it succeeded), 1 once it exited (status valid)
+	 */
+	int32_t kind;
+	int32_t error;
+	int32_t pid;
+	int32_t status;
+
+	/**
+	 * Resource usage of the exited command from wait4()
+	 */
+	int64_t user_us;
+	int64_t system_us;
+	int64_t max_rss_kb;
+};
+
+/**
+ * What the caller's commands inherit, taken before the server changes it for itself
+ */
+struct exec_signals
+{
+	sigset_t mask;
+	struct sigaction pipe;
+	struct sigaction child;
+};
+
+/**
+ * A started command the server is waiting to reap
+ */
+struct exec_pending
+{
+	pid_t pid;
+	int reply_fd;
+};
+
+// Client side state, the control socket is -1 while the server is not running
+static int server_fd = -1;
+static pid_t server_pid = -1;
+static bool server_routing = true;
+
+//-------------------------------------SERVER-------------------------------------
+
+/**
+* @param fd - The reply socket
+* @param kind/error/pid/status - The reply message contents
+* @param usage - The command's resource usage, NULL for the started reply
+*/
+static void server_reply(int fd, int kind, int error, pid_t pid, int status, const struct rusage *usage)
+{
+	struct exec_reply reply = { kind, error, pid, status, 0, 0, 0 };
+	if(usage != NULL)
+	{
+		reply.user_us = (int64_t)usage->ru_utime.tv_sec * 1000000 + usage->ru_utime.tv_usec;
+		reply.system_us = (int64_t)usage->ru_stime.tv_sec * 1000000 + usage->ru_stime.tv_usec;
+		reply.max_rss_kb = usage->ru_maxrss;
+	}
+	send(fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+}
+
+/**
+* Fork and exec one request inside the server, returning once the exec has happened (or failed).
+* @param exec_error - Set to the errno of a failed execve(), 0 if the command is running
+* @return the child pid, or -1 with errno set
+*/
+static pid_t server_spawn(char *strings, const struct exec_request *request, const int *fds,
+		const struct exec_signals *signals, int *exec_error)
+{
+	// Lets build the argv and envp vectors in place, pointing into the received strings
+	char *argv[request->argc + 1];
+	char *envp[request->envc + 1];
+	char *cwd = strings;
+	char *cursor = cwd + strlen(cwd) + 1;
+	uint32_t i;
+
+	for(i = 0; i < request->argc; i++)
+	{
+		argv[i] = cursor;
+		cursor += strlen(cursor) + 1;
+	}
+	argv[request->argc] = NULL;
+	for(i = 0; i < request->envc; i++)
+	{
+		envp[i] = cursor;
+		cursor += strlen(cursor) + 1;
+	}
+	envp[request->envc] = NULL;
+
+	// The child reports a failed execve over this pipe, a successful one simply closes it (O_CLOEXEC)
+	int exec_pipe[2];
+	if(pipe2(exec_pipe, O_CLOEXEC) < 0)
+		return -1;
+
+	pid_t pid = fork();
+	if(pid < 0)
+	{
+		int saved_errno = errno;
+		close(exec_pipe[0]);
+		close(exec_pipe[1]);
+		errno = saved_errno;
+		return -1;
+	}
+
+	if(pid > 0)
+	{
+		ssize_t got;
+
+		// Returns 0 bytes once execve has replaced the child
+		close(exec_pipe[1]);
+		*exec_error = 0;
+		while((got = read(exec_pipe[0], exec_error, sizeof(*exec_error))) < 0 && errno == EINTR)
+			;
+		if(got != sizeof(*exec_error))
+			*exec_error = 0;
+		close(exec_pipe[0]);
+		return pid;
+	}
+
+	// Child, restore the caller's view of the world before executing the command: the server
+	// ignores SIGPIPE and blocks SIGCHLD for itself, a command run locally would do neither
+	sigaction(SIGPIPE, &signals->pipe, NULL);
+	sigaction(SIGCHLD, &signals->child, NULL);
+	sigprocmask(SIG_SETMASK, &signals->mask, NULL);
+	int error = EBADF;
+	if(dup2(fds[1], STDIN_FILENO) >= 0 && dup2(fds[2], STDOUT_FILENO) >= 0 && dup2(fds[3], STDERR_FILENO) >= 0)
+	{
+		if(chdir(cwd) < 0)
+			error = errno;
+		else
+		{
+			execve(argv[0], argv, envp);
+			error = errno;
+		}
+	}
+
+	// Tell the server why, then exit the process with -1 like a local child whose execv failed
+	ssize_t ignored = write(exec_pipe[1], &error, sizeof(error));
+	(void)ignored;
+	_exit(-1);
+}
+
+/**
+* Receive one request from the control socket and start it.
+* @return false once the client has gone away
+*/
+static bool server_accept(int control, char *buffer, struct exec_pending **pending, size_t *count, size_t *capacity,
+		const struct exec_signals *signals)
+{
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(int) * EXEC_SERVER_FDS)];
+		struct cmsghdr align;
+	} control_buf;
+	struct iovec iov = { buffer, EXEC_SERVER_MAX_REQUEST };
+	struct msghdr msg;
+	int fds[EXEC_SERVER_FDS];
+	int i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control_buf.buf;
+	msg.msg_controllen = sizeof(control_buf.buf);
+
+	ssize_t got = recvmsg(control, &msg, MSG_CMSG_CLOEXEC);
+	if(got < 0)
+		return errno == EINTR;
+	if(got == 0)
+		return false;
+
+	// Pull the passed descriptors out of the SCM_RIGHTS message
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if(cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+	   cmsg->cmsg_len != CMSG_LEN(sizeof(int) * EXEC_SERVER_FDS))
+		return true;
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+	struct exec_request request;
+	int error = 0;
+	if((size_t)got < sizeof(request) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+		error = E2BIG;
+	else
+	{
+		memcpy(&request, buffer, sizeof(request));
+		if(request.argc == 0 || request.length != (size_t)got - sizeof(request) || buffer[got - 1] != '\0')
+			error = EINVAL;
+
+		// The strings must hold exactly the working directory, argv and envp
+		size_t strings = 0;
+		ssize_t j;
+		for(j = sizeof(request); error == 0 && j < got; j++)
+			strings += buffer[j] == '\0';
+		if(error == 0 && strings != (size_t)request.argc + request.envc + 1)
+			error = EINVAL;
+	}
+
+	// Make sure we have room to track the child before we start it
+	if(error == 0 && *count == *capacity)
+	{
+		size_t grown_capacity = *capacity ? *capacity * 2 : 16;
+		struct exec_pending *grown = realloc(*pending, grown_capacity * sizeof(**pending));
+		if(grown == NULL)
+			error = ENOMEM;
+		else
+		{
+			*pending = grown;
+			*capacity = grown_capacity;
+		}
+	}
+
+	pid_t pid = -1;
+	int exec_error = 0;
+	if(error == 0)
+	{
+		pid = server_spawn(buffer + sizeof(request), &request, fds, signals, &exec_error);
+		if(pid < 0)
+			error = errno;
+	}
+
+	// The child has its own copies of the standard descriptors now
+	for(i = 1; i < EXEC_SERVER_FDS; i++)
+		close(fds[i]);
+
+	server_reply(fds[0], 0, error, pid, exec_error, NULL);
+	if(error != 0)
+	{
+		close(fds[0]);
+		return true;
+	}
+
+	(*pending)[*count].pid = pid;
+	(*pending)[*count].reply_fd = fds[0];
+	(*count)++;
+	return true;
+}
+
+/**
+* Main loop of the server process, never returns.
+*/
+static void server_main(int control)
+{
+	struct exec_pending *pending = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	sigset_t mask;
+	struct exec_signals original;
+	struct sigaction action;
+
+	// Children are noticed through a signalfd so the loop only ever blocks in poll()
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &original.mask);
+	memset(&action, 0, sizeof(action));
+	sigemptyset(&action.sa_mask);
+	action.sa_handler = SIG_DFL;
+	sigaction(SIGCHLD, &action, &original.child);
+	action.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &action, &original.pipe);
+	int child_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+	char *buffer = malloc(EXEC_SERVER_MAX_REQUEST);
+	if(child_fd < 0 || buffer == NULL)
+		_exit(1);
+
+	bool running = true;
+	while(running || count > 0)
+	{
+		struct pollfd fds[2] = {
+			{ child_fd, POLLIN, 0 },
+			{ running ? control : -1, POLLIN, 0 },
+		};
+
+		if(poll(fds, 2, -1) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+
+		if(fds[1].revents)
+			running = server_accept(control, buffer, &pending, &count, &capacity, &original);
+
+		if(fds[0].revents & POLLIN)
+		{
+			struct signalfd_siginfo info;
+			while(read(child_fd, &info, sizeof(info)) < 0 && errno == EINTR)
+				;
+
+			// Lets reap everything that has exited and tell each caller how it went
+			struct rusage usage;
+			int status;
+			pid_t pid;
+			while((pid = wait4(-1, &status, WNOHANG, &usage)) > 0)
+			{
+				size_t i;
+				for(i = 0; i < count; i++)
+				{
+					if(pending[i].pid != pid)
+						continue;
+					server_reply(pending[i].reply_fd, 1, 0, pid, status, &usage);
+					close(pending[i].reply_fd);
+					pending[i] = pending[--count];
+					break;
+				}
+			}
+		}
+	}
+
+	_exit(0);
+}
+
+//-------------------------------------CLIENT-------------------------------------
+
+bool exec_server_start(void)
+{
+	int pair[2];
+
+	if(server_fd >= 0)
+		return true;
+
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) < 0)
+		return false;
+
+	pid_t pid = fork();
+	if(pid < 0)
+	{
+		close(pair[0]);
+		close(pair[1]);
+		return false;
+	}
+
+	// Child becomes the server and never returns
+	if(pid == 0)
+	{
+		close(pair[0]);
+		server_main(pair[1]);
+	}
+
+	close(pair[1]);
+	server_fd = pair[0];
+	server_pid = pid;
+	return true;
+}
+
+void exec_server_stop(void)
+{
+	if(server_fd < 0)
+		return;
+
+	// Closing the control socket tells the server to exit once its children are reaped
+	close(server_fd);
+	server_fd = -1;
+	while(waitpid(server_pid, NULL, 0) < 0 && errno == EINTR)
+		;
+	server_pid = -1;
+}
+
+bool exec_server_enabled(void)
+{
+	return server_fd >= 0 && server_routing;
+}
+
+void exec_server_set_routing(bool enabled)
+{
+	server_routing = enabled;
+}
+
+enum exec_server_result exec_server_run(char * const argv[], char * const envp[], int stdout_fd, int *status,
+		struct rusage *usage, struct timespec *started)
+{
+	char cwd[4096];
+	size_t length;
+	size_t i;
+	uint32_t argc = 0;
+	uint32_t envc = 0;
+
+	if(!exec_server_enabled() || argv == NULL || argv[0] == NULL || status == NULL)
+		return EXEC_SERVER_UNAVAILABLE;
+	if(envp == NULL)
+		envp = environ;
+	// The server runs the command from our working directory, without one a relative command or
+	// redirect would resolve against the server's, so the caller has to spawn it locally
+	if(getcwd(cwd, sizeof(cwd)) == NULL)
+		return EXEC_SERVER_UNAVAILABLE;
+
+	// Lets work out how big the request is so we know whether it fits in one message
+	length = strlen(cwd) + 1;
+	for(; argv[argc] != NULL; argc++)
+		length += strlen(argv[argc]) + 1;
+	for(; envp[envc] != NULL; envc++)
+		length += strlen(envp[envc]) + 1;
+	if(length + sizeof(struct exec_request) > EXEC_SERVER_MAX_REQUEST)
+		return EXEC_SERVER_UNAVAILABLE;
+
+	char *buffer = malloc(sizeof(struct exec_request) + length);
+	if(buffer == NULL)
+		return EXEC_SERVER_UNAVAILABLE;
+
+	struct exec_request request = { argc, envc, (uint32_t)length };
+	memcpy(buffer, &request, sizeof(request));
+	char *cursor = buffer + sizeof(request);
+	cursor = stpcpy(cursor, cwd) + 1;
+	for(i = 0; i < argc; i++)
+		cursor = stpcpy(cursor, argv[i]) + 1;
+	for(i = 0; i < envc; i++)
+		cursor = stpcpy(cursor, envp[i]) + 1;
+
+	// Every request gets its own reply socket so concurrent callers never see each other's replies
+	int reply[2];
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, reply) < 0)
+	{
+		free(buffer);
+		return EXEC_SERVER_UNAVAILABLE;
+	}
+
+	int fds[EXEC_SERVER_FDS] = { reply[1], STDIN_FILENO, stdout_fd >= 0 ? stdout_fd : STDOUT_FILENO, STDERR_FILENO };
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control_buf;
+	struct iovec iov = { buffer, sizeof(request) + length };
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&control_buf, 0, sizeof(control_buf));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control_buf.buf;
+	msg.msg_controllen = sizeof(control_buf.buf);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	ssize_t sent;
+	do
+	{
+		sent = sendmsg(server_fd, &msg, MSG_NOSIGNAL);
+	} while(sent < 0 && errno == EINTR);
+	free(buffer);
+	close(reply[1]);
+	if(sent < 0)
+	{
+		close(reply[0]);
+		return EXEC_SERVER_UNAVAILABLE;
+	}
+
+	// Wait for the started reply followed by the exited reply
+	enum exec_server_result result = EXEC_SERVER_FAILED;
+	for(;;)
+	{
+		struct exec_reply message;
+		ssize_t got = recv(reply[0], &message, sizeof(message), 0);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got != sizeof(message) || message.error != 0)
+			break;
+		if(message.kind == 0)
+		{
+			// Like the local path, a command that could not be executed has no start time
+			if(started != NULL && message.status == 0)
+				clock_gettime(CLOCK_MONOTONIC, started);
+			else if(started != NULL)
+				memset(started, 0, sizeof(*started));
+			continue;
+		}
+		if(message.kind == 1)
+		{
+			*status = message.status;
+			if(usage != NULL)
+			{
+				memset(usage, 0, sizeof(*usage));
+				usage->ru_utime.tv_sec = message.user_us / 1000000;
+				usage->ru_utime.tv_usec = message.user_us % 1000000;
+				usage->ru_stime.tv_sec = message.system_us / 1000000;
+				usage->ru_stime.tv_usec = message.system_us % 1000000;
+				usage->ru_maxrss = message.max_rss_kb;
+			}
+			result = EXEC_SERVER_DONE;
+			break;
+		}
+	}
+
+	close(reply[0]);
+	return result;
+}
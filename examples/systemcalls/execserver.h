@@ -0,0 +1,74 @@
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/**
+ * The exec server is a small helper process forked early in the life of the calling
+ * process, while its address space is still tiny and it has a single thread.  Once it
+ * is running, do_exec() and do_exec_redirect() hand their commands to it over a Unix
+ * socket instead of forking the (possibly large, multi-threaded) caller.  The helper
+ * forks from its own small address space and streams the exit status back.  Commands
+ * get the signal mask and the SIGPIPE and SIGCHLD dispositions the caller had when the
+ * server was started, not the server's own.
+ */
+
+/**
+ * Result of handing a command to the exec server
+ */
+enum exec_server_result
+{
+	/**
+	 * The command ran and its waitpid() status was returned
+	 */
+	EXEC_SERVER_DONE,
+
+	/**
+	 * The request was never sent (server not running, request too large, working
+	 * directory unknown), the caller should fall back to forking locally
+	 */
+	EXEC_SERVER_UNAVAILABLE,
+
+	/**
+	 * The request was sent but the command could not be started or its status was lost
+	 */
+	EXEC_SERVER_FAILED
+};
+
+/**
+* Start the exec server.  Call this as early as possible, before the process
+* grows or creates threads.
+* @return true if the server is running (or was already running), false otherwise
+*/
+bool exec_server_start(void);
+
+/**
+* Stop the exec server and wait for it to exit.  Commands still running are not killed.
+*/
+void exec_server_stop(void);
+
+/**
+* @return true if exec_server_start() succeeded, exec_server_stop() has not been called
+*   and routing is on
+*/
+bool exec_server_enabled(void);
+
+/**
+* Turn routing of do_exec() and do_exec_redirect() through a running server on or off
+* (it is on by default).  The server keeps running either way, so it can be switched back
+* on later without forking it again from a process that has since grown.
+*/
+void exec_server_set_routing(bool enabled);
+
+/**
+* @param argv - NULL terminated argument vector, argv[0] is the full path to the command
+* @param envp - NULL terminated environment for the command, NULL to pass our environ
+* @param stdout_fd - The file descriptor to use as the command's standard out, -1 for ours
+* @param status - Filled with the raw waitpid() status of the command on EXEC_SERVER_DONE
+* @param usage - If non NULL, filled with the command's resource usage on EXEC_SERVER_DONE
+* @param started - If non NULL, set (CLOCK_MONOTONIC) when the server reports the command was
+*   executed, which is once execve() succeeded as on the local path.  Zeroed if it failed.
+* @return see enum exec_server_result
+*/
+enum exec_server_result exec_server_run(char * const argv[], char * const envp[], int stdout_fd, int *status,
+		struct rusage *usage, struct timespec *started);
@@ -0,0 +1,359 @@
+#include "execstats.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+// Latencies are kept in a log-linear histogram of microseconds: values below
+// HISTOGRAM_LINEAR get their own bucket, above that every power of two is split
+// into HISTOGRAM_LINEAR sub-buckets, so a bucket is never wider than 1/16 of its value
+#define HISTOGRAM_SHIFT 4
+#define HISTOGRAM_LINEAR (1 << HISTOGRAM_SHIFT)
+#define HISTOGRAM_MAX_EXP 40
+#define HISTOGRAM_BUCKETS (HISTOGRAM_LINEAR + (HISTOGRAM_MAX_EXP - HISTOGRAM_SHIFT + 1) * HISTOGRAM_LINEAR)
+
+// Number of hash chains for command paths
+#define STATS_CHAINS 64
+
+/**
+ * Everything recorded for one command path
+ */
+struct stats_entry
+{
+	struct stats_entry *next;
+	char *path;
+	unsigned long count;
+	unsigned long failures;
+	unsigned long exec_count;
+	uint64_t max_us;
+	long max_rss_kb;
+	double user_cpu_s;
+	double system_cpu_s;
+	uint32_t latency[HISTOGRAM_BUCKETS];
+	uint32_t exec_latency[HISTOGRAM_BUCKETS];
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_entry *stats_table[STATS_CHAINS];
+
+// Periodic dump thread state, protected by dump_lock
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dump_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t dump_thread;
+static bool dump_running = false;
+static bool dump_stop = false;
+static FILE *dump_stream;
+static unsigned int dump_interval_s;
+
+//------------------------------------HISTOGRAM-----------------------------------
+
+static unsigned int histogram_index(uint64_t us)
+{
+	if(us < HISTOGRAM_LINEAR)
+		return (unsigned int)us;
+
+	unsigned int exp = 63 - __builtin_clzll(us);
+	if(exp > HISTOGRAM_MAX_EXP)
+		return HISTOGRAM_BUCKETS - 1;
+
+	unsigned int sub = (unsigned int)(us >> (exp - HISTOGRAM_SHIFT)) & (HISTOGRAM_LINEAR - 1);
+	return HISTOGRAM_LINEAR + (exp - HISTOGRAM_SHIFT) * HISTOGRAM_LINEAR + sub;
+}
+
+/**
+* @return the midpoint of bucket index in microseconds
+*/
+static double histogram_value(unsigned int index)
+{
+	if(index < HISTOGRAM_LINEAR)
+		return index;
+
+	unsigned int exp = (index - HISTOGRAM_LINEAR) / HISTOGRAM_LINEAR + HISTOGRAM_SHIFT;
+	unsigned int sub = (index - HISTOGRAM_LINEAR) % HISTOGRAM_LINEAR;
+	double width = (double)(1ULL << (exp - HISTOGRAM_SHIFT));
+	return (double)(1ULL << exp) + sub * width + width / 2;
+}
+
+/**
+* @return the value in microseconds below which fraction of the samples fall
+*/
+static double histogram_percentile(const uint32_t *histogram, unsigned long count, double fraction)
+{
+	unsigned long target = (unsigned long)(fraction * count);
+	unsigned long seen = 0;
+	unsigned int i;
+
+	if(count == 0)
+		return 0;
+	if(target >= count)
+		target = count - 1;
+
+	for(i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += histogram[i];
+		if(seen > target)
+			return histogram_value(i);
+	}
+	return histogram_value(HISTOGRAM_BUCKETS - 1);
+}
+
+static uint64_t elapsed_us(const struct timespec *from, const struct timespec *to)
+{
+	int64_t ns = (int64_t)(to->tv_sec - from->tv_sec) * 1000000000 + (to->tv_nsec - from->tv_nsec);
+	return ns > 0 ? (uint64_t)ns / 1000 : 0;
+}
+
+//--------------------------------------TABLE-------------------------------------
+
+static unsigned int path_chain(const char *path)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for(; *path; path++)
+		hash = (hash ^ (unsigned char)*path) * 16777619u;
+	return hash % STATS_CHAINS;
+}
+
+/**
+* @return the entry for path, creating it if create is set, NULL otherwise.  Call with stats_lock held.
+*/
+static struct stats_entry *stats_lookup(const char *path, bool create)
+{
+	unsigned int chain = path_chain(path);
+	struct stats_entry *entry;
+
+	for(entry = stats_table[chain]; entry != NULL; entry = entry->next)
+	{
+		if(strcmp(entry->path, path) == 0)
+			return entry;
+	}
+
+	if(!create)
+		return NULL;
+
+	entry = calloc(1, sizeof(*entry));
+	if(entry == NULL)
+		return NULL;
+	entry->path = strdup(path);
+	if(entry->path == NULL)
+	{
+		free(entry);
+		return NULL;
+	}
+	entry->next = stats_table[chain];
+	stats_table[chain] = entry;
+	return entry;
+}
+
+static void stats_fill(const struct stats_entry *entry, struct exec_stats *stats)
+{
+	stats->count = entry->count;
+	stats->failures = entry->failures;
+	stats->p50_ms = histogram_percentile(entry->latency, entry->count, 0.50) / 1000.0;
+	stats->p99_ms = histogram_percentile(entry->latency, entry->count, 0.99) / 1000.0;
+	stats->max_ms = entry->max_us / 1000.0;
+
+	// A bucket midpoint can land past the largest sample, never report more than the max
+	if(stats->p50_ms > stats->max_ms)
+		stats->p50_ms = stats->max_ms;
+	if(stats->p99_ms > stats->max_ms)
+		stats->p99_ms = stats->max_ms;
+	stats->p50_exec_ms = histogram_percentile(entry->exec_latency, entry->exec_count, 0.50) / 1000.0;
+	stats->max_rss_kb = entry->max_rss_kb;
+	stats->user_cpu_s = entry->user_cpu_s;
+	stats->system_cpu_s = entry->system_cpu_s;
+}
+
+//--------------------------------------PUBLIC------------------------------------
+
+void exec_stats_record(const char *path, const struct timespec *spawned, const struct timespec *execed,
+		const struct timespec *exited, const struct rusage *usage, int status)
+{
+	if(path == NULL || spawned == NULL || exited == NULL)
+		return;
+
+	uint64_t total_us = elapsed_us(spawned, exited);
+
+	pthread_mutex_lock(&stats_lock);
+	struct stats_entry *entry = stats_lookup(path, true);
+	if(entry != NULL)
+	{
+		entry->count++;
+		if(!(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+			entry->failures++;
+		entry->latency[histogram_index(total_us)]++;
+		if(total_us > entry->max_us)
+			entry->max_us = total_us;
+
+		if(execed != NULL)
+		{
+			entry->exec_latency[histogram_index(elapsed_us(spawned, execed))]++;
+			entry->exec_count++;
+		}
+
+		if(usage != NULL)
+		{
+			if(usage->ru_maxrss > entry->max_rss_kb)
+				entry->max_rss_kb = usage->ru_maxrss;
+			entry->user_cpu_s += usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6;
+			entry->system_cpu_s += usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+		}
+	}
+	pthread_mutex_unlock(&stats_lock);
+}
+
+bool exec_stats_get(const char *path, struct exec_stats *stats)
+{
+	bool found = false;
+
+	if(path == NULL || stats == NULL)
+		return false;
+
+	pthread_mutex_lock(&stats_lock);
+	struct stats_entry *entry = stats_lookup(path, false);
+	if(entry != NULL)
+	{
+		stats_fill(entry, stats);
+		found = true;
+	}
+	pthread_mutex_unlock(&stats_lock);
+	return found;
+}
+
+void exec_stats_dump(FILE *stream)
+{
+	struct dump_line
+	{
+		const char *path;
+		struct exec_stats stats;
+	};
+	struct dump_line *lines = NULL;
+	size_t count = 0;
+	size_t path_bytes = 0;
+	size_t i;
+	unsigned int chain;
+
+	if(stream == NULL)
+		return;
+
+	// Only take a snapshot under the lock, a slow stream must not stall the commands recording stats
+	pthread_mutex_lock(&stats_lock);
+	for(chain = 0; chain < STATS_CHAINS; chain++)
+	{
+		struct stats_entry *entry;
+		for(entry = stats_table[chain]; entry != NULL; entry = entry->next)
+		{
+			count++;
+			path_bytes += strlen(entry->path) + 1;
+		}
+	}
+	if(count > 0)
+		lines = malloc(count * sizeof(*lines) + path_bytes);
+	if(lines != NULL)
+	{
+		char *paths = (char *)(lines + count);
+		i = 0;
+		for(chain = 0; chain < STATS_CHAINS; chain++)
+		{
+			struct stats_entry *entry;
+			for(entry = stats_table[chain]; entry != NULL; entry = entry->next)
+			{
+				lines[i].path = paths;
+				paths = stpcpy(paths, entry->path) + 1;
+				stats_fill(entry, &lines[i].stats);
+				i++;
+			}
+		}
+	}
+	pthread_mutex_unlock(&stats_lock);
+
+	for(i = 0; lines != NULL && i < count; i++)
+	{
+		const struct exec_stats *stats = &lines[i].stats;
+		fprintf(stream, "%s count=%lu failures=%lu p50=%.3fms p99=%.3fms max=%.3fms exec_p50=%.3fms "
+				"maxrss=%ldkB user=%.3fs sys=%.3fs\n",
+				lines[i].path, stats->count, stats->failures, stats->p50_ms, stats->p99_ms, stats->max_ms,
+				stats->p50_exec_ms, stats->max_rss_kb, stats->user_cpu_s, stats->system_cpu_s);
+	}
+	free(lines);
+	fflush(stream);
+}
+
+void exec_stats_reset(void)
+{
+	unsigned int chain;
+
+	pthread_mutex_lock(&stats_lock);
+	for(chain = 0; chain < STATS_CHAINS; chain++)
+	{
+		while(stats_table[chain] != NULL)
+		{
+			struct stats_entry *entry = stats_table[chain];
+			stats_table[chain] = entry->next;
+			free(entry->path);
+			free(entry);
+		}
+	}
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static void *dump_main(void *unused)
+{
+	(void)unused;
+
+	pthread_mutex_lock(&dump_lock);
+	while(!dump_stop)
+	{
+		struct timespec wake;
+		clock_gettime(CLOCK_REALTIME, &wake);
+		wake.tv_sec += dump_interval_s;
+
+		// Sleep for the interval unless we are asked to stop first
+		while(!dump_stop && pthread_cond_timedwait(&dump_cond, &dump_lock, &wake) == 0)
+			;
+		if(!dump_stop)
+			exec_stats_dump(dump_stream);
+	}
+	pthread_mutex_unlock(&dump_lock);
+	return NULL;
+}
+
+bool exec_stats_start_dump(FILE *stream, unsigned int interval_s)
+{
+	bool started = true;
+
+	if(stream == NULL || interval_s == 0)
+		return false;
+
+	pthread_mutex_lock(&dump_lock);
+	if(!dump_running)
+	{
+		dump_stream = stream;
+		dump_interval_s = interval_s;
+		dump_stop = false;
+		dump_running = pthread_create(&dump_thread, NULL, dump_main, NULL) == 0;
+		started = dump_running;
+	}
+	pthread_mutex_unlock(&dump_lock);
+	return started;
+}
+
+void exec_stats_stop_dump(void)
+{
+	pthread_mutex_lock(&dump_lock);
+	if(!dump_running)
+	{
+		pthread_mutex_unlock(&dump_lock);
+		return;
+	}
+	dump_stop = true;
+	pthread_cond_signal(&dump_cond);
+	pthread_mutex_unlock(&dump_lock);
+
+	pthread_join(dump_thread, NULL);
+
+	pthread_mutex_lock(&dump_lock);
+	dump_running = false;
+	pthread_mutex_unlock(&dump_lock);
+}
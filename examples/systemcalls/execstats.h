@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/**
+ * Per command resource accounting for the exec family.  Every command reaped by
+ * do_exec(), do_exec_redirect() and do_exec_pipeline() is recorded against its path
+ * (argv[0]) so the expensive helpers can be found.
+ */
+
+/**
+ * Aggregated statistics for one command path
+ */
+struct exec_stats
+{
+	/**
+	 * Number of times the command was run, and how many of those did not exit with 0
+	 */
+	unsigned long count;
+	unsigned long failures;
+
+	/**
+	 * Spawn to exit latency in milliseconds, percentiles are approximate (within ~6%)
+	 */
+	double p50_ms;
+	double p99_ms;
+	double max_ms;
+
+	/**
+	 * Median spawn to exec latency in milliseconds, 0 if never measured
+	 */
+	double p50_exec_ms;
+
+	/**
+	 * Largest resident set size seen in kilobytes
+	 */
+	long max_rss_kb;
+
+	/**
+	 * Total user and system CPU time in seconds
+	 */
+	double user_cpu_s;
+	double system_cpu_s;
+};
+
+/**
+* Record one reaped command.
+* @param path - The command path, argv[0]
+* @param spawned - When the spawn was started (CLOCK_MONOTONIC)
+* @param execed - When the exec succeeded, NULL if unknown
+* @param exited - When the command was reaped
+* @param usage - The rusage returned by wait4(), NULL if unknown
+* @param status - The raw wait status
+*/
+void exec_stats_record(const char *path, const struct timespec *spawned, const struct timespec *execed,
+		const struct timespec *exited, const struct rusage *usage, int status);
+
+/**
+* @param path - The command path to look up
+* @param stats - Filled with the aggregated statistics for path
+* @return true if path has been recorded, false otherwise
+*/
+bool exec_stats_get(const char *path, struct exec_stats *stats);
+
+/**
+* Write one line per recorded command path to stream.  The lines are formatted from a snapshot,
+* so a stream that blocks does not hold up the commands recording their statistics.
+*/
+void exec_stats_dump(FILE *stream);
+
+/**
+* Forget everything recorded so far.
+*/
+void exec_stats_reset(void);
+
+/**
+* Start a background thread calling exec_stats_dump(stream) every interval_s seconds.
+* @return true if the thread was started (or is already running), false otherwise
+*/
+bool exec_stats_start_dump(FILE *stream, unsigned int interval_s);
+
+/**
+* Stop the periodic dump thread, if running.
+*/
+void exec_stats_stop_dump(void);
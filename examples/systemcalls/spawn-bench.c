@@ -0,0 +1,468 @@
+// Process spawn benchmark for the systemcalls example
+//
+// Measures what it costs to start and reap a trivial command with each of the
+// spawn strategies available to systemcalls.c, while the parent's resident set is
+// inflated and while a number of parent threads are running and touching memory.
+// Fork cost grows with the parent's page tables, so this is where the strategies
+// differ.  Reports spawns/sec and latency percentiles for every combination.
+//
+// Usage: spawn-bench [-n iterations] [-m sizes] [-t threads] [-s strategies] [-c command]
+//   -n  Spawns per combination (default 100)
+//   -m  Comma separated parent RSS sizes, K/M/G suffixes allowed (default 10M,1G,4G)
+//   -t  Comma separated parent thread counts, including the main thread (default 1,2,4,8,16,32)
+//   -s  Comma separated strategies (default all): system, fork, vfork, posix_spawn,
+//       clone3, clone-vm, do_exec, exec-server, prepared
+//   -c  Command to spawn (default /bin/true)
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <spawn.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/sched.h>
+#include "systemcalls.h"
+#include "execserver.h"
+
+//------------------------------------DEFINES-------------------------------------
+
+// Stack handed to the CLONE_VM child, it only has to get as far as execve()
+#define CLONE_STACK_SIZE (64 * 1024)
+
+// Page size assumed when touching the inflated memory
+#define TOUCH_STRIDE 4096
+
+// Kernel headers before 5.3 have neither clone3() nor CLONE_PIDFD, the syscall number is the
+// same on every architecture
+#ifndef SYS_clone3
+#define SYS_clone3 435
+#endif
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+
+extern char **environ;
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * The first version of the kernel's struct clone_args, declared here as older <linux/sched.h>
+ * lacks it and newer ones may grow it
+ */
+struct spawn_clone_args
+{
+	uint64_t flags;
+	uint64_t pidfd;
+	uint64_t child_tid;
+	uint64_t parent_tid;
+	uint64_t exit_signal;
+	uint64_t stack;
+	uint64_t stack_size;
+	uint64_t tls;
+};
+
+/**
+ * A spawn strategy: start command, wait for it, return true if it ran and exited with 0
+ */
+struct strategy
+{
+	const char *name;
+	bool (*spawn)(char * const argv[]);
+};
+
+static bool spawn_system(char * const argv[]);
+static bool spawn_fork(char * const argv[]);
+static bool spawn_vfork(char * const argv[]);
+static bool spawn_posix_spawn(char * const argv[]);
+static bool spawn_clone3(char * const argv[]);
+static bool spawn_clone_vm(char * const argv[]);
+static bool spawn_do_exec(char * const argv[]);
+static bool spawn_prepared(char * const argv[]);
+
+static const struct strategy strategies[] =
+{
+	{ "system", spawn_system },
+	{ "fork", spawn_fork },
+	{ "vfork", spawn_vfork },
+	{ "posix_spawn", spawn_posix_spawn },
+	{ "clone3", spawn_clone3 },
+	{ "clone-vm", spawn_clone_vm },
+	{ "do_exec", spawn_do_exec },
+	{ "exec-server", spawn_do_exec },
+	{ "prepared", spawn_prepared },
+};
+
+#define STRATEGY_COUNT (sizeof(strategies) / sizeof(strategies[0]))
+
+// Memory the parent is holding, and the threads keeping it warm
+static char *ballast;
+static size_t ballast_size;
+static volatile bool threads_stop;
+
+//-----------------------------------STRATEGIES-----------------------------------
+
+static bool status_ok(int status)
+{
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool reap(pid_t pid)
+{
+	int status;
+	while(waitpid(pid, &status, 0) < 0)
+	{
+		if(errno != EINTR)
+			return false;
+	}
+	return status_ok(status);
+}
+
+static bool spawn_system(char * const argv[])
+{
+	return system(argv[0]) == 0;
+}
+
+static bool spawn_fork(char * const argv[])
+{
+	pid_t pid = fork();
+	if(pid < 0)
+		return false;
+	if(pid == 0)
+	{
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	return reap(pid);
+}
+
+static bool spawn_vfork(char * const argv[])
+{
+	pid_t pid = vfork();
+	if(pid < 0)
+		return false;
+	if(pid == 0)
+	{
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	return reap(pid);
+}
+
+static bool spawn_posix_spawn(char * const argv[])
+{
+	pid_t pid;
+	if(posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) != 0)
+		return false;
+	return reap(pid);
+}
+
+/**
+* clone3() with fork semantics plus CLONE_PIDFD, waiting for exit with poll() on the pidfd
+*/
+static bool spawn_clone3(char * const argv[])
+{
+	int pidfd = -1;
+	struct spawn_clone_args args;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = CLONE_PIDFD;
+	args.pidfd = (uint64_t)(uintptr_t)&pidfd;
+	args.exit_signal = SIGCHLD;
+
+	long pid = syscall(SYS_clone3, &args, sizeof(args));
+	if(pid < 0)
+		return false;
+	if(pid == 0)
+	{
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	struct pollfd fd = { pidfd, POLLIN, 0 };
+	while(poll(&fd, 1, -1) < 0 && errno == EINTR)
+		;
+	close(pidfd);
+	return reap((pid_t)pid);
+}
+
+static int clone_vm_child(void *argv)
+{
+	execv(((char **)argv)[0], (char **)argv);
+	_exit(127);
+}
+
+/**
+* CLONE_VM|CLONE_VFORK on a private stack, the way posix_spawn() works internally
+*/
+static bool spawn_clone_vm(char * const argv[])
+{
+	static char *stack;
+	if(stack == NULL)
+	{
+		stack = mmap(NULL, CLONE_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+		if(stack == MAP_FAILED)
+		{
+			stack = NULL;
+			return false;
+		}
+	}
+
+	pid_t pid = clone(clone_vm_child, stack + CLONE_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, (void *)argv);
+	if(pid < 0)
+		return false;
+	return reap(pid);
+}
+
+static bool spawn_do_exec(char * const argv[])
+{
+	return do_exec(1, argv[0]);
+}
+
+/**
+* do_exec_prepared() with the command opened once up front
+*/
+static bool spawn_prepared(char * const argv[])
+{
+	static struct prepared_command *prepared;
+	if(prepared == NULL)
+		prepared = prepared_command_create(1, argv, NULL);
+	return do_exec_prepared(prepared);
+}
+
+/**
+* @return true if name is one of the comma separated entries of list, or list is NULL
+*/
+static bool selected_has(const char *list, const char *name)
+{
+	size_t length = strlen(name);
+
+	if(list == NULL)
+		return true;
+
+	while(*list != '\0')
+	{
+		const char *end = strchrnul(list, ',');
+		if((size_t)(end - list) == length && strncmp(list, name, length) == 0)
+			return true;
+		list = *end ? end + 1 : end;
+	}
+	return false;
+}
+
+//-------------------------------------PARENT-------------------------------------
+
+/**
+* Keep the parent's memory and scheduler busy like a real service would
+*/
+static void *toucher(void *seed)
+{
+	unsigned int state = (unsigned int)(uintptr_t)seed;
+	struct timespec nap = { 0, 100000 };
+
+	while(!threads_stop)
+	{
+		int i;
+		for(i = 0; i < 64 && ballast_size >= TOUCH_STRIDE; i++)
+		{
+			state = state * 1103515245u + 12345u;
+			ballast[((size_t)state * TOUCH_STRIDE) % ballast_size]++;
+		}
+		nanosleep(&nap, NULL);
+	}
+	return NULL;
+}
+
+/**
+* Grow (never shrink) the ballast to size bytes and fault every page in
+* @return true if the parent now holds size bytes
+*/
+static bool inflate(size_t size)
+{
+	if(size <= ballast_size)
+		return true;
+
+	char *grown = realloc(ballast, size);
+	if(grown == NULL)
+		return false;
+
+	ballast = grown;
+	size_t offset;
+	for(offset = ballast_size; offset < size; offset += TOUCH_STRIDE)
+		ballast[offset] = 1;
+	ballast_size = size;
+	return true;
+}
+
+static double elapsed_us(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1e6 + (to->tv_nsec - from->tv_nsec) / 1e3;
+}
+
+static int compare_double(const void *left, const void *right)
+{
+	double a = *(const double *)left;
+	double b = *(const double *)right;
+	return (a > b) - (a < b);
+}
+
+/**
+* Run one strategy iterations times and print a result row
+*/
+static void measure(const struct strategy *strategy, char * const argv[], size_t rss, int threads, int iterations)
+{
+	double *samples = malloc(sizeof(double) * iterations);
+	struct timespec start;
+	struct timespec end;
+	int failures = 0;
+	int i;
+
+	if(samples == NULL)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < iterations; i++)
+	{
+		struct timespec before;
+		struct timespec after;
+
+		clock_gettime(CLOCK_MONOTONIC, &before);
+		if(!strategy->spawn(argv))
+			failures++;
+		clock_gettime(CLOCK_MONOTONIC, &after);
+		samples[i] = elapsed_us(&before, &after);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	qsort(samples, iterations, sizeof(double), compare_double);
+	double seconds = elapsed_us(&start, &end) / 1e6;
+	printf("%-12s %8zuM %7d %12.1f %10.1f %10.1f %10.1f %8d\n",
+			strategy->name, rss >> 20, threads, iterations / seconds,
+			samples[iterations / 2], samples[(iterations * 99) / 100], samples[iterations - 1], failures);
+	fflush(stdout);
+	free(samples);
+}
+
+/**
+* @return the next comma separated token of list as a size in bytes (K/M/G suffixes), 0 at the end
+*/
+static size_t parse_size(char **list)
+{
+	char *token = strsep(list, ",");
+	if(token == NULL || *token == '\0')
+		return 0;
+
+	char *suffix;
+	double value = strtod(token, &suffix);
+	switch(*suffix)
+	{
+		case 'G': case 'g': value *= 1024;	// fall through
+		case 'M': case 'm': value *= 1024;	// fall through
+		case 'K': case 'k': value *= 1024;
+	}
+	return (size_t)value;
+}
+
+//--------------------------------------MAIN--------------------------------------
+
+int main(int argc, char *argv[])
+{
+	int iterations = 100;
+	char *sizes = strdup("10M,1G,4G");
+	char *thread_counts = strdup("1,2,4,8,16,32");
+	char *selected = NULL;
+	char *command[] = { "/bin/true", NULL };
+	int option;
+
+	// The exec server has to be forked while we are still small, that is its whole point
+	bool server = exec_server_start();
+
+	while((option = getopt(argc, argv, "n:m:t:s:c:")) != -1)
+	{
+		switch(option)
+		{
+			case 'n': iterations = atoi(optarg); break;
+			case 'm': free(sizes); sizes = strdup(optarg); break;
+			case 't': free(thread_counts); thread_counts = strdup(optarg); break;
+			case 's': selected = optarg; break;
+			case 'c': command[0] = optarg; break;
+			default:
+				fprintf(stderr, "Usage: %s [-n iterations] [-m sizes] [-t threads] [-s strategies] [-c command]\n", argv[0]);
+				return 1;
+		}
+	}
+	if(iterations <= 0)
+		iterations = 1;
+
+	printf("%-12s %9s %7s %12s %10s %10s %10s %8s\n", "strategy", "rss", "threads", "spawns/sec", "p50(us)", "p99(us)", "max(us)", "failures");
+
+	char *size_list = sizes;
+	size_t rss;
+	while((rss = parse_size(&size_list)) != 0)
+	{
+		if(!inflate(rss))
+		{
+			printf("# could not grow the parent to %zuM, skipping\n", rss >> 20);
+			continue;
+		}
+
+		char *thread_copy = strdup(thread_counts);
+		char *thread_list = thread_copy;
+		char *token;
+		while((token = strsep(&thread_list, ",")) != NULL)
+		{
+			int threads = atoi(token);
+			if(threads < 1)
+				continue;
+
+			// The main thread counts as one
+			pthread_t workers[threads];
+			int started = 0;
+			threads_stop = false;
+			for(; started < threads - 1; started++)
+			{
+				if(pthread_create(&workers[started], NULL, toucher, (void *)(uintptr_t)(started + 1)) != 0)
+					break;
+			}
+
+			size_t i;
+			for(i = 0; i < STRATEGY_COUNT; i++)
+			{
+				const struct strategy *strategy = &strategies[i];
+				if(!selected_has(selected, strategy->name))
+					continue;
+
+				// Route do_exec() through the exec server only for its own row
+				bool use_server = strcmp(strategy->name, "exec-server") == 0;
+				if(use_server && !server)
+					continue;
+				exec_server_set_routing(use_server);
+
+				measure(strategy, command, rss, threads, iterations);
+			}
+
+			threads_stop = true;
+			int j;
+			for(j = 0; j < started; j++)
+				pthread_join(workers[j], NULL);
+		}
+		free(thread_copy);
+	}
+
+	exec_server_stop();
+	free(sizes);
+	free(thread_counts);
+	free(ballast);
+	return 0;
+}
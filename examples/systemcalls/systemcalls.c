@@ -1,10 +1,32 @@
+#define _GNU_SOURCE
 #include "systemcalls.h"
+#include "execserver.h"
+#include "execstats.h"
+#include "execcache.h"
 #include "unistd.h"
 #include "stdlib.h"
 #include "inttypes.h"
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+extern char **environ;
+
+// Older C libraries do not expose pidfd_open(), the syscall number is the same on every architecture
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
 
 /**
  * @param cmd the command to execute with system()
@@ -32,6 +54,284 @@ bool do_system(const char *cmd)
 		return false;	
 	}	
 }
+
+/**
+* @param status - A raw wait status
+* @return EXEC_RESULT_SUCCESS for a zero exit, EXEC_RESULT_FAILED otherwise
+*/
+static enum exec_result exec_result_from_status(int status)
+{
+	if((WIFEXITED(status)) && (WEXITSTATUS(status) == 0))
+		return EXEC_RESULT_SUCCESS;
+	return EXEC_RESULT_FAILED;
+}
+
+/**
+* @return milliseconds left until deadline (CLOCK_MONOTONIC), never negative
+*/
+static int remaining_ms(const struct timespec *deadline)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long ms = (long long)(deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+	if(ms < 0)
+		return 0;
+	return ms > INT32_MAX ? INT32_MAX : (int)ms;
+}
+
+/**
+* @param deadline - Filled with now + ms on CLOCK_MONOTONIC
+*/
+static void deadline_after(struct timespec *deadline, int ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec += ms / 1000;
+	deadline->tv_nsec += (long)(ms % 1000) * 1000000;
+	if(deadline->tv_nsec >= 1000000000)
+	{
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+}
+
+/**
+* Wait until the child behind pidfd exits or the deadline passes.
+* @param pidfd - pidfd of the child, -1 if pidfd_open() is unavailable
+* @param pid - The child, used for the polling fallback when pidfd is -1
+* @return true if the child has exited (it is not reaped), false on timeout
+*/
+static bool wait_exit_until(int pidfd, pid_t pid, const struct timespec *deadline)
+{
+	for(;;)
+	{
+		int left = remaining_ms(deadline);
+
+		if(pidfd >= 0)
+		{
+			struct pollfd fd = { pidfd, POLLIN, 0 };
+			int ready = poll(&fd, 1, left);
+			if(ready > 0)
+				return true;
+			if(ready == 0)
+				return false;
+			if(errno != EINTR)
+				return false;
+			continue;
+		}
+
+		// Kernels before 5.3 have no pidfd, so peek at the child without reaping it
+		siginfo_t info;
+		info.si_pid = 0;
+		if(waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == pid)
+			return true;
+		if(left == 0)
+			return false;
+		struct timespec nap = { 0, 1000000 };
+		nanosleep(&nap, NULL);
+	}
+}
+
+/**
+ * A command started by exec_start() and not yet reaped
+ */
+struct exec_child
+{
+	pid_t pid;
+	bool own_group;
+	bool exec_known;
+	struct timespec spawned;
+	struct timespec execed;
+};
+
+/**
+* Fork and execv one command, returning once the exec has happened (or failed).
+* @param command - NULL terminated argument vector, command[0] is the full path to the command
+* @param exec_fd - An already opened command[0] to fexecve(), -1 to execv() the path
+* @param envp - Environment for the command, NULL for ours
+* @param fds - The descriptors to install as the command's stdin, stdout and stderr, -1 to keep ours
+* @param own_group - Put the command in its own process group so it can be killed along with its children
+* @param child - Filled with the started command
+* @return true if the child was forked, false otherwise
+*/
+static bool exec_start(char * const command[], int exec_fd, char * const envp[], const int fds[3], bool own_group,
+		struct exec_child *child)
+{
+	child->own_group = own_group;
+	child->exec_known = false;
+	clock_gettime(CLOCK_MONOTONIC, &child->spawned);
+
+	// The child reports a failed execv over this pipe, a successful one simply closes it (O_CLOEXEC)
+	int exec_pipe[2];
+	if(pipe2(exec_pipe, O_CLOEXEC) < 0)
+		return false;
+
+	// Lets fork from this process and save the new prcoess ID
+	pid_t processID = fork();
+
+	switch(processID)
+	{
+		// If we see a processID of -1, we are the parent process and the Fork Failed
+		case -1:
+		{
+			close(exec_pipe[0]);
+			close(exec_pipe[1]);
+			return false;
+		}
+
+		// If we see a processID of 0, we are the child process, so lets execute the command
+		case 0:
+		{
+			int target;
+
+			// A child with a deadline leads its own process group so everything it starts can be killed with it
+			if(own_group)
+				setpgid(0, 0);
+
+			// If redirection operation fails exit the child process
+			for(target = 0; target < 3; target++)
+			{
+				if(fds[target] >= 0 && dup2(fds[target], target) < 0)
+					_exit(-1);
+			}
+
+			// If execv does not exit the process, then it will return here and continue.  A prepared
+			// command skips the path lookup, scripts cannot be run from a descriptor so retry by path.
+			if(exec_fd >= 0)
+				fexecve(exec_fd, command, envp != NULL ? envp : environ);
+			if(envp != NULL)
+				execve(command[0], command, envp);
+			else
+				execv(command[0], command);
+
+			// Tell the parent why, then exit the process with -1 to indicate that execv failed
+			int error = errno;
+			ssize_t ignored = write(exec_pipe[1], &error, sizeof(error));
+			(void)ignored;
+			_exit(-1);
+		}
+
+		// If we see any other processID, we are the parent process, and the fork succeeded
+		default:
+		{
+			int error;
+			ssize_t got;
+
+			// Set the group from this side too, so it exists before we could ever need to signal it
+			if(own_group)
+				setpgid(processID, processID);
+
+			// Returns 0 bytes once execv has replaced the child
+			close(exec_pipe[1]);
+			while((got = read(exec_pipe[0], &error, sizeof(error))) < 0 && errno == EINTR)
+				;
+			close(exec_pipe[0]);
+			clock_gettime(CLOCK_MONOTONIC, &child->execed);
+
+			child->pid = processID;
+			child->exec_known = got == 0;
+			return true;
+		}
+	}
+}
+
+/**
+* Wait for a command started by exec_start() and record its resource usage with exec_stats_record().
+* @param command - The command's argument vector, used to attribute the statistics
+* @param child - The started command
+* @param timeout_ms - Milliseconds from now the command may still run, -1 to wait forever.  The command
+*   must have been started with own_group; at the deadline its group gets SIGTERM, then SIGKILL grace_ms later.
+* @param grace_ms - Time between SIGTERM and SIGKILL
+* @return see enum exec_result
+*/
+static enum exec_result exec_finish(char * const command[], struct exec_child *child, int timeout_ms, int grace_ms)
+{
+	// Lets get a status variable we can give to the wait4 command for debugging
+	int status;
+	struct rusage usage;
+	struct timespec exited;
+	bool timed_out = false;
+
+	// With a deadline, wait on a pidfd with poll() rather than blocking in wait4 forever
+	if(timeout_ms >= 0)
+	{
+		struct timespec deadline;
+		int pidfd = (int)syscall(SYS_pidfd_open, child->pid, 0);
+
+		deadline_after(&deadline, timeout_ms);
+		if(!wait_exit_until(pidfd, child->pid, &deadline))
+		{
+			timed_out = true;
+			kill(child->own_group ? -child->pid : child->pid, SIGTERM);
+			deadline_after(&deadline, grace_ms);
+			wait_exit_until(pidfd, child->pid, &deadline);
+		}
+
+		// Kill anything left in the group while the leader is unreaped and the group ID cannot be reused
+		if(timed_out)
+			kill(child->own_group ? -child->pid : child->pid, SIGKILL);
+		if(pidfd >= 0)
+			close(pidfd);
+	}
+
+	// If the child wraps with a processID of -1, there was some sort of error
+	pid_t reaped;
+	while((reaped = wait4(child->pid, &status, 0, &usage)) == -1 && errno == EINTR)
+		;
+	if(reaped == -1)
+		return EXEC_RESULT_ERROR;
+
+	clock_gettime(CLOCK_MONOTONIC, &exited);
+	exec_stats_record(command[0], &child->spawned, child->exec_known ? &child->execed : NULL, &exited, &usage, status);
+
+	if(timed_out)
+		return EXEC_RESULT_TIMEOUT;
+	return exec_result_from_status(status);
+}
+
+/**
+* Run one command and wait for it.
+* @param command - NULL terminated argument vector, command[0] is the full path to the command
+* @param stdout_fd - The file descriptor to use as the command's standard out, -1 for ours
+* @param timeout_ms - Deadline for the command, -1 to wait forever.  With a deadline the command
+*   runs in its own process group which gets SIGTERM at the deadline and SIGKILL grace_ms later.
+* @param grace_ms - Time between SIGTERM and SIGKILL
+* @return see enum exec_result
+*/
+static enum exec_result exec_command(char * const command[], int stdout_fd, int timeout_ms, int grace_ms)
+{
+	// If the exec server is running, let it fork from its small address space instead of us.
+	// It has no notion of deadlines, so commands with a timeout are always run locally.
+	if(timeout_ms < 0)
+	{
+		int status;
+		struct rusage usage;
+		struct timespec spawned;
+		struct timespec execed;
+		struct timespec exited;
+
+		clock_gettime(CLOCK_MONOTONIC, &spawned);
+		switch(exec_server_run(command, NULL, stdout_fd, &status, &usage, &execed))
+		{
+			case EXEC_SERVER_DONE:
+				clock_gettime(CLOCK_MONOTONIC, &exited);
+				// A zeroed execed means the command could not be executed, as exec_known does locally
+				exec_stats_record(command[0], &spawned, execed.tv_sec != 0 || execed.tv_nsec != 0 ? &execed : NULL,
+						&exited, &usage, status);
+				return exec_result_from_status(status);
+			case EXEC_SERVER_FAILED:
+				return EXEC_RESULT_ERROR;
+			case EXEC_SERVER_UNAVAILABLE:
+				break;
+		}
+	}
+
+	struct exec_child child;
+	int fds[3] = { -1, stdout_fd, -1 };
+	if(!exec_start(command, -1, NULL, fds, timeout_ms >= 0, &child))
+		return EXEC_RESULT_ERROR;
+	return exec_finish(command, &child, timeout_ms, grace_ms);
+}
+
 /**
 * @param count -The numbers of variables passed to the function. The variables are command to execute.
 *   followed by arguments to pass to the command
@@ -57,64 +357,10 @@ bool do_exec(int count, ...)
         command[i] = va_arg(args, char *);
     }
     command[count] = NULL;
-    // this line is to avoid a compile warning before your implementation is complete
-    // and may be removed
-    command[count] = command[count];
-
-/*
- * TODO:
- *   Execute a system command by calling fork, execv(),
- *   and wait instead of system (see LSP page 161).
- *   Use the command[0] as the full path to the command to execute
- *   (first argument to execv), and use the remaining arguments
- *   as second argument to the execv() command.
- *
-*/
 	va_end(args);
-   
-	// Lets get a status variable we can give to the waitpid command for debugging
-	int status;
 
-	// Lets fork from this process and save the new prcoess ID
-	pid_t processID = fork();
-                
-	switch(processID)
-	{
-                // If we see a processID of -1, we are the parent process and the Fork Failed
-		case -1:
-		{
-			return false;
-	      		break;
-      		}
-
-		// If we see a processID of 0, we are the child process, so lets execute the command
-		case 0:
-      		{	
-			// If execv does not exit the process, then it will return here and continue
-	      		execv(command[0], (command));
-
-			// Exit the process with -1 to indicate that execv failed
-			exit(-1);
-			break;
-     		}
-
-		// If we see any other processID, we are the parent process, and the fork succeeded
-		default:
-    		{
-			// If the child wraps with a processID of -1, there was some sort of error
-			if(waitpid(processID, &status, 0) == -1)
-				return false;
-			
-			// If the child wrapped successfully, return true
-			if((WIFEXITED(status)) && (WEXITSTATUS(status) == 0))
-				return true;
-
-			// Else return false
-			else
-				return false;
-			
-      		}
-	}
+	// Fork, execv and wait for the command with our own standard out
+	return exec_command(command, -1, -1, 0) == EXEC_RESULT_SUCCESS;
 }
 
 /**
@@ -133,69 +379,940 @@ bool do_exec_redirect(const char *outputfile, int count, ...)
         command[i] = va_arg(args, char *);
     }
     command[count] = NULL;
-    // this line is to avoid a compile warning before your implementation is complete
-    // and may be removed
-    command[count] = command[count];
+    va_end(args);
 
+	// Lets create a new fd to direct stdout to, the child gets its own copy through dup2
+	int fd = open(outputfile, O_WRONLY|O_TRUNC|O_CREAT|O_CLOEXEC, 0644);
+	if(fd < 0)
+		return false;
 
-/*
- * TODO
- *   Call execv, but first using https://stackoverflow.com/a/13784315/1446624 as a refernce,
- *   redirect standard out to a file specified by outputfile.
- *   The rest of the behaviour is same as do_exec()
- *
+	bool success = exec_command(command, fd, -1, 0) == EXEC_RESULT_SUCCESS;
+	close(fd);
+	return success;
+}
+
+void exec_input_buffer(struct exec_input *input, const void *data, size_t length)
+{
+	memset(input, 0, sizeof(*input));
+	input->data = data;
+	input->length = length;
+	input->fd = -1;
+	input->memfd = -1;
+}
+
+void exec_input_fd(struct exec_input *input, int fd)
+{
+	exec_input_buffer(input, NULL, 0);
+	input->fd = fd;
+}
+
+void *exec_input_alloc(struct exec_input *input, size_t length)
+{
+	exec_input_buffer(input, NULL, 0);
+
+	int fd = memfd_create("exec-input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(fd < 0)
+		return NULL;
+	if(length > 0 && ftruncate(fd, (off_t)length) < 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void *data = length > 0 ? mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : NULL;
+	if(data == MAP_FAILED)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	input->data = data;
+	input->length = length;
+	input->memfd = fd;
+	return data;
+}
+
+void exec_input_release(struct exec_input *input)
+{
+	if(input == NULL || input->memfd < 0)
+		return;
+
+	if(input->data != NULL)
+		munmap((void *)input->data, input->length);
+	close(input->memfd);
+	exec_input_buffer(input, NULL, 0);
+}
+
+/**
+* Seal a memfd so the command sees a stable input, and rewind it for the next reader.
+* F_SEAL_FUTURE_WRITE (Linux 5.1) still allows our existing mapping, older kernels only get size seals.
 */
+static bool seal_input(int memfd)
+{
+	if(fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE) < 0 &&
+	   fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0)
+		return false;
+	return lseek(memfd, 0, SEEK_SET) == 0;
+}
 
-    va_end(args);
+/**
+* @return a sealed memfd holding a copy of length bytes of data, -1 on failure
+*/
+static int memfd_from_buffer(const void *data, size_t length)
+{
+	int fd = memfd_create("exec-input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(fd < 0)
+		return -1;
 
-    	// Lets create a new fd to direct stdout to
-	int fd = open(outputfile, O_WRONLY|O_TRUNC|O_CREAT, 0644);
-
-        // Lets get a status variable we can give to the waitpid command for debugging
-        int status;
-
-        // Lets fork from this process and save the new prcoess ID
-        pid_t processID = fork();
-
-        switch(processID)
-        {
-                // If we see a processID of -1, we are the parent process and the Fork Failed
-                case -1:
-                {
-                        return false;
-                        break;
-                }
-
-                // If we see a processID of 0, we are the child process, so lets execute the command
-                case 0:
-                {
-                        // If redirection operation fails exit the child process
-                        if(dup2(fd, 1) < 0)
-			       exit(-1);
-
-                        // If execv does not exit the process, then it will return here and continue
-                        execv(command[0], (command));
-
-                        // Exit the process with -1 to indicate that execv failed
-                        exit(-1);
-                        break;
-                }
-
-                // If we see any other processID, we are the parent process, and the fork succeeded
-                default:
-                {
-                        // If the child wraps with a processID of -1, there was some sort of error
-                        if(waitpid(processID, &status, 0) == -1)
-			{close(fd); return false;}
-
-                        // If the child wrapped successfully, return true
-                        if((WIFEXITED(status)) && (WEXITSTATUS(status) == 0))
-			{close(fd); return true;}
-
-			// Else return false
+	size_t done = 0;
+	while(done < length)
+	{
+		ssize_t put = write(fd, (const char *)data + done, length - done);
+		if(put < 0 && errno == EINTR)
+			continue;
+		if(put <= 0)
+		{
+			close(fd);
+			return -1;
+		}
+		done += (size_t)put;
+	}
+
+	if(!seal_input(fd))
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+* Splice (or, where vmsplice() is refused, write) as much of iov as the pipe takes without blocking.
+* @return bytes moved, 0 if the pipe is full, -1 with errno set on error (EPIPE once the command stops reading)
+*/
+static ssize_t feed_pipe(int fd, struct iovec *iov)
+{
+	ssize_t moved = vmsplice(fd, iov, 1, SPLICE_F_NONBLOCK);
+	if(moved < 0 && (errno == EINVAL || errno == ENOSYS))
+		moved = write(fd, iov->iov_base, iov->iov_len);
+	if(moved < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if(moved > 0)
+	{
+		iov->iov_base = (char *)iov->iov_base + moved;
+		iov->iov_len -= (size_t)moved;
+	}
+	return moved;
+}
+
+/**
+* Run a command with input on its standard input, standard out to stdout_fd or captured.
+* @param output - If non NULL, standard out is captured into a malloc'd buffer (stdout_fd is ignored)
+* @return see enum exec_result
+*/
+static enum exec_result exec_with_input(char * const command[], const struct exec_input *input, int stdout_fd,
+		char **output, size_t *output_len)
+{
+	int child_fds[3] = { -1, stdout_fd, -1 };
+	int owned_in = -1;
+	int feed_fd = -1;
+	int capture_fd = -1;
+	int capture_write = -1;
+	struct iovec feed = { NULL, 0 };
+
+	// Pick how the input reaches the command: as is, its own memfd, a fresh memfd or a pipe
+	if(input->fd >= 0)
+		child_fds[0] = input->fd;
+	else if(input->memfd >= 0)
+	{
+		if(!seal_input(input->memfd))
+			return EXEC_RESULT_ERROR;
+		child_fds[0] = input->memfd;
+	}
+	else if(input->length >= EXEC_INPUT_MEMFD_THRESHOLD && !input->stream)
+	{
+		owned_in = memfd_from_buffer(input->data, input->length);
+		if(owned_in < 0)
+			return EXEC_RESULT_ERROR;
+		child_fds[0] = owned_in;
+	}
+	else
+	{
+		int link[2];
+		if(pipe2(link, O_CLOEXEC) < 0)
+			return EXEC_RESULT_ERROR;
+		owned_in = link[0];
+		feed_fd = link[1];
+		fcntl(feed_fd, F_SETFL, O_NONBLOCK);
+		child_fds[0] = owned_in;
+		feed.iov_base = (void *)input->data;
+		feed.iov_len = input->length;
+	}
+
+	if(output != NULL)
+	{
+		int link[2];
+		if(pipe2(link, O_CLOEXEC) < 0)
+		{
+			if(owned_in >= 0)
+				close(owned_in);
+			if(feed_fd >= 0)
+				close(feed_fd);
+			return EXEC_RESULT_ERROR;
+		}
+		capture_fd = link[0];
+		capture_write = link[1];
+		child_fds[1] = capture_write;
+	}
+
+	struct exec_child child;
+	bool started = exec_start(command, -1, NULL, child_fds, false, &child);
+
+	// The child holds its own copies, keep only our ends
+	if(owned_in >= 0)
+		close(owned_in);
+	if(capture_write >= 0)
+		close(capture_write);
+	if(!started)
+	{
+		if(feed_fd >= 0)
+			close(feed_fd);
+		if(capture_fd >= 0)
+			close(capture_fd);
+		return EXEC_RESULT_ERROR;
+	}
+
+	// A command that exits without reading all its input must not take us down with SIGPIPE
+	sigset_t pipe_mask;
+	sigset_t old_mask;
+	sigset_t pending;
+	sigemptyset(&pipe_mask);
+	sigaddset(&pipe_mask, SIGPIPE);
+	sigpending(&pending);
+	bool pipe_was_pending = sigismember(&pending, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipe_mask, &old_mask);
+
+	size_t capacity = 0;
+	size_t length = 0;
+	char *buffer = NULL;
+	bool success = true;
+
+	if(feed_fd >= 0 && feed.iov_len == 0)
+	{
+		close(feed_fd);
+		feed_fd = -1;
+	}
+
+	// Feed and drain together, otherwise a command that writes before it has read everything deadlocks
+	while(success && (feed_fd >= 0 || capture_fd >= 0))
+	{
+		struct pollfd fds[2] = {
+			{ feed_fd, POLLOUT, 0 },
+			{ capture_fd, POLLIN, 0 },
+		};
+
+		if(poll(fds, 2, -1) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			success = false;
+			break;
+		}
+
+		if(feed_fd >= 0 && fds[0].revents)
+		{
+			ssize_t moved = feed_pipe(feed_fd, &feed);
+			if(moved < 0 || feed.iov_len == 0)
+			{
+				if(moved < 0 && errno != EPIPE)
+					success = false;
+				close(feed_fd);
+				feed_fd = -1;
+			}
+		}
+
+		if(capture_fd >= 0 && fds[1].revents)
+		{
+			if(length == capacity)
+			{
+				size_t grown_capacity = capacity ? capacity * 2 : 4096;
+				char *grown = realloc(buffer, grown_capacity);
+				if(grown == NULL)
+				{
+					success = false;
+					break;
+				}
+				buffer = grown;
+				capacity = grown_capacity;
+			}
+
+			ssize_t got = read(capture_fd, buffer + length, capacity - length);
+			if(got < 0 && errno == EINTR)
+				continue;
+			if(got <= 0)
+			{
+				success = got == 0;
+				close(capture_fd);
+				capture_fd = -1;
+			}
 			else
-			{close(fd); return false;}
-                        
-                }
-        }
+				length += (size_t)got;
+		}
+	}
+
+	if(feed_fd >= 0)
+		close(feed_fd);
+	if(capture_fd >= 0)
+		close(capture_fd);
+
+	// Swallow a SIGPIPE we caused before unblocking it again
+	struct timespec no_wait = { 0, 0 };
+	sigpending(&pending);
+	if(!pipe_was_pending && sigismember(&pending, SIGPIPE))
+		sigtimedwait(&pipe_mask, NULL, &no_wait);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+	enum exec_result result = exec_finish(command, &child, -1, 0);
+	if(output != NULL && success && result == EXEC_RESULT_SUCCESS)
+	{
+		*output = buffer;
+		*output_len = length;
+		return result;
+	}
+
+	free(buffer);
+	if(!success && result == EXEC_RESULT_SUCCESS)
+		return EXEC_RESULT_ERROR;
+	return result;
+}
+
+bool do_exec_input(const struct exec_input *input, const char *outputfile, int count, ...)
+{
+	va_list args;
+	va_start(args, count);
+	char * command[count+1];
+	int i;
+	for(i=0; i<count; i++)
+	{
+		command[i] = va_arg(args, char *);
+	}
+	command[count] = NULL;
+	va_end(args);
+
+	// Lets safely handle NULL pointers before we do anything else
+	if(input == NULL || count < 1)
+		return false;
+
+	int fd = -1;
+	if(outputfile != NULL)
+	{
+		fd = open(outputfile, O_WRONLY|O_TRUNC|O_CREAT|O_CLOEXEC, 0644);
+		if(fd < 0)
+			return false;
+	}
+
+	bool success = exec_with_input(command, input, fd, NULL, NULL) == EXEC_RESULT_SUCCESS;
+	if(fd >= 0)
+		close(fd);
+	return success;
+}
+
+bool do_exec_filter(const struct exec_input *input, char **output, size_t *output_len, int count, ...)
+{
+	va_list args;
+	va_start(args, count);
+	char * command[count+1];
+	int i;
+	for(i=0; i<count; i++)
+	{
+		command[i] = va_arg(args, char *);
+	}
+	command[count] = NULL;
+	va_end(args);
+
+	// Lets safely handle NULL pointers before we do anything else
+	if(input == NULL || output == NULL || output_len == NULL || count < 1)
+		return false;
+
+	*output = NULL;
+	*output_len = 0;
+	return exec_with_input(command, input, -1, output, output_len) == EXEC_RESULT_SUCCESS;
+}
+
+/**
+ * A command opened and marshalled once by prepared_command_create()
+ */
+struct prepared_command
+{
+	/**
+	 * O_PATH descriptor of the executable, fexecve()'d by every run
+	 */
+	int exec_fd;
+
+	/**
+	 * Cached output descriptor, truncated before every run if it is a regular file,
+	 * -1 for our standard out
+	 */
+	int output_fd;
+	bool output_regular;
+
+	/**
+	 * argv with the variable slots patched per run, and where those slots are
+	 */
+	char **argv;
+	int *slots;
+	int slot_count;
+
+	/**
+	 * Copy of the environment taken when the command was prepared, our own strings so a
+	 * later setenv() or unsetenv() can not free them from under us
+	 */
+	char **envp;
+};
+
+struct prepared_command *prepared_command_create(int argc, char * const argv[], const char *outputfile)
+{
+	int i;
+	int envc = 0;
+
+	// Lets safely handle NULL pointers before we do anything else
+	if(argc < 1 || argv == NULL || argv[0] == NULL)
+		return NULL;
+
+	struct prepared_command *prepared = calloc(1, sizeof(*prepared));
+	if(prepared == NULL)
+		return NULL;
+	prepared->exec_fd = -1;
+	prepared->output_fd = -1;
+
+	while(environ[envc] != NULL)
+		envc++;
+
+	prepared->argv = calloc(argc + 1, sizeof(char *));
+	prepared->slots = calloc(argc, sizeof(int));
+	prepared->envp = calloc(envc + 1, sizeof(char *));
+	if(prepared->argv == NULL || prepared->slots == NULL || prepared->envp == NULL)
+	{
+		prepared_command_free(prepared);
+		return NULL;
+	}
+
+	for(i = 0; i < argc; i++)
+	{
+		prepared->argv[i] = argv[i];
+		if(argv[i] == NULL)
+			prepared->slots[prepared->slot_count++] = i;
+	}
+	for(i = 0; i < envc; i++)
+	{
+		prepared->envp[i] = strdup(environ[i]);
+		if(prepared->envp[i] == NULL)
+		{
+			prepared_command_free(prepared);
+			return NULL;
+		}
+	}
+
+	// Resolve the executable once, every run execs straight from this descriptor
+	prepared->exec_fd = open(argv[0], O_PATH | O_CLOEXEC);
+	if(prepared->exec_fd < 0)
+	{
+		prepared_command_free(prepared);
+		return NULL;
+	}
+
+	if(outputfile != NULL)
+	{
+		prepared->output_fd = open(outputfile, O_WRONLY|O_TRUNC|O_CREAT|O_CLOEXEC, 0644);
+		struct stat st;
+		if(prepared->output_fd < 0 || fstat(prepared->output_fd, &st) < 0)
+		{
+			prepared_command_free(prepared);
+			return NULL;
+		}
+		prepared->output_regular = S_ISREG(st.st_mode);
+	}
+
+	return prepared;
+}
+
+bool do_exec_prepared(struct prepared_command *prepared, ...)
+{
+	va_list args;
+	int i;
+
+	if(prepared == NULL)
+		return false;
+
+	// Patch only the variable slots, everything else was built by prepared_command_create()
+	va_start(args, prepared);
+	for(i = 0; i < prepared->slot_count; i++)
+		prepared->argv[prepared->slots[i]] = va_arg(args, char *);
+	va_end(args);
+
+	// Same truncate-then-write behaviour as do_exec_redirect(), without reopening the file
+	if(prepared->output_regular)
+	{
+		if(ftruncate(prepared->output_fd, 0) < 0 || lseek(prepared->output_fd, 0, SEEK_SET) < 0)
+			return false;
+	}
+
+	struct exec_child child;
+	int fds[3] = { -1, prepared->output_fd, -1 };
+	bool started = exec_start(prepared->argv, prepared->exec_fd, prepared->envp, fds, false, &child);
+
+	// Do not leave the caller's strings behind in the template
+	for(i = 0; i < prepared->slot_count; i++)
+		prepared->argv[prepared->slots[i]] = NULL;
+
+	if(!started)
+		return false;
+	return exec_finish(prepared->argv, &child, -1, 0) == EXEC_RESULT_SUCCESS;
+}
+
+void prepared_command_free(struct prepared_command *prepared)
+{
+	if(prepared == NULL)
+		return;
+
+	if(prepared->exec_fd >= 0)
+		close(prepared->exec_fd);
+	if(prepared->output_fd >= 0)
+		close(prepared->output_fd);
+	free(prepared->argv);
+	free(prepared->slots);
+	if(prepared->envp != NULL)
+	{
+		char **env;
+		for(env = prepared->envp; *env != NULL; env++)
+			free(*env);
+		free(prepared->envp);
+	}
+	free(prepared);
+}
+
+bool do_exec_redirect_cached(const char *outputfile, const char * const inputs[], int count, ...)
+{
+	va_list args;
+	va_start(args, count);
+	char * command[count+1];
+	int i;
+	for(i=0; i<count; i++)
+	{
+		command[i] = va_arg(args, char *);
+	}
+	command[count] = NULL;
+	va_end(args);
+
+	// On a hit the cached output is materialised into outputfile and nothing is spawned
+	char key[EXEC_CACHE_KEY_LEN];
+	bool keyed = exec_cache_enabled() && exec_cache_key(command, inputs, key);
+	if(keyed && exec_cache_lookup(key, outputfile))
+		return true;
+
+	int fd = open(outputfile, O_WRONLY|O_TRUNC|O_CREAT|O_CLOEXEC, 0644);
+	if(fd < 0)
+		return false;
+
+	bool success = exec_command(command, fd, -1, 0) == EXEC_RESULT_SUCCESS;
+	close(fd);
+
+	// Only successful runs are worth remembering
+	if(success && keyed)
+		exec_cache_store(key, outputfile);
+	return success;
+}
+
+enum exec_result do_exec_timeout(int timeout_ms, int grace_ms, int count, ...)
+{
+	va_list args;
+	va_start(args, count);
+	char * command[count+1];
+	int i;
+	for(i=0; i<count; i++)
+	{
+		command[i] = va_arg(args, char *);
+	}
+	command[count] = NULL;
+	va_end(args);
+
+	return exec_command(command, -1, timeout_ms, grace_ms);
+}
+
+enum exec_result do_exec_redirect_timeout(const char *outputfile, int timeout_ms, int grace_ms, int count, ...)
+{
+	va_list args;
+	va_start(args, count);
+	char * command[count+1];
+	int i;
+	for(i=0; i<count; i++)
+	{
+		command[i] = va_arg(args, char *);
+	}
+	command[count] = NULL;
+	va_end(args);
+
+	int fd = open(outputfile, O_WRONLY|O_TRUNC|O_CREAT|O_CLOEXEC, 0644);
+	if(fd < 0)
+		return EXEC_RESULT_ERROR;
+
+	enum exec_result result = exec_command(command, fd, timeout_ms, grace_ms);
+	close(fd);
+	return result;
+}
+
+/**
+ * One output channel being streamed by do_exec_stream()
+ */
+struct stream_channel
+{
+	enum exec_stream_channel channel;
+	int fd;
+	char *buffer;
+	size_t fill;
+};
+
+/**
+* Deliver everything complete in channel's buffer.
+* @param eof - The pipe is finished, deliver whatever is left even without a newline
+* @return the callback's verdict, false to stop streaming
+*/
+static bool stream_deliver(const struct exec_stream *stream, struct stream_channel *channel, size_t capacity, bool eof)
+{
+	if(!stream->lines)
+	{
+		bool more = channel->fill == 0 || stream->callback(channel->channel, channel->buffer, channel->fill, stream->context);
+		channel->fill = 0;
+		return more;
+	}
+
+	// Hand out every complete line, then slide the partial tail to the front of the buffer
+	size_t start = 0;
+	char *newline;
+	while((newline = memchr(channel->buffer + start, '\n', channel->fill - start)) != NULL)
+	{
+		size_t end = (size_t)(newline - channel->buffer);
+		if(!stream->callback(channel->channel, channel->buffer + start, end - start, stream->context))
+			return false;
+		start = end + 1;
+	}
+
+	// A line that fills the whole buffer, or the last line without a newline, goes out as is
+	if(start < channel->fill && (eof || (start == 0 && channel->fill == capacity)))
+	{
+		if(!stream->callback(channel->channel, channel->buffer + start, channel->fill - start, stream->context))
+			return false;
+		start = channel->fill;
+	}
+
+	memmove(channel->buffer, channel->buffer + start, channel->fill - start);
+	channel->fill -= start;
+	return true;
+}
+
+bool do_exec_stream(const struct exec_stream *stream, int count, ...)
+{
+	va_list args;
+	va_start(args, count);
+	char * command[count+1];
+	int i;
+	for(i=0; i<count; i++)
+	{
+		command[i] = va_arg(args, char *);
+	}
+	command[count] = NULL;
+	va_end(args);
+
+	// Lets safely handle NULL pointers before we do anything else
+	if(stream == NULL || stream->callback == NULL || count < 1)
+		return false;
+
+	size_t capacity = stream->buffer_size ? stream->buffer_size : 64 * 1024;
+	struct stream_channel channels[2] = {
+		{ EXEC_STREAM_STDOUT, -1, NULL, 0 },
+		{ EXEC_STREAM_STDERR, -1, NULL, 0 },
+	};
+	int child_fds[3] = { -1, -1, -1 };
+	int nchannels = stream->capture_stderr ? 2 : 1;
+	bool success = true;
+
+	// One pipe and one reusable buffer per captured channel
+	for(i = 0; i < nchannels; i++)
+	{
+		int link[2];
+		channels[i].buffer = malloc(capacity);
+		if(channels[i].buffer == NULL || pipe2(link, O_CLOEXEC) < 0)
+		{
+			success = false;
+			break;
+		}
+		channels[i].fd = link[0];
+		child_fds[i + 1] = link[1];
+	}
+
+	struct exec_child child;
+	if(success)
+		success = exec_start(command, -1, NULL, child_fds, false, &child);
+
+	// The child owns the write ends now, we must not hold them or we never see EOF
+	for(i = 1; i < 3; i++)
+	{
+		if(child_fds[i] >= 0)
+			close(child_fds[i]);
+	}
+
+	if(!success)
+	{
+		for(i = 0; i < nchannels; i++)
+		{
+			if(channels[i].fd >= 0)
+				close(channels[i].fd);
+			free(channels[i].buffer);
+		}
+		return false;
+	}
+
+	int open_channels = nchannels;
+	while(success && open_channels > 0)
+	{
+		struct pollfd fds[2];
+		for(i = 0; i < nchannels; i++)
+		{
+			fds[i].fd = channels[i].fd;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+
+		if(poll(fds, nchannels, -1) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			success = false;
+			break;
+		}
+
+		for(i = 0; success && i < nchannels; i++)
+		{
+			struct stream_channel *channel = &channels[i];
+			if(channel->fd < 0 || fds[i].revents == 0)
+				continue;
+
+			ssize_t got = read(channel->fd, channel->buffer + channel->fill, capacity - channel->fill);
+			if(got < 0 && errno == EINTR)
+				continue;
+			if(got > 0)
+			{
+				channel->fill += (size_t)got;
+				success = stream_deliver(stream, channel, capacity, false);
+				continue;
+			}
+
+			// EOF (or a broken pipe), flush the tail and stop watching this channel
+			success = stream_deliver(stream, channel, capacity, true) && got == 0;
+			close(channel->fd);
+			channel->fd = -1;
+			open_channels--;
+		}
+	}
+
+	// Closing early makes a command that is still writing fail with EPIPE rather than hang
+	for(i = 0; i < nchannels; i++)
+	{
+		if(channels[i].fd >= 0)
+			close(channels[i].fd);
+		free(channels[i].buffer);
+	}
+
+	return exec_finish(command, &child, -1, 0) == EXEC_RESULT_SUCCESS && success;
+}
+
+/**
+* @param fd - The read end of the pipe connected to the last pipeline stage
+* @param pipeline - The pipeline whose output/output_len members are filled in
+* @return true if the pipe was drained to EOF, false on a read or allocation error
+*/
+static bool pipeline_capture(int fd, struct pipeline *pipeline)
+{
+	size_t capacity = 4096;
+	char *buffer = malloc(capacity);
+	size_t length = 0;
+
+	if(buffer == NULL)
+		return false;
+
+	// Keep reading until every writer has closed its end of the pipe
+	for(;;)
+	{
+		// Lets double the buffer any time we run out of room
+		if(length == capacity)
+		{
+			char *grown = realloc(buffer, capacity * 2);
+			if(grown == NULL)
+			{
+				free(buffer);
+				return false;
+			}
+			buffer = grown;
+			capacity *= 2;
+		}
+
+		ssize_t got = read(fd, buffer + length, capacity - length);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got < 0)
+		{
+			free(buffer);
+			return false;
+		}
+		if(got == 0)
+			break;
+		length += (size_t)got;
+	}
+
+	pipeline->output = buffer;
+	pipeline->output_len = length;
+	return true;
+}
+
+bool do_exec_pipeline(struct pipeline *pipeline)
+{
+	size_t i;
+	bool success = true;
+
+	// Lets safely handle NULL pointers and empty pipelines before we do anything else
+	if(pipeline == NULL || pipeline->stages == NULL || pipeline->count == 0)
+		return false;
+
+	pipeline->output = NULL;
+	pipeline->output_len = 0;
+	for(i = 0; i < pipeline->count; i++)
+	{
+		pipeline->stages[i].pid = -1;
+		pipeline->stages[i].status = -1;
+	}
+
+	// Work out where the tail of the pipeline writes to, -1 means inherit our standard out
+	int tail_fd = -1;
+	int capture_fd = -1;
+	if(pipeline->outputfile != NULL)
+	{
+		tail_fd = open(pipeline->outputfile, O_WRONLY|O_TRUNC|O_CREAT|O_CLOEXEC, 0644);
+		if(tail_fd < 0)
+			return false;
+	}
+	else if(pipeline->capture)
+	{
+		int capture_pipe[2];
+		if(pipe2(capture_pipe, O_CLOEXEC) < 0)
+			return false;
+		capture_fd = capture_pipe[0];
+		tail_fd = capture_pipe[1];
+		if(pipeline->stages[pipeline->count - 1].pipe_size > 0)
+			fcntl(tail_fd, F_SETPIPE_SZ, pipeline->stages[pipeline->count - 1].pipe_size);
+	}
+
+	// in_fd is the read end feeding the stage we are about to start, -1 for the first stage
+	int in_fd = -1;
+	struct timespec spawned;
+	clock_gettime(CLOCK_MONOTONIC, &spawned);
+	for(i = 0; i < pipeline->count; i++)
+	{
+		struct pipeline_stage *stage = &pipeline->stages[i];
+		int link[2] = {-1, -1};
+		int out_fd = tail_fd;
+
+		// Every stage but the last writes into a fresh pipe read by the next stage.
+		// O_CLOEXEC keeps the other stages' pipe ends out of each child after execv.
+		if(i + 1 < pipeline->count)
+		{
+			if(pipe2(link, O_CLOEXEC) < 0)
+			{
+				success = false;
+				break;
+			}
+
+			// A larger pipe buffer is only a hint, keep going with the default if refused
+			if(stage->pipe_size > 0)
+				fcntl(link[1], F_SETPIPE_SZ, stage->pipe_size);
+
+			out_fd = link[1];
+		}
+
+		stage->pid = fork();
+
+		// If we see a processID of -1, the Fork Failed
+		if(stage->pid == -1)
+		{
+			if(link[0] >= 0)
+			{
+				close(link[0]);
+				close(link[1]);
+			}
+			success = false;
+			break;
+		}
+
+		// If we see a processID of 0, we are the child process, so lets wire up and execute the stage
+		if(stage->pid == 0)
+		{
+			if(in_fd >= 0 && dup2(in_fd, STDIN_FILENO) < 0)
+				_exit(127);
+			if(out_fd >= 0 && dup2(out_fd, STDOUT_FILENO) < 0)
+				_exit(127);
+
+			execv(stage->argv[0], stage->argv);
+
+			// Exit the process to indicate that execv failed
+			_exit(127);
+		}
+
+		// Parent, the child owns these ends now
+		if(in_fd >= 0)
+			close(in_fd);
+		if(link[1] >= 0)
+			close(link[1]);
+		in_fd = link[0];
+	}
+
+	// Close whatever the parent still holds so the readers see EOF
+	if(in_fd >= 0)
+		close(in_fd);
+	if(tail_fd >= 0)
+		close(tail_fd);
+
+	// Drain the captured output while the stages are still running, otherwise a full pipe would deadlock them
+	if(capture_fd >= 0)
+	{
+		if(!pipeline_capture(capture_fd, pipeline))
+			success = false;
+		close(capture_fd);
+	}
+
+	// Reap every stage that was started and report each status
+	for(i = 0; i < pipeline->count; i++)
+	{
+		struct pipeline_stage *stage = &pipeline->stages[i];
+		struct rusage usage;
+		struct timespec exited;
+		pid_t reaped;
+
+		if(stage->pid <= 0)
+			continue;
+
+		while((reaped = wait4(stage->pid, &stage->status, 0, &usage)) == -1 && errno == EINTR)
+			;
+		if(reaped == -1)
+		{
+			success = false;
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &exited);
+		exec_stats_record(stage->argv[0], &spawned, NULL, &exited, &usage, stage->status);
+
+		if(!(WIFEXITED(stage->status) && WEXITSTATUS(stage->status) == 0))
+			success = false;
+	}
+
+	return success;
 }
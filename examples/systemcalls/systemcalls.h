@@ -1,9 +1,283 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <sys/types.h>
 
 bool do_system(const char *command);
 
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+/**
+* Like do_exec_redirect(), but for deterministic commands: when the result cache has been
+* enabled with exec_cache_enable() (see execcache.h) and a previous successful run had the
+* same executable, arguments, allowlisted environment and input file contents, its output
+* is copied into outputfile without spawning anything.
+* @param inputs - NULL terminated list of files the command reads, NULL for none
+* All other parameters, see do_exec_redirect above
+*/
+bool do_exec_redirect_cached(const char *outputfile, const char * const inputs[], int count, ...);
+
+/**
+ * Standard input for do_exec_input() and do_exec_filter().  Set it up with one of
+ * exec_input_buffer(), exec_input_fd() or exec_input_alloc().
+ */
+struct exec_input
+{
+	/**
+	 * Buffer to feed, must not change until the command has exited
+	 */
+	const void *data;
+	size_t length;
+
+	/**
+	 * If >= 0, handed to the command as its standard input as is (data is ignored)
+	 */
+	int fd;
+
+	/**
+	 * memfd behind a buffer from exec_input_alloc(), -1 otherwise
+	 */
+	int memfd;
+
+	/**
+	 * If true always feed through a pipe with vmsplice(), even for large buffers
+	 */
+	bool stream;
+};
+
+/**
+ * Buffers of at least this many bytes are placed in a sealed memfd rather than a pipe
+ */
+#define EXEC_INPUT_MEMFD_THRESHOLD (64 * 1024)
+
+/**
+* Feed data/length to the command.  Small buffers (or stream set) are spliced into a pipe
+* with vmsplice(), larger ones are copied once into a sealed memfd the command reads directly.
+*/
+void exec_input_buffer(struct exec_input *input, const void *data, size_t length);
+
+/**
+* Hand fd to the command as its standard input (a file, pipe or socket), nothing is copied
+*/
+void exec_input_fd(struct exec_input *input, int fd);
+
+/**
+* Allocate a length byte buffer backed by a memfd, for callers that can produce their input
+* in place.  The memfd itself becomes the command's standard input, so nothing is copied.
+* The memfd is sealed against resizing and further writes on first use.
+* @return the buffer to fill, NULL on failure.  Release with exec_input_release().
+*/
+void *exec_input_alloc(struct exec_input *input, size_t length);
+
+/**
+* Release a buffer from exec_input_alloc()
+*/
+void exec_input_release(struct exec_input *input);
+
+/**
+* @param input - The command's standard input
+* @param outputfile - If non NULL, standard out goes to this file (truncated), else it is ours
+* All other parameters, see do_exec above
+* @return true if the command ran and exited with a zero status.  The command closing its
+*   standard input before reading everything is not an error.
+*/
+bool do_exec_input(const struct exec_input *input, const char *outputfile, int count, ...);
+
+/**
+* Filter style execution: feed input to the command and capture its standard out in memory.
+* @param output/output_len - Filled with a malloc'd buffer holding the output, the caller frees it
+* All other parameters, see do_exec_input above
+*/
+bool do_exec_filter(const struct exec_input *input, char **output, size_t *output_len, int count, ...);
+
+/**
+ * A command prepared once and run many times with do_exec_prepared()
+ */
+struct prepared_command;
+
+/**
+* Open the executable, build the argument and environment vectors and open the output
+* file once, for commands run thousands of times in a loop.
+* @param argc - Number of entries in argv
+* @param argv - Argument template, argv[0] is the full path to the command.  NULL entries
+*   are variable slots filled in on every do_exec_prepared() call.  The strings are not
+*   copied and must outlive the prepared command.  The environment is copied, later changes
+*   to it do not reach the prepared command.
+* @param outputfile - If non NULL, standard out goes to this file, truncated before every run
+* @return the prepared command, NULL if the executable or output file could not be opened
+*/
+struct prepared_command *prepared_command_create(int argc, char * const argv[], const char *outputfile);
+
+/**
+* Run a prepared command.  A prepared command must not be run from two threads at once.
+* @param prepared - From prepared_command_create()
+* @param ... - One char * for every NULL slot in the argv template, in order
+* @return true if the command ran and exited with a zero status, false otherwise
+*/
+bool do_exec_prepared(struct prepared_command *prepared, ...);
+
+/**
+* Close and free a prepared command, NULL is ignored
+*/
+void prepared_command_free(struct prepared_command *prepared);
+
+/**
+ * Which of the command's outputs a do_exec_stream() callback is receiving
+ */
+enum exec_stream_channel
+{
+	EXEC_STREAM_STDOUT,
+	EXEC_STREAM_STDERR
+};
+
+/**
+ * Receives output from do_exec_stream().  data points into a buffer that is reused after
+ * the callback returns and is not NUL terminated.  Return false to stop streaming, the
+ * command's pipes are then closed (it sees EPIPE/SIGPIPE on its next write) and reaped.
+ */
+typedef bool (*exec_stream_callback)(enum exec_stream_channel channel, const char *data, size_t length, void *context);
+
+/**
+ * Options for do_exec_stream()
+ */
+struct exec_stream
+{
+	/**
+	 * Called for every chunk or line, with context passed through
+	 */
+	exec_stream_callback callback;
+	void *context;
+
+	/**
+	 * Size of the buffer kept per channel, 0 for 64kB.  In chunk mode this is the largest
+	 * chunk delivered, in line mode a longer line is delivered in buffer sized pieces.
+	 */
+	size_t buffer_size;
+
+	/**
+	 * If true deliver one line at a time (without its newline), else whatever each read returns
+	 */
+	bool lines;
+
+	/**
+	 * If true standard error is delivered on EXEC_STREAM_STDERR, else the command shares ours
+	 */
+	bool capture_stderr;
+};
+
+/**
+* Run a command and hand its output to a callback while it is produced.  Memory use is two
+* fixed buffers regardless of how much the command writes.  The callback runs on the calling
+* thread and nothing is read while it runs, so a slow consumer fills the pipe and the command
+* blocks in write() until the consumer catches up.
+* @param stream - The callback and framing options
+* All other parameters, see do_exec above
+* @return true if the command ran, exited with a zero status and the callback never stopped it
+*/
+bool do_exec_stream(const struct exec_stream *stream, int count, ...);
+
+/**
+ * Outcome of a command run with a deadline
+ */
+enum exec_result
+{
+	/**
+	 * The command exited with a zero status
+	 */
+	EXEC_RESULT_SUCCESS,
+
+	/**
+	 * The command exited with a non-zero status or was killed by a signal before the deadline
+	 */
+	EXEC_RESULT_FAILED,
+
+	/**
+	 * The command could not be started or waited for
+	 */
+	EXEC_RESULT_ERROR,
+
+	/**
+	 * The deadline passed and the command's process group was terminated
+	 */
+	EXEC_RESULT_TIMEOUT
+};
+
+/**
+* @param timeout_ms - How long the command may run, -1 to wait forever.  The command runs in its
+*   own process group; at the deadline the group is sent SIGTERM, then SIGKILL after grace_ms.
+* @param grace_ms - Time between SIGTERM and SIGKILL
+* All other parameters, see do_exec above
+* @return see enum exec_result, a timeout is reported as EXEC_RESULT_TIMEOUT
+*/
+enum exec_result do_exec_timeout(int timeout_ms, int grace_ms, int count, ...);
+
+/**
+* @param outputfile - The full path to the file to write with command output
+* All other parameters, see do_exec_timeout above
+*/
+enum exec_result do_exec_redirect_timeout(const char *outputfile, int timeout_ms, int grace_ms, int count, ...);
+
+/**
+ * A single stage of a pipeline executed by do_exec_pipeline().
+ */
+struct pipeline_stage
+{
+	/**
+	 * NULL terminated argument vector, argv[0] is the full path to the command
+	 */
+	char * const *argv;
+
+	/**
+	 * If non zero, the size in bytes requested with F_SETPIPE_SZ for the pipe
+	 * carrying this stage's standard out.  Useful for data heavy stages.
+	 */
+	int pipe_size;
+
+	/**
+	 * Process ID of the stage, filled in by do_exec_pipeline(), -1 if never started
+	 */
+	pid_t pid;
+
+	/**
+	 * Raw waitpid() status of the stage, filled in by do_exec_pipeline()
+	 */
+	int status;
+};
+
+/**
+ * Describes a pipeline of the form cmd1 | cmd2 | ... | cmdN [> outputfile]
+ */
+struct pipeline
+{
+	/**
+	 * Array of count stages, stage i's standard out feeds stage i+1's standard in
+	 */
+	struct pipeline_stage *stages;
+	size_t count;
+
+	/**
+	 * If non NULL, the standard out of the last stage is redirected to this file
+	 */
+	const char *outputfile;
+
+	/**
+	 * If true (and outputfile is NULL), the standard out of the last stage is
+	 * captured into a malloc'd buffer returned in output/output_len.  The caller
+	 * must free() output.
+	 */
+	bool capture;
+	char *output;
+	size_t output_len;
+};
+
+/**
+* @param pipeline - The pipeline to execute.  All stages are started concurrently and
+*   connected with pipes, without invoking a shell.
+* @return true if every stage was started and exited with a zero status, false if an
+*   error occurred or any stage failed.  The status of each stage is reported in
+*   pipeline->stages[i].status either way.
+*/
+bool do_exec_pipeline(struct pipeline *pipeline);
@@ -0,0 +1,73 @@
+#!/bin/sh
+# Tester script for the native finder
+# Builds a fixture tree with the cases where finder has to count like grep and checks that
+# finder prints the same numbers as the grep -r pipelines finder.sh used to run.
+#
+# Usage: finder-compare-test.sh [finder]
+
+set -e
+set -u
+
+SEARCHSTR=AELD_IS_FUN
+TESTDIR=/tmp/aeld-finder-compare
+
+# Use the finder given, else the one next to this script, else the one on the PATH
+if [ $# -ge 1 ]
+then
+	FINDER=$1
+else
+	FINDER=$(dirname "$0")/finder
+	if [ ! -x "$FINDER" ]
+	then
+		FINDER=$(command -v finder)
+	fi
+fi
+
+rm -rf "${TESTDIR}"
+mkdir -p "${TESTDIR}/tree/a/b/c" "${TESTDIR}/tree/empty" "${TESTDIR}/outside"
+
+# Nested directories, with several matches on some lines and none in some files
+printf '%s\nnothing here\n%s twice %s\n' "${SEARCHSTR}" "${SEARCHSTR}" "${SEARCHSTR}" > "${TESTDIR}/tree/top.txt"
+printf '%s\n' "${SEARCHSTR}" > "${TESTDIR}/tree/a/one.txt"
+printf 'no match\n' > "${TESTDIR}/tree/a/b/none.txt"
+printf 'first\n%s\n' "${SEARCHSTR}" > "${TESTDIR}/tree/a/b/c/deep.txt"
+printf '%s\n' "${SEARCHSTR}" > "${TESTDIR}/tree/a/.hidden"
+
+# The last line has no newline and still counts
+printf 'first\nlast %s' "${SEARCHSTR}" > "${TESTDIR}/tree/a/b/no-newline.txt"
+
+# An empty file
+: > "${TESTDIR}/tree/empty/empty.txt"
+
+# A binary file with a match, and one without
+printf 'bin\000ary %s\n%s\n' "${SEARCHSTR}" "${SEARCHSTR}" > "${TESTDIR}/tree/a/binary.bin"
+printf 'bin\000ary\n' > "${TESTDIR}/tree/a/b/other.bin"
+
+# Symbolic links to a file and to a directory outside the tree, neither is followed
+printf '%s\n' "${SEARCHSTR}" > "${TESTDIR}/outside/linked.txt"
+ln -s "${TESTDIR}/outside/linked.txt" "${TESTDIR}/tree/a/link.txt"
+ln -s "${TESTDIR}/outside" "${TESTDIR}/tree/a/b/linkdir"
+
+# What finder.sh printed with its grep pipelines, GNU grep 3.5 and later report binary matches on stderr
+NUMFILES=$(grep -r -l "${SEARCHSTR}" "${TESTDIR}/tree" | wc -l)
+NUMMATCH=$(grep -r "${SEARCHSTR}" "${TESTDIR}/tree" 2>/dev/null | wc -l)
+MATCHSTR="The number of files are ${NUMFILES} and the number of matching lines are ${NUMMATCH}"
+
+set +e
+for THREADS in 1 4
+do
+	OUTPUTSTRING=$("${FINDER}" -j ${THREADS} "${TESTDIR}/tree" "${SEARCHSTR}")
+	if [ "${OUTPUTSTRING}" != "${MATCHSTR}" ]
+	then
+		echo "failed: expected ${MATCHSTR} with ${THREADS} threads but instead found ${OUTPUTSTRING}"
+		rm -rf "${TESTDIR}"
+		exit 1
+	fi
+done
+
+# remove temporary directories
+rm -rf "${TESTDIR}"
+
+echo "${MATCHSTR}"
+echo "success"
+exit 0
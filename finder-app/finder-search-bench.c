@@ -0,0 +1,266 @@
+// This is a C File for a benchmark of the Finder search kernels, see findersearch.h
+//
+// Counts the lines containing a needle in a text file held in memory with every kernel
+// this CPU supports, with a loop splitting every line and searching it on its own, and
+// with grep -F -c on the same file, and prints the throughput of each.  Without a file
+// one is generated: lines of random words with the needle in about one line in a hundred.
+//
+// Usage: finder-search-bench [-s megabytes] [-n needle] [-r repeats] [file]
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "findersearch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+static double now_s(void);
+static char *generate(size_t size, const char *needle, size_t *length);
+static char *load(const char *path, size_t *length);
+static unsigned long count_split(const char *needle, const char *data, size_t length);
+static unsigned long count_grep(const char *needle, const char *path);
+static void report(const char *name, double seconds, size_t length, unsigned long lines);
+
+//--------------------------------------MAIN--------------------------------------
+
+int main(int argc, char *argv[])
+{
+	size_t megabytes = 256;
+	const char *needle = "AELD_IS_FUN";
+	int repeats = 5;
+	int opt;
+
+	while((opt = getopt(argc, argv, "s:n:r:")) != -1)
+	{
+		switch(opt)
+		{
+			case 's':
+				megabytes = strtoul(optarg, NULL, 10);
+				break;
+			case 'n':
+				needle = optarg;
+				break;
+			case 'r':
+				repeats = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-s megabytes] [-n needle] [-r repeats] [file]\n", argv[0]);
+				return 1;
+		}
+	}
+	if(repeats < 1)
+		repeats = 1;
+
+	// grep needs the text in a file, a generated one goes to a scratch file
+	char scratch[] = "/tmp/finder-search-bench.XXXXXX";
+	const char *path = optind < argc ? argv[optind] : NULL;
+	size_t length;
+	char *data;
+	if(path != NULL)
+		data = load(path, &length);
+	else
+	{
+		data = generate(megabytes * 1024 * 1024, needle, &length);
+		int fd = mkstemp(scratch);
+		if(data == NULL || fd < 0 || write(fd, data, length) != (ssize_t)length)
+		{
+			perror(scratch);
+			return 1;
+		}
+		close(fd);
+		path = scratch;
+	}
+	if(data == NULL)
+	{
+		perror(path);
+		return 1;
+	}
+
+	printf("%zu bytes, needle \"%s\", best of %d\n", length, needle, repeats);
+
+	const char *kernel;
+	size_t index;
+	for(index = 0; (kernel = finder_search_kernel(index)) != NULL; index++)
+	{
+		struct finder_search search;
+		finder_search_init(&search, needle, strlen(needle), kernel);
+
+		double best = 0;
+		unsigned long lines = 0;
+		int i;
+		for(i = 0; i < repeats; i++)
+		{
+			double start = now_s();
+			lines = finder_search_count_lines(&search, data, length);
+			double elapsed = now_s() - start;
+			if(i == 0 || elapsed < best)
+				best = elapsed;
+		}
+		report(kernel, best, length, lines);
+	}
+
+	double best = 0;
+	unsigned long lines = 0;
+	int i;
+	for(i = 0; i < repeats; i++)
+	{
+		double start = now_s();
+		lines = count_split(needle, data, length);
+		double elapsed = now_s() - start;
+		if(i == 0 || elapsed < best)
+			best = elapsed;
+	}
+	report("per line", best, length, lines);
+
+	// grep reads the file from the page cache, the first run warms it
+	for(i = 0; i < repeats; i++)
+	{
+		double start = now_s();
+		lines = count_grep(needle, path);
+		double elapsed = now_s() - start;
+		if(i == 0 || elapsed < best)
+			best = elapsed;
+	}
+	report("grep -F", best, length, lines);
+
+	if(path == scratch)
+		unlink(scratch);
+	free(data);
+	return 0;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static double now_s(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief - Lines of 3 to 15 lower case words, every hundredth or so holding the needle
+ */
+static char *generate(size_t size, const char *needle, size_t *length)
+{
+	char *data = malloc(size + 256);
+	if(data == NULL)
+		return NULL;
+
+	size_t used = 0;
+	unsigned int seed = 1;
+	while(used < size)
+	{
+		int words = 3 + rand_r(&seed) % 13;
+		int needle_at = rand_r(&seed) % 100 == 0 ? rand_r(&seed) % words : -1;
+		int w;
+		for(w = 0; w < words; w++)
+		{
+			if(w == needle_at)
+				used += sprintf(data + used, "%s ", needle);
+			else
+			{
+				int letters = 2 + rand_r(&seed) % 9;
+				while(letters-- > 0)
+					data[used++] = 'a' + rand_r(&seed) % 26;
+				data[used++] = ' ';
+			}
+		}
+		data[used - 1] = '\n';
+	}
+	*length = used;
+	return data;
+}
+
+static char *load(const char *path, size_t *length)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0 || fstat(fd, &st) < 0)
+		return NULL;
+
+	char *data = malloc(st.st_size + 1);
+	size_t done = 0;
+	while(data != NULL && done < (size_t)st.st_size)
+	{
+		ssize_t got = read(fd, data + done, st.st_size - done);
+		if(got <= 0)
+			break;
+		done += got;
+	}
+	close(fd);
+	*length = done;
+	return data;
+}
+
+/**
+ * @brief - What the kernels avoid: split every line out, then search it
+ */
+static unsigned long count_split(const char *needle, const char *data, size_t length)
+{
+	const char *end = data + length;
+	size_t needle_length = strlen(needle);
+	unsigned long lines = 0;
+
+	while(data < end)
+	{
+		const char *newline = memchr(data, '\n', end - data);
+		const char *line_end = newline != NULL ? newline : end;
+		if(memmem(data, line_end - data, needle, needle_length) != NULL)
+			lines++;
+		data = line_end + 1;
+	}
+	return lines;
+}
+
+static unsigned long count_grep(const char *needle, const char *path)
+{
+	unsigned long lines = 0;
+	int link[2];
+
+	// grep is run without a shell, so a needle or file name may hold anything
+	if(pipe2(link, O_CLOEXEC) < 0)
+		return 0;
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		char *argv[] = { "grep", "-F", "-c", "--", (char *)needle, (char *)path, NULL };
+		if(dup2(link[1], STDOUT_FILENO) < 0 || setenv("LC_ALL", "C", 1) < 0)
+			_exit(127);
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	close(link[1]);
+	if(pid < 0)
+	{
+		close(link[0]);
+		return 0;
+	}
+
+	FILE *grep = fdopen(link[0], "r");
+	if(grep == NULL || fscanf(grep, "%lu", &lines) != 1)
+		lines = 0;
+	if(grep != NULL)
+		fclose(grep);
+	else
+		close(link[0]);
+	while(waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+		;
+	return lines;
+}
+
+static void report(const char *name, double seconds, size_t length, unsigned long lines)
+{
+	printf("%-10s %8.2f ms %8.2f GB/s %10lu lines\n", name, seconds * 1e3, seconds > 0 ? length / seconds / 1e9 : 0.0, lines);
+}
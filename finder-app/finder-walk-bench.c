@@ -0,0 +1,172 @@
+// This is a C File for a benchmark of the Finder directory traversal, see finderwalk.h
+//
+// Walks a tree with finder_walk() and a callback that does nothing, with 1, 2, 4 and so on
+// up to the given number of threads, after a walk with opendir() and readdir() on one
+// thread like the finder used to, and prints the entries per second of each.  With -d the
+// page, dentry and inode caches are dropped before every walk, which needs root, to see
+// how the threads do when the walk waits on the disk.
+//
+// Usage: finder-walk-bench [-j threads] [-d] directory
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "finderwalk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+static double now_s(void);
+static void drop_caches(void);
+static void count_file(void *context, int dirfd, const char *name, const char *dir, size_t length);
+static unsigned long walk_readdir(char *path, size_t length);
+
+//--------------------------------------MAIN--------------------------------------
+
+int main(int argc, char *argv[])
+{
+	unsigned int max_threads = sysconf(_SC_NPROCESSORS_ONLN) * 2;
+	bool drop = false;
+	int opt;
+
+	while((opt = getopt(argc, argv, "j:d")) != -1)
+	{
+		switch(opt)
+		{
+			case 'j':
+				max_threads = atoi(optarg);
+				break;
+			case 'd':
+				drop = true;
+				break;
+			default:
+				goto usage;
+		}
+	}
+	if(argc - optind != 1)
+		goto usage;
+	if(max_threads < 1)
+		max_threads = 1;
+
+	char path[PATH_MAX];
+	size_t length = strlen(argv[optind]);
+	if(length >= sizeof(path))
+		return 1;
+	memcpy(path, argv[optind], length + 1);
+
+	if(drop)
+		drop_caches();
+	double start = now_s();
+	unsigned long entries = walk_readdir(path, length);
+	double elapsed = now_s() - start;
+	printf("readdir    %2u threads %8.3f s %10lu entries %10.0f entries/s\n", 1, elapsed, entries, entries / elapsed);
+
+	unsigned long *files = calloc(max_threads, sizeof(*files));
+	void **contexts = calloc(max_threads, sizeof(*contexts));
+	if(files == NULL || contexts == NULL)
+		return 1;
+	unsigned int i, threads;
+	for(i = 0; i < max_threads; i++)
+		contexts[i] = &files[i];
+
+	for(threads = 1;; threads *= 2)
+	{
+		struct finder_walk_stats stats;
+		if(threads > max_threads)
+			threads = max_threads;
+		if(drop)
+			drop_caches();
+		start = now_s();
+		if(finder_walk(path, threads, count_file, contexts, &stats) != 0)
+		{
+			perror(path);
+			return 1;
+		}
+		elapsed = now_s() - start;
+		printf("getdents64 %2u threads %8.3f s %10lu entries %10.0f entries/s\n", threads, elapsed, stats.entries,
+				stats.entries / elapsed);
+		if(threads == max_threads)
+			break;
+	}
+
+	free(files);
+	free(contexts);
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-j threads] [-d] directory\n", argv[0]);
+	return 1;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static double now_s(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void drop_caches(void)
+{
+	sync();
+	int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+	if(fd < 0 || write(fd, "3", 1) != 1)
+		perror("/proc/sys/vm/drop_caches");
+	if(fd >= 0)
+		close(fd);
+}
+
+static void count_file(void *context, int dirfd, const char *name, const char *dir, size_t length)
+{
+	(void)dirfd;
+	(void)name;
+	(void)dir;
+	(void)length;
+	(*(unsigned long *)context)++;
+}
+
+/**
+ * @brief - The walk finder did before finderwalk.c, entries below the directory path
+ */
+static unsigned long walk_readdir(char *path, size_t length)
+{
+	DIR *dir = opendir(path);
+	if(dir == NULL)
+		return 0;
+
+	unsigned long entries = 0;
+	struct dirent *entry;
+	while((entry = readdir(dir)) != NULL)
+	{
+		if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		entries++;
+
+		size_t name_length = strlen(entry->d_name);
+		if(length + 1 + name_length + 1 > PATH_MAX)
+			continue;
+		path[length] = '/';
+		memcpy(path + length + 1, entry->d_name, name_length + 1);
+
+		unsigned char type = entry->d_type;
+		struct stat st;
+		if(type == DT_UNKNOWN && lstat(path, &st) == 0)
+			type = S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN;
+		if(type == DT_DIR)
+			entries += walk_readdir(path, length + 1 + name_length);
+	}
+	path[length] = '\0';
+	closedir(dir);
+	return entries;
+}
@@ -1 +1,250 @@
 // This is a C File for the Finder Implementation
+//
+// Takes two arguments
+// Argument 1 - filesdir - specifies a directory to search, recursively
+// Argument 2 - searchstr - specifies a text string to search for in the files of filesdir
+// Prints "The number of files are X and the number of matching lines are Y", X being the
+// files containing searchstr and Y the lines containing it, the counts finder.sh gets from
+// grep -r -l and grep -r.  Exits with 1 and an error message on bad arguments, and like
+// grep with 2 once the counts are printed if part of the tree could not be searched.
+//
+// One pass over the tree instead of grep's two: a pool of threads walks filesdir with the
+// work stealing traversal of finderwalk.h, each scanning the regular files it comes across
+// into counters of its own that are added up once at the end.  searchstr is a fixed
+// string, not a regular expression, finder.sh only hands plain strings over, and is
+// searched for with the SIMD kernels of findersearch.h.  Like grep, symbolic links found
+// inside the tree are not followed, and a file with a NUL byte in its first block is
+// binary: it counts as a matching file but adds no lines, GNU grep reports it on stderr
+// rather than printing them.  With -v the walk's throughput is reported on stderr.
+//
+// Usage: finder [-j threads] [-v] filesdir searchstr
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "findersearch.h"
+#include "finderwalk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Most threads walking and scanning by default, more only help on cold caches
+#define FINDER_MAX_THREADS 8
+
+// Initial size of each scanner's read buffer, it grows to hold the longest line
+#define FINDER_READ_SIZE (256 * 1024)
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * @brief - Counts of one scanner, a cache line each so scanners never share one
+ */
+struct finder_counts
+{
+	unsigned long files;
+	unsigned long lines;
+	unsigned long errors;
+} __attribute__((aligned(64)));
+
+struct finder_scanner
+{
+	struct finder_counts counts;
+	char *buffer;
+	size_t size;
+};
+
+static struct finder_search search;
+
+static void scan_file(void *context, int dirfd, const char *name, const char *dir, size_t length);
+
+//--------------------------------------MAIN--------------------------------------
+
+int main(int argc, char *argv[])
+{
+	long threads = 0;
+	bool verbose = false;
+	int opt;
+
+	while((opt = getopt(argc, argv, "j:v")) != -1)
+	{
+		switch(opt)
+		{
+			case 'j':
+				threads = atol(optarg);
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			default:
+				goto usage;
+		}
+	}
+	if(argc - optind != 2)
+		goto usage;
+
+	struct stat st;
+	if(stat(argv[optind], &st) != 0 || !S_ISDIR(st.st_mode))
+	{
+		fprintf(stderr, "Invalid directory provided for fileDir.\n%s is not a directory.\n", argv[optind]);
+		return 1;
+	}
+
+	const char *needle = argv[optind + 1];
+	if(strchr(needle, '\n') != NULL)
+	{
+		fprintf(stderr, "searchStr must be a single line\n");
+		return 1;
+	}
+	finder_search_init(&search, needle, strlen(needle), NULL);
+
+	// One thread per CPU by default, each walks and scans
+	if(threads <= 0)
+	{
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if(threads > FINDER_MAX_THREADS)
+			threads = FINDER_MAX_THREADS;
+		if(threads < 1)
+			threads = 1;
+	}
+
+	struct finder_scanner *scanners = calloc(threads, sizeof(*scanners));
+	void **contexts = calloc(threads, sizeof(*contexts));
+	if(scanners == NULL || contexts == NULL)
+		return 1;
+	long i;
+	for(i = 0; i < threads; i++)
+	{
+		scanners[i].size = FINDER_READ_SIZE;
+		scanners[i].buffer = malloc(scanners[i].size);
+		if(scanners[i].buffer == NULL)
+			return 1;
+		contexts[i] = &scanners[i];
+	}
+
+	struct finder_walk_stats stats;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if(finder_walk(argv[optind], threads, scan_file, contexts, &stats) != 0)
+	{
+		fprintf(stderr, "finder: %s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	// Each scanner counted on its own, the totals are added up once they are all done
+	struct finder_counts total = { 0, 0, stats.errors };
+	for(i = 0; i < threads; i++)
+	{
+		total.files += scanners[i].counts.files;
+		total.lines += scanners[i].counts.lines;
+		total.errors += scanners[i].counts.errors;
+		free(scanners[i].buffer);
+	}
+	free(scanners);
+	free(contexts);
+
+	if(verbose)
+	{
+		double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		fprintf(stderr, "finder: %lu directories, %lu entries in %.3f s with %ld threads, %.0f entries/s\n",
+				stats.directories, stats.entries, seconds, threads, seconds > 0 ? stats.entries / seconds : 0.0);
+	}
+
+	printf("The number of files are %lu and the number of matching lines are %lu\n", total.files, total.lines);
+
+	// The counts leave out whatever could not be read, the caller has to know they are short
+	return total.errors > 0 ? 2 : 0;
+
+usage:
+	fprintf(stderr, "Invalid number of arguments.\nThis program accepts two arguments.\n"
+			"filesDir - The directory to search.\nsearchStr - The string to find at the specified directoy.\n"
+			"Usage: %s [-j threads] [-v] filesDir searchStr\n", argv[0]);
+	return 1;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+/**
+ * @brief - Count the matching lines of one file into the counters of the scanner context,
+ *          called by finder_walk() for every regular file
+ */
+static void scan_file(void *context, int dirfd, const char *name, const char *dir, size_t length)
+{
+	struct finder_scanner *scanner = context;
+
+	int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NOFOLLOW);
+	if(fd < 0)
+	{
+		fprintf(stderr, "finder: %.*s/%s: %s\n", (int)length, dir, name, strerror(errno));
+		scanner->counts.errors++;
+		return;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	unsigned long lines = 0;
+	size_t used = 0;
+	bool first = true, binary = false;
+	for(;;)
+	{
+		// Only whole lines are counted, a line longer than the buffer grows it
+		if(used == scanner->size)
+		{
+			char *grown = realloc(scanner->buffer, scanner->size * 2);
+			if(grown == NULL)
+				break;
+			scanner->buffer = grown;
+			scanner->size *= 2;
+		}
+
+		ssize_t got = read(fd, scanner->buffer + used, scanner->size - used);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got < 0)
+		{
+			fprintf(stderr, "finder: %.*s/%s: %s\n", (int)length, dir, name, strerror(errno));
+			scanner->counts.errors++;
+			break;
+		}
+		if(got == 0)
+		{
+			// The last line does not need a newline to count
+			if(used > 0)
+				lines += finder_search_count_lines(&search, scanner->buffer, used);
+			break;
+		}
+
+		if(first)
+			binary = memchr(scanner->buffer, '\0', got) != NULL;
+		first = false;
+		used += got;
+
+		char *last = memrchr(scanner->buffer, '\n', used);
+		if(last == NULL)
+			continue;
+		size_t complete = last - scanner->buffer + 1;
+		lines += finder_search_count_lines(&search, scanner->buffer, complete);
+
+		// A binary file only needs one match to be counted, no need to read on
+		if(binary && lines > 0)
+			break;
+
+		memmove(scanner->buffer, scanner->buffer + complete, used - complete);
+		used -= complete;
+	}
+	close(fd);
+
+	if(lines > 0)
+	{
+		scanner->counts.files++;
+		scanner->counts.lines += binary ? 0 : lines;
+	}
+}
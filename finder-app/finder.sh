@@ -29,6 +29,26 @@ fi
 
 # Now that we know we have the proper number of arguments and we know the directory exists, we can move on
 
+# Use the native finder next to this script or on the PATH if there is one, it gets both counts in one pass
+FINDER=$(dirname "$0")/finder
+if [ ! -x "$FINDER" ]
+then
+	FINDER=$(command -v finder)
+fi
+
+# It searches for a fixed string, anything grep would read as a regular expression stays with grep
+case "$2" in
+	*[].[*^\$\\]* | *"
+"*)
+		FINDER=
+		;;
+esac
+
+if [ -n "$FINDER" ]
+then
+	exec "$FINDER" "$1" "$2"
+fi
+
 # Determine the number of files that contain searchstr in the filesdir
 # Pipe the name of all files in $1 which contain $2 to wc which will count the number of files provided 
 NUMFILES=$(grep -r -l "$2" "$1"* | wc -l)
@@ -0,0 +1,226 @@
+// This is a C File for the Finder fixed string search, see findersearch.h
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "findersearch.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * @brief - A kernel and whether this CPU can run it
+ */
+struct search_kernel
+{
+	const char *name;
+	finder_search_fn find;
+	bool (*supported)(void);
+};
+
+static const char *find_memmem(const struct finder_search *search, const char *data, size_t length);
+static bool always(void);
+
+#if defined(__x86_64__)
+static const char *find_avx2(const struct finder_search *search, const char *data, size_t length);
+static const char *find_sse2(const struct finder_search *search, const char *data, size_t length);
+static bool has_avx2(void);
+#elif defined(__aarch64__)
+static const char *find_neon(const struct finder_search *search, const char *data, size_t length);
+static bool has_asimd(void);
+#endif
+
+// Fastest first, the first one supported is the default
+static const struct search_kernel kernels[] = {
+#if defined(__x86_64__)
+	{ "avx2", find_avx2, has_avx2 },
+	{ "sse2", find_sse2, always },
+#elif defined(__aarch64__)
+	{ "neon", find_neon, has_asimd },
+#endif
+	{ "memmem", find_memmem, always },
+};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+bool finder_search_init(struct finder_search *search, const char *needle, size_t length, const char *kernel)
+{
+	size_t i;
+
+	search->needle = needle;
+	search->length = length;
+	for(i = 0; i < KERNEL_COUNT; i++)
+	{
+		if((kernel == NULL || strcmp(kernel, kernels[i].name) == 0) && kernels[i].supported())
+		{
+			search->find = kernels[i].find;
+			search->kernel = kernels[i].name;
+
+			// Nothing to prefilter with fewer than two bytes, the C library's memchr() is as good as it gets
+			if(length < 2)
+			{
+				search->find = find_memmem;
+				search->kernel = "memmem";
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *finder_search_kernel(size_t index)
+{
+	size_t i;
+
+	for(i = 0; i < KERNEL_COUNT; i++)
+	{
+		if(kernels[i].supported() && index-- == 0)
+			return kernels[i].name;
+	}
+	return NULL;
+}
+
+unsigned long finder_search_count_lines(const struct finder_search *search, const char *data, size_t length)
+{
+	const char *end = data + length;
+	unsigned long lines = 0;
+
+	while(data < end)
+	{
+		const char *match = search->find(search, data, end - data);
+		if(match == NULL)
+			break;
+		lines++;
+		const char *newline = memchr(match, '\n', end - match);
+		if(newline == NULL)
+			break;
+		data = newline + 1;
+	}
+	return lines;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static const char *find_memmem(const struct finder_search *search, const char *data, size_t length)
+{
+	if(search->length == 1)
+		return memchr(data, search->needle[0], length);
+	return memmem(data, length, search->needle, search->length);
+}
+
+static bool always(void)
+{
+	return true;
+}
+
+#if defined(__x86_64__)
+
+static bool has_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+/**
+ * @brief - 32 positions a step: where the needle's first byte and last byte both agree,
+ *          memcmp() the bytes in between.  The tail shorter than a step goes to memmem().
+ */
+__attribute__((target("avx2")))
+static const char *find_avx2(const struct finder_search *search, const char *data, size_t length)
+{
+	const size_t n = search->length;
+	const __m256i first = _mm256_set1_epi8(search->needle[0]);
+	const __m256i last = _mm256_set1_epi8(search->needle[n - 1]);
+	size_t i = 0;
+
+	for(; length >= n - 1 + 32 && i <= length - (n - 1) - 32; i += 32)
+	{
+		__m256i first_block = _mm256_loadu_si256((const __m256i *)(data + i));
+		__m256i last_block = _mm256_loadu_si256((const __m256i *)(data + i + n - 1));
+		uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, first_block),
+				_mm256_cmpeq_epi8(last, last_block)));
+		while(mask != 0)
+		{
+			unsigned int bit = __builtin_ctz(mask);
+			if(memcmp(data + i + bit + 1, search->needle + 1, n - 2) == 0)
+				return data + i + bit;
+			mask &= mask - 1;
+		}
+	}
+	return find_memmem(search, data + i, length - i);
+}
+
+/**
+ * @brief - find_avx2() 16 positions a step, SSE2 is part of every x86_64
+ */
+static const char *find_sse2(const struct finder_search *search, const char *data, size_t length)
+{
+	const size_t n = search->length;
+	const __m128i first = _mm_set1_epi8(search->needle[0]);
+	const __m128i last = _mm_set1_epi8(search->needle[n - 1]);
+	size_t i = 0;
+
+	for(; length >= n - 1 + 16 && i <= length - (n - 1) - 16; i += 16)
+	{
+		__m128i first_block = _mm_loadu_si128((const __m128i *)(data + i));
+		__m128i last_block = _mm_loadu_si128((const __m128i *)(data + i + n - 1));
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, first_block),
+				_mm_cmpeq_epi8(last, last_block)));
+		while(mask != 0)
+		{
+			unsigned int bit = __builtin_ctz(mask);
+			if(memcmp(data + i + bit + 1, search->needle + 1, n - 2) == 0)
+				return data + i + bit;
+			mask &= mask - 1;
+		}
+	}
+	return find_memmem(search, data + i, length - i);
+}
+
+#elif defined(__aarch64__)
+
+static bool has_asimd(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_ASIMD) != 0;
+}
+
+/**
+ * @brief - find_avx2() 16 positions a step.  NEON has no movemask, narrowing each 16 bit lane
+ *          by 4 leaves a 64 bit mask with 4 bits per position instead.
+ */
+static const char *find_neon(const struct finder_search *search, const char *data, size_t length)
+{
+	const size_t n = search->length;
+	const uint8x16_t first = vdupq_n_u8(search->needle[0]);
+	const uint8x16_t last = vdupq_n_u8(search->needle[n - 1]);
+	size_t i = 0;
+
+	for(; length >= n - 1 + 16 && i <= length - (n - 1) - 16; i += 16)
+	{
+		uint8x16_t first_block = vld1q_u8((const uint8_t *)data + i);
+		uint8x16_t last_block = vld1q_u8((const uint8_t *)data + i + n - 1);
+		uint8x16_t both = vandq_u8(vceqq_u8(first, first_block), vceqq_u8(last, last_block));
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(both), 4)), 0);
+		while(mask != 0)
+		{
+			unsigned int bit = __builtin_ctzll(mask) >> 2;
+			if(memcmp(data + i + bit + 1, search->needle + 1, n - 2) == 0)
+				return data + i + bit;
+			mask &= ~(0xfull << (bit * 4));
+		}
+	}
+	return find_memmem(search, data + i, length - i);
+}
+
+#endif
@@ -0,0 +1,72 @@
+// Fixed string search for the Finder
+//
+// Finds a needle in a buffer with a SIMD prefilter: the needle's first and last bytes
+// are compared against 16 (SSE2, NEON) or 32 (AVX2) positions of the buffer at once, and
+// only positions where both agree are checked with memcmp().  That skips most of the
+// buffer at a few instructions per block, also for needles whose first byte is common.
+// The kernel is picked at runtime from what the CPU supports: AVX2 then SSE2 on x86_64,
+// NEON (ASIMD) on aarch64, memmem() anywhere else.
+//
+// Matching lines are counted by finding a match first and only then the end of its line
+// with memchr(), itself vectorised by the C library, and carrying on from there.  Lines
+// without a match are never looked at one by one.
+//
+
+#ifndef FINDERSEARCH_H
+#define FINDERSEARCH_H
+
+//------------------------------------INCLUDES------------------------------------
+#include <stdbool.h>
+#include <stddef.h>
+
+//------------------------------PUBLIC DECLARATIONS-------------------------------
+
+struct finder_search;
+
+/**
+ * @brief - A kernel, returns the first match of the needle in data or NULL
+ */
+typedef const char *(*finder_search_fn)(const struct finder_search *search, const char *data, size_t length);
+
+/**
+ * @brief - A needle ready to be searched for, see finder_search_init()
+ */
+struct finder_search
+{
+	const char *needle;
+	size_t length;
+
+	finder_search_fn find;
+
+	// Name of the kernel in use
+	const char *kernel;
+};
+
+/**
+ * @brief - Prepare a search for needle, it must stay valid as long as the search is used
+ * @param - kernel - Name of the kernel to use, NULL for the fastest this CPU supports
+ * @return - true for Success, false if the kernel is unknown or not supported here
+ */
+bool finder_search_init(struct finder_search *search, const char *needle, size_t length, const char *kernel);
+
+/**
+ * @brief - Name of the index'th kernel this CPU supports, fastest first
+ * @return - The name, NULL past the last one
+ */
+const char *finder_search_kernel(size_t index);
+
+/**
+ * @brief - First match of the needle in data
+ * @return - The match, NULL if there is none
+ */
+static inline const char *finder_search_find(const struct finder_search *search, const char *data, size_t length)
+{
+	return search->find(search, data, length);
+}
+
+/**
+ * @brief - Number of lines of data containing the needle, the last one may lack its newline
+ */
+unsigned long finder_search_count_lines(const struct finder_search *search, const char *data, size_t length);
+
+#endif
@@ -0,0 +1,648 @@
+// This is a C File for the Finder directory traversal, see finderwalk.h
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "finderwalk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Regular files of a directory handed out together, a thief takes a whole batch
+#define WALK_BATCH_FILES 64
+
+// Bytes of names in a batch
+#define WALK_BATCH_SIZE 4096
+
+// Longest an idle thread sleeps before it looks for work again
+#define WALK_IDLE_NS (1000 * 1000)
+
+// Arena allocations are aligned to this
+#define WALK_ARENA_ALIGN 16
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * @brief - Entry layout of getdents64(), glibc only declares it from 2.30 on
+ */
+struct linux_dirent64
+{
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/**
+ * @brief - A directory found by the walk, in the arena of the thread that found it
+ */
+struct walk_dir
+{
+	// -1 until it is read if it was queued past the descriptor budget
+	int fd;
+
+	// The thread reading it and every batch of its files still queued, the last one closes fd
+	atomic_uint references;
+
+	const char *path;
+	size_t length;
+};
+
+/**
+ * @brief - Names of regular files of one directory, NUL terminated one after the other
+ */
+struct walk_batch
+{
+	unsigned int count;
+	size_t used;
+	char names[WALK_BATCH_SIZE];
+};
+
+/**
+ * @brief - Work in a deque: a directory to read, or a batch of its files to hand to the callback
+ */
+struct walk_item
+{
+	struct walk_dir *dir;
+	struct walk_batch *batch;
+};
+
+/**
+ * @brief - The owner pushes and pops at the tail, thieves take from the head
+ */
+struct walk_deque
+{
+	struct walk_item *items;
+	size_t head;
+	size_t tail;
+	size_t capacity;
+	pthread_mutex_t lock;
+};
+
+/**
+ * @brief - Chunks of directory records and paths, freed all at once after the walk
+ */
+struct walk_arena
+{
+	// Current chunk, its first bytes point to the previous one
+	char *chunk;
+	size_t used;
+	size_t size;
+};
+
+struct walk_state;
+
+struct walk_worker
+{
+	pthread_t thread;
+	struct walk_state *state;
+	unsigned int index;
+	void *context;
+
+	struct walk_deque deque;
+	struct walk_arena arena;
+	char *dents;
+
+	struct finder_walk_stats stats;
+};
+
+struct walk_state
+{
+	struct walk_worker *workers;
+	unsigned int count;
+	finder_walk_file_fn file;
+
+	// Items queued or being worked on, the walk is over once it drops to 0
+	atomic_ulong pending;
+
+	// Directory descriptors open, and how many may be before directories are queued by path
+	atomic_long descriptors;
+	long budget;
+
+	// Threads waiting for work, pushes only wake them when there are any
+	atomic_uint sleepers;
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle;
+};
+
+static void *worker_main(void *arg);
+static bool next_item(struct walk_worker *worker, struct walk_item *item);
+static void finish_item(struct walk_state *state);
+static bool push_item(struct walk_worker *worker, const struct walk_item *item);
+static void read_dir(struct walk_worker *worker, struct walk_dir *dir);
+static void push_dir(struct walk_worker *worker, struct walk_dir *parent, const char *name);
+static struct walk_batch *add_file(struct walk_worker *worker, struct walk_dir *dir, struct walk_batch *batch,
+		const char *name);
+static void scan_batch(struct walk_worker *worker, struct walk_dir *dir, struct walk_batch *batch);
+static void release_dir(struct walk_state *state, struct walk_dir *dir);
+static struct walk_dir *new_dir(struct walk_worker *worker, int fd, const char *parent, size_t parent_length,
+		const char *name);
+static long descriptor_budget(unsigned int threads);
+
+static bool deque_push(struct walk_deque *deque, const struct walk_item *item);
+static bool deque_pop(struct walk_deque *deque, struct walk_item *item);
+static bool deque_steal(struct walk_deque *deque, struct walk_item *item);
+
+static void *arena_alloc(struct walk_arena *arena, size_t size);
+static void arena_free(struct walk_arena *arena);
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+int finder_walk(const char *root, unsigned int threads, finder_walk_file_fn file, void **contexts,
+		struct finder_walk_stats *stats)
+{
+	if(threads < 1)
+		threads = 1;
+
+	int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(fd < 0)
+		return -1;
+
+	struct walk_state state = {
+		.count = threads,
+		.file = file,
+		.budget = descriptor_budget(threads),
+		.idle_lock = PTHREAD_MUTEX_INITIALIZER,
+		.idle = PTHREAD_COND_INITIALIZER,
+	};
+	atomic_init(&state.pending, 0);
+	atomic_init(&state.descriptors, 1);
+	atomic_init(&state.sleepers, 0);
+
+	state.workers = calloc(threads, sizeof(*state.workers));
+	if(state.workers == NULL)
+	{
+		close(fd);
+		return -1;
+	}
+
+	unsigned int i;
+	bool ready = true;
+	for(i = 0; i < threads; i++)
+	{
+		struct walk_worker *worker = &state.workers[i];
+		worker->state = &state;
+		worker->index = i;
+		worker->context = contexts[i];
+		pthread_mutex_init(&worker->deque.lock, NULL);
+		worker->dents = malloc(FINDER_WALK_DENTS_SIZE);
+		ready = ready && worker->dents != NULL;
+	}
+
+	// The root keeps the name it was given, less trailing slashes
+	size_t length = strlen(root);
+	while(length > 1 && root[length - 1] == '/')
+		length--;
+	struct walk_dir *dir = ready ? new_dir(&state.workers[0], fd, root, length, NULL) : NULL;
+	struct walk_item item = { dir, NULL };
+	unsigned int started = 0;
+	if(dir != NULL && push_item(&state.workers[0], &item))
+	{
+		// Idle threads steal from any deque, one that failed to start just never has anything
+		for(started = 0; started < threads; started++)
+		{
+			if(pthread_create(&state.workers[started].thread, NULL, worker_main, &state.workers[started]) != 0)
+				break;
+		}
+	}
+	if(started == 0)
+		close(fd);
+
+	struct finder_walk_stats total = { 0, 0, 0 };
+	for(i = 0; i < started; i++)
+		pthread_join(state.workers[i].thread, NULL);
+	for(i = 0; i < threads; i++)
+	{
+		struct walk_worker *worker = &state.workers[i];
+		total.directories += worker->stats.directories;
+		total.entries += worker->stats.entries;
+		total.errors += worker->stats.errors;
+		arena_free(&worker->arena);
+		free(worker->dents);
+		free(worker->deque.items);
+		pthread_mutex_destroy(&worker->deque.lock);
+	}
+	free(state.workers);
+
+	if(stats != NULL)
+		*stats = total;
+	if(started == 0)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static void *worker_main(void *arg)
+{
+	struct walk_worker *worker = arg;
+	struct walk_item item;
+
+	while(next_item(worker, &item))
+	{
+		if(item.batch == NULL)
+			read_dir(worker, item.dir);
+		else
+		{
+			scan_batch(worker, item.dir, item.batch);
+			free(item.batch);
+			release_dir(worker->state, item.dir);
+		}
+		finish_item(worker->state);
+	}
+	return NULL;
+}
+
+/**
+ * @brief - The newest item of this thread's deque, else the oldest of another's
+ * @return - true with an item, false once the walk is over
+ */
+static bool next_item(struct walk_worker *worker, struct walk_item *item)
+{
+	struct walk_state *state = worker->state;
+	unsigned int i;
+
+	for(;;)
+	{
+		if(deque_pop(&worker->deque, item))
+			return true;
+		for(i = 1; i < state->count; i++)
+		{
+			if(deque_steal(&state->workers[(worker->index + i) % state->count].deque, item))
+				return true;
+		}
+		if(atomic_load(&state->pending) == 0)
+			return false;
+
+		// Nothing to steal until a thread still reading a directory pushes some, a push
+		// wakes a sleeper and the timeout covers one that raced with going to sleep
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += WALK_IDLE_NS;
+		if(until.tv_nsec >= 1000000000)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000;
+		}
+		pthread_mutex_lock(&state->idle_lock);
+		atomic_fetch_add(&state->sleepers, 1);
+		if(atomic_load(&state->pending) != 0)
+			pthread_cond_timedwait(&state->idle, &state->idle_lock, &until);
+		atomic_fetch_sub(&state->sleepers, 1);
+		pthread_mutex_unlock(&state->idle_lock);
+	}
+}
+
+static void finish_item(struct walk_state *state)
+{
+	// The last item done ends the walk, every sleeper has to see it
+	if(atomic_fetch_sub(&state->pending, 1) == 1)
+	{
+		pthread_mutex_lock(&state->idle_lock);
+		pthread_cond_broadcast(&state->idle);
+		pthread_mutex_unlock(&state->idle_lock);
+	}
+}
+
+/**
+ * @brief - Queue an item on this thread's deque
+ * @return - true for Success, false if the deque could not grow and the caller has to do it
+ */
+static bool push_item(struct walk_worker *worker, const struct walk_item *item)
+{
+	struct walk_state *state = worker->state;
+
+	atomic_fetch_add(&state->pending, 1);
+	if(!deque_push(&worker->deque, item))
+	{
+		atomic_fetch_sub(&state->pending, 1);
+		return false;
+	}
+
+	if(atomic_load(&state->sleepers) > 0)
+	{
+		pthread_mutex_lock(&state->idle_lock);
+		pthread_cond_signal(&state->idle);
+		pthread_mutex_unlock(&state->idle_lock);
+	}
+	return true;
+}
+
+/**
+ * @brief - Queue the subdirectories of dir and hand its regular files out in batches
+ */
+static void read_dir(struct walk_worker *worker, struct walk_dir *dir)
+{
+	struct walk_state *state = worker->state;
+
+	if(dir->fd < 0)
+	{
+		dir->fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if(dir->fd < 0)
+		{
+			fprintf(stderr, "finder: %s: %s\n", dir->path, strerror(errno));
+			worker->stats.errors++;
+			return;
+		}
+		atomic_fetch_add(&state->descriptors, 1);
+	}
+	worker->stats.directories++;
+
+	struct walk_batch *batch = NULL;
+	for(;;)
+	{
+		long got = syscall(SYS_getdents64, dir->fd, worker->dents, FINDER_WALK_DENTS_SIZE);
+		if(got < 0)
+		{
+			fprintf(stderr, "finder: %s: %s\n", dir->path, strerror(errno));
+			worker->stats.errors++;
+			break;
+		}
+		if(got == 0)
+			break;
+
+		long offset;
+		struct linux_dirent64 *entry;
+		for(offset = 0; offset < got; offset += entry->d_reclen)
+		{
+			entry = (struct linux_dirent64 *)(worker->dents + offset);
+			const char *name = entry->d_name;
+			if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+				continue;
+			worker->stats.entries++;
+
+			// Most filesystems give the type away with the name, only the others cost an fstatat()
+			unsigned char type = entry->d_type;
+			struct stat st;
+			if(type == DT_UNKNOWN && fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+				type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+
+			if(type == DT_DIR)
+				push_dir(worker, dir, name);
+			else if(type == DT_REG)
+				batch = add_file(worker, dir, batch, name);
+		}
+	}
+
+	// The last batch is not worth queueing, this thread would pop it right away
+	if(batch != NULL)
+	{
+		scan_batch(worker, dir, batch);
+		free(batch);
+	}
+	release_dir(state, dir);
+}
+
+static void push_dir(struct walk_worker *worker, struct walk_dir *parent, const char *name)
+{
+	struct walk_state *state = worker->state;
+	int fd = -1;
+
+	if(atomic_load(&state->descriptors) < state->budget)
+	{
+		fd = openat(parent->fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if(fd >= 0)
+			atomic_fetch_add(&state->descriptors, 1);
+		else if(errno != EMFILE && errno != ENFILE)
+		{
+			fprintf(stderr, "finder: %s/%s: %s\n", parent->path, name, strerror(errno));
+			worker->stats.errors++;
+			return;
+		}
+	}
+
+	struct walk_dir *dir = new_dir(worker, fd, parent->path, parent->length, name);
+	if(dir == NULL)
+	{
+		fprintf(stderr, "finder: %s/%s: %s\n", parent->path, name, strerror(ENOMEM));
+		worker->stats.errors++;
+		if(fd >= 0)
+		{
+			close(fd);
+			atomic_fetch_sub(&state->descriptors, 1);
+		}
+		return;
+	}
+
+	struct walk_item item = { dir, NULL };
+	if(!push_item(worker, &item))
+		read_dir(worker, dir);
+}
+
+/**
+ * @brief - Add a file to batch, queueing batch first if it is full
+ * @return - The batch to add the next file to, NULL if there is none yet
+ */
+static struct walk_batch *add_file(struct walk_worker *worker, struct walk_dir *dir, struct walk_batch *batch,
+		const char *name)
+{
+	size_t size = strlen(name) + 1;
+
+	if(batch != NULL && (batch->count == WALK_BATCH_FILES || batch->used + size > sizeof(batch->names)))
+	{
+		atomic_fetch_add(&dir->references, 1);
+		struct walk_item item = { dir, batch };
+		if(!push_item(worker, &item))
+		{
+			atomic_fetch_sub(&dir->references, 1);
+			scan_batch(worker, dir, batch);
+			free(batch);
+		}
+		batch = NULL;
+	}
+
+	if(batch == NULL)
+	{
+		batch = malloc(sizeof(*batch));
+		if(batch == NULL)
+		{
+			worker->state->file(worker->context, dir->fd, name, dir->path, dir->length);
+			return NULL;
+		}
+		batch->count = 0;
+		batch->used = 0;
+	}
+	memcpy(batch->names + batch->used, name, size);
+	batch->used += size;
+	batch->count++;
+	return batch;
+}
+
+static void scan_batch(struct walk_worker *worker, struct walk_dir *dir, struct walk_batch *batch)
+{
+	const char *name = batch->names;
+	unsigned int i;
+
+	for(i = 0; i < batch->count; i++)
+	{
+		worker->state->file(worker->context, dir->fd, name, dir->path, dir->length);
+		name += strlen(name) + 1;
+	}
+}
+
+static void release_dir(struct walk_state *state, struct walk_dir *dir)
+{
+	if(atomic_fetch_sub(&dir->references, 1) == 1 && dir->fd >= 0)
+	{
+		close(dir->fd);
+		dir->fd = -1;
+		atomic_fetch_sub(&state->descriptors, 1);
+	}
+}
+
+/**
+ * @brief - A directory record with its path, parent/name or just parent without a name
+ * @return - The record holding one reference, NULL if the arena could not grow
+ */
+static struct walk_dir *new_dir(struct walk_worker *worker, int fd, const char *parent, size_t parent_length,
+		const char *name)
+{
+	size_t name_length = name != NULL ? strlen(name) : 0;
+	bool slash = name != NULL && parent_length > 0 && parent[parent_length - 1] != '/';
+	size_t length = parent_length + slash + name_length;
+
+	struct walk_dir *dir = arena_alloc(&worker->arena, sizeof(*dir) + length + 1);
+	if(dir == NULL)
+		return NULL;
+
+	char *path = (char *)(dir + 1);
+	memcpy(path, parent, parent_length);
+	if(slash)
+		path[parent_length] = '/';
+	if(name != NULL)
+		memcpy(path + parent_length + slash, name, name_length);
+	path[length] = '\0';
+
+	dir->fd = fd;
+	atomic_init(&dir->references, 1);
+	dir->path = path;
+	dir->length = length;
+	return dir;
+}
+
+/**
+ * @brief - How many directories may wait open, half of RLIMIT_NOFILE less a file per thread
+ */
+static long descriptor_budget(unsigned int threads)
+{
+	struct rlimit limit;
+	long budget = 1024;
+
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0)
+		budget = limit.rlim_cur == RLIM_INFINITY ? 65536 : (long)(limit.rlim_cur / 2) - (long)threads;
+	return budget > 1 ? budget : 1;
+}
+
+static bool deque_push(struct walk_deque *deque, const struct walk_item *item)
+{
+	bool pushed = true;
+
+	pthread_mutex_lock(&deque->lock);
+	if(deque->tail == deque->capacity)
+	{
+		// Reuse what thieves freed at the head before growing
+		if(deque->head > 0)
+		{
+			memmove(deque->items, deque->items + deque->head, (deque->tail - deque->head) * sizeof(*item));
+			deque->tail -= deque->head;
+			deque->head = 0;
+		}
+		else
+		{
+			size_t capacity = deque->capacity > 0 ? deque->capacity * 2 : 256;
+			struct walk_item *items = realloc(deque->items, capacity * sizeof(*items));
+			if(items == NULL)
+				pushed = false;
+			else
+			{
+				deque->items = items;
+				deque->capacity = capacity;
+			}
+		}
+	}
+	if(pushed)
+		deque->items[deque->tail++] = *item;
+	pthread_mutex_unlock(&deque->lock);
+	return pushed;
+}
+
+static bool deque_pop(struct walk_deque *deque, struct walk_item *item)
+{
+	bool popped = false;
+
+	pthread_mutex_lock(&deque->lock);
+	if(deque->tail > deque->head)
+	{
+		*item = deque->items[--deque->tail];
+		popped = true;
+	}
+	if(deque->tail == deque->head)
+		deque->head = deque->tail = 0;
+	pthread_mutex_unlock(&deque->lock);
+	return popped;
+}
+
+static bool deque_steal(struct walk_deque *deque, struct walk_item *item)
+{
+	bool stolen = false;
+
+	pthread_mutex_lock(&deque->lock);
+	if(deque->tail > deque->head)
+	{
+		*item = deque->items[deque->head++];
+		stolen = true;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return stolen;
+}
+
+static void *arena_alloc(struct walk_arena *arena, size_t size)
+{
+	size = (size + WALK_ARENA_ALIGN - 1) & ~(size_t)(WALK_ARENA_ALIGN - 1);
+
+	if(arena->chunk == NULL || arena->used + size > arena->size)
+	{
+		size_t chunk_size = FINDER_WALK_ARENA_SIZE;
+		if(chunk_size < WALK_ARENA_ALIGN + size)
+			chunk_size = WALK_ARENA_ALIGN + size;
+		char *chunk = malloc(chunk_size);
+		if(chunk == NULL)
+			return NULL;
+		*(char **)chunk = arena->chunk;
+		arena->chunk = chunk;
+		arena->used = WALK_ARENA_ALIGN;
+		arena->size = chunk_size;
+	}
+
+	void *allocation = arena->chunk + arena->used;
+	arena->used += size;
+	return allocation;
+}
+
+static void arena_free(struct walk_arena *arena)
+{
+	while(arena->chunk != NULL)
+	{
+		char *previous = *(char **)arena->chunk;
+		free(arena->chunk);
+		arena->chunk = previous;
+	}
+}
@@ -0,0 +1,66 @@
+// Parallel directory traversal for the Finder
+//
+// Walks a tree with a pool of threads and hands every regular file to a callback on one of
+// them.  Each thread keeps a deque of directories still to be read: it
+// pushes the subdirectories it finds and pops the newest one itself, depth first, while a
+// thread that runs dry steals the oldest one from another's deque, the one most likely to
+// hold a large subtree.  A directory waits in a deque as an open descriptor, so it is read
+// with getdents64() into a large buffer and its entries are opened with openat() relative
+// to it, no path is ever resolved again from the root.  The type comes from d_type, only
+// filesystems that leave it DT_UNKNOWN cost an fstatat().  Regular files are queued in
+// batches of their directory the same way, so the files of one large directory are still
+// spread over the threads.
+//
+// Paths are only kept for directories, for error messages and for the callback, in arenas
+// of the thread that found them that live until the walk is over.  Past a budget of open
+// descriptors, derived from RLIMIT_NOFILE, directories are queued by path instead and
+// opened when they are read.
+//
+// Like grep -r, symbolic links inside the tree are not followed, the root itself is.
+//
+
+#ifndef FINDERWALK_H
+#define FINDERWALK_H
+
+//------------------------------------INCLUDES------------------------------------
+#include <stddef.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Size of each thread's getdents64() buffer
+#define FINDER_WALK_DENTS_SIZE (128 * 1024)
+
+// Size of each arena chunk holding directory paths
+#define FINDER_WALK_ARENA_SIZE (64 * 1024)
+
+//------------------------------PUBLIC DECLARATIONS-------------------------------
+
+/**
+ * @brief - Called for every regular file, on whichever thread took its batch
+ * @param - context - The thread's entry of finder_walk()'s contexts
+ * @param - dirfd - The directory holding the file, for openat()
+ * @param - name - The file's name in that directory
+ * @param - dir - The directory's path, for messages, length bytes
+ */
+typedef void (*finder_walk_file_fn)(void *context, int dirfd, const char *name, const char *dir, size_t length);
+
+/**
+ * @brief - What a walk went through, added up over its threads
+ */
+struct finder_walk_stats
+{
+	unsigned long directories;
+	unsigned long entries;
+	unsigned long errors;
+};
+
+/**
+ * @brief - Walk the tree below root with threads threads, calling file for every regular file
+ * @param - contexts - threads pointers, each thread passes its own to file
+ * @param - stats - Filled in if not NULL
+ * @return - 0 for Success, -1 if root can not be opened or no thread started (errno is set)
+ */
+int finder_walk(const char *root, unsigned int threads, finder_walk_file_fn file, void **contexts,
+		struct finder_walk_stats *stats);
+
+#endif
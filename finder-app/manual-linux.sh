@@ -224,6 +224,7 @@ make CROSS_COMPILE=${CROSS_COMPILE} all
 # Copy the newly generated Writer Utility into Root File System /home
 echo "Copying Writer Utility to Root File System"
 cp "${FINDER_APP_DIR}/writer" "${OUTDIR}/rootfs/home"
+cp "${FINDER_APP_DIR}/finder" "${OUTDIR}/rootfs/home"
 
 # Navigate to output directory OUTDIR
 cd ${OUTDIR}
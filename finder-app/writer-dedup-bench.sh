@@ -0,0 +1,70 @@
+#!/bin/sh
+
+# Write a script that reports what deduplicating a repeated payload saves
+# Argument 1 - numfiles - The number of files to write (default 1000000)
+# Argument 2 - writedir - The directory to write them to (default /tmp/aeld-dedup)
+# Argument 3 - writestr - The payload every file gets (default AELD_IS_FUN)
+# Script writes the files once plainly and once through a $WRITER_DEDUP store and prints
+# the time, inodes, blocks and disk writes each run used, from writer --batch -v, df, du
+# and /proc/diskstats
+
+NUMFILES=${1:-1000000}
+WRITEDIR=${2:-/tmp/aeld-dedup}
+WRITESTR=${3:-AELD_IS_FUN}
+
+# Use the writer next to this script if there is one, else the one on the PATH
+WRITER=$(dirname "$0")/writer
+if [ ! -x "$WRITER" ]
+then
+	WRITER=writer
+fi
+
+rm -rf "$WRITEDIR"
+mkdir -p "$WRITEDIR/files"
+MANIFEST="$WRITEDIR/manifest"
+
+# One manifest for both runs, so they write exactly the same files
+i=1
+while [ $i -le $NUMFILES ]
+do
+	printf '%s/files/file%d.txt\t%s\n' "$WRITEDIR" $i "$WRITESTR"
+	i=$((i + 1))
+done > "$MANIFEST"
+
+# Prints the inodes in use on the filesystem holding the directory
+inodes_used()
+{
+	df -P -i "$WRITEDIR" | awk 'NR == 2 { print $3 }'
+}
+
+# Prints the KiB written to every disk so far
+kib_written()
+{
+	awk '$3 !~ /[0-9]$/ || $3 ~ /^(nvme|mmcblk)[0-9]+n?[0-9]*$/ { kib += $10 / 2 } END { printf "%d\n", kib }' /proc/diskstats
+}
+
+for RUN in plain dedup
+do
+	rm -rf "$WRITEDIR/files" "$WRITEDIR/store"
+	mkdir -p "$WRITEDIR/files"
+	sync
+
+	BEFORE=$(inodes_used)
+	WRITTEN=$(kib_written)
+	if [ $RUN = dedup ]
+	then
+		WRITER_DEDUP="$WRITEDIR/store" "$WRITER" --batch -v "$MANIFEST" || exit 1
+	else
+		"$WRITER" --batch -v "$MANIFEST" || exit 1
+	fi
+	sync
+	AFTER=$(inodes_used)
+
+	echo "$RUN: $((AFTER - BEFORE)) inodes, $(du -s -k "$WRITEDIR/files" | cut -f1) KiB of blocks under files/," \
+		"$(($(kib_written) - WRITTEN)) KiB written to disk"
+done
+
+rm -rf "$WRITEDIR"
+
+# Exit with success
+exit 0
@@ -0,0 +1,76 @@
+#!/bin/sh
+# Tester script for deduplicating writes
+# Writes files through a $WRITER_DEDUP store and checks that files with the same payload are
+# linked to one blob, and that rewriting one of them never changes the others.
+#
+# Usage: writer-dedup-test.sh
+
+set -e
+set -u
+
+WRITESTR=AELD_IS_FUN
+WRITEDIR=/tmp/aeld-dedup-test
+STORE=${WRITEDIR}/store
+
+# Use the writer next to this script if there is one, else the one on the PATH
+WRITER=$(dirname "$0")/writer
+if [ ! -x "$WRITER" ]
+then
+	WRITER=writer
+fi
+
+rm -rf "${WRITEDIR}"
+mkdir -p "${WRITEDIR}/files"
+
+# Prints "failed: ..." and exits unless the file holds the string
+expect()
+{
+	if [ "$(cat "$1")" != "$2" ]
+	then
+		echo "failed: expected $2 in $1 but instead found $(cat "$1")"
+		exit 1
+	fi
+}
+
+for NAME in a b c d
+do
+	WRITER_DEDUP="${STORE}" "$WRITER" "${WRITEDIR}/files/${NAME}" "${WRITESTR}"
+done
+
+# Four targets and the blob are one inode
+if [ $(stat -c %h "${WRITEDIR}/files/a") -ne 5 ] || [ $(stat -c %i "${WRITEDIR}/files/a") -ne $(stat -c %i "${WRITEDIR}/files/d") ]
+then
+	echo "failed: the files with the same payload are not linked to one blob"
+	exit 1
+fi
+
+# Every way of rewriting a target replaces it, the others keep the shared payload
+WRITER_DEDUP="${STORE}" "$WRITER" "${WRITEDIR}/files/a" "new payload"
+WRITER_DEDUP="${STORE}" "$WRITER" -d fdatasync "${WRITEDIR}/files/b" "synced payload"
+WRITER_DEDUP="${STORE}" "$WRITER" -I "${WRITEDIR}/files/c" "independent payload"
+expect "${WRITEDIR}/files/a" "new payload"
+expect "${WRITEDIR}/files/b" "synced payload"
+expect "${WRITEDIR}/files/c" "independent payload"
+expect "${WRITEDIR}/files/d" "${WRITESTR}"
+
+# Without the store a linked target is a read only file like any other, writing it fails.
+# root is not stopped by the permissions, so this only runs for other users.
+if [ $(id -u) -ne 0 ]
+then
+	set +e
+	"$WRITER" "${WRITEDIR}/files/d" "through the link"
+	if [ $? -ne 1 ]
+	then
+		echo "failed: writing a read only linked target without the store should fail"
+		exit 1
+	fi
+	set -e
+	expect "${WRITEDIR}/files/d" "${WRITESTR}"
+fi
+
+# remove temporary directories, the blobs are read only
+chmod -R u+w "${WRITEDIR}"
+rm -rf "${WRITEDIR}"
+
+echo "success"
+exit 0
@@ -0,0 +1,39 @@
+#!/bin/sh
+
+# Write a script that reports writer throughput for each durability mode
+# Argument 1 - numfiles - The number of files to write per mode (default 10000)
+# Argument 2 - writedir - The directory to write them to (default /tmp/aeld-durability)
+# Script prints one line per mode, from writer --batch -v
+
+NUMFILES=${1:-10000}
+WRITEDIR=${2:-/tmp/aeld-durability}
+
+# Use the writer next to this script if there is one, else the one on the PATH
+WRITER=$(dirname "$0")/writer
+if [ ! -x "$WRITER" ]
+then
+	WRITER=writer
+fi
+
+mkdir -p "$WRITEDIR"
+MANIFEST="$WRITEDIR/manifest"
+
+# Build one manifest and reuse it, so every mode writes exactly the same files
+i=1
+while [ $i -le $NUMFILES ]
+do
+	printf '%s/file%d.txt\tAELD_IS_FUN %d\n' "$WRITEDIR" $i $i
+	i=$((i + 1))
+done > "$MANIFEST"
+
+for MODE in none atomic fdatasync group
+do
+	# Start each mode from an empty directory so none of them only overwrites
+	find "$WRITEDIR" -name 'file*.txt' -exec rm -f {} +
+	"$WRITER" --batch -d $MODE -v "$MANIFEST" || exit 1
+done
+
+rm -rf "$WRITEDIR"
+
+# Exit with success
+exit 0
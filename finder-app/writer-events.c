@@ -0,0 +1,141 @@
+// This is a C File for the decoder of the Writer event file, see writerevent.h
+//
+// Prints the events still held by an event file, oldest first, one per line:
+// local time, event code, byte count and path hash.  -p prints only the events about
+// the given path, -n only the last so many.  The file may be in use, records being
+// written while it is read are skipped like those torn by a crash.  A summary of what
+// was recorded, overwritten and skipped goes to stderr.
+//
+// Usage: writer-events [-n last] [-p path] eventFile
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "writerevent.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+static void print_record(const struct writer_event_record *record);
+
+//--------------------------------------MAIN--------------------------------------
+
+int main(int argc, char *argv[])
+{
+	uint64_t last = UINT64_MAX;
+	const char *path = NULL;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:p:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n':
+				last = strtoull(optarg, NULL, 10);
+				break;
+			case 'p':
+				path = optarg;
+				break;
+			default:
+				goto usage;
+		}
+	}
+	if(optind != argc - 1)
+		goto usage;
+
+	int fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) < 0)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+
+	const struct writer_event_header *header = NULL;
+	if((size_t)st.st_size >= sizeof(*header))
+	{
+		header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if(header == MAP_FAILED)
+			header = NULL;
+	}
+	close(fd);
+	if(header == NULL ||
+	   memcmp(header->magic, WRITER_EVENT_MAGIC, sizeof(header->magic)) != 0 ||
+	   header->record_size != sizeof(struct writer_event_record) ||
+	   header->capacity == 0 || (header->capacity & (header->capacity - 1)) != 0 ||
+	   (uint64_t)st.st_size < sizeof(*header) + header->capacity * sizeof(struct writer_event_record))
+	{
+		fprintf(stderr, "%s is not a writer event file\n", argv[optind]);
+		return 1;
+	}
+
+	const struct writer_event_record *records = (const struct writer_event_record *)(header + 1);
+	uint64_t mask = header->capacity - 1;
+	uint64_t end = atomic_load_explicit(&header->next, memory_order_acquire);
+	uint64_t first = end > header->capacity ? end - header->capacity : 0;
+	uint64_t hash = path != NULL ? writer_event_hash(path) : 0;
+
+	// Copy each record out and only trust the copy if its sequence was right before and after
+	struct writer_event_record *kept = malloc((end - first) * sizeof(*kept) + 1);
+	if(kept == NULL)
+		return 1;
+	uint64_t count = 0, incomplete = 0;
+	uint64_t position;
+	for(position = first; position < end; position++)
+	{
+		const struct writer_event_record *record = &records[position & mask];
+		uint32_t sequence = (uint32_t)(position + 1);
+		if(atomic_load_explicit(&record->sequence, memory_order_acquire) != sequence)
+		{
+			incomplete++;
+			continue;
+		}
+		kept[count].time_ns = record->time_ns;
+		kept[count].path_hash = record->path_hash;
+		kept[count].bytes = record->bytes;
+		kept[count].code = record->code;
+		atomic_thread_fence(memory_order_acquire);
+		if(atomic_load_explicit(&record->sequence, memory_order_relaxed) != sequence)
+		{
+			incomplete++;
+			continue;
+		}
+		if(path == NULL || kept[count].path_hash == hash)
+			count++;
+	}
+
+	uint64_t i;
+	for(i = count > last ? count - last : 0; i < count; i++)
+		print_record(&kept[i]);
+
+	fprintf(stderr, "%" PRIu64 " events recorded, %" PRIu64 " overwritten, %" PRIu64 " incomplete\n",
+			end, first, incomplete);
+	free(kept);
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-n last] [-p path] eventFile\n", argv[0]);
+	return 1;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static void print_record(const struct writer_event_record *record)
+{
+	char stamp[32];
+	struct tm when;
+	time_t seconds = record->time_ns / 1000000000u;
+	strftime(stamp, sizeof(stamp), "%F %T", localtime_r(&seconds, &when));
+
+	printf("%s.%09" PRIu64 " %-14s %12" PRIu64 " %016" PRIx64 "\n", stamp, record->time_ns % 1000000000u,
+			writer_event_name(record->code), record->bytes, record->path_hash);
+}
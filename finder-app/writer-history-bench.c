@@ -0,0 +1,234 @@
+// This is a C File for a benchmark of the Writer write history, see writerhistory.h
+//
+// Fills a history with writes of random length, then times random offset reads against
+// it: first a lookup of the entry holding each offset, then a short copy from it.  The
+// same reads are repeated with an appender thread running, so readers keep retrying
+// around appends.  As a baseline the lookup is also done with a linear walk of the
+// entries, the way a plain circular buffer has to.
+//
+// Usage: writer-history-bench [-n reads] [-e entries] [-r readers]
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "writerhistory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Writes are 1 to BENCH_MAX_WRITE bytes
+#define BENCH_MAX_WRITE 256
+
+// Bytes copied per read
+#define BENCH_READ_SIZE 16
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * @brief - Shared by the reader and appender threads
+ */
+struct bench
+{
+	struct writer_history *history;
+	unsigned long reads;
+	atomic_bool appending;
+	atomic_ulong appended;
+
+	// Lengths of the retained writes in order, for the linear baseline
+	size_t *lengths;
+	size_t entries;
+
+	// Sum of what every reader found, keeps the reads from being optimized away
+	atomic_ulong checksum;
+};
+
+static double now_s(void);
+static uint64_t next_random(uint64_t *state);
+static void *bench_reader(void *arg);
+static void *bench_appender(void *arg);
+static double bench_readers(struct bench *bench, int readers);
+
+//--------------------------------------MAIN--------------------------------------
+
+int main(int argc, char *argv[])
+{
+	struct bench bench;
+	int readers = 1;
+	int opt;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.reads = 10000000;
+	bench.entries = 4096;
+
+	while((opt = getopt(argc, argv, "n:e:r:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n':
+				bench.reads = strtoul(optarg, NULL, 10);
+				break;
+			case 'e':
+				bench.entries = strtoul(optarg, NULL, 10);
+				break;
+			case 'r':
+				readers = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n reads] [-e entries] [-r readers]\n", argv[0]);
+				return 1;
+		}
+	}
+	if(bench.reads == 0 || bench.entries == 0 || readers <= 0)
+		return 1;
+
+	// Arena big enough that the entry count, not the bytes, decides what is retained
+	bench.history = writer_history_create(bench.entries, bench.entries * BENCH_MAX_WRITE);
+	bench.lengths = calloc(bench.entries, sizeof(*bench.lengths));
+	if(bench.history == NULL || bench.lengths == NULL)
+		return 1;
+
+	char data[BENCH_MAX_WRITE];
+	uint64_t state = 1;
+	size_t i;
+	for(i = 0; i < sizeof(data); i++)
+		data[i] = 'a' + i % 26;
+	for(i = 0; i < bench.entries; i++)
+	{
+		bench.lengths[i] = 1 + next_random(&state) % BENCH_MAX_WRITE;
+		writer_history_append(bench.history, data, bench.lengths[i]);
+	}
+
+	uint64_t first;
+	uint64_t end;
+	writer_history_bounds(bench.history, &first, &end);
+	printf("%zu entries, %llu bytes retained, %lu reads of %d bytes per reader\n",
+			bench.entries, (unsigned long long)(end - first), bench.reads, BENCH_READ_SIZE);
+
+	// Baseline: walk the lengths from the oldest entry, what a lookup costs without the prefix sums
+	unsigned long baseline_reads = bench.reads / 100 ? bench.reads / 100 : 1;
+	unsigned long found = 0;
+	double start = now_s();
+	unsigned long n;
+	for(n = 0; n < baseline_reads; n++)
+	{
+		uint64_t offset = next_random(&state) % (end - first);
+		size_t entry = 0;
+		while(offset >= bench.lengths[entry])
+			offset -= bench.lengths[entry++];
+		found += entry;
+	}
+	double elapsed = now_s() - start;
+	printf("linear lookup:   %8.1f ns/read (%lu reads, %lu)\n", elapsed * 1e9 / baseline_reads, baseline_reads, found % 2);
+
+	elapsed = bench_readers(&bench, readers);
+	printf("history read:    %8.1f ns/read, %.1fM reads/s over %d readers\n",
+			elapsed * 1e9 / bench.reads, readers * bench.reads / elapsed / 1e6, readers);
+
+	pthread_t appender;
+	atomic_store(&bench.appending, true);
+	if(pthread_create(&appender, NULL, bench_appender, &bench) != 0)
+		return 1;
+	elapsed = bench_readers(&bench, readers);
+	atomic_store(&bench.appending, false);
+	pthread_join(appender, NULL);
+	printf("with appender:   %8.1f ns/read, %.1fM reads/s over %d readers, %lu appends meanwhile\n",
+			elapsed * 1e9 / bench.reads, readers * bench.reads / elapsed / 1e6, readers, atomic_load(&bench.appended));
+
+	writer_history_destroy(bench.history);
+	free(bench.lengths);
+	return 0;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static double now_s(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief - xorshift64, cheap enough not to show up next to a read
+ */
+static uint64_t next_random(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+/**
+ * @brief - Run readers reader threads to completion
+ * @return - Wall clock seconds they took
+ */
+static double bench_readers(struct bench *bench, int readers)
+{
+	pthread_t threads[readers];
+	int started = 0;
+	int i;
+
+	double start = now_s();
+	for(i = 0; i < readers; i++)
+	{
+		if(pthread_create(&threads[started], NULL, bench_reader, bench) == 0)
+			started++;
+	}
+	for(i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	return now_s() - start;
+}
+
+static void *bench_reader(void *arg)
+{
+	struct bench *bench = arg;
+	uint64_t state = (uintptr_t)&state | 1;
+	unsigned long checksum = 0;
+	unsigned long n;
+
+	for(n = 0; n < bench->reads; n++)
+	{
+		// Bounds move while the appender runs, an offset evicted meanwhile is moved up by the read
+		uint64_t first;
+		uint64_t end;
+		writer_history_bounds(bench->history, &first, &end);
+
+		struct writer_history_position position;
+		uint64_t offset = first + next_random(&state) % (end - first);
+		if(writer_history_find(bench->history, offset, &position))
+			checksum += position.entry_offset;
+
+		char buffer[BENCH_READ_SIZE];
+		checksum += writer_history_read(bench->history, &offset, buffer, sizeof(buffer));
+	}
+
+	atomic_fetch_add(&bench->checksum, checksum);
+	return NULL;
+}
+
+static void *bench_appender(void *arg)
+{
+	struct bench *bench = arg;
+	char data[BENCH_MAX_WRITE];
+	uint64_t state = 7;
+	unsigned long appended = 0;
+
+	memset(data, 'z', sizeof(data));
+	while(atomic_load_explicit(&bench->appending, memory_order_relaxed))
+	{
+		writer_history_append(bench->history, data, 1 + next_random(&state) % BENCH_MAX_WRITE);
+		appended++;
+	}
+
+	atomic_store(&bench->appended, appended);
+	return NULL;
+}
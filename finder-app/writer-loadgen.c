@@ -0,0 +1,222 @@
+// This is a C File for a load generator for writer --listen
+//
+// Opens connections to the TCP append server from several threads at once.  Each
+// connection sends one newline terminated packet, half closes and reads the reply to
+// EOF.  Prints connections per second and the round trip percentiles.
+//
+// Usage: writer-loadgen [-H host] [-p port] [-n connections] [-c concurrency] [-s packetSize]
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+#define LOADGEN_PORT "9000"
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * @brief - Shared by every client thread
+ */
+struct loadgen
+{
+	struct addrinfo *address;
+	char *packet;
+	size_t packet_size;
+	unsigned long connections;
+
+	// Next connection to make
+	atomic_ulong next;
+
+	// Round trip of each connection in microseconds, UINT64_MAX for a failure
+	uint64_t *round_trips;
+	atomic_ulong received;
+};
+
+static uint64_t now_us(void);
+static void *loadgen_client(void *arg);
+static int compare_u64(const void *a, const void *b);
+
+//--------------------------------------MAIN--------------------------------------
+
+int main(int argc, char *argv[])
+{
+	const char *host = "127.0.0.1";
+	const char *port = LOADGEN_PORT;
+	struct loadgen load;
+	int concurrency = 16;
+	int opt;
+
+	memset(&load, 0, sizeof(load));
+	load.connections = 10000;
+	load.packet_size = 64;
+
+	while((opt = getopt(argc, argv, "H:p:n:c:s:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'H':
+				host = optarg;
+				break;
+			case 'p':
+				port = optarg;
+				break;
+			case 'n':
+				load.connections = strtoul(optarg, NULL, 10);
+				break;
+			case 'c':
+				concurrency = atoi(optarg);
+				break;
+			case 's':
+				load.packet_size = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-H host] [-p port] [-n connections] [-c concurrency] [-s packetSize]\n", argv[0]);
+				return 1;
+		}
+	}
+	if(load.connections == 0 || concurrency <= 0 || load.packet_size == 0)
+		return 1;
+
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+	int error = getaddrinfo(host, port, &hints, &load.address);
+	if(error != 0)
+	{
+		fprintf(stderr, "%s: %s\n", host, gai_strerror(error));
+		return 1;
+	}
+
+	// Printable packet ending in the newline that frames it
+	load.packet = malloc(load.packet_size);
+	load.round_trips = calloc(load.connections, sizeof(*load.round_trips));
+	if(load.packet == NULL || load.round_trips == NULL)
+		return 1;
+	size_t i;
+	for(i = 0; i < load.packet_size - 1; i++)
+		load.packet[i] = 'a' + i % 26;
+	load.packet[load.packet_size - 1] = '\n';
+
+	pthread_t threads[concurrency];
+	int started = 0;
+	uint64_t start = now_us();
+	for(i = 0; i < (size_t)concurrency; i++)
+	{
+		if(pthread_create(&threads[started], NULL, loadgen_client, &load) == 0)
+			started++;
+	}
+	for(i = 0; i < (size_t)started; i++)
+		pthread_join(threads[i], NULL);
+	double elapsed = (now_us() - start) / 1e6;
+
+	// Failures sort last
+	qsort(load.round_trips, load.connections, sizeof(*load.round_trips), compare_u64);
+	unsigned long failures = 0;
+	while(failures < load.connections && load.round_trips[load.connections - 1 - failures] == UINT64_MAX)
+		failures++;
+	unsigned long ok = load.connections - failures;
+
+	printf("%lu connections (%lu failed) in %.3fs, %.0f connections/s, %d clients\n",
+			load.connections, failures, elapsed, elapsed > 0 ? ok / elapsed : 0.0, started);
+	if(ok > 0)
+	{
+		printf("round trip p50=%.3fms p99=%.3fms max=%.3fms, %lu reply bytes\n",
+				load.round_trips[ok / 2] / 1000.0, load.round_trips[(ok * 99) / 100] / 1000.0,
+				load.round_trips[ok - 1] / 1000.0, atomic_load(&load.received));
+	}
+
+	freeaddrinfo(load.address);
+	free(load.packet);
+	free(load.round_trips);
+	return failures == 0 ? 0 : 1;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static uint64_t now_us(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * @brief - One connection: connect, send the packet, half close, read the reply to EOF
+ * @return - Reply bytes, -1 on failure
+ */
+static long loadgen_once(const struct loadgen *load)
+{
+	char buffer[64 * 1024];
+	long received = 0;
+
+	int fd = socket(load->address->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+		return -1;
+	if(connect(fd, load->address->ai_addr, load->address->ai_addrlen) < 0 ||
+	   send(fd, load->packet, load->packet_size, MSG_NOSIGNAL) != (ssize_t)load->packet_size ||
+	   shutdown(fd, SHUT_WR) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	for(;;)
+	{
+		ssize_t got = read(fd, buffer, sizeof(buffer));
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got < 0)
+		{
+			close(fd);
+			return -1;
+		}
+		if(got == 0)
+			break;
+		received += got;
+	}
+	close(fd);
+
+	// The reply is the file up to our packet, so it can never be shorter than the packet
+	return received >= (long)load->packet_size ? received : -1;
+}
+
+static void *loadgen_client(void *arg)
+{
+	struct loadgen *load = arg;
+	unsigned long received = 0;
+
+	for(;;)
+	{
+		unsigned long index = atomic_fetch_add(&load->next, 1);
+		if(index >= load->connections)
+			break;
+
+		uint64_t start = now_us();
+		long bytes = loadgen_once(load);
+		load->round_trips[index] = bytes < 0 ? UINT64_MAX : now_us() - start;
+		if(bytes > 0)
+			received += bytes;
+	}
+
+	atomic_fetch_add(&load->received, received);
+	return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
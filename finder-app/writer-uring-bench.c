@@ -0,0 +1,148 @@
+// This is a C File for a benchmark of the Writer io_uring backend, see writeruring.h
+//
+// Writes the same set of small files twice into a scratch directory, once with an
+// openat(), write() and close() per file the way the synchronous path does, once
+// through the io_uring backend, and prints files per second for both.  When io_uring
+// can not be used here only the synchronous numbers are printed.
+//
+// Usage: writer-uring-bench [-n files] [-s size] [-q depth] [directory]
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "writeruring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+static double now_s(void);
+static bool sync_write(const char *path, const void *data, size_t length);
+
+//--------------------------------------MAIN--------------------------------------
+
+int main(int argc, char *argv[])
+{
+	const char *directory = "/tmp";
+	size_t count = 100000;
+	size_t size = 64;
+	unsigned int depth = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:s:q:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n':
+				count = strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				size = strtoul(optarg, NULL, 10);
+				break;
+			case 'q':
+				depth = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n files] [-s size] [-q depth] [directory]\n", argv[0]);
+				return 1;
+		}
+	}
+	if(optind < argc)
+		directory = argv[optind];
+	if(count == 0)
+		return 1;
+
+	// A fresh scratch directory, so both runs create the same files from nothing
+	char scratch[PATH_MAX];
+	snprintf(scratch, sizeof(scratch), "%s/writer-uring-bench.XXXXXX", directory);
+	if(mkdtemp(scratch) == NULL)
+	{
+		perror(scratch);
+		return 1;
+	}
+
+	char *data = malloc(size ? size : 1);
+	struct writer_uring_file *files = calloc(count, sizeof(*files));
+	char *paths = malloc(count * 32);
+	if(data == NULL || files == NULL || paths == NULL)
+		return 1;
+	memset(data, 'w', size);
+
+	// Paths relative to the scratch directory keep the path walk the same for both runs
+	if(chdir(scratch) < 0)
+		return 1;
+	size_t i;
+	for(i = 0; i < count; i++)
+	{
+		snprintf(paths + i * 32, 32, "f%zu", i);
+		files[i].path = paths + i * 32;
+		files[i].data = data;
+		files[i].length = size;
+	}
+
+	printf("%zu files of %zu bytes in %s\n", count, size, scratch);
+
+	size_t failures = 0;
+	double start = now_s();
+	for(i = 0; i < count; i++)
+		failures += !sync_write(files[i].path, data, size);
+	double elapsed = now_s() - start;
+	printf("sync:     %8.3fs %10.0f files/s, %zu failed, 3 syscalls per file\n", elapsed, count / elapsed, failures);
+
+	for(i = 0; i < count; i++)
+		unlink(files[i].path);
+
+	struct writer_uring *ring = writer_uring_open(depth);
+	if(ring == NULL)
+		printf("io_uring: unavailable (%s), writer uses the sync path\n", strerror(errno));
+	else
+	{
+		start = now_s();
+		writer_uring_write(ring, files, count);
+		elapsed = now_s() - start;
+		failures = 0;
+		for(i = 0; i < count; i++)
+			failures += files[i].error != 0;
+		printf("io_uring: %8.3fs %10.0f files/s, %zu failed, queue depth %u\n", elapsed, count / elapsed, failures,
+				depth ? depth : WRITER_URING_DEPTH);
+		writer_uring_close(ring);
+	}
+
+	for(i = 0; i < count; i++)
+		unlink(files[i].path);
+	if(chdir("/") == 0)
+		rmdir(scratch);
+	free(data);
+	free(files);
+	free(paths);
+	return 0;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static double now_s(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief - What writer_file_write() does in durability mode none
+ */
+static bool sync_write(const char *path, const void *data, size_t length)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if(fd < 0)
+		return false;
+	bool success = write(fd, data, length) == (ssize_t)length;
+	return close(fd) == 0 && success;
+}
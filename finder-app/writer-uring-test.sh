@@ -0,0 +1,58 @@
+#!/bin/sh
+# Tester script for the Writer io_uring backend
+# Writes the same manifest with writer --batch -u and with the synchronous path and checks
+# every file came out the same.  Where io_uring is unavailable -u falls back to the
+# synchronous path, so the check holds either way.
+#
+# Usage: writer-uring-test.sh [numfiles]
+
+set -e
+set -u
+
+NUMFILES=${1:-500}
+WRITESTR=AELD_IS_FUN
+WRITEDIR=/tmp/aeld-uring
+
+# Use the writer next to this script if there is one, else the one on the PATH
+WRITER=$(dirname "$0")/writer
+if [ ! -x "$WRITER" ]
+then
+	WRITER=writer
+fi
+
+rm -rf "${WRITEDIR}"
+mkdir -p "${WRITEDIR}/uring" "${WRITEDIR}/sync"
+
+# Every fifth file holds an escaped newline and tab, every seventh a contents larger than a
+# registered buffer, and every file is written twice, the second record is the one that counts
+LARGE=$(printf '%05000d' 0)
+i=1
+while [ $i -le $NUMFILES ]
+do
+	printf 'DIR/file%d.txt\tstale\n' $i
+	if [ $((i % 5)) -eq 0 ]
+	then
+		printf 'DIR/file%d.txt\t%s %d\\nsecond\\tline\n' $i "${WRITESTR}" $i
+	elif [ $((i % 7)) -eq 0 ]
+	then
+		printf 'DIR/file%d.txt\t%s\n' $i "${LARGE}"
+	else
+		printf 'DIR/file%d.txt\t%s %d\n' $i "${WRITESTR}" $i
+	fi
+	i=$((i + 1))
+done > "${WRITEDIR}/manifest"
+
+sed "s|^DIR|${WRITEDIR}/uring|" "${WRITEDIR}/manifest" | "$WRITER" --batch -u -j 2
+sed "s|^DIR|${WRITEDIR}/sync|" "${WRITEDIR}/manifest" | "$WRITER" --batch -j 2
+
+set +e
+if diff -r "${WRITEDIR}/sync" "${WRITEDIR}/uring" > /dev/null && [ $(ls "${WRITEDIR}/uring" | wc -l) -eq ${NUMFILES} ] &&
+   grep -q "^${WRITESTR} 1$" "${WRITEDIR}/uring/file1.txt"
+then
+	rm -rf "${WRITEDIR}"
+	echo "success"
+	exit 0
+else
+	echo "failed: the files written with -u in ${WRITEDIR}/uring differ from ${WRITEDIR}/sync"
+	exit 1
+fi
@@ -13,17 +13,19 @@
 //
 
 //------------------------------------INCLUDES------------------------------------
-#include <syslog.h>
+#include "writer.h"
+#include "writerbatch.h"
+#include "writerlog.h"
+#include "writerevent.h"
+#include "writerfile.h"
+#include "writerappend.h"
+#include "writerserve.h"
+#include "writernet.h"
+#include "writersegment.h"
+#include "writerdedup.h"
+#include <stdlib.h>
 #include <stdio.h>
-
-//------------------------------------DEFINES-------------------------------------
-
-// Set to 1 to enable syslog logging
-#define ENABLE_LOGGING 1
-
-// Set tp 1 to enable non syslog terminal outputs
-#define ENABLE_PRINTING 0
-
+#include <string.h>
 
 //------------------------------PRIVATE DECLARATIONS------------------------------
 
@@ -31,9 +33,29 @@
  * @brief - Private function that implements writer.sh logic
  * @param - arg1 - The path to the file to write
  * @param - arg2 - The string to write to arg1
+ * @param - arg3 - How the file is placed, see writerfile.h
+ * @return - 0 for Success, 1 Otherwise
+ */
+int writer(const char* filePath, const char* writeString, enum writer_durability durability);
+
+/**
+ * @brief - Private function that writes a file through the $WRITER_DEDUP store
+ * @param - arg1 - The path to the file to write
+ * @param - arg2 - The string to write to arg1
+ * @return - 0 for Success, 1 Otherwise
+ */
+int writer_deduplicated(const char* filePath, const char* writeString);
+
+/**
+ * @brief - Private function that writes a copy of another file
+ * @param - arg1 - The path to the file to write
+ * @param - arg2 - The path to the file whose contents are written to arg1
+ * @param - arg3 - How the file is placed, see writerfile.h
+ * @param - arg4 - Whether the copy goes through the page cache, see writerfile.h
  * @return - 0 for Success, 1 Otherwise
  */
-int writer(const char* filePath, const char* writeString);
+int writer_from_file(const char* filePath, const char* sourcePath, enum writer_durability durability,
+		enum writer_cache cache);
 
 //--------------------------------------MAIN--------------------------------------
 
@@ -45,6 +67,96 @@ int writer(const char* filePath, const char* writeString);
  */
 int main(int argc, char *argv[])
 {
+	// With $WRITER_EVENTS set the write paths record binary events there instead of syslog messages
+	const char *events_path = getenv(WRITER_EVENTS_ENV);
+	if(ENABLE_LOGGING && events_path != NULL && *events_path != '\0')
+		writer_event_open(events_path);
+
+	// writer --batch [-0] [-j threads] [-v] [manifest] writes many files from one process
+	if(argc >= 2 && strcmp(argv[1], "--batch") == 0)
+	{
+		return writer_batch_main(argc - 1, argv + 1);
+	}
+
+	// writer --append [-b buffer] [-t flush_ms] [-P preallocate] [-T] [-S size] [-R seconds] [-k keep] [-z] writeFile
+	// streams stdin onto writeFile, optionally as rolling segments
+	if(argc >= 2 && strcmp(argv[1], "--append") == 0)
+	{
+		return writer_append_main(argc - 1, argv + 1);
+	}
+
+	// writer --tail [-n lines] [-f fromLine] writeFile reads back a segmented writeFile
+	if(argc >= 2 && strcmp(argv[1], "--tail") == 0)
+	{
+		return writer_segments_main(argc - 1, argv + 1);
+	}
+
+	// writer --serve [-u] socketPath runs the daemon the client shim below talks to
+	if(argc >= 2 && strcmp(argv[1], "--serve") == 0)
+	{
+		return writer_serve_main(argc - 1, argv + 1);
+	}
+
+	// writer --listen [-p port] [-w workers] [-r recentPackets] dataFile appends packets received over TCP
+	if(argc >= 2 && strcmp(argv[1], "--listen") == 0)
+	{
+		return writer_net_main(argc - 1, argv + 1);
+	}
+
+	// writer -d none|atomic|fdatasync|group writeFile writeStr picks a durability mode
+	enum writer_durability durability = WRITER_DURABILITY_NONE;
+	if(argc >= 3 && strcmp(argv[1], "-d") == 0)
+	{
+		if(!writer_durability_parse(argv[2], &durability))
+		{
+			fprintf(stderr, "Unknown durability mode %s, expected none, atomic, fdatasync or group\n", argv[2]);
+			return 1;
+		}
+		argc -= 2;
+		argv += 2;
+	}
+
+	// writer [-d mode] -c keep|direct|dontneed --from-file ... keeps a large copy out of the page cache
+	enum writer_cache cache = WRITER_CACHE_KEEP;
+	if(argc >= 3 && strcmp(argv[1], "-c") == 0)
+	{
+		if(!writer_cache_parse(argv[2], &cache))
+		{
+			fprintf(stderr, "Unknown cache mode %s, expected keep, direct or dontneed\n", argv[2]);
+			return 1;
+		}
+		argc -= 2;
+		argv += 2;
+	}
+
+	// writer [-d mode] -I ... writes a file of its own even when $WRITER_DEDUP is set
+	bool independent = false;
+	if(argc >= 2 && strcmp(argv[1], "-I") == 0)
+	{
+		independent = true;
+		argc--;
+		argv++;
+	}
+
+	// With $WRITER_DEDUP naming a store payloads are shared through it.  Anything else replaces its
+	// target rather than writing through what may be a link into the store, fdatasync as group.
+	const char *store = getenv(WRITER_DEDUP_ENV);
+	bool deduplicate = false;
+	if(store != NULL && *store != '\0')
+	{
+		deduplicate = !independent && (durability == WRITER_DURABILITY_NONE || durability == WRITER_DURABILITY_ATOMIC);
+		if(durability == WRITER_DURABILITY_NONE)
+			durability = WRITER_DURABILITY_ATOMIC;
+		else if(durability == WRITER_DURABILITY_FDATASYNC)
+			durability = WRITER_DURABILITY_GROUP;
+	}
+
+	// writer [-d mode] [-c cache] --from-file sourceFile writeFile places a copy of sourceFile, however large
+	if(argc == 4 && strcmp(argv[1], "--from-file") == 0)
+	{
+		return writer_from_file(argv[3], argv[2], durability, cache);
+	}
+
 	// If anything other than two arguments were passed to the script
 	if(argc != 3)
 	{
@@ -62,9 +174,8 @@ int main(int argc, char *argv[])
 		// If global file sysLogging is enabled
 		if(ENABLE_LOGGING)
 		{
-			// Open a Log and Log an Error Message
-			openlog(NULL, 0, LOG_USER);
-			syslog(LOG_ERR, "Invalid number of arguements.  This file accepts 2 arguments.");
+			// Queue an Error Message, it is sent to syslog at exit
+			writer_log(LOG_ERR, "Invalid number of arguements.  This file accepts 2 arguments.");
 		}
 		
 		// Return with error code
@@ -74,24 +185,45 @@ int main(int argc, char *argv[])
 	// Else we are safe to call the writer function
 	else
 	{
+		// The store does the write, the daemon does not deduplicate
+		if(deduplicate)
+			return writer_deduplicated(argv[1], argv[2]);
+
+		// With a daemon listening on $WRITER_SOCKET let it do the write, else do it ourselves
+		const char *socket_path = getenv(WRITER_SOCKET_ENV);
+		if(socket_path != NULL && *socket_path != '\0')
+		{
+			int status = writer_client_write(socket_path, WRITER_OP_WRITE, argv[1], argv[2], strlen(argv[2]), durability);
+			if(status == 1)
+			{
+				// The daemon failed the write, report it here like writer() would
+				if(ENABLE_PRINTING)
+				{
+					fprintf(stdout, "Error opening file %s", argv[1]);
+				}
+
+				if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_WRITE_FAILED, argv[1], strlen(argv[2])))
+				{
+					writer_log(LOG_ERR, "Unable to create the requested writeFile - %s", argv[1]);
+				}
+			}
+			if(status >= 0)
+				return status;
+		}
+
 		// argv[1] will contain the first argument passed to the file (filePath)
 		// argv[2] will contain the second argument passed to the file (writeStr)
-		return writer(argv[1], argv[2]);
+		return writer(argv[1], argv[2], durability);
 	}
 }
 
 //-------------------------------PRIVATE DEFINITIONS------------------------------
 
-int writer(const char* filePath, const char* writeStr)
+int writer(const char* filePath, const char* writeStr, enum writer_durability durability)
 {
-	// Lets create a file object to manipulate
-	FILE *outFile;
-
-	// Lets open the file for writing, if it exists, overwrite, else create
-	outFile = fopen(filePath, "w");
-	
-	// If the outFile did not open succesffully, we need to log error and exit
-	if(!outFile)
+	// Lets write the file, if it exists, overwrite, else create
+	// If the write did not succeed, we need to log error and exit
+	if(!writer_file_write(filePath, writeStr, strlen(writeStr), durability))
 	{
 		// Print the error to the terminal
 		if(ENABLE_PRINTING)
@@ -100,29 +232,84 @@ int writer(const char* filePath, const char* writeStr)
 		}
 
 		// Log the error to LOG_ERR
-		if(ENABLE_LOGGING)
+		if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_WRITE_FAILED, filePath, strlen(writeStr)))
 		{
-			openlog(NULL, 0, LOG_USER);
-			syslog(LOG_ERR, "Unable to create the requested writeFile - %s", filePath);
+			writer_log(LOG_ERR, "Unable to create the requested writeFile - %s", filePath);
 		}
 
 		return 1;
 	}
 	
-	// Else we can perform requested write
+	// Else the requested write was performed
 	else
 	{
 		// Log the write to LOG_DEBUG
-		if(ENABLE_LOGGING)
+		if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_WRITE, filePath, strlen(writeStr)))
 		{
-			openlog(NULL, 0, LOG_USER);
-			syslog(LOG_DEBUG, "Writing writeStr to writeFile");
+			writer_log(LOG_DEBUG, "Writing writeStr to writeFile");
 		}
 
-		// Perform the write, close the file, and exit with success
-		fputs(writeStr, outFile);
-		fclose(outFile);
 		return 0;
 	}
 }
 
+
+int writer_deduplicated(const char* filePath, const char* writeStr)
+{
+	// A store that can not be opened still leaves the write to be done, on its own
+	struct writer_dedup *dedup = writer_dedup_open_env();
+	if(dedup == NULL)
+		return writer(filePath, writeStr, WRITER_DURABILITY_ATOMIC);
+
+	bool success = writer_dedup_write(dedup, filePath, writeStr, strlen(writeStr));
+	writer_dedup_close(dedup);
+
+	if(!success)
+	{
+		if(ENABLE_PRINTING)
+		{
+			fprintf(stdout, "Error opening file %s", filePath);
+		}
+		if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_WRITE_FAILED, filePath, strlen(writeStr)))
+		{
+			writer_log(LOG_ERR, "Unable to create the requested writeFile - %s", filePath);
+		}
+		return 1;
+	}
+
+	if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_WRITE, filePath, strlen(writeStr)))
+	{
+		writer_log(LOG_DEBUG, "Writing writeStr to writeFile");
+	}
+	return 0;
+}
+
+int writer_from_file(const char* filePath, const char* sourcePath, enum writer_durability durability,
+		enum writer_cache cache)
+{
+	// Lets copy the source over, if the file exists, overwrite, else create
+	if(!writer_file_copy_uncached(filePath, sourcePath, durability, cache))
+	{
+		// Print the error to the terminal
+		if(ENABLE_PRINTING)
+		{
+			fprintf(stdout, "Error copying %s to file %s", sourcePath, filePath);
+		}
+
+		// Log the error to LOG_ERR
+		if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_COPY_FAILED, filePath, 0))
+		{
+			writer_log(LOG_ERR, "Unable to copy %s to the requested writeFile - %s", sourcePath, filePath);
+		}
+
+		return 1;
+	}
+
+	// Log the write to LOG_DEBUG
+	if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_COPY, filePath, 0))
+	{
+		writer_log(LOG_DEBUG, "Writing %s to writeFile", sourcePath);
+	}
+
+	return 0;
+}
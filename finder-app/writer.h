@@ -0,0 +1,15 @@
+// Settings shared by the Writer and its modes
+//
+
+#ifndef WRITER_H
+#define WRITER_H
+
+//------------------------------------DEFINES-------------------------------------
+
+// Set to 1 to enable syslog logging
+#define ENABLE_LOGGING 1
+
+// Set tp 1 to enable non syslog terminal outputs
+#define ENABLE_PRINTING 0
+
+#endif
@@ -0,0 +1,496 @@
+// This is a C File for the Writer streaming append mode, see writerappend.h
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "writer.h"
+#include "writerappend.h"
+#include "writerlog.h"
+#include "writerevent.h"
+#include "writersegment.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// "2026-01-31T23:59:59.123Z " plus its NUL
+#define STAMP_SIZE 26
+
+// Buffers are page aligned so they can also be handed to O_DIRECT
+#define APPEND_ALIGN 4096
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * @brief - Where a line starts in the buffer and when it was read, timestamps only
+ */
+struct line_mark
+{
+	size_t offset;
+	char stamp[STAMP_SIZE];
+};
+
+/**
+ * @brief - Everything the append loop carries around
+ */
+struct append_state
+{
+	const struct writer_append_options *options;
+	int fd;
+
+	// Set when writing segments instead of fd
+	struct writer_segments *segments;
+
+	char *buffer;
+	size_t size;
+	size_t used;
+
+	// When the oldest unflushed byte arrived (CLOCK_MONOTONIC)
+	struct timespec pending_since;
+
+	// Timestamps only, the lines starting in the buffer
+	struct line_mark *lines;
+	size_t line_count;
+	size_t line_capacity;
+	bool at_line_start;
+
+	// End of the file as of our last write, and how far ahead it has been preallocated
+	off_t file_end;
+	off_t allocated_end;
+	bool preallocate;
+};
+
+static volatile sig_atomic_t append_stop = 0;
+
+static void append_signal(int signal);
+static bool append_read(struct append_state *state, bool *eof);
+static bool append_flush(struct append_state *state, size_t upto);
+static size_t last_line_end(const struct append_state *state);
+static long ms_until_flush(const struct append_state *state);
+static bool parse_size(const char *text, size_t *size);
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+int writer_append_main(int argc, char *argv[])
+{
+	struct writer_append_options options = {
+		NULL, WRITER_APPEND_BUFFER_SIZE, WRITER_APPEND_FLUSH_MS, WRITER_APPEND_PREALLOCATE, false, 0, 0, 0, false
+	};
+	int opt;
+
+	// Skip "--append" itself
+	optind = 1;
+	while((opt = getopt(argc, argv, "b:t:P:TS:R:k:z")) != -1)
+	{
+		switch(opt)
+		{
+			case 'b':
+				if(!parse_size(optarg, &options.buffer_size) || options.buffer_size == 0)
+					goto usage;
+				break;
+			case 't':
+				options.flush_ms = atoi(optarg);
+				break;
+			case 'P':
+				if(!parse_size(optarg, &options.preallocate))
+					goto usage;
+				break;
+			case 'T':
+				options.timestamps = true;
+				break;
+			case 'S':
+				if(!parse_size(optarg, &options.segment_bytes))
+					goto usage;
+				break;
+			case 'R':
+				options.segment_seconds = atoi(optarg);
+				break;
+			case 'k':
+				options.keep = atoi(optarg);
+				break;
+			case 'z':
+				options.compress = true;
+				break;
+			default:
+				goto usage;
+		}
+	}
+
+	if(optind != argc - 1)
+		goto usage;
+	options.path = argv[optind];
+	return writer_append(&options);
+
+usage:
+	fprintf(stderr, "Usage: writer --append [-b buffer] [-t flush_ms] [-P preallocate] [-T] "
+			"[-S segmentSize] [-R segmentSeconds] [-k keep] [-z] writeFile\n");
+	return 1;
+}
+
+int writer_append(const struct writer_append_options *options)
+{
+	struct append_state state;
+	struct stat st;
+	int result = 1;
+
+	memset(&state, 0, sizeof(state));
+	state.options = options;
+	state.at_line_start = true;
+	state.preallocate = options->preallocate > 0;
+	state.size = options->buffer_size;
+	state.fd = -1;
+
+	// A segment rolls over between flushes, a buffer no larger than a segment keeps them close to size
+	if(options->segment_bytes > 0 && state.size > options->segment_bytes)
+		state.size = options->segment_bytes;
+	state.size = (state.size + APPEND_ALIGN - 1) & ~(size_t)(APPEND_ALIGN - 1);
+
+	if(ENABLE_LOGGING)
+		writer_log_open(true);
+
+	// Lets open the file for appending, else create, segments preallocate for themselves
+	if(options->segment_bytes > 0 || options->segment_seconds > 0)
+	{
+		struct writer_segment_options segment_options = {
+			options->path, options->segment_bytes, options->segment_seconds, options->keep, options->compress, options->preallocate
+		};
+		state.segments = writer_segments_open(&segment_options);
+		state.preallocate = false;
+		st.st_size = 0;
+	}
+	else
+		state.fd = open(options->path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+
+	if((state.segments == NULL && (state.fd < 0 || fstat(state.fd, &st) < 0)) ||
+	   posix_memalign((void **)&state.buffer, APPEND_ALIGN, state.size) != 0)
+	{
+		if(ENABLE_PRINTING)
+			fprintf(stdout, "Error opening file %s", options->path);
+		if(ENABLE_LOGGING)
+			writer_log(LOG_ERR, "Unable to create the requested writeFile - %s", options->path);
+		if(state.fd >= 0)
+			close(state.fd);
+		writer_segments_close(state.segments);
+		return 1;
+	}
+	state.file_end = st.st_size;
+	state.allocated_end = st.st_size;
+
+	if(ENABLE_LOGGING)
+		writer_log(LOG_DEBUG, "Appending stdin to %s", options->path);
+
+	// SIGINT and SIGTERM end the stream like EOF does, without SA_RESTART so poll() returns
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = append_signal;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	bool eof = false;
+	bool success = true;
+	while(success && !eof && !append_stop)
+	{
+		struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+		int ready = poll(&pfd, 1, state.used > 0 ? ms_until_flush(&state) : -1);
+		if(ready < 0 && errno != EINTR)
+			break;
+
+		if(ready > 0)
+			success = append_read(&state, &eof);
+
+		// Full buffer, write what we can and keep a trailing partial line for later
+		if(success && state.used == state.size)
+		{
+			size_t upto = last_line_end(&state);
+			success = append_flush(&state, upto ? upto : state.used);
+		}
+
+		// Timed flush, whole lines only
+		if(success && state.used > 0 && ms_until_flush(&state) == 0)
+		{
+			size_t upto = last_line_end(&state);
+			if(upto > 0)
+				success = append_flush(&state, upto);
+			else
+				clock_gettime(CLOCK_MONOTONIC, &state.pending_since);
+		}
+	}
+
+	// EOF or a signal, everything left goes out, a partial last line included
+	if(success && state.used > 0)
+		success = append_flush(&state, state.used);
+
+	if(!success)
+	{
+		if(ENABLE_PRINTING)
+			fprintf(stdout, "Error appending to file %s", options->path);
+		if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_APPEND_FAILED, options->path, state.used))
+			writer_log(LOG_ERR, "Unable to append to the requested writeFile - %s", options->path);
+	}
+	else
+		result = 0;
+
+	if(state.segments != NULL ? writer_segments_close(state.segments) != 0 : close(state.fd) != 0)
+		result = 1;
+	free(state.buffer);
+	free(state.lines);
+	return result;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static void append_signal(int signal)
+{
+	(void)signal;
+	append_stop = 1;
+}
+
+/**
+ * @brief - Remember that a line starts at offset, stamped with now
+ */
+static bool mark_line(struct append_state *state, size_t offset, const struct timespec *now)
+{
+	if(state->line_count == state->line_capacity)
+	{
+		size_t grown_capacity = state->line_capacity ? state->line_capacity * 2 : 256;
+		struct line_mark *grown = realloc(state->lines, grown_capacity * sizeof(*grown));
+		if(grown == NULL)
+			return false;
+		state->lines = grown;
+		state->line_capacity = grown_capacity;
+	}
+
+	struct line_mark *mark = &state->lines[state->line_count++];
+	struct tm tm;
+	mark->offset = offset;
+	gmtime_r(&now->tv_sec, &tm);
+	size_t length = strftime(mark->stamp, sizeof(mark->stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+	snprintf(mark->stamp + length, sizeof(mark->stamp) - length, ".%03ldZ ", now->tv_nsec / 1000000);
+	return true;
+}
+
+/**
+ * @brief - Read whatever stdin has into the free end of the buffer
+ * @return - false on a read error
+ */
+static bool append_read(struct append_state *state, bool *eof)
+{
+	ssize_t got = read(STDIN_FILENO, state->buffer + state->used, state->size - state->used);
+	if(got < 0)
+		return errno == EINTR || errno == EAGAIN;
+	if(got == 0)
+	{
+		*eof = true;
+		return true;
+	}
+
+	if(state->used == 0)
+		clock_gettime(CLOCK_MONOTONIC, &state->pending_since);
+
+	if(state->options->timestamps)
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		char *cursor = state->buffer + state->used;
+		char *end = cursor + got;
+		while(cursor < end)
+		{
+			if(state->at_line_start && !mark_line(state, cursor - state->buffer, &now))
+				return false;
+
+			char *newline = memchr(cursor, '\n', end - cursor);
+			state->at_line_start = newline != NULL;
+			cursor = newline ? newline + 1 : end;
+		}
+	}
+
+	state->used += got;
+	return true;
+}
+
+/**
+ * @brief - writev() all of iov, picking up after short writes
+ */
+static bool write_iov(struct append_state *state, struct iovec *iov, int count)
+{
+	if(state->segments != NULL)
+		return writer_segments_write(state->segments, iov, count);
+
+	while(count > 0)
+	{
+		ssize_t put = writev(state->fd, iov, count);
+		if(put < 0 && errno == EINTR)
+			continue;
+		if(put <= 0)
+			return false;
+
+		while(count > 0 && (size_t)put >= iov->iov_len)
+		{
+			put -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + put;
+			iov->iov_len -= put;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief - Keep preallocated space ahead of the end of the file
+ */
+static void append_preallocate(struct append_state *state, size_t incoming)
+{
+	if(!state->preallocate || state->file_end + (off_t)incoming <= state->allocated_end)
+		return;
+
+	// KEEP_SIZE reserves the blocks without moving EOF, so O_APPEND still lands right after the data
+	off_t length = (off_t)(incoming > state->options->preallocate ? incoming : state->options->preallocate);
+	if(fallocate(state->fd, FALLOC_FL_KEEP_SIZE, state->file_end, length) == 0)
+		state->allocated_end = state->file_end + length;
+	else if(errno == EOPNOTSUPP || errno == ENOSYS)
+		state->preallocate = false;
+}
+
+/**
+ * @brief - Append the first upto bytes of the buffer and move the rest to the front
+ * @return - false on a write error
+ */
+static bool append_flush(struct append_state *state, size_t upto)
+{
+	struct iovec iov[IOV_MAX];
+	size_t written_lines = 0;
+	bool success = true;
+
+	append_preallocate(state, upto + state->line_count * (STAMP_SIZE - 1));
+
+	if(!state->options->timestamps)
+	{
+		iov[0].iov_base = state->buffer;
+		iov[0].iov_len = upto;
+		success = write_iov(state, iov, 1);
+	}
+	else
+	{
+		// Stamp and line alternate, the lines are never copied to sit next to their stamps
+		size_t offset = 0;
+		while(success && offset < upto)
+		{
+			int count = 0;
+			while(offset < upto && count + 2 <= IOV_MAX)
+			{
+				if(written_lines < state->line_count && state->lines[written_lines].offset == offset)
+				{
+					iov[count].iov_base = state->lines[written_lines].stamp;
+					iov[count].iov_len = STAMP_SIZE - 1;
+					count++;
+					written_lines++;
+				}
+
+				size_t next = written_lines < state->line_count ? state->lines[written_lines].offset : upto;
+				if(next > upto)
+					next = upto;
+				iov[count].iov_base = state->buffer + offset;
+				iov[count].iov_len = next - offset;
+				count++;
+				offset = next;
+			}
+			success = write_iov(state, iov, count);
+		}
+	}
+
+	if(!success)
+		return false;
+	if(ENABLE_LOGGING)
+		writer_event(WRITER_EVENT_APPEND, state->options->path, upto);
+
+	// With O_APPEND the offset is the end of the file, whoever else is appending
+	off_t end = state->fd >= 0 ? lseek(state->fd, 0, SEEK_CUR) : -1;
+	state->file_end = end >= 0 ? end : state->file_end + (off_t)upto;
+
+	// Keep the unwritten tail and the marks of the lines in it
+	memmove(state->buffer, state->buffer + upto, state->used - upto);
+	state->used -= upto;
+
+	size_t i;
+	for(i = written_lines; i < state->line_count; i++)
+	{
+		state->lines[i - written_lines] = state->lines[i];
+		state->lines[i - written_lines].offset -= upto;
+	}
+	state->line_count -= written_lines;
+
+	if(state->used > 0)
+		clock_gettime(CLOCK_MONOTONIC, &state->pending_since);
+	return true;
+}
+
+/**
+ * @brief - Length of the buffer up to and including its last newline, 0 if there is none
+ */
+static size_t last_line_end(const struct append_state *state)
+{
+	char *newline = memrchr(state->buffer, '\n', state->used);
+	return newline ? (size_t)(newline - state->buffer) + 1 : 0;
+}
+
+/**
+ * @brief - Milliseconds until the pending data is due, -1 if there is no flush interval
+ */
+static long ms_until_flush(const struct append_state *state)
+{
+	if(state->options->flush_ms <= 0)
+		return -1;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long elapsed = (now.tv_sec - state->pending_since.tv_sec) * 1000 +
+			(now.tv_nsec - state->pending_since.tv_nsec) / 1000000;
+	return elapsed >= state->options->flush_ms ? 0 : state->options->flush_ms - elapsed;
+}
+
+/**
+ * @brief - Parse a size with an optional K, M or G suffix
+ */
+static bool parse_size(const char *text, size_t *size)
+{
+	char *end;
+	unsigned long long value = strtoull(text, &end, 10);
+
+	if(end == text)
+		return false;
+	switch(*end)
+	{
+		case 'G': case 'g':
+			value <<= 10;
+			// fall through
+		case 'M': case 'm':
+			value <<= 10;
+			// fall through
+		case 'K': case 'k':
+			value <<= 10;
+			end++;
+			break;
+	}
+	if(*end != '\0')
+		return false;
+
+	*size = (size_t)value;
+	return true;
+}
@@ -0,0 +1,74 @@
+// Streaming append mode for the Writer
+//
+// writer --append reads stdin until EOF and appends it to writeFile (O_APPEND), so a
+// log collector can pipe lines into one writer instead of running one writer per line.
+// Input collects in a large page aligned buffer that is flushed when it fills or when
+// the oldest unflushed byte is older than the flush interval.  Only whole lines are
+// written, except at EOF or when a single line outgrows the buffer, so several
+// appenders to one file never split each other's lines.  Space is preallocated ahead
+// of the end of the file with fallocate() to keep the file in few extents, it stays
+// reserved for the next appender after we exit.
+//
+// With -S size or -R seconds writeFile is written as segments that roll over at that
+// size or age, -k keeps that many closed segments and -z compresses them, see
+// writersegment.h.
+//
+
+#ifndef WRITERAPPEND_H
+#define WRITERAPPEND_H
+
+//------------------------------------INCLUDES------------------------------------
+#include <stdbool.h>
+#include <stddef.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Defaults for struct writer_append_options
+#define WRITER_APPEND_BUFFER_SIZE (1024 * 1024)
+#define WRITER_APPEND_FLUSH_MS 1000
+#define WRITER_APPEND_PREALLOCATE (16 * 1024 * 1024)
+
+//------------------------------PUBLIC DECLARATIONS-------------------------------
+
+/**
+ * @brief - Options for writer_append()
+ */
+struct writer_append_options
+{
+	// File to append to, created if it does not exist
+	const char *path;
+
+	// Buffer size in bytes, rounded up to a whole page
+	size_t buffer_size;
+
+	// Flush buffered lines once they are this old, 0 flushes only when the buffer is full
+	int flush_ms;
+
+	// Bytes to preallocate past the end of the file at a time, 0 disables preallocation
+	size_t preallocate;
+
+	// Prefix each line with the time it was read (ISO 8601, UTC), written with writev()
+	bool timestamps;
+
+	// Segment writeFile by size or age, both 0 for one plain file
+	size_t segment_bytes;
+	int segment_seconds;
+
+	// Segments only, closed segments kept (0 for all) and whether they are compressed
+	int keep;
+	bool compress;
+};
+
+/**
+ * @brief - Append stdin to options->path until EOF, SIGINT or SIGTERM
+ * @return - 0 for Success, 1 Otherwise
+ */
+int writer_append(const struct writer_append_options *options);
+
+/**
+ * @brief - Parse the append mode command line, argv[0] being "--append", and run it
+ * @return - 0 for Success, 1 Otherwise
+ */
+int writer_append_main(int argc, char *argv[]);
+
+#endif
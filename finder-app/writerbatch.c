@@ -0,0 +1,698 @@
+// This is a C File for the Writer batch mode, see writerbatch.h
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "writer.h"
+#include "writerbatch.h"
+#include "writerlog.h"
+#include "writerevent.h"
+#include "writeruring.h"
+#include "writerdedup.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Records a worker claims at a time, keeps the shared counter off the hot path
+#define BATCH_CHUNK 64
+
+// Initial size of the buffer stdin is read into
+#define BATCH_READ_SIZE (64 * 1024)
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * @brief - One (path, content) pair, both point into the manifest buffer
+ */
+struct batch_record
+{
+	const char *path;
+	const char *content;
+	size_t length;
+
+	// A later record has the same path, only that one is written
+	bool superseded;
+};
+
+/**
+ * @brief - What the workers do on a pass over the records
+ */
+enum batch_phase
+{
+	// Write each record with the batch's durability mode, group mode only stages it
+	BATCH_WRITE,
+
+	// Group mode, rename the staged records into place
+	BATCH_COMMIT,
+};
+
+/**
+ * @brief - Everything the workers share
+ */
+struct batch_job
+{
+	struct batch_record *records;
+	size_t count;
+	enum writer_durability durability;
+	enum batch_phase phase;
+
+	// Workers try io_uring for the write phase, and how many got a ring
+	bool uring;
+	atomic_long uring_workers;
+
+	// Records are placed as links into this store, NULL to write them
+	struct writer_dedup *dedup;
+
+	// Group mode, the staged temporary of each record
+	struct writer_staged *staged;
+
+	// Whether each record made it through the last phase
+	bool *placed;
+
+	// Next record to hand out
+	atomic_size_t next;
+
+	// Totals, for the summary and exit status
+	atomic_size_t failures;
+	atomic_size_t bytes;
+};
+
+/**
+ * @brief - The manifest contents and how to release them
+ */
+struct batch_manifest
+{
+	char *data;
+	size_t length;
+	bool mapped;
+};
+
+static bool manifest_load(const char *path, struct batch_manifest *manifest);
+static void manifest_release(struct batch_manifest *manifest);
+static bool manifest_parse(struct batch_manifest *manifest, bool nul_separated,
+		struct batch_record **records, size_t *count);
+static bool mark_superseded(struct batch_record *records, size_t count);
+static void *batch_worker(void *arg);
+static long run_phase(struct batch_job *job, enum batch_phase phase, long threads);
+static bool sync_placed(const struct batch_job *job, bool staged);
+static double seconds_since(const struct timespec *start);
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+int writer_batch_main(int argc, char *argv[])
+{
+	struct writer_batch_options options = { NULL, false, 0, false, WRITER_DURABILITY_NONE, false, false };
+	int opt;
+
+	// Skip "--batch" itself
+	optind = 1;
+	while((opt = getopt(argc, argv, "0d:Ij:uv")) != -1)
+	{
+		switch(opt)
+		{
+			case 'd':
+				if(!writer_durability_parse(optarg, &options.durability))
+				{
+					fprintf(stderr, "Unknown durability mode %s, expected none, atomic, fdatasync or group\n", optarg);
+					return 1;
+				}
+				break;
+			case '0':
+				options.nul_separated = true;
+				break;
+			case 'I':
+				options.independent = true;
+				break;
+			case 'j':
+				options.threads = atoi(optarg);
+				break;
+			case 'u':
+				options.uring = true;
+				break;
+			case 'v':
+				options.verbose = true;
+				break;
+			default:
+				fprintf(stderr, "Usage: writer --batch [-0] [-d durability] [-I] [-j threads] [-u] [-v] [manifest]\n");
+				return 1;
+		}
+	}
+
+	if(optind < argc)
+		options.manifest = argv[optind];
+
+	return writer_batch(&options);
+}
+
+int writer_batch(const struct writer_batch_options *options)
+{
+	struct batch_manifest manifest;
+	struct batch_record *records = NULL;
+	size_t count = 0;
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// Records are sent to syslog by a background thread, the workers only queue them
+	if(ENABLE_LOGGING)
+		writer_log_open(true);
+
+	if(!manifest_load(options->manifest, &manifest))
+	{
+		if(ENABLE_PRINTING)
+			fprintf(stderr, "Unable to read the manifest %s\n", options->manifest ? options->manifest : "-");
+		if(ENABLE_LOGGING)
+			writer_log(LOG_ERR, "Unable to read the batch manifest - %s", options->manifest ? options->manifest : "-");
+		return 1;
+	}
+
+	if(!manifest_parse(&manifest, options->nul_separated, &records, &count))
+	{
+		if(ENABLE_LOGGING)
+			writer_log(LOG_ERR, "Malformed batch manifest - %s", options->manifest ? options->manifest : "-");
+		fprintf(stderr, "Malformed manifest, expected path<TAB>content records\n");
+		manifest_release(&manifest);
+		return 1;
+	}
+
+	if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_BATCH, options->manifest, count))
+		writer_log(LOG_DEBUG, "Writing %zu files from a batch manifest", count);
+
+	// Two workers must never write one path at once, the last record of each path is the
+	// only one written, as if the manifest had been written in order.  Without the memory to
+	// tell, a single thread writes every record in order.
+	bool ordered = !mark_superseded(records, count);
+
+	struct batch_job job;
+	job.records = records;
+	job.count = count;
+	job.durability = options->durability;
+	job.dedup = NULL;
+
+	// With a $WRITER_DEDUP store records are linked to it, anything else replaces its target rather
+	// than writing through what may be a link into the store, fdatasync as group
+	const char *store = getenv(WRITER_DEDUP_ENV);
+	if(store != NULL && *store != '\0')
+	{
+		if(!options->independent &&
+		   (job.durability == WRITER_DURABILITY_NONE || job.durability == WRITER_DURABILITY_ATOMIC))
+			job.dedup = writer_dedup_open_env();
+		if(job.durability == WRITER_DURABILITY_NONE)
+			job.durability = WRITER_DURABILITY_ATOMIC;
+		else if(job.durability == WRITER_DURABILITY_FDATASYNC)
+			job.durability = WRITER_DURABILITY_GROUP;
+	}
+
+	job.uring = options->uring && job.durability == WRITER_DURABILITY_NONE;
+	atomic_init(&job.uring_workers, 0);
+	job.staged = NULL;
+	job.placed = calloc(count ? count : 1, sizeof(*job.placed));
+	atomic_init(&job.next, 0);
+	atomic_init(&job.failures, 0);
+	atomic_init(&job.bytes, 0);
+	if(job.placed == NULL)
+	{
+		writer_dedup_close(job.dedup);
+		free(records);
+		manifest_release(&manifest);
+		return 1;
+	}
+
+	// One thread per CPU by default, never more threads than chunks of work
+	long threads = options->threads;
+	if(threads <= 0)
+	{
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if(threads > WRITER_BATCH_MAX_THREADS)
+			threads = WRITER_BATCH_MAX_THREADS;
+	}
+	if(threads > (long)((count + BATCH_CHUNK - 1) / BATCH_CHUNK))
+		threads = (long)((count + BATCH_CHUNK - 1) / BATCH_CHUNK);
+	if(threads < 1 || ordered)
+		threads = 1;
+
+	long started;
+	if(job.durability != WRITER_DURABILITY_GROUP)
+		started = run_phase(&job, BATCH_WRITE, threads);
+	else
+	{
+		// Group commit: stage everything, one syncfs() so the data is down before any rename,
+		// rename everything, one more syncfs() for the renames
+		job.staged = calloc(count ? count : 1, sizeof(*job.staged));
+		if(job.staged == NULL)
+		{
+			writer_dedup_close(job.dedup);
+			free(job.placed);
+			free(records);
+			manifest_release(&manifest);
+			return 1;
+		}
+
+		started = run_phase(&job, BATCH_WRITE, threads);
+		if(!sync_placed(&job, true))
+		{
+			// Nothing was renamed, the targets still hold their old contents
+			size_t i;
+			for(i = 0; i < count; i++)
+				writer_file_abort(&job.staged[i]);
+			atomic_store(&job.failures, count);
+			if(ENABLE_LOGGING)
+				writer_log(LOG_ERR, "Unable to sync the staged batch, no file was replaced");
+		}
+		else
+		{
+			run_phase(&job, BATCH_COMMIT, threads);
+			if(!sync_placed(&job, false))
+			{
+				atomic_store(&job.failures, count);
+				if(ENABLE_LOGGING)
+					writer_log(LOG_ERR, "Unable to sync the committed batch");
+			}
+		}
+		free(job.staged);
+	}
+
+	size_t failures = atomic_load(&job.failures);
+	if(options->verbose)
+	{
+		double elapsed = seconds_since(&start);
+		struct writer_log_counters log;
+		writer_log_get_counters(&log);
+		fprintf(stderr, "wrote %zu of %zu files, %zu bytes in %.3fs (%.0f files/s, %s, %ld threads, "
+				"%ld on io_uring, %lu log records dropped)\n",
+				count - failures, count, atomic_load(&job.bytes), elapsed,
+				elapsed > 0 ? (count - failures) / elapsed : 0.0, writer_durability_name(job.durability),
+				started, atomic_load(&job.uring_workers), log.dropped);
+
+		if(job.dedup != NULL)
+		{
+			struct writer_dedup_counters dedup;
+			writer_dedup_get_counters(job.dedup, &dedup);
+			fprintf(stderr, "linked %lu files to the store, %lu new blobs, %lu written on their own, %llu bytes not written\n",
+					dedup.linked, dedup.blobs, dedup.independent, dedup.bytes_saved);
+		}
+	}
+	writer_dedup_close(job.dedup);
+
+	free(job.placed);
+	free(records);
+	manifest_release(&manifest);
+	return failures == 0 ? 0 : 1;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static bool manifest_load(const char *path, struct batch_manifest *manifest)
+{
+	memset(manifest, 0, sizeof(*manifest));
+
+	int fd = STDIN_FILENO;
+	if(path != NULL && strcmp(path, "-") != 0)
+	{
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(fd < 0)
+			return false;
+
+		// A regular file is mapped privately, parsing edits it in place without touching the file
+		struct stat st;
+		if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+		{
+			void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if(data != MAP_FAILED)
+			{
+				close(fd);
+				madvise(data, st.st_size, MADV_SEQUENTIAL);
+				manifest->data = data;
+				manifest->length = st.st_size;
+				manifest->mapped = true;
+				return true;
+			}
+		}
+	}
+
+	// Pipes and anything we could not map are read into a growing buffer
+	size_t capacity = 0;
+	ssize_t got;
+	do
+	{
+		if(manifest->length == capacity)
+		{
+			size_t grown_capacity = capacity ? capacity * 2 : BATCH_READ_SIZE;
+			char *grown = realloc(manifest->data, grown_capacity);
+			if(grown == NULL)
+			{
+				got = -1;
+				break;
+			}
+			manifest->data = grown;
+			capacity = grown_capacity;
+		}
+
+		got = read(fd, manifest->data + manifest->length, capacity - manifest->length);
+		if(got > 0)
+			manifest->length += got;
+	} while(got > 0 || (got < 0 && errno == EINTR));
+
+	if(fd != STDIN_FILENO)
+		close(fd);
+	if(got < 0)
+	{
+		free(manifest->data);
+		manifest->data = NULL;
+		return false;
+	}
+	return true;
+}
+
+static void manifest_release(struct batch_manifest *manifest)
+{
+	if(manifest->mapped)
+		munmap(manifest->data, manifest->length);
+	else
+		free(manifest->data);
+	manifest->data = NULL;
+}
+
+/**
+ * @brief - Decode \n, \t and \\ in place
+ * @return - The decoded length
+ */
+static size_t unescape(char *text, size_t length)
+{
+	size_t in;
+	size_t out = 0;
+
+	for(in = 0; in < length; in++)
+	{
+		if(text[in] == '\\' && in + 1 < length)
+		{
+			switch(text[in + 1])
+			{
+				case 'n':
+					text[out++] = '\n';
+					in++;
+					continue;
+				case 't':
+					text[out++] = '\t';
+					in++;
+					continue;
+				case '\\':
+					text[out++] = '\\';
+					in++;
+					continue;
+			}
+		}
+		text[out++] = text[in];
+	}
+	return out;
+}
+
+static bool manifest_parse(struct batch_manifest *manifest, bool nul_separated,
+		struct batch_record **records, size_t *count)
+{
+	char *cursor = manifest->data;
+	char *end = manifest->data + manifest->length;
+	char separator = nul_separated ? '\0' : '\n';
+	size_t capacity = 0;
+
+	*records = NULL;
+	*count = 0;
+
+	while(cursor < end)
+	{
+		char *record_end = memchr(cursor, separator, end - cursor);
+		struct batch_record record;
+
+		// Skip blank lines, a manifest built by a shell loop often ends with one
+		if(!nul_separated && (record_end == cursor || *cursor == '\r') &&
+		   (record_end ? record_end : end) - cursor <= 1)
+		{
+			cursor = record_end ? record_end + 1 : end;
+			continue;
+		}
+
+		if(nul_separated)
+		{
+			// path\0content\0, the content must be terminated too
+			char *content = record_end ? record_end + 1 : end;
+			char *content_end = content < end ? memchr(content, '\0', end - content) : NULL;
+			if(record_end == NULL || content_end == NULL || record_end == cursor)
+				goto malformed;
+
+			record.path = cursor;
+			record.content = content;
+			record.length = content_end - content;
+			cursor = content_end + 1;
+		}
+		else
+		{
+			// The last line may be unterminated, it is still a record
+			if(record_end == NULL)
+				record_end = end;
+			char *tab = memchr(cursor, '\t', record_end - cursor);
+			if(tab == NULL || tab == cursor)
+				goto malformed;
+
+			// Terminate the path in place, the mapping is private so the file is untouched
+			*tab = '\0';
+			record.path = cursor;
+			record.content = tab + 1;
+			size_t length = record_end - (tab + 1);
+			if(length > 0 && record.content[length - 1] == '\r')
+				length--;
+			record.length = unescape(tab + 1, length);
+			cursor = record_end + 1;
+		}
+
+		if(*count == capacity)
+		{
+			size_t grown_capacity = capacity ? capacity * 2 : 1024;
+			struct batch_record *grown = realloc(*records, grown_capacity * sizeof(*grown));
+			if(grown == NULL)
+				goto malformed;
+			*records = grown;
+			capacity = grown_capacity;
+		}
+		record.superseded = false;
+		(*records)[(*count)++] = record;
+	}
+	return true;
+
+malformed:
+	free(*records);
+	*records = NULL;
+	*count = 0;
+	return false;
+}
+
+/**
+ * @brief - Flag every record whose path a later record of the manifest writes again
+ * @return - true for Success, false if there was no memory to find them
+ */
+static bool mark_superseded(struct batch_record *records, size_t count)
+{
+	// Open addressing over record indexes, at most half full
+	size_t size = 16;
+	while(size < count * 2)
+		size *= 2;
+	size_t *table = malloc(size * sizeof(*table));
+	if(table == NULL)
+		return false;
+	memset(table, 0xff, size * sizeof(*table));
+
+	size_t i = count;
+	while(i-- > 0)
+	{
+		// FNV-1a of the path
+		const unsigned char *byte;
+		uint64_t hash = 14695981039346656037ULL;
+		for(byte = (const unsigned char *)records[i].path; *byte != '\0'; byte++)
+			hash = (hash ^ *byte) * 1099511628211ULL;
+
+		size_t slot = hash & (size - 1);
+		while(table[slot] != SIZE_MAX && strcmp(records[table[slot]].path, records[i].path) != 0)
+			slot = (slot + 1) & (size - 1);
+		if(table[slot] != SIZE_MAX)
+			records[i].superseded = true;
+		else
+			table[slot] = i;
+	}
+	free(table);
+	return true;
+}
+
+/**
+ * @brief - Place one record for the current phase
+ * @return - true for Success, false Otherwise
+ */
+static bool place_record(struct batch_job *job, size_t index)
+{
+	const struct batch_record *record = &job->records[index];
+
+	switch(job->phase)
+	{
+		case BATCH_WRITE:
+			if(job->dedup != NULL)
+				return writer_dedup_write(job->dedup, record->path, record->content, record->length);
+			if(job->durability == WRITER_DURABILITY_GROUP)
+				return writer_file_stage(record->path, record->content, record->length, &job->staged[index]);
+			return writer_file_write(record->path, record->content, record->length, job->durability);
+
+		case BATCH_COMMIT:
+			// A record that failed to stage stays unplaced, it has already been counted
+			if(!job->placed[index])
+				return false;
+			return writer_file_commit(record->path, &job->staged[index]);
+	}
+	return false;
+}
+
+static void *batch_worker(void *arg)
+{
+	struct batch_job *job = arg;
+	struct writer_uring *ring = NULL;
+	size_t failures = 0;
+	size_t bytes = 0;
+
+	// A ring per worker, none to be had leaves this worker on the synchronous path
+	if(job->uring && job->phase == BATCH_WRITE)
+	{
+		ring = writer_uring_open(0);
+		if(ring != NULL)
+			atomic_fetch_add(&job->uring_workers, 1);
+	}
+
+	for(;;)
+	{
+		size_t first = atomic_fetch_add_explicit(&job->next, BATCH_CHUNK, memory_order_relaxed);
+		if(first >= job->count)
+			break;
+
+		size_t last = first + BATCH_CHUNK < job->count ? first + BATCH_CHUNK : job->count;
+		size_t i;
+
+		// The whole chunk goes through the ring, whatever fails there is redone below
+		struct writer_uring_file files[BATCH_CHUNK];
+		size_t slots[BATCH_CHUNK];
+		if(ring != NULL)
+		{
+			size_t submitted = 0;
+			for(i = first; i < last; i++)
+			{
+				if(job->records[i].superseded)
+					continue;
+				files[submitted].path = job->records[i].path;
+				files[submitted].data = job->records[i].content;
+				files[submitted].length = job->records[i].length;
+				slots[i - first] = submitted++;
+			}
+			writer_uring_write(ring, files, submitted);
+		}
+
+		for(i = first; i < last; i++)
+		{
+			// Replaced by a later record anyway, it is neither written nor a failure
+			if(job->records[i].superseded)
+				continue;
+
+			bool was_placed = job->placed[i];
+			job->placed[i] = (ring != NULL && files[slots[i - first]].error == 0) || place_record(job, i);
+			if(job->placed[i])
+			{
+				if(job->phase == BATCH_WRITE)
+					bytes += job->records[i].length;
+				continue;
+			}
+
+			// Only report a record once, on the phase it first failed in
+			if(job->phase == BATCH_COMMIT && !was_placed)
+				continue;
+
+			failures++;
+			if(ENABLE_PRINTING)
+				fprintf(stdout, "Error writing file %s", job->records[i].path);
+			if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_WRITE_FAILED, job->records[i].path, job->records[i].length))
+				writer_log(LOG_ERR, "Unable to create the requested writeFile - %s", job->records[i].path);
+		}
+	}
+
+	writer_uring_close(ring);
+	atomic_fetch_add(&job->failures, failures);
+	atomic_fetch_add(&job->bytes, bytes);
+	return NULL;
+}
+
+/**
+ * @brief - Run one phase over every record on up to threads threads
+ * @return - The number of threads that ran, the caller included
+ */
+static long run_phase(struct batch_job *job, enum batch_phase phase, long threads)
+{
+	job->phase = phase;
+	atomic_store(&job->next, 0);
+
+	// The calling thread is worker 0, any thread we fail to start just leaves it more to do
+	pthread_t workers[threads];
+	long started = 0;
+	long i;
+	for(i = 1; i < threads; i++)
+	{
+		if(pthread_create(&workers[started], NULL, batch_worker, job) == 0)
+			started++;
+	}
+	batch_worker(job);
+	for(i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+	return started + 1;
+}
+
+/**
+ * @brief - syncfs() each filesystem holding a placed record once
+ * @param - staged - Sync through the staged temporaries rather than the final paths
+ * @return - true if every sync succeeded
+ */
+static bool sync_placed(const struct batch_job *job, bool staged)
+{
+	// Batches rarely span more than a filesystem or two, a short list is enough
+	dev_t synced[16];
+	size_t synced_count = 0;
+	bool success = true;
+	size_t i;
+
+	for(i = 0; i < job->count; i++)
+	{
+		if(!job->placed[i])
+			continue;
+
+		size_t j;
+		for(j = 0; j < synced_count && synced[j] != job->staged[i].dev; j++)
+			;
+		if(j < synced_count)
+			continue;
+
+		if(!writer_file_syncfs(staged ? job->staged[i].temp : job->records[i].path))
+			success = false;
+		if(synced_count < sizeof(synced) / sizeof(synced[0]))
+			synced[synced_count++] = job->staged[i].dev;
+	}
+	return success;
+}
+
+static double seconds_since(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -0,0 +1,72 @@
+// Batch mode for the Writer
+//
+// Writes many (path, content) records from a single process instead of one writer
+// process per file.  The manifest is read from a file or stdin and the open/write/close
+// of the records is spread over a small pool of threads.  With -u each thread drives an
+// io_uring instead (see writeruring.h), durability mode none only, falling back to the
+// synchronous path where io_uring is not available.  With $WRITER_DEDUP set records
+// share their payloads through the store (see writerdedup.h) unless -I is given.  A path
+// given more than once gets the contents of its last record, as if the records were
+// written one after another; the earlier ones are skipped.
+//
+// Manifest formats
+//  Lines (default) - One record per line, "path<TAB>content".  The content may use the
+//                    escapes \n, \t and \\ so records can span lines.
+//  NUL (-0)        - "path\0content\0" repeated, the content is written byte for byte.
+//
+
+#ifndef WRITERBATCH_H
+#define WRITERBATCH_H
+
+//------------------------------------INCLUDES------------------------------------
+#include <stdbool.h>
+#include "writerfile.h"
+
+//------------------------------------DEFINES-------------------------------------
+
+// Most threads batch mode will use by default
+#define WRITER_BATCH_MAX_THREADS 8
+
+//------------------------------PUBLIC DECLARATIONS-------------------------------
+
+/**
+ * @brief - Options for writer_batch()
+ */
+struct writer_batch_options
+{
+	// Path to the manifest, NULL or "-" for stdin
+	const char *manifest;
+
+	// Records are NUL separated rather than one per line
+	bool nul_separated;
+
+	// Number of worker threads, 0 picks one per CPU up to WRITER_BATCH_MAX_THREADS
+	int threads;
+
+	// Print a throughput summary to stderr when done
+	bool verbose;
+
+	// How each file is placed, group syncs the whole batch with two syncfs() calls
+	enum writer_durability durability;
+
+	// Write through io_uring where it is available, durability mode none only
+	bool uring;
+
+	// Do not share payloads through the $WRITER_DEDUP store, every file gets its own
+	bool independent;
+};
+
+/**
+ * @brief - Write every record of a manifest, each file is overwritten or created
+ * @param - options - See struct writer_batch_options
+ * @return - 0 if every record was written, 1 Otherwise
+ */
+int writer_batch(const struct writer_batch_options *options);
+
+/**
+ * @brief - Parse the batch mode command line, argv[0] being "--batch", and run it
+ * @return - 0 for Success, 1 Otherwise
+ */
+int writer_batch_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,286 @@
+// This is a C File for the Writer content deduplicating writes, see writerdedup.h
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "writerdedup.h"
+#include "writerfile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Blobs remembered as already checked against their payload, must be a power of two
+#define DEDUP_CACHE_SIZE 64
+
+// Blobs are read only for everyone, a target is the blob itself
+#define DEDUP_BLOB_MODE 0444
+
+// Generations of one payload, a new one is started when a blob has all the links it can take
+#define DEDUP_GENERATIONS 65536
+
+// Times a blob that vanished from under a link is made again
+#define DEDUP_RETRIES 3
+
+// Piece of a blob compared with the payload at a time
+#define DEDUP_COMPARE_CHUNK (64 * 1024)
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * @brief - A blob known to hold its payload
+ */
+struct dedup_blob
+{
+	uint64_t hash;
+	size_t length;
+	unsigned int generation;
+	bool valid;
+};
+
+struct writer_dedup
+{
+	char *store;
+	enum writer_dedup_link link;
+
+	pthread_mutex_t lock;
+	struct dedup_blob cache[DEDUP_CACHE_SIZE];
+
+	atomic_ulong blobs;
+	atomic_ulong linked;
+	atomic_ulong independent;
+	atomic_ullong bytes_saved;
+};
+
+enum blob_state
+{
+	BLOB_READY,
+	BLOB_DIFFERENT,
+	BLOB_FAILED,
+};
+
+static uint64_t dedup_hash(const void *data, size_t length);
+static enum blob_state blob_ensure(struct writer_dedup *dedup, const char *blob, const void *data, size_t length);
+static bool blob_matches(int fd, const void *data, size_t length);
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+bool writer_dedup_parse_link(const char *name, enum writer_dedup_link *link)
+{
+	if(strcmp(name, "hard") == 0)
+		*link = WRITER_DEDUP_HARDLINK;
+	else if(strcmp(name, "reflink") == 0)
+		*link = WRITER_DEDUP_REFLINK;
+	else
+		return false;
+	return true;
+}
+
+struct writer_dedup *writer_dedup_open(const char *store, enum writer_dedup_link link)
+{
+	if(mkdir(store, 0777) != 0 && errno != EEXIST)
+		return NULL;
+
+	struct writer_dedup *dedup = calloc(1, sizeof(*dedup));
+	if(dedup == NULL)
+		return NULL;
+	dedup->store = strdup(store);
+	if(dedup->store == NULL)
+	{
+		free(dedup);
+		return NULL;
+	}
+	dedup->link = link;
+	pthread_mutex_init(&dedup->lock, NULL);
+	return dedup;
+}
+
+struct writer_dedup *writer_dedup_open_env(void)
+{
+	const char *store = getenv(WRITER_DEDUP_ENV);
+	const char *link_name = getenv(WRITER_DEDUP_LINK_ENV);
+	enum writer_dedup_link link = WRITER_DEDUP_HARDLINK;
+
+	if(store == NULL || *store == '\0')
+		return NULL;
+	if(link_name != NULL && *link_name != '\0' && !writer_dedup_parse_link(link_name, &link))
+	{
+		fprintf(stderr, "Unknown %s %s, expected hard or reflink\n", WRITER_DEDUP_LINK_ENV, link_name);
+		return NULL;
+	}
+	return writer_dedup_open(store, link);
+}
+
+void writer_dedup_close(struct writer_dedup *dedup)
+{
+	if(dedup == NULL)
+		return;
+	pthread_mutex_destroy(&dedup->lock);
+	free(dedup->store);
+	free(dedup);
+}
+
+bool writer_dedup_write(struct writer_dedup *dedup, const char *path, const void *data, size_t length)
+{
+	uint64_t hash = dedup_hash(data, length);
+	struct dedup_blob *slot = &dedup->cache[hash & (DEDUP_CACHE_SIZE - 1)];
+
+	pthread_mutex_lock(&dedup->lock);
+	bool known = slot->valid && slot->hash == hash && slot->length == length;
+	unsigned int generation = known ? slot->generation : 0;
+	pthread_mutex_unlock(&dedup->lock);
+
+	int retries = 0;
+	while(generation < DEDUP_GENERATIONS)
+	{
+		char blob[PATH_MAX];
+		if(snprintf(blob, sizeof(blob), "%s/%016" PRIx64 "-%zx.%u", dedup->store, hash, length, generation) >= (int)sizeof(blob))
+			break;
+
+		// Checked once per process, after that the cache vouches for it
+		if(!known)
+		{
+			if(blob_ensure(dedup, blob, data, length) != BLOB_READY)
+				break;
+			pthread_mutex_lock(&dedup->lock);
+			slot->hash = hash;
+			slot->length = length;
+			slot->generation = generation;
+			slot->valid = true;
+			pthread_mutex_unlock(&dedup->lock);
+			known = true;
+		}
+
+		bool success = dedup->link == WRITER_DEDUP_HARDLINK ? writer_file_link(path, blob) :
+				writer_file_copy(path, blob, WRITER_DURABILITY_ATOMIC);
+		if(success)
+		{
+			atomic_fetch_add_explicit(&dedup->linked, 1, memory_order_relaxed);
+			atomic_fetch_add_explicit(&dedup->bytes_saved, length, memory_order_relaxed);
+			return true;
+		}
+
+		// The blob has all the links the filesystem allows, move on to the next generation
+		if(errno == EMLINK)
+			generation++;
+		// Removed from the store since it was checked, make it again
+		else if(errno != ENOENT || ++retries > DEDUP_RETRIES)
+			break;
+		known = false;
+	}
+
+	// A collision, another filesystem or a store that can not be written: the target gets its own
+	// copy, still by a rename so a target that was a link does not write into its blob
+	atomic_fetch_add_explicit(&dedup->independent, 1, memory_order_relaxed);
+	return writer_file_write(path, data, length, WRITER_DURABILITY_ATOMIC);
+}
+
+void writer_dedup_get_counters(struct writer_dedup *dedup, struct writer_dedup_counters *counters)
+{
+	counters->blobs = atomic_load(&dedup->blobs);
+	counters->linked = atomic_load(&dedup->linked);
+	counters->independent = atomic_load(&dedup->independent);
+	counters->bytes_saved = atomic_load(&dedup->bytes_saved);
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static uint64_t dedup_mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdu;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53u;
+	x ^= x >> 33;
+	return x;
+}
+
+/**
+ * @brief - 64 bit hash of a payload, eight bytes at a time.  Blobs are compared before use, it
+ *          only has to spread payloads well.
+ */
+static uint64_t dedup_hash(const void *data, size_t length)
+{
+	const unsigned char *bytes = data;
+	uint64_t hash = 0x9e3779b97f4a7c15u ^ length;
+	uint64_t word;
+
+	for(; length >= sizeof(word); bytes += sizeof(word), length -= sizeof(word))
+	{
+		memcpy(&word, bytes, sizeof(word));
+		hash = dedup_mix(hash ^ word);
+	}
+	word = 0;
+	memcpy(&word, bytes, length);
+	return dedup_mix(hash ^ word ^ ((uint64_t)length << 56));
+}
+
+/**
+ * @brief - Make sure blob holds the payload, adding it to the store if it is not there
+ * @return - BLOB_READY, BLOB_DIFFERENT for a collision, BLOB_FAILED Otherwise
+ */
+static enum blob_state blob_ensure(struct writer_dedup *dedup, const char *blob, const void *data, size_t length)
+{
+	int fd = open(blob, O_RDONLY | O_CLOEXEC);
+	if(fd < 0 && errno == ENOENT)
+	{
+		struct writer_staged staged;
+		if(!writer_file_stage(blob, data, length, &staged))
+			return BLOB_FAILED;
+
+		// link() rather than rename(), a blob another writer added in the meantime is kept
+		int linked = chmod(staged.temp, DEDUP_BLOB_MODE) == 0 ? link(staged.temp, blob) : -1;
+		int saved_errno = errno;
+		writer_file_abort(&staged);
+		if(linked == 0)
+		{
+			atomic_fetch_add_explicit(&dedup->blobs, 1, memory_order_relaxed);
+			return BLOB_READY;
+		}
+		if(saved_errno != EEXIST)
+		{
+			errno = saved_errno;
+			return BLOB_FAILED;
+		}
+		fd = open(blob, O_RDONLY | O_CLOEXEC);
+	}
+	if(fd < 0)
+		return BLOB_FAILED;
+
+	bool matches = blob_matches(fd, data, length);
+	close(fd);
+	return matches ? BLOB_READY : BLOB_DIFFERENT;
+}
+
+/**
+ * @brief - Whether the file holds exactly length bytes of data
+ */
+static bool blob_matches(int fd, const void *data, size_t length)
+{
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (uint64_t)st.st_size != length)
+		return false;
+
+	char buffer[DEDUP_COMPARE_CHUNK];
+	size_t done = 0;
+	while(done < length)
+	{
+		ssize_t got = pread(fd, buffer, sizeof(buffer), done);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got <= 0 || (size_t)got > length - done || memcmp(buffer, (const char *)data + done, got) != 0)
+			return false;
+		done += got;
+	}
+	return true;
+}
@@ -0,0 +1,102 @@
+// Content deduplicating writes for the Writer
+//
+// Many targets written with the same payload share one copy of it.  The payload is
+// hashed and stored once as a read only blob in a content addressed store directory,
+// named by its hash and length.  Each target is then made a hard link to the blob
+// (no inode and no data of its own) or a reflink copy of it (an inode of its own
+// sharing the blob's extents, where the filesystem supports it).  A blob found in the
+// store is compared with the payload before it is used, so a hash collision costs a
+// normal write rather than wrong contents.
+//
+// Hard linked targets are one file: they must be replaced, never written in place.
+// The Writer always replaces them by a rename, and the blobs are read only so an
+// unprivileged writer truncating one fails rather than changing every target.  Targets
+// that must stay independent are written with -I, or use reflinks.
+//
+// Enabled for the plain writer and batch mode by $WRITER_DEDUP naming the store, which
+// must be on the same filesystem as the targets.  $WRITER_DEDUP_LINK picks hard
+// (default) or reflink.  Durability modes none and atomic only, a deduplicated target
+// is always placed atomically.  While a store is set every other write replaces its target
+// too, fdatasync is done as group; without one a linked target fails to open like any
+// read only file.
+//
+
+#ifndef WRITERDEDUP_H
+#define WRITERDEDUP_H
+
+//------------------------------------INCLUDES------------------------------------
+#include <stdbool.h>
+#include <stddef.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Environment variable naming the store directory
+#define WRITER_DEDUP_ENV "WRITER_DEDUP"
+
+// Environment variable picking how targets share a blob, hard or reflink
+#define WRITER_DEDUP_LINK_ENV "WRITER_DEDUP_LINK"
+
+//------------------------------PUBLIC DECLARATIONS-------------------------------
+
+enum writer_dedup_link
+{
+	WRITER_DEDUP_HARDLINK,
+	WRITER_DEDUP_REFLINK,
+};
+
+/**
+ * @brief - Counters for a store
+ */
+struct writer_dedup_counters
+{
+	// Blobs this process added to the store
+	unsigned long blobs;
+
+	// Targets placed as a link or reflink to a blob
+	unsigned long linked;
+
+	// Targets written on their own, the store could not be used for them
+	unsigned long independent;
+
+	// Payload bytes the linked targets did not write
+	unsigned long long bytes_saved;
+};
+
+struct writer_dedup;
+
+/**
+ * @brief - Map hard or reflink to its link kind
+ * @return - true if name is a known kind
+ */
+bool writer_dedup_parse_link(const char *name, enum writer_dedup_link *link);
+
+/**
+ * @brief - Open a store, creating its directory if needed
+ * @return - The store, NULL Otherwise (errno is set)
+ */
+struct writer_dedup *writer_dedup_open(const char *store, enum writer_dedup_link link);
+
+/**
+ * @brief - Open the store named by $WRITER_DEDUP and $WRITER_DEDUP_LINK
+ * @return - The store, NULL when none is set or it can not be opened
+ */
+struct writer_dedup *writer_dedup_open_env(void);
+
+/**
+ * @brief - Release a store, NULL is ignored
+ */
+void writer_dedup_close(struct writer_dedup *dedup);
+
+/**
+ * @brief - Overwrite or create path with length bytes of data, sharing the store's copy of
+ *          them.  Safe to call from several threads.
+ * @return - true for Success, false Otherwise (errno is set)
+ */
+bool writer_dedup_write(struct writer_dedup *dedup, const char *path, const void *data, size_t length);
+
+/**
+ * @brief - Snapshot of the store counters
+ */
+void writer_dedup_get_counters(struct writer_dedup *dedup, struct writer_dedup_counters *counters);
+
+#endif
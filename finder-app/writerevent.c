@@ -0,0 +1,145 @@
+// This is a C File for the Writer binary event log, see writerevent.h
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "writerevent.h"
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+// The mapped file, NULL until writer_event_open() succeeds
+static struct writer_event_header *events;
+static struct writer_event_record *records;
+static uint64_t mask;
+static bool opened;
+
+static const char *const names[WRITER_EVENT_CODES] = {
+	[WRITER_EVENT_WRITE] = "write",
+	[WRITER_EVENT_WRITE_FAILED] = "write-failed",
+	[WRITER_EVENT_COPY] = "copy",
+	[WRITER_EVENT_COPY_FAILED] = "copy-failed",
+	[WRITER_EVENT_APPEND] = "append",
+	[WRITER_EVENT_APPEND_FAILED] = "append-failed",
+	[WRITER_EVENT_BATCH] = "batch",
+	[WRITER_EVENT_CONNECT] = "connect",
+	[WRITER_EVENT_DISCONNECT] = "disconnect",
+	[WRITER_EVENT_PACKET_DROPPED] = "packet-dropped",
+	[WRITER_EVENT_SEGMENT] = "segment",
+};
+
+static bool event_init(int fd, off_t size);
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+bool writer_event_open(const char *path)
+{
+	if(opened)
+		return events != NULL;
+	opened = true;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if(fd < 0)
+		return false;
+
+	// Every writer maps the same file, whoever comes first lays it out while the others wait
+	struct writer_event_header header;
+	struct stat st;
+	bool success = false;
+	if(flock(fd, LOCK_EX) == 0 && fstat(fd, &st) == 0)
+	{
+		// No magic means a new file, or one whose creator died before finishing it
+		if(pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic[0] == '\0')
+		{
+			st.st_size = sizeof(header) + (off_t)WRITER_EVENT_RING_SIZE * sizeof(struct writer_event_record);
+			if(!event_init(fd, st.st_size) || pread(fd, &header, sizeof(header), 0) != sizeof(header))
+				st.st_size = 0;
+		}
+
+		success = st.st_size > 0 &&
+		          memcmp(header.magic, WRITER_EVENT_MAGIC, sizeof(header.magic)) == 0 &&
+		          header.record_size == sizeof(struct writer_event_record) &&
+		          header.capacity > 0 && (header.capacity & (header.capacity - 1)) == 0 &&
+		          (uint64_t)st.st_size >= sizeof(header) + header.capacity * sizeof(struct writer_event_record);
+	}
+
+	if(success)
+	{
+		void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(map != MAP_FAILED)
+		{
+			events = map;
+			records = (struct writer_event_record *)(events + 1);
+			mask = header.capacity - 1;
+		}
+	}
+
+	// The mapping outlives the descriptor, and with it the lock
+	close(fd);
+	return events != NULL;
+}
+
+bool writer_event(enum writer_event_code code, const char *path, uint64_t bytes)
+{
+	if(events == NULL)
+		return false;
+
+	uint64_t position = atomic_fetch_add_explicit(&events->next, 1, memory_order_relaxed);
+	struct writer_event_record *record = &records[position & mask];
+
+	// Invalidate the slot first, a reader or a crash in between then sees an incomplete record
+	// rather than half of this one mixed with what it overwrites
+	atomic_store_explicit(&record->sequence, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	record->time_ns = (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+	record->path_hash = path != NULL ? writer_event_hash(path) : 0;
+	record->bytes = bytes;
+	record->code = code;
+
+	atomic_store_explicit(&record->sequence, (uint32_t)(position + 1), memory_order_release);
+	return true;
+}
+
+uint64_t writer_event_hash(const char *path)
+{
+	uint64_t hash = 14695981039346656037u;
+	for(; *path != '\0'; path++)
+		hash = (hash ^ (unsigned char)*path) * 1099511628211u;
+	return hash;
+}
+
+const char *writer_event_name(uint32_t code)
+{
+	if(code >= WRITER_EVENT_CODES || names[code] == NULL)
+		return "unknown";
+	return names[code];
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+/**
+ * @brief - Lay out an empty ring of size bytes, call with the file locked
+ */
+static bool event_init(int fd, off_t size)
+{
+	struct writer_event_header header;
+	memset(&header, 0, sizeof(header));
+	header.record_size = sizeof(struct writer_event_record);
+	header.capacity = WRITER_EVENT_RING_SIZE;
+
+	// Zeroed records are all incomplete, the magic goes in last so a half made file is redone
+	if(ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0 ||
+	   pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+		return false;
+	return pwrite(fd, WRITER_EVENT_MAGIC, sizeof(header.magic), 0) == sizeof(header.magic);
+}
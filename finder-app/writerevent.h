@@ -0,0 +1,116 @@
+// Binary event log for the Writer
+//
+// An alternative to the syslog sink (writerlog.h) for the write paths.  With
+// $WRITER_EVENTS naming a file every writer process maps that file and records each
+// event as a fixed-size binary record - timestamp, event code, path hash and byte
+// count - in a ring inside it.  Recording one is a clock read from the vDSO, a hash of
+// the path, an atomic increment and a few stores: no formatting and no syscall.
+//
+// The file is shared by every process using it and holds the last
+// WRITER_EVENT_RING_SIZE events.  Records live in the page cache, so they survive the
+// writer crashing or being killed; surviving a power loss is not attempted.  A record
+// carries its own position once complete, so one torn by a crash mid-store is told
+// apart from a good one.  writer-events decodes the file.
+//
+// Where an event is recorded the syslog message it replaces is not sent.  Messages
+// without an event code, start up and rare errors, still go to syslog.
+//
+
+#ifndef WRITEREVENT_H
+#define WRITEREVENT_H
+
+//------------------------------------INCLUDES------------------------------------
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Environment variable naming the event file
+#define WRITER_EVENTS_ENV "WRITER_EVENTS"
+
+// Records a new event file holds, must be a power of two.  An existing file keeps its size.
+#define WRITER_EVENT_RING_SIZE 65536
+
+// First bytes of an event file
+#define WRITER_EVENT_MAGIC "WREVENT1"
+
+//------------------------------PUBLIC DECLARATIONS-------------------------------
+
+enum writer_event_code
+{
+	WRITER_EVENT_WRITE = 1,		// A file was written, bytes is its length
+	WRITER_EVENT_WRITE_FAILED,	// A file could not be written
+	WRITER_EVENT_COPY,		// A file was written from another, bytes is 0
+	WRITER_EVENT_COPY_FAILED,
+	WRITER_EVENT_APPEND,		// Bytes were appended to a file, once per flush
+	WRITER_EVENT_APPEND_FAILED,
+	WRITER_EVENT_BATCH,		// A batch started, bytes is the number of records
+	WRITER_EVENT_CONNECT,		// A --listen peer connected, the hash is of its address
+	WRITER_EVENT_DISCONNECT,
+	WRITER_EVENT_PACKET_DROPPED,	// A --listen packet was too large, bytes is its length
+	WRITER_EVENT_SEGMENT,		// A new segment was started, the hash is of its name
+	WRITER_EVENT_CODES
+};
+
+/**
+ * @brief - One record of the event file, 32 bytes
+ */
+struct writer_event_record
+{
+	// CLOCK_REALTIME in nanoseconds
+	uint64_t time_ns;
+
+	// writer_event_hash() of the path, 0 without one
+	uint64_t path_hash;
+
+	uint64_t bytes;
+	uint32_t code;
+
+	// Low 32 bits of the record's position + 1, stored last.  Anything else means the record
+	// is being written, or was torn by a crash.
+	_Atomic uint32_t sequence;
+};
+
+/**
+ * @brief - Header at the start of the event file, the records follow it
+ */
+struct writer_event_header
+{
+	char magic[8];
+	uint32_t record_size;
+	uint32_t reserved;
+
+	// Records the ring holds, a power of two
+	uint64_t capacity;
+
+	// Positions handed out so far, the next record goes to next % capacity
+	_Atomic uint64_t next;
+
+	uint8_t padding[32];
+};
+
+/**
+ * @brief - Map an event file, creating it if needed.  Later calls are no-ops.
+ * @return - true for Success, false Otherwise (events are then not recorded)
+ */
+bool writer_event_open(const char *path);
+
+/**
+ * @brief - Record an event
+ * @param - path - What the event is about, NULL for nothing
+ * @return - true if the event was recorded, false when no event file is open
+ */
+bool writer_event(enum writer_event_code code, const char *path, uint64_t bytes);
+
+/**
+ * @brief - 64 bit FNV-1a of a path, as stored in the records
+ */
+uint64_t writer_event_hash(const char *path);
+
+/**
+ * @brief - Name of an event code, "unknown" for anything else
+ */
+const char *writer_event_name(uint32_t code);
+
+#endif
@@ -0,0 +1,630 @@
+// This is a C File for the Writer file placement, see writerfile.h
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "writerfile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Same permissions fopen() would create the file with
+#define WRITER_FILE_MODE 0666
+
+// Largest piece copy_file_range()/sendfile()/mmap() move at a time
+#define COPY_CHUNK (1 << 30)
+
+// Piece the cache modes write, and drop from the cache, at a time
+#define UNCACHED_CHUNK (8 * 1024 * 1024)
+
+// O_DIRECT alignment where the filesystem does not say, right for any block size up to a page
+#define UNCACHED_ALIGN 4096
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+static const char * const durability_names[] = {
+	[WRITER_DURABILITY_NONE] = "none",
+	[WRITER_DURABILITY_ATOMIC] = "atomic",
+	[WRITER_DURABILITY_FDATASYNC] = "fdatasync",
+	[WRITER_DURABILITY_GROUP] = "group",
+};
+
+static const char * const cache_names[] = {
+	[WRITER_CACHE_KEEP] = "keep",
+	[WRITER_CACHE_DIRECT] = "direct",
+	[WRITER_CACHE_DONTNEED] = "dontneed",
+};
+
+/**
+ * @brief - What a file is filled with, a buffer or (fd >= 0) another file
+ */
+struct file_source
+{
+	const void *data;
+	size_t length;
+	int fd;
+	enum writer_cache cache;
+};
+
+// Makes temporary names unique between the threads of one process
+static atomic_ulong temp_counter;
+
+static bool place(const char *path, const struct file_source *source, enum writer_durability mode);
+static bool stage(const char *path, const struct file_source *source, struct writer_staged *staged);
+static bool fill(int fd, const struct file_source *source);
+static bool fill_uncached(int fd, const struct file_source *source);
+static size_t direct_alignment(int fd);
+static bool read_at(int fd, char *buffer, size_t length, off_t offset, size_t align);
+static bool write_at(int fd, const char *data, size_t length, off_t offset);
+static void drop_written(int fd, off_t from, off_t to, bool wait);
+static bool copy_fd(int dst, int src);
+static bool write_all(int fd, const void *data, size_t length);
+static char *temp_name(const char *path);
+static int open_tmpfile(const char *path);
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+bool writer_durability_parse(const char *name, enum writer_durability *mode)
+{
+	size_t i;
+
+	for(i = 0; i < sizeof(durability_names) / sizeof(durability_names[0]); i++)
+	{
+		if(strcmp(name, durability_names[i]) == 0)
+		{
+			*mode = (enum writer_durability)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *writer_durability_name(enum writer_durability mode)
+{
+	return durability_names[mode];
+}
+
+bool writer_cache_parse(const char *name, enum writer_cache *cache)
+{
+	size_t i;
+
+	for(i = 0; i < sizeof(cache_names) / sizeof(cache_names[0]); i++)
+	{
+		if(strcmp(name, cache_names[i]) == 0)
+		{
+			*cache = (enum writer_cache)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool writer_file_write(const char *path, const void *data, size_t length, enum writer_durability mode)
+{
+	return writer_file_write_uncached(path, data, length, mode, WRITER_CACHE_KEEP);
+}
+
+bool writer_file_write_uncached(const char *path, const void *data, size_t length, enum writer_durability mode,
+		enum writer_cache cache)
+{
+	struct file_source source = { data, length, -1, cache };
+	return place(path, &source, mode);
+}
+
+bool writer_file_copy(const char *path, const char *source_path, enum writer_durability mode)
+{
+	return writer_file_copy_uncached(path, source_path, mode, WRITER_CACHE_KEEP);
+}
+
+bool writer_file_copy_uncached(const char *path, const char *source_path, enum writer_durability mode,
+		enum writer_cache cache)
+{
+	struct file_source source = { NULL, 0, -1, cache };
+
+	source.fd = open(source_path, O_RDONLY | O_CLOEXEC);
+	if(source.fd < 0)
+		return false;
+
+	bool success = place(path, &source, mode);
+	int saved_errno = errno;
+	close(source.fd);
+	errno = saved_errno;
+	return success;
+}
+
+bool writer_file_link(const char *path, const char *source_path)
+{
+	struct stat st, source_st;
+
+	// A new target is one link(), only an existing one needs a temporary and a rename
+	if(link(source_path, path) == 0)
+		return true;
+	if(errno != EEXIST)
+		return false;
+
+	// rename() between two links of one file does nothing and would leave the temporary behind
+	if(stat(path, &st) == 0 && stat(source_path, &source_st) == 0 &&
+	   st.st_dev == source_st.st_dev && st.st_ino == source_st.st_ino)
+		return true;
+
+	struct writer_staged staged = { temp_name(path), 0 };
+	if(staged.temp == NULL)
+		return false;
+	if(link(source_path, staged.temp) != 0)
+	{
+		free(staged.temp);
+		return false;
+	}
+	return writer_file_commit(path, &staged);
+}
+
+bool writer_file_stage(const char *path, const void *data, size_t length, struct writer_staged *staged)
+{
+	struct file_source source = { data, length, -1, WRITER_CACHE_KEEP };
+	return stage(path, &source, staged);
+}
+
+bool writer_file_commit(const char *path, struct writer_staged *staged)
+{
+	if(rename(staged->temp, path) != 0)
+	{
+		writer_file_abort(staged);
+		return false;
+	}
+
+	free(staged->temp);
+	staged->temp = NULL;
+	return true;
+}
+
+void writer_file_abort(struct writer_staged *staged)
+{
+	if(staged->temp == NULL)
+		return;
+
+	int saved_errno = errno;
+	unlink(staged->temp);
+	free(staged->temp);
+	staged->temp = NULL;
+	errno = saved_errno;
+}
+
+bool writer_file_syncfs(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+	if(fd < 0)
+		return false;
+
+	bool success = syncfs(fd) == 0;
+	close(fd);
+	return success;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static bool place(const char *path, const struct file_source *source, enum writer_durability mode)
+{
+	struct writer_staged staged;
+
+	switch(mode)
+	{
+		case WRITER_DURABILITY_ATOMIC:
+			return stage(path, source, &staged) && writer_file_commit(path, &staged);
+
+		case WRITER_DURABILITY_GROUP:
+			// A group of one, the data is on disk before the rename and the rename after
+			if(!stage(path, source, &staged))
+				return false;
+			if(!writer_file_syncfs(staged.temp))
+			{
+				writer_file_abort(&staged);
+				return false;
+			}
+			return writer_file_commit(path, &staged) && writer_file_syncfs(path);
+
+		case WRITER_DURABILITY_NONE:
+		case WRITER_DURABILITY_FDATASYNC:
+			break;
+	}
+
+	// Lets open the file for writing, if it exists, overwrite, else create
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, WRITER_FILE_MODE);
+	if(fd < 0)
+		return false;
+
+	bool success = fill(fd, source);
+	if(success && mode == WRITER_DURABILITY_FDATASYNC)
+		success = fdatasync(fd) == 0;
+
+	int saved_errno = errno;
+	if(close(fd) != 0)
+		success = false;
+	else
+		errno = saved_errno;
+	return success;
+}
+
+static bool stage(const char *path, const struct file_source *source, struct writer_staged *staged)
+{
+	struct stat st;
+
+	staged->temp = temp_name(path);
+	if(staged->temp == NULL)
+		return false;
+
+	// An O_TMPFILE has no name until it is complete, a crash mid write leaves nothing behind
+	int fd = open_tmpfile(path);
+	if(fd >= 0)
+	{
+		char proc_path[64];
+		snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+
+		if(fill(fd, source) && fstat(fd, &st) == 0 &&
+		   (linkat(AT_FDCWD, proc_path, AT_FDCWD, staged->temp, AT_SYMLINK_FOLLOW) == 0 ||
+		    linkat(fd, "", AT_FDCWD, staged->temp, AT_EMPTY_PATH) == 0))
+		{
+			close(fd);
+			staged->dev = st.st_dev;
+			return true;
+		}
+		close(fd);
+	}
+
+	// No O_TMPFILE (or no way to name it), write the temporary under its name directly
+	fd = open(staged->temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, WRITER_FILE_MODE);
+	if(fd < 0)
+	{
+		free(staged->temp);
+		staged->temp = NULL;
+		return false;
+	}
+
+	bool success = fill(fd, source) && fstat(fd, &st) == 0;
+	if(close(fd) != 0)
+		success = false;
+	if(!success)
+	{
+		writer_file_abort(staged);
+		return false;
+	}
+
+	staged->dev = st.st_dev;
+	return true;
+}
+
+/**
+ * @brief - Fill fd from source, a file is copied at the fd's current offset
+ */
+static bool fill(int fd, const struct file_source *source)
+{
+	if(source->cache != WRITER_CACHE_KEEP)
+		return fill_uncached(fd, source);
+	if(source->fd >= 0)
+		return copy_fd(fd, source->fd);
+	return write_all(fd, source->data, source->length);
+}
+
+/**
+ * @brief - Copy all of src (from offset 0) into the freshly truncated dst, cheapest way first:
+ *          reflink, copy_file_range(), sendfile(), then mmap() and write()
+ */
+static bool copy_fd(int dst, int src)
+{
+	struct stat st;
+	off_t offset = 0;
+	ssize_t moved = -1;
+
+	if(fstat(src, &st) < 0)
+		return false;
+
+	// Pipes, devices and procfs style files (size 0) only work with plain reads
+	bool regular = S_ISREG(st.st_mode) && st.st_size > 0;
+
+	// Same filesystem with reflink support, the extents are shared and nothing is copied
+	if(regular && ioctl(dst, FICLONE, src) == 0)
+		return lseek(dst, 0, SEEK_END) >= 0;
+
+	// Kernel side copy, may still be offloaded or reflinked by the filesystem
+	while(regular && (moved = copy_file_range(src, &offset, dst, NULL, COPY_CHUNK, 0)) != 0)
+	{
+		if(moved > 0)
+			continue;
+		if(errno == EINTR)
+			continue;
+		if(errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF)
+			return false;
+		break;
+	}
+	if(regular && moved == 0)
+		return true;
+
+	// Kernel side copy through the page cache, any destination fd
+	while(regular && (moved = sendfile(dst, src, &offset, COPY_CHUNK)) != 0)
+	{
+		if(moved > 0)
+			continue;
+		if(errno == EINTR)
+			continue;
+		if(errno != EINVAL && errno != ENOSYS)
+			return false;
+		break;
+	}
+	if(regular && moved == 0)
+		return true;
+
+	// Map the rest of the source and write it out, one copy instead of two
+	while(regular && offset < st.st_size)
+	{
+		off_t aligned = offset & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+		size_t length = st.st_size - aligned > COPY_CHUNK ? COPY_CHUNK : (size_t)(st.st_size - aligned);
+		void *map = mmap(NULL, length, PROT_READ, MAP_SHARED, src, aligned);
+		if(map == MAP_FAILED)
+			break;
+
+		madvise(map, length, MADV_SEQUENTIAL);
+		bool success = write_all(dst, (char *)map + (offset - aligned), length - (offset - aligned));
+		munmap(map, length);
+		if(!success)
+			return false;
+		offset = aligned + length;
+	}
+	if(regular && offset >= st.st_size)
+		return true;
+
+	// Read what is left, also whatever the source grew by
+	char buffer[64 * 1024];
+	for(;;)
+	{
+		moved = pread(src, buffer, sizeof(buffer), offset);
+		if(moved < 0 && errno == ESPIPE)
+			moved = read(src, buffer, sizeof(buffer));
+		if(moved < 0 && errno == EINTR)
+			continue;
+		if(moved < 0)
+			return false;
+		if(moved == 0)
+			return true;
+		if(!write_all(dst, buffer, moved))
+			return false;
+		offset += moved;
+	}
+}
+
+/**
+ * @brief - Fill the freshly truncated fd from source bypassing (direct) or dropping (dontneed)
+ *          the page cache as it goes, see writerfile.h
+ */
+static bool fill_uncached(int fd, const struct file_source *source)
+{
+	struct stat st;
+	size_t length = source->length;
+
+	if(source->fd >= 0)
+	{
+		// Pipes and the like have no size to plan chunks by, and a reflink moves no data at all
+		if(fstat(source->fd, &st) < 0)
+			return false;
+		if(!S_ISREG(st.st_mode) || st.st_size == 0)
+			return copy_fd(fd, source->fd);
+		if(ioctl(fd, FICLONE, source->fd) == 0)
+			return lseek(fd, 0, SEEK_END) >= 0;
+		length = st.st_size;
+	}
+	if(length < WRITER_FILE_UNCACHED_MIN)
+		return source->fd >= 0 ? copy_fd(fd, source->fd) : write_all(fd, source->data, length);
+
+	size_t align = direct_alignment(fd);
+	char *buffer;
+	if(posix_memalign((void **)&buffer, align, UNCACHED_CHUNK) != 0)
+		return false;
+
+	// O_DIRECT is switched on for the open descriptors, a filesystem that refuses it gets dontneed
+	int flags = fcntl(fd, F_GETFL);
+	bool direct = source->cache == WRITER_CACHE_DIRECT && flags >= 0 && fcntl(fd, F_SETFL, flags | O_DIRECT) == 0;
+	bool source_direct = false;
+	if(direct && source->fd >= 0)
+	{
+		int source_flags = fcntl(source->fd, F_GETFL);
+		source_direct = source_flags >= 0 && fcntl(source->fd, F_SETFL, source_flags | O_DIRECT) == 0;
+	}
+
+	// [dropped, started) is being written back, [started, offset) is still dirty in the cache
+	off_t offset = 0, dropped = 0, started = 0;
+	bool success = true;
+	while(success && (size_t)offset < length)
+	{
+		size_t want = length - offset < UNCACHED_CHUNK ? length - offset : UNCACHED_CHUNK;
+		const char *chunk = buffer;
+
+		if(source->fd >= 0)
+		{
+			success = read_at(source->fd, buffer, want, offset, source_direct ? align : 1);
+			if(success && !source_direct)
+				posix_fadvise(source->fd, offset, want, POSIX_FADV_DONTNEED);
+		}
+		else if(!direct || (uintptr_t)source->data % align == 0)
+			chunk = (const char *)source->data + offset;
+		else
+			memcpy(buffer, (const char *)source->data + offset, want);
+
+		size_t whole = direct ? want & ~(align - 1) : want;
+		success = success && write_at(fd, chunk, whole, offset);
+		if(success && whole < want)
+		{
+			// The unaligned tail of the last chunk goes through the cache, and is dropped below
+			direct = false;
+			success = fcntl(fd, F_SETFL, flags) == 0 && write_at(fd, chunk + whole, want - whole, offset + whole);
+			offset += whole;
+			dropped = started = offset;
+			want -= whole;
+		}
+		offset += want;
+
+		// Nothing of a direct chunk is cached.  A buffered one has its writeback started, the one
+		// before it is waited for and dropped, so the disk is kept busy while the cache stays small.
+		if(direct)
+			dropped = started = offset;
+		else if(success)
+		{
+			drop_written(fd, started, offset, false);
+			drop_written(fd, dropped, started, true);
+			dropped = started;
+			started = offset;
+		}
+	}
+	if(success)
+		drop_written(fd, dropped, offset, true);
+
+	free(buffer);
+	return success;
+}
+
+/**
+ * @brief - Alignment O_DIRECT needs for buffers, offsets and lengths on the file of fd
+ */
+static size_t direct_alignment(int fd)
+{
+#ifdef STATX_DIOALIGN
+	struct statx stx;
+	if(statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN) &&
+	   stx.stx_dio_offset_align > 0)
+	{
+		size_t align = stx.stx_dio_offset_align > stx.stx_dio_mem_align ? stx.stx_dio_offset_align : stx.stx_dio_mem_align;
+		if(align <= UNCACHED_CHUNK && (align & (align - 1)) == 0)
+			return align;
+	}
+#else
+	(void)fd;
+#endif
+	return UNCACHED_ALIGN;
+}
+
+/**
+ * @brief - Read exactly length bytes at offset, in reads rounded up to align as O_DIRECT wants
+ */
+static bool read_at(int fd, char *buffer, size_t length, off_t offset, size_t align)
+{
+	size_t done = 0;
+	size_t rounded = (length + align - 1) & ~(align - 1);
+
+	while(done < length)
+	{
+		ssize_t got = pread(fd, buffer + done, rounded - done, offset + done);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got < 0)
+			return false;
+
+		// The source shrank under us
+		if(got == 0)
+		{
+			errno = EIO;
+			return false;
+		}
+		done += got;
+	}
+	return true;
+}
+
+static bool write_at(int fd, const char *data, size_t length, off_t offset)
+{
+	size_t done = 0;
+
+	while(done < length)
+	{
+		ssize_t put = pwrite(fd, data + done, length - done, offset + done);
+		if(put < 0 && errno == EINTR)
+			continue;
+		if(put <= 0)
+			return false;
+		done += put;
+	}
+	return true;
+}
+
+/**
+ * @brief - Start writeback of [from, to), or with wait see it through and drop the range from the cache
+ */
+static void drop_written(int fd, off_t from, off_t to, bool wait)
+{
+	if(to <= from)
+		return;
+	if(!wait)
+	{
+		sync_file_range(fd, from, to - from, SYNC_FILE_RANGE_WRITE);
+		return;
+	}
+	sync_file_range(fd, from, to - from, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+	posix_fadvise(fd, from, to - from, POSIX_FADV_DONTNEED);
+}
+
+static bool write_all(int fd, const void *data, size_t length)
+{
+	size_t done = 0;
+
+	while(done < length)
+	{
+		ssize_t put = write(fd, (const char *)data + done, length - done);
+		if(put < 0 && errno == EINTR)
+			continue;
+		if(put <= 0)
+		{
+			if(put == 0)
+				errno = EIO;
+			return false;
+		}
+		done += put;
+	}
+	return true;
+}
+
+/**
+ * @brief - dir/.base.pid.n.tmp for path dir/base, malloc'd
+ */
+static char *temp_name(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	int dir_length = slash ? (int)(slash - path + 1) : 0;
+	const char *base = slash ? slash + 1 : path;
+	char *temp;
+
+	if(asprintf(&temp, "%.*s.%s.%d.%lu.tmp", dir_length, path, base, (int)getpid(),
+			atomic_fetch_add(&temp_counter, 1)) < 0)
+		return NULL;
+	return temp;
+}
+
+/**
+ * @brief - An unnamed O_TMPFILE in the directory of path
+ * @return - The fd, -1 if the kernel or filesystem does not support it
+ */
+static int open_tmpfile(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char *dir;
+
+	if(slash == NULL)
+		dir = strdup(".");
+	else if(slash == path)
+		dir = strdup("/");
+	else
+		dir = strndup(path, slash - path);
+	if(dir == NULL)
+		return -1;
+
+	int fd = open(dir, O_TMPFILE | O_WRONLY | O_CLOEXEC, WRITER_FILE_MODE);
+	free(dir);
+	return fd;
+}
@@ -0,0 +1,145 @@
+// File placement for the Writer, shared by every mode
+//
+// Durability modes
+//  none      - Truncate and write in place, what writer has always done.  A reader can
+//              see a half written file and a crash can lose or tear it.
+//  atomic    - Write a temporary (O_TMPFILE where supported) and rename it over the
+//              target.  Readers see the old or the new file, never a mix.  Not crash safe.
+//  fdatasync - Write in place and fdatasync() before returning.  Crash safe once writer
+//              returns, but readers can still see a half written file.
+//  group     - atomic, made crash safe by a syncfs() before the renames and another after.
+//              In batch mode those two syncfs() calls cover every file of the batch.
+//
+// Cache modes, for payloads of WRITER_FILE_UNCACHED_MIN bytes or more
+//  keep      - Write through the page cache, what writer has always done.
+//  direct    - O_DIRECT writes of aligned chunks from an aligned buffer, the unaligned
+//              tail by a buffered pwrite() that is then written back and dropped.  A
+//              copied source is read with O_DIRECT too.  Where the filesystem refuses
+//              O_DIRECT this is dontneed.
+//  dontneed  - Buffered writes, each chunk is written back and dropped with
+//              posix_fadvise(POSIX_FADV_DONTNEED) once the next one is under way.
+//              Pages read from a copied source are dropped the same way.
+// Either way a large payload leaves next to nothing in the page cache.  A copy that
+// can be reflinked still is, that moves no data at all.
+//
+
+#ifndef WRITERFILE_H
+#define WRITERFILE_H
+
+//------------------------------------INCLUDES------------------------------------
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Smallest payload the cache modes apply to, smaller ones are not worth the extra syscalls
+#define WRITER_FILE_UNCACHED_MIN (1024 * 1024)
+
+//------------------------------PUBLIC DECLARATIONS-------------------------------
+
+enum writer_durability
+{
+	WRITER_DURABILITY_NONE,
+	WRITER_DURABILITY_ATOMIC,
+	WRITER_DURABILITY_FDATASYNC,
+	WRITER_DURABILITY_GROUP,
+};
+
+enum writer_cache
+{
+	WRITER_CACHE_KEEP,
+	WRITER_CACHE_DIRECT,
+	WRITER_CACHE_DONTNEED,
+};
+
+/**
+ * @brief - A file written to a temporary name, waiting for writer_file_commit()
+ */
+struct writer_staged
+{
+	// Temporary path in the target's directory, NULL when nothing is staged
+	char *temp;
+
+	// Filesystem the temporary lives on, for writer_file_syncfs()
+	dev_t dev;
+};
+
+/**
+ * @brief - Map a mode name (none, atomic, fdatasync, group) to its mode
+ * @return - true if name is a known mode
+ */
+bool writer_durability_parse(const char *name, enum writer_durability *mode);
+
+/**
+ * @brief - The name of a mode, as accepted by writer_durability_parse()
+ */
+const char *writer_durability_name(enum writer_durability mode);
+
+/**
+ * @brief - Map a cache mode name (keep, direct, dontneed) to its mode
+ * @return - true if name is a known mode
+ */
+bool writer_cache_parse(const char *name, enum writer_cache *cache);
+
+/**
+ * @brief - Overwrite or create path with length bytes of data, using the given mode
+ * @return - true for Success, false Otherwise (errno is set)
+ */
+bool writer_file_write(const char *path, const void *data, size_t length, enum writer_durability mode);
+
+/**
+ * @brief - writer_file_write(), keeping a large payload out of the page cache as cache says
+ * @return - true for Success, false Otherwise (errno is set)
+ */
+bool writer_file_write_uncached(const char *path, const void *data, size_t length, enum writer_durability mode,
+		enum writer_cache cache);
+
+/**
+ * @brief - Overwrite or create path with the contents of source_path, using the given mode.
+ *          The data stays in the kernel: reflink (FICLONE) where the filesystem shares
+ *          extents, else copy_file_range(), sendfile(), and finally mmap() of the source.
+ * @return - true for Success, false Otherwise (errno is set)
+ */
+bool writer_file_copy(const char *path, const char *source_path, enum writer_durability mode);
+
+/**
+ * @brief - writer_file_copy(), keeping a large source and its copy out of the page cache as
+ *          cache says
+ * @return - true for Success, false Otherwise (errno is set)
+ */
+bool writer_file_copy_uncached(const char *path, const char *source_path, enum writer_durability mode,
+		enum writer_cache cache);
+
+/**
+ * @brief - Make path a hard link to source_path, replacing whatever path was by a rename so
+ *          the file path used to be is never written to.  A path already linked to
+ *          source_path is left as it is.
+ * @return - true for Success, false Otherwise (errno is set, EXDEV and EMLINK included)
+ */
+bool writer_file_link(const char *path, const char *source_path);
+
+/**
+ * @brief - Write data to a temporary file next to path, without syncing it
+ * @return - true for Success, false Otherwise (nothing is left behind)
+ */
+bool writer_file_stage(const char *path, const void *data, size_t length, struct writer_staged *staged);
+
+/**
+ * @brief - Rename a staged file over path and release it
+ * @return - true for Success, false Otherwise (the temporary is removed)
+ */
+bool writer_file_commit(const char *path, struct writer_staged *staged);
+
+/**
+ * @brief - Remove a staged file that will not be committed
+ */
+void writer_file_abort(struct writer_staged *staged);
+
+/**
+ * @brief - syncfs() the filesystem holding path
+ * @return - true for Success, false Otherwise
+ */
+bool writer_file_syncfs(const char *path);
+
+#endif
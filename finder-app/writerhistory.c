@@ -0,0 +1,243 @@
+// This is a C File for the Writer write history, see writerhistory.h
+//
+
+//------------------------------------INCLUDES------------------------------------
+#include "writerhistory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * @brief - One retained write
+ */
+struct history_entry
+{
+	// Global offset of the first byte, the prefix sum of every earlier length
+	uint64_t start;
+
+	// Where the bytes sit in the arena
+	size_t arena_offset;
+	size_t length;
+};
+
+struct writer_history
+{
+	// Odd while an append is changing the history
+	atomic_uint sequence;
+
+	// Entries [tail, head) are retained, at most limit of them, indexes run on and are masked into entries[]
+	struct history_entry *entries;
+	size_t mask;
+	size_t limit;
+	uint64_t head;
+	uint64_t tail;
+
+	// Bytes are carved from the arena in order, wrapping to the start when they do not fit
+	char *arena;
+	size_t arena_size;
+	size_t arena_head;
+
+	// Global offset one past the newest byte
+	uint64_t end;
+
+	pthread_mutex_t append_lock;
+};
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+struct writer_history *writer_history_create(size_t entries, size_t arena_bytes)
+{
+	struct writer_history *history;
+	size_t capacity = 1;
+
+	if(entries == 0 || arena_bytes == 0)
+		return NULL;
+	while(capacity < entries)
+		capacity <<= 1;
+
+	history = calloc(1, sizeof(*history));
+	if(history == NULL)
+		return NULL;
+	history->entries = calloc(capacity, sizeof(*history->entries));
+	history->arena = malloc(arena_bytes);
+	if(history->entries == NULL || history->arena == NULL)
+	{
+		free(history->entries);
+		free(history->arena);
+		free(history);
+		return NULL;
+	}
+
+	history->mask = capacity - 1;
+	history->limit = entries;
+	history->arena_size = arena_bytes;
+	atomic_init(&history->sequence, 0);
+	pthread_mutex_init(&history->append_lock, NULL);
+	return history;
+}
+
+void writer_history_destroy(struct writer_history *history)
+{
+	if(history == NULL)
+		return;
+
+	pthread_mutex_destroy(&history->append_lock);
+	free(history->entries);
+	free(history->arena);
+	free(history);
+}
+
+bool writer_history_append(struct writer_history *history, const void *data, size_t length)
+{
+	if(length > history->arena_size)
+		return false;
+
+	// An empty write has no bytes to find, and as the oldest entry it would never be in the way
+	// of the bytes after it, holding them from eviction
+	if(length == 0)
+		return true;
+
+	pthread_mutex_lock(&history->append_lock);
+
+	// Readers that start from here on retry until the sequence is even again
+	unsigned int sequence = atomic_load_explicit(&history->sequence, memory_order_relaxed);
+	atomic_store_explicit(&history->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	size_t position = history->arena_head;
+	bool wrapped = position + length > history->arena_size;
+	if(wrapped)
+		position = 0;
+
+	// The oldest entries sit just past arena_head, so they are the ones in the way: first
+	// anything in the tail we skip when wrapping, then anything overlapping the new bytes
+	while(history->tail < history->head)
+	{
+		struct history_entry *oldest = &history->entries[history->tail & history->mask];
+		bool skipped = wrapped && oldest->arena_offset >= history->arena_head;
+		bool overlaps = oldest->arena_offset < position + length && position < oldest->arena_offset + oldest->length;
+		bool full = history->head - history->tail >= history->limit;
+		if(!skipped && !overlaps && !full)
+			break;
+		history->tail++;
+	}
+
+	struct history_entry *entry = &history->entries[history->head & history->mask];
+	entry->start = history->end;
+	entry->arena_offset = position;
+	entry->length = length;
+	memcpy(history->arena + position, data, length);
+
+	history->arena_head = position + length;
+	history->end += length;
+	history->head++;
+
+	atomic_store_explicit(&history->sequence, sequence + 2, memory_order_release);
+	pthread_mutex_unlock(&history->append_lock);
+	return true;
+}
+
+void writer_history_bounds(const struct writer_history *history, uint64_t *first, uint64_t *end)
+{
+	struct writer_history *shared = (struct writer_history *)history;
+	unsigned int sequence;
+
+	do
+	{
+		sequence = atomic_load_explicit(&shared->sequence, memory_order_acquire);
+		*end = history->end;
+		*first = history->tail < history->head ? history->entries[history->tail & history->mask].start : history->end;
+		atomic_thread_fence(memory_order_acquire);
+	} while((sequence & 1) || atomic_load_explicit(&shared->sequence, memory_order_relaxed) != sequence);
+}
+
+/**
+ * @brief - Binary search the retained entries for the one holding offset, call inside a read section
+ * @return - The entry index, or history->head if offset is not retained
+ */
+static uint64_t history_search(const struct writer_history *history, uint64_t offset)
+{
+	uint64_t low = history->tail;
+	uint64_t high = history->head;
+
+	if(low == high || offset < history->entries[low & history->mask].start || offset >= history->end)
+		return history->head;
+
+	// Last entry starting at or before offset, starts increase with the index
+	while(high - low > 1)
+	{
+		uint64_t middle = low + (high - low) / 2;
+		if(history->entries[middle & history->mask].start <= offset)
+			low = middle;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+bool writer_history_find(const struct writer_history *history, uint64_t offset, struct writer_history_position *position)
+{
+	struct writer_history *shared = (struct writer_history *)history;
+	unsigned int sequence;
+	bool found;
+
+	do
+	{
+		sequence = atomic_load_explicit(&shared->sequence, memory_order_acquire);
+		uint64_t index = history_search(history, offset);
+		found = index != history->head;
+		if(found)
+		{
+			const struct history_entry *entry = &history->entries[index & history->mask];
+			position->entry_start = entry->start;
+			position->entry_length = entry->length;
+			position->entry_offset = offset - entry->start;
+		}
+		atomic_thread_fence(memory_order_acquire);
+	} while((sequence & 1) || atomic_load_explicit(&shared->sequence, memory_order_relaxed) != sequence);
+
+	return found;
+}
+
+size_t writer_history_read(const struct writer_history *history, uint64_t *offset, void *buffer, size_t length)
+{
+	struct writer_history *shared = (struct writer_history *)history;
+	unsigned int sequence;
+	uint64_t start;
+	size_t copied;
+
+	do
+	{
+		sequence = atomic_load_explicit(&shared->sequence, memory_order_acquire);
+		start = *offset;
+		copied = 0;
+
+		// Evicted bytes are gone, carry on from the oldest we still have
+		if(history->tail < history->head && start < history->entries[history->tail & history->mask].start)
+			start = history->entries[history->tail & history->mask].start;
+
+		uint64_t index = history_search(history, start);
+		while(index < history->head && copied < length)
+		{
+			// A torn read may have us looking at garbage, stay inside the arena until we retry
+			const struct history_entry *entry = &history->entries[index & history->mask];
+			size_t in_entry = (size_t)(start + copied - entry->start);
+			if(in_entry > entry->length || entry->arena_offset + entry->length > history->arena_size)
+				break;
+
+			size_t chunk = entry->length - in_entry;
+			if(chunk > length - copied)
+				chunk = length - copied;
+			memcpy((char *)buffer + copied, history->arena + entry->arena_offset + in_entry, chunk);
+			copied += chunk;
+			index++;
+		}
+		atomic_thread_fence(memory_order_acquire);
+	} while((sequence & 1) || atomic_load_explicit(&shared->sequence, memory_order_relaxed) != sequence);
+
+	*offset = start + copied;
+	return copied;
+}
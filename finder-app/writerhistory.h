@@ -0,0 +1,78 @@
+// In memory history of the most recent writes
+//
+// A fixed capacity circular buffer of write entries whose bytes live in one ring arena.
+// Every byte ever appended has a global offset, counted from the first append, and each
+// entry records the global offset it starts at.  Those starts are the prefix sums of the
+// entry lengths and never change once written, so finding the entry holding a global
+// offset is a binary search over the retained entries, O(log n), and eviction needs no
+// re-indexing.
+//
+// Appends are serialized by a mutex.  Readers take no lock: a sequence counter is bumped
+// around every append and a reader that overlapped one simply retries, so lookups and
+// copies scale with the number of reading threads.
+//
+
+#ifndef WRITERHISTORY_H
+#define WRITERHISTORY_H
+
+//------------------------------------INCLUDES------------------------------------
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//------------------------------PUBLIC DECLARATIONS-------------------------------
+
+struct writer_history;
+
+/**
+ * @brief - Where a global offset falls, see writer_history_find()
+ */
+struct writer_history_position
+{
+	// Global offset of the first byte of the entry, and its length
+	uint64_t entry_start;
+	size_t entry_length;
+
+	// Offset of the byte within the entry
+	size_t entry_offset;
+};
+
+/**
+ * @brief - Create an empty history
+ * @param - entries - Most writes retained
+ * @param - arena_bytes - Most bytes retained, older writes are evicted to make room
+ * @return - The history, NULL on failure
+ */
+struct writer_history *writer_history_create(size_t entries, size_t arena_bytes);
+
+/**
+ * @brief - Free a history, no reader may still be using it
+ */
+void writer_history_destroy(struct writer_history *history);
+
+/**
+ * @brief - Append one write, evicting the oldest writes as needed
+ * @return - false if length is larger than the whole arena (nothing is evicted)
+ */
+bool writer_history_append(struct writer_history *history, const void *data, size_t length);
+
+/**
+ * @brief - The global offsets of the oldest retained byte and one past the newest
+ */
+void writer_history_bounds(const struct writer_history *history, uint64_t *first, uint64_t *end);
+
+/**
+ * @brief - Find the entry holding global offset
+ * @return - false if offset has been evicted or not been written yet
+ */
+bool writer_history_find(const struct writer_history *history, uint64_t offset, struct writer_history_position *position);
+
+/**
+ * @brief - Copy retained bytes from *offset on, across entries
+ * @param - offset - Global offset to start at, moved past the bytes copied.  If it had already
+ *                   been evicted it is first moved up to the oldest retained byte.
+ * @return - Bytes copied, 0 once *offset reaches the end
+ */
+size_t writer_history_read(const struct writer_history *history, uint64_t *offset, void *buffer, size_t length);
+
+#endif
@@ -0,0 +1,328 @@
+// This is a C File for the Writer syslog sink, see writerlog.h
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "writerlog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+#define LOG_RING_MASK (WRITER_LOG_RING_SIZE - 1)
+
+// Records per sendmmsg() call
+#define LOG_BATCH 64
+
+// How long a drain waits for a busy /dev/log before dropping the batch
+#define LOG_BUSY_WAIT_MS 50
+
+// How often the background thread looks at the ring when nobody wakes it
+#define LOG_IDLE_WAIT_MS 200
+
+#define LOG_PATH "/dev/log"
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * @brief - One ring slot.  seq tells producers and the consumer whose turn it is:
+ *          position when free, position + 1 when filled.
+ */
+struct log_slot
+{
+	atomic_size_t seq;
+	int length;
+	char text[WRITER_LOG_RECORD_MAX];
+};
+
+static struct log_slot ring[WRITER_LOG_RING_SIZE];
+static atomic_size_t ring_tail;
+static size_t ring_head;
+
+// Only one thread drains at a time, whoever holds this owns ring_head and the socket
+static atomic_flag draining = ATOMIC_FLAG_INIT;
+static int log_fd = -1;
+
+static atomic_ulong sent_count;
+static atomic_ulong dropped_count;
+
+// Sink state, set up once by log_setup().  open_background is what writer_log_open()
+// asked for, drain_running whether the background thread actually exists.
+static pthread_once_t open_once = PTHREAD_ONCE_INIT;
+static bool open_background;
+static pthread_t drain_thread;
+static bool drain_running;
+static atomic_bool drain_stop;
+
+// Futex word the background thread sleeps on, 1 while it is asleep
+static atomic_int drain_sleeping;
+
+static void log_setup(void);
+static bool log_connect(void);
+static void log_drain(void);
+static void *drain_main(void *arg);
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+void writer_log_open(bool background)
+{
+	open_background = background;
+	pthread_once(&open_once, log_setup);
+}
+
+void writer_log(int priority, const char *format, ...)
+{
+	pthread_once(&open_once, log_setup);
+
+	// Claim a slot, the ring being full means the record is dropped, never waited for
+	size_t pos = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+	struct log_slot *slot;
+	for(;;)
+	{
+		slot = &ring[pos & LOG_RING_MASK];
+		size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if(seq == pos)
+		{
+			if(atomic_compare_exchange_weak_explicit(&ring_tail, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if((ptrdiff_t)(seq - pos) < 0)
+		{
+			// Without a background thread the producer empties the ring itself, if nobody else is
+			if(!drain_running && !atomic_flag_test_and_set_explicit(&draining, memory_order_acquire))
+			{
+				log_drain();
+				atomic_flag_clear_explicit(&draining, memory_order_release);
+				pos = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+				continue;
+			}
+			atomic_fetch_add_explicit(&dropped_count, 1, memory_order_relaxed);
+			return;
+		}
+		else
+			pos = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+	}
+
+	// Same layout as syslog(3): <PRI>Mmm dd hh:mm:ss ident[pid]: message
+	char stamp[32];
+	struct tm now_tm;
+	time_t now = time(NULL);
+	strftime(stamp, sizeof(stamp), "%h %e %T", localtime_r(&now, &now_tm));
+
+	int length = snprintf(slot->text, sizeof(slot->text), "<%d>%s %s[%d]: ",
+			LOG_MAKEPRI(LOG_USER, LOG_PRI(priority)), stamp, program_invocation_short_name, (int)getpid());
+	if(length < 0)
+		length = 0;
+	if(length < (int)sizeof(slot->text))
+	{
+		va_list args;
+		va_start(args, format);
+		int body = vsnprintf(slot->text + length, sizeof(slot->text) - length, format, args);
+		va_end(args);
+		if(body > 0)
+			length += body;
+	}
+	if(length >= (int)sizeof(slot->text))
+		length = sizeof(slot->text) - 1;
+	slot->length = length;
+
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+	// Wake the background thread only if it went to sleep, the common case is no syscall at all
+	if(atomic_load_explicit(&drain_sleeping, memory_order_relaxed) &&
+	   atomic_exchange(&drain_sleeping, 0))
+		syscall(SYS_futex, &drain_sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+void writer_log_close(void)
+{
+	if(drain_running)
+	{
+		atomic_store(&drain_stop, true);
+		atomic_store(&drain_sleeping, 0);
+		syscall(SYS_futex, &drain_sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+		pthread_join(drain_thread, NULL);
+		drain_running = false;
+	}
+
+	while(atomic_flag_test_and_set_explicit(&draining, memory_order_acquire))
+		sched_yield();
+	log_drain();
+	if(log_fd >= 0)
+	{
+		close(log_fd);
+		log_fd = -1;
+	}
+	atomic_flag_clear_explicit(&draining, memory_order_release);
+}
+
+void writer_log_get_counters(struct writer_log_counters *counters)
+{
+	counters->sent = atomic_load(&sent_count);
+	counters->dropped = atomic_load(&dropped_count);
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static void log_setup(void)
+{
+	size_t i;
+	for(i = 0; i < WRITER_LOG_RING_SIZE; i++)
+		atomic_init(&ring[i].seq, i);
+
+	atexit(writer_log_close);
+
+	// Without the thread producers drain a full ring themselves, and writer_log_close() the rest
+	if(open_background)
+		drain_running = pthread_create(&drain_thread, NULL, drain_main, NULL) == 0;
+}
+
+static bool log_connect(void)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX, .sun_path = LOG_PATH };
+
+	if(log_fd >= 0)
+		close(log_fd);
+
+	log_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(log_fd < 0)
+		return false;
+	if(connect(log_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+	{
+		close(log_fd);
+		log_fd = -1;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief - Send records [0, count) of a batch, reconnecting once and waiting briefly on a busy socket
+ * @return - Number of records sent, the rest are dropped by the caller
+ */
+static unsigned int log_send(struct mmsghdr *messages, unsigned int count)
+{
+	unsigned int done = 0;
+	bool reconnected = false;
+
+	while(done < count)
+	{
+		if(log_fd < 0 && (reconnected || !log_connect()))
+			break;
+
+		int sent = sendmmsg(log_fd, messages + done, count - done, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if(sent > 0)
+		{
+			done += sent;
+			continue;
+		}
+		if(sent < 0 && errno == EINTR)
+			continue;
+
+		// syslogd is behind, give it a moment but do not stall the writer behind it
+		if(sent < 0 && (errno == EAGAIN || errno == ENOBUFS))
+		{
+			struct pollfd pfd = { log_fd, POLLOUT, 0 };
+			if(poll(&pfd, 1, LOG_BUSY_WAIT_MS) > 0)
+				continue;
+			break;
+		}
+
+		// syslogd restarted or went away, reconnect once per batch
+		if(reconnected)
+			break;
+		reconnected = true;
+		if(!log_connect())
+			break;
+	}
+	return done;
+}
+
+/**
+ * @brief - Send every filled record, call with draining held
+ */
+static void log_drain(void)
+{
+	struct mmsghdr messages[LOG_BATCH];
+	struct iovec vectors[LOG_BATCH];
+
+	for(;;)
+	{
+		unsigned int count = 0;
+		while(count < LOG_BATCH)
+		{
+			struct log_slot *slot = &ring[(ring_head + count) & LOG_RING_MASK];
+			if(atomic_load_explicit(&slot->seq, memory_order_acquire) != ring_head + count + 1)
+				break;
+
+			vectors[count].iov_base = slot->text;
+			vectors[count].iov_len = slot->length;
+			memset(&messages[count], 0, sizeof(messages[count]));
+			messages[count].msg_hdr.msg_iov = &vectors[count];
+			messages[count].msg_hdr.msg_iovlen = 1;
+			count++;
+		}
+		if(count == 0)
+			return;
+
+		unsigned int sent = log_send(messages, count);
+		atomic_fetch_add_explicit(&sent_count, sent, memory_order_relaxed);
+		atomic_fetch_add_explicit(&dropped_count, count - sent, memory_order_relaxed);
+
+		// Hand the slots back to the producers
+		unsigned int i;
+		for(i = 0; i < count; i++)
+		{
+			struct log_slot *slot = &ring[ring_head & LOG_RING_MASK];
+			atomic_store_explicit(&slot->seq, ring_head + WRITER_LOG_RING_SIZE, memory_order_release);
+			ring_head++;
+		}
+	}
+}
+
+static bool ring_empty(void)
+{
+	struct log_slot *slot = &ring[ring_head & LOG_RING_MASK];
+	return atomic_load_explicit(&slot->seq, memory_order_acquire) != ring_head + 1;
+}
+
+static void *drain_main(void *arg)
+{
+	(void)arg;
+
+	while(!atomic_load(&drain_stop))
+	{
+		if(!atomic_flag_test_and_set_explicit(&draining, memory_order_acquire))
+		{
+			log_drain();
+			atomic_flag_clear_explicit(&draining, memory_order_release);
+		}
+
+		// Announce we are going to sleep, then look once more so a record queued in between is not missed
+		atomic_store(&drain_sleeping, 1);
+		if(!ring_empty() || atomic_load(&drain_stop))
+		{
+			atomic_store(&drain_sleeping, 0);
+			continue;
+		}
+
+		struct timespec timeout = { 0, LOG_IDLE_WAIT_MS * 1000000L };
+		syscall(SYS_futex, &drain_sleeping, FUTEX_WAIT_PRIVATE, 1, &timeout, NULL, 0);
+		atomic_store(&drain_sleeping, 0);
+	}
+	return NULL;
+}
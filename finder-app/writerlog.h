@@ -0,0 +1,63 @@
+// Asynchronous syslog sink for the Writer
+//
+// writer_log() formats a record the way syslog(3) would and drops it into a lock-free
+// ring, it never blocks on /dev/log.  The ring is drained to a connected /dev/log
+// datagram socket in batches with sendmmsg(), either by a background thread or by
+// writer_log_close() at exit.  When the ring is full, or /dev/log stays busy, records
+// are dropped and counted rather than stalling the write path.
+//
+
+#ifndef WRITERLOG_H
+#define WRITERLOG_H
+
+//------------------------------------INCLUDES------------------------------------
+#include <stdbool.h>
+#include <syslog.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Records the ring holds, must be a power of two
+#define WRITER_LOG_RING_SIZE 1024
+
+// Longest record sent, longer messages are truncated
+#define WRITER_LOG_RECORD_MAX 512
+
+//------------------------------PUBLIC DECLARATIONS-------------------------------
+
+/**
+ * @brief - Counters for the log sink
+ */
+struct writer_log_counters
+{
+	// Records handed to /dev/log
+	unsigned long sent;
+
+	// Records lost to a full ring or an unavailable /dev/log
+	unsigned long dropped;
+};
+
+/**
+ * @brief - Start the sink, the facility is always LOG_USER.  Later calls are no-ops.
+ * @param - background - Drain from a background thread, else only when the ring fills
+ *                       and in writer_log_close()
+ */
+void writer_log_open(bool background);
+
+/**
+ * @brief - Queue a record, opening the sink without a background thread if needed
+ * @param - priority - LOG_DEBUG, LOG_ERR, ...
+ */
+void writer_log(int priority, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief - Send everything queued, stop the background thread and close /dev/log.
+ *          Also registered with atexit() by writer_log_open().
+ */
+void writer_log_close(void);
+
+/**
+ * @brief - Snapshot of the sink counters
+ */
+void writer_log_get_counters(struct writer_log_counters *counters);
+
+#endif
@@ -0,0 +1,508 @@
+// This is a C File for the Writer TCP append server, see writernet.h
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "writer.h"
+#include "writernet.h"
+#include "writerlog.h"
+#include "writerevent.h"
+#include "writerhistory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Events a worker takes per epoll_wait()
+#define NET_EVENTS 16
+
+// Bytes read from a client at a time
+#define NET_READ_SIZE (64 * 1024)
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * @brief - One client, only ever touched by the worker its one shot event went to
+ */
+struct net_connection
+{
+	int fd;
+	char peer[INET6_ADDRSTRLEN];
+
+	// Received bytes not yet making up a whole packet
+	char *in;
+	size_t in_used;
+	size_t in_capacity;
+
+	// Reply still being sent, [send_offset, send_end) of the data file, or of the history
+	off_t send_offset;
+	off_t send_end;
+
+	// The client has closed its side
+	bool eof;
+};
+
+/**
+ * @brief - What a worker wants next for a connection
+ */
+enum net_next
+{
+	NET_READ,
+	NET_WRITE,
+	NET_CLOSE,
+};
+
+static int epoll_fd = -1;
+static int listen_fd = -1;
+static int data_fd = -1;
+
+// Path of the data file, for the event log
+static const char *data_name;
+
+// Level triggered and never read, once written every worker wakes up and stops
+static int wake_fd = -1;
+
+// Markers for the two descriptors that are not connections
+static int listen_marker;
+static int wake_marker;
+
+// End of the last reserved packet, and end of the written prefix of the file
+static atomic_llong reserved_end;
+static off_t committed_end;
+static pthread_mutex_t commit_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t commit_cond = PTHREAD_COND_INITIALIZER;
+
+// With -r the recent packets, in commit order, and the file offset its global offset 0 stands for
+static struct writer_history *history;
+static off_t history_base;
+
+static void net_run_workers(int workers);
+static void net_signal(int signal);
+static void *net_worker(void *arg);
+static void net_accept(void);
+static enum net_next net_handle(struct net_connection *connection);
+static off_t net_append(const char *packet, size_t length);
+static void net_close(struct net_connection *connection);
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+int writer_net_main(int argc, char *argv[])
+{
+	int port = WRITER_NET_PORT;
+	int workers = 0;
+	long recent = 0;
+	int opt;
+
+	// Skip "--listen" itself
+	optind = 1;
+	while((opt = getopt(argc, argv, "p:w:r:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'w':
+				workers = atoi(optarg);
+				break;
+			case 'r':
+				recent = atol(optarg);
+				break;
+			default:
+				goto usage;
+		}
+	}
+
+	if(optind != argc - 1 || port <= 0 || port > 65535 || recent < 0)
+		goto usage;
+	return writer_net_serve(argv[optind], port, workers, recent);
+
+usage:
+	fprintf(stderr, "Usage: writer --listen [-p port] [-w workers] [-r recentPackets] dataFile\n");
+	return 1;
+}
+
+int writer_net_serve(const char *data_path, int port, int workers, size_t recent)
+{
+	struct stat st;
+	int result = 1;
+
+	if(workers <= 0)
+		workers = WRITER_NET_WORKERS;
+
+	if(ENABLE_LOGGING)
+		writer_log_open(true);
+
+	// Lets open the data file for appending, else create
+	data_name = data_path;
+	data_fd = open(data_path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if(data_fd < 0 || fstat(data_fd, &st) < 0)
+	{
+		if(ENABLE_PRINTING)
+			fprintf(stdout, "Error opening file %s", data_path);
+		if(ENABLE_LOGGING)
+			writer_log(LOG_ERR, "Unable to create the requested writeFile - %s", data_path);
+		goto out;
+	}
+	atomic_store(&reserved_end, st.st_size);
+	committed_end = st.st_size;
+
+	if(recent > 0)
+	{
+		history = writer_history_create(recent, WRITER_NET_HISTORY_BYTES);
+		history_base = st.st_size;
+		if(history == NULL)
+			goto out;
+	}
+
+	struct sockaddr_in6 address = { .sin6_family = AF_INET6, .sin6_port = htons(port), .sin6_addr = IN6ADDR_ANY_INIT };
+	int on = 1;
+	int off = 0;
+	listen_fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(listen_fd < 0 ||
+	   setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+	   setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) < 0 ||
+	   bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+	   listen(listen_fd, SOMAXCONN) < 0)
+	{
+		if(ENABLE_PRINTING)
+			fprintf(stdout, "Error listening on port %d", port);
+		if(ENABLE_LOGGING)
+			writer_log(LOG_ERR, "Unable to listen on port %d", port);
+		goto out;
+	}
+
+	// Every worker waits on the one epoll instance, edge triggered hands each new batch of clients to one of them
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	struct epoll_event listen_event = { .events = EPOLLIN | EPOLLET, .data.ptr = &listen_marker };
+	struct epoll_event wake_event = { .events = EPOLLIN, .data.ptr = &wake_marker };
+	if(epoll_fd < 0 || wake_fd < 0 ||
+	   epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) < 0 ||
+	   epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &wake_event) < 0)
+		goto out;
+
+	// SIGINT and SIGTERM wake every worker through wake_fd
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = net_signal;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if(ENABLE_LOGGING)
+		writer_log(LOG_DEBUG, "Appending packets from port %d to %s", port, data_path);
+
+	net_run_workers(workers);
+
+	if(ENABLE_LOGGING)
+		writer_log(LOG_DEBUG, "Caught signal, exiting");
+	result = 0;
+
+out:
+	if(wake_fd >= 0)
+		close(wake_fd);
+	if(epoll_fd >= 0)
+		close(epoll_fd);
+	if(listen_fd >= 0)
+		close(listen_fd);
+	if(data_fd >= 0)
+		close(data_fd);
+	writer_history_destroy(history);
+	history = NULL;
+	return result;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+/**
+ * @brief - Run workers workers until they are woken to stop, the calling thread is worker 0
+ */
+static void net_run_workers(int workers)
+{
+	pthread_t threads[workers];
+	int started = 0;
+	int i;
+
+	for(i = 1; i < workers; i++)
+	{
+		if(pthread_create(&threads[started], NULL, net_worker, NULL) == 0)
+			started++;
+	}
+	net_worker(NULL);
+	for(i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+}
+
+static void net_signal(int signal)
+{
+	uint64_t one = 1;
+	(void)signal;
+	if(write(wake_fd, &one, sizeof(one)) < 0)
+		return;
+}
+
+static void *net_worker(void *arg)
+{
+	(void)arg;
+
+	for(;;)
+	{
+		struct epoll_event events[NET_EVENTS];
+		int ready = epoll_wait(epoll_fd, events, NET_EVENTS, -1);
+		if(ready < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return NULL;
+		}
+
+		int i;
+		for(i = 0; i < ready; i++)
+		{
+			if(events[i].data.ptr == &wake_marker)
+				return NULL;
+			if(events[i].data.ptr == &listen_marker)
+			{
+				net_accept();
+				continue;
+			}
+
+			struct net_connection *connection = events[i].data.ptr;
+			enum net_next next = net_handle(connection);
+			if(next == NET_CLOSE)
+			{
+				net_close(connection);
+				continue;
+			}
+
+			// Hand the connection back, MOD reports it again at once if it is already ready
+			struct epoll_event event = {
+				.events = (next == NET_WRITE ? EPOLLOUT : EPOLLIN | EPOLLRDHUP) | EPOLLET | EPOLLONESHOT,
+				.data.ptr = connection
+			};
+			if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) < 0)
+				net_close(connection);
+		}
+	}
+}
+
+/**
+ * @brief - Accept every waiting client, edge triggered means we must drain the backlog
+ */
+static void net_accept(void)
+{
+	for(;;)
+	{
+		struct sockaddr_in6 peer;
+		socklen_t peer_length = sizeof(peer);
+		int fd = accept4(listen_fd, (struct sockaddr *)&peer, &peer_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0)
+		{
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return;
+		}
+
+		struct net_connection *connection = calloc(1, sizeof(*connection));
+		if(connection == NULL)
+		{
+			close(fd);
+			continue;
+		}
+		connection->fd = fd;
+
+		// Show IPv4 clients as plain dotted quads
+		if(IN6_IS_ADDR_V4MAPPED(&peer.sin6_addr))
+			inet_ntop(AF_INET, &peer.sin6_addr.s6_addr[12], connection->peer, sizeof(connection->peer));
+		else
+			inet_ntop(AF_INET6, &peer.sin6_addr, connection->peer, sizeof(connection->peer));
+
+		if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_CONNECT, connection->peer, 0))
+			writer_log(LOG_DEBUG, "Accepted connection from %s", connection->peer);
+
+		struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT, .data.ptr = connection };
+		if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+			net_close(connection);
+	}
+}
+
+/**
+ * @brief - Send as much of the pending reply as the socket takes
+ * @return - true once the reply is out, false if the socket is full
+ */
+static bool net_send(struct net_connection *connection, bool *failed)
+{
+	while(history != NULL && connection->send_offset < connection->send_end)
+	{
+		char buffer[NET_READ_SIZE];
+		uint64_t offset = connection->send_offset;
+		size_t length = connection->send_end - connection->send_offset;
+		length = writer_history_read(history, &offset, buffer, length < sizeof(buffer) ? length : sizeof(buffer));
+
+		// Packets evicted since the reply was queued are skipped, a reply never goes past its own packet
+		off_t start = offset - length;
+		if(length == 0 || start >= connection->send_end)
+			break;
+		if(offset > (uint64_t)connection->send_end)
+			length -= offset - connection->send_end;
+
+		ssize_t sent = send(connection->fd, buffer, length, MSG_NOSIGNAL);
+		if(sent < 0 && errno == EINTR)
+			continue;
+		if(sent < 0 && errno == EAGAIN)
+			return false;
+		if(sent <= 0)
+		{
+			*failed = true;
+			return false;
+		}
+		connection->send_offset = start + sent;
+	}
+
+	while(history == NULL && connection->send_offset < connection->send_end)
+	{
+		ssize_t sent = sendfile(connection->fd, data_fd, &connection->send_offset,
+				connection->send_end - connection->send_offset);
+		if(sent < 0 && errno == EINTR)
+			continue;
+		if(sent < 0 && errno == EAGAIN)
+			return false;
+		if(sent <= 0)
+		{
+			*failed = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+static enum net_next net_handle(struct net_connection *connection)
+{
+	bool failed = false;
+
+	for(;;)
+	{
+		// Finish the reply in flight before looking at the next packet, replies keep packet order
+		if(!net_send(connection, &failed))
+			return failed ? NET_CLOSE : NET_WRITE;
+
+		// Append and answer every whole packet we already have
+		char *newline = connection->in_used ? memchr(connection->in, '\n', connection->in_used) : NULL;
+		if(newline != NULL)
+		{
+			size_t length = newline - connection->in + 1;
+			connection->send_offset = 0;
+			connection->send_end = net_append(connection->in, length);
+			if(history != NULL)
+				connection->send_end -= history_base;
+			memmove(connection->in, connection->in + length, connection->in_used - length);
+			connection->in_used -= length;
+			continue;
+		}
+
+		// A partial packet left when the client is gone is dropped
+		if(connection->eof)
+			return NET_CLOSE;
+
+		if(connection->in_capacity - connection->in_used < NET_READ_SIZE)
+		{
+			size_t grown_capacity = connection->in_capacity ? connection->in_capacity * 2 : NET_READ_SIZE;
+			char *grown;
+			if(grown_capacity > WRITER_NET_MAX_PACKET + NET_READ_SIZE ||
+			   (grown = realloc(connection->in, grown_capacity)) == NULL)
+			{
+				if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_PACKET_DROPPED, connection->peer, connection->in_used))
+					writer_log(LOG_ERR, "Dropping %s, packet larger than %d bytes", connection->peer, WRITER_NET_MAX_PACKET);
+				return NET_CLOSE;
+			}
+			connection->in = grown;
+			connection->in_capacity = grown_capacity;
+		}
+
+		// Edge triggered, keep reading until the socket says EAGAIN
+		ssize_t got = read(connection->fd, connection->in + connection->in_used,
+				connection->in_capacity - connection->in_used);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got < 0 && errno == EAGAIN)
+			return NET_READ;
+		if(got < 0)
+			return NET_CLOSE;
+		if(got == 0)
+			connection->eof = true;
+		connection->in_used += got;
+	}
+}
+
+/**
+ * @brief - Append one packet at its reserved offset and wait for the file to be whole up to it
+ * @return - The end of the written prefix of the file, the reply covers [0, end) or with -r the
+ *           recent packets up to end
+ */
+static off_t net_append(const char *packet, size_t length)
+{
+	off_t offset = atomic_fetch_add(&reserved_end, (long long)length);
+	size_t done = 0;
+
+	while(done < length)
+	{
+		ssize_t put = pwrite(data_fd, packet + done, length - done, offset + done);
+		if(put < 0 && errno == EINTR)
+			continue;
+		if(put <= 0)
+		{
+			// The range stays reserved (and reads back as zeros), later packets must not wait forever
+			if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_APPEND_FAILED, data_name, length))
+				writer_log(LOG_ERR, "Unable to append a packet to the data file");
+			break;
+		}
+		done += put;
+	}
+
+	// Commit in reservation order, a reply never covers a range still being written
+	pthread_mutex_lock(&commit_lock);
+	while(committed_end != offset)
+		pthread_cond_wait(&commit_cond, &commit_lock);
+	committed_end = offset + length;
+	off_t end = committed_end;
+	if(history != NULL && !writer_history_append(history, packet, length))
+	{
+		if(ENABLE_LOGGING)
+			writer_log(LOG_ERR, "Packet of %zu bytes too large for the history", length);
+	}
+	pthread_cond_broadcast(&commit_cond);
+	pthread_mutex_unlock(&commit_lock);
+
+	// Too frequent for syslog, but an event is only a few stores
+	if(ENABLE_LOGGING && done == length)
+		writer_event(WRITER_EVENT_APPEND, data_name, length);
+	return end;
+}
+
+static void net_close(struct net_connection *connection)
+{
+	if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_DISCONNECT, connection->peer, 0))
+		writer_log(LOG_DEBUG, "Closed connection from %s", connection->peer);
+
+	close(connection->fd);
+	free(connection->in);
+	free(connection);
+}
@@ -0,0 +1,53 @@
+// TCP append server for the Writer
+//
+// writer --listen [-p port] [-w workers] dataFile accepts TCP connections (port 9000 by
+// default).  Every newline terminated packet a client sends is appended to dataFile and
+// the whole file, up to and including that packet, is sent back with sendfile().
+//
+// Connections are registered edge triggered and one shot on a single epoll instance that
+// a small pool of worker threads waits on, so a connection is only ever handled by one
+// worker at a time and no thread is tied to an idle client.  Each packet reserves its
+// byte range of dataFile up front and is written with pwrite(), packets from different
+// connections are written in parallel and never interleave.  A packet's reply waits
+// until every range before it has been written, so it never contains a hole.
+//
+// With -r N the server keeps the last N packets in memory (see writerhistory.h) and a
+// reply is only those packets, copied out of memory rather than read back from dataFile.
+//
+
+#ifndef WRITERNET_H
+#define WRITERNET_H
+
+//------------------------------------INCLUDES------------------------------------
+#include <stddef.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+#define WRITER_NET_PORT 9000
+
+// Worker threads by default
+#define WRITER_NET_WORKERS 4
+
+// A connection sending more than this without a newline is dropped
+#define WRITER_NET_MAX_PACKET (16 * 1024 * 1024)
+
+// Bytes the -r history keeps, room for two of the largest packets
+#define WRITER_NET_HISTORY_BYTES (2 * WRITER_NET_MAX_PACKET)
+
+//------------------------------PUBLIC DECLARATIONS-------------------------------
+
+/**
+ * @brief - Serve dataFile on port until SIGINT or SIGTERM
+ * @param - workers - Worker threads, 0 for WRITER_NET_WORKERS
+ * @param - recent - Reply with only the last recent packets from memory, 0 for the whole file
+ * @return - 0 for Success, 1 Otherwise
+ */
+int writer_net_serve(const char *data_path, int port, int workers, size_t recent);
+
+/**
+ * @brief - Parse the server command line, argv[0] being "--listen", and run it
+ * @return - 0 for Success, 1 Otherwise
+ */
+int writer_net_main(int argc, char *argv[]);
+
+#endif
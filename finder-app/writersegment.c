@@ -0,0 +1,865 @@
+// This is a C File for the Writer segmented output, see writersegment.h
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "writer.h"
+#include "writersegment.h"
+#include "writerlog.h"
+#include "writerevent.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// <first line> in a segment name
+#define SEGMENT_DIGITS 20
+
+// Bytes copied at a time by the reader
+#define SEGMENT_COPY_SIZE (64 * 1024)
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+extern char **environ;
+
+/**
+ * @brief - A segment found in the directory
+ */
+struct segment_name
+{
+	uint64_t first;
+	bool compressed;
+};
+
+struct writer_segments
+{
+	struct writer_segment_options options;
+
+	// Where the segments live, writeFile split into its directory and name
+	char *dir;
+	char *base;
+	int dir_fd;
+
+	// The segment being appended to and its index
+	int fd;
+	int index_fd;
+	uint64_t first_line;
+	uint64_t lines;
+	off_t size;
+	struct timespec opened;
+
+	// Where the next index entry is due, and whether the next byte starts a line
+	off_t next_index;
+	bool at_line_start;
+
+	// Index entries for the bytes being written, added to the index once they are
+	struct writer_segment_index_entry *entries;
+	size_t entry_count;
+	size_t entry_capacity;
+
+	// Background retention and compression, woken after each new segment
+	pthread_t maintainer;
+	bool maintaining;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool pending;
+	bool stop;
+	uint64_t current;
+};
+
+static bool split_path(const char *path, char **dir, char **base);
+static void segment_file(char *name, size_t size, const char *base, uint64_t first, const char *suffix);
+static bool list_segments(int dir_fd, const char *base, struct segment_name **names, size_t *count);
+static bool segment_start(struct writer_segments *segments, uint64_t first, bool existing);
+static bool segment_finish(struct writer_segments *segments);
+static bool segment_account(struct writer_segments *segments, const char *data, size_t length);
+static void *segment_maintain(void *arg);
+static bool gzip_spawn(const char *option, int in_fd, int out_fd, pid_t *pid);
+static bool segment_copy(int dir_fd, const char *base, const struct segment_name *segment, uint64_t skip, int out_fd, uint64_t *end_line);
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+struct writer_segments *writer_segments_open(const struct writer_segment_options *options)
+{
+	struct writer_segments *segments = calloc(1, sizeof(*segments));
+	struct segment_name *names = NULL;
+	size_t count = 0;
+	struct stat st;
+
+	if(segments == NULL)
+		return NULL;
+	segments->options = *options;
+	segments->dir_fd = -1;
+	segments->fd = -1;
+	segments->index_fd = -1;
+	pthread_mutex_init(&segments->lock, NULL);
+	pthread_cond_init(&segments->cond, NULL);
+
+	if(!split_path(options->path, &segments->dir, &segments->base))
+		goto fail;
+	segments->dir_fd = open(segments->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(segments->dir_fd < 0)
+		goto fail;
+
+	// A plain file left by an unsegmented writer is not ours to replace
+	if(fstatat(segments->dir_fd, segments->base, &st, AT_SYMLINK_NOFOLLOW) == 0 && !S_ISLNK(st.st_mode))
+	{
+		if(ENABLE_LOGGING)
+			writer_log(LOG_ERR, "Unable to segment %s, it is not a link to a segment", options->path);
+		goto fail;
+	}
+
+	// Carry on appending to the newest segment, one closed and compressed is followed by a new one
+	if(!list_segments(segments->dir_fd, segments->base, &names, &count))
+		goto fail;
+	bool started;
+	if(count == 0)
+		started = segment_start(segments, 0, false);
+	else if(!names[count - 1].compressed)
+		started = segment_start(segments, names[count - 1].first, true);
+	else
+	{
+		uint64_t next;
+		started = segment_copy(segments->dir_fd, segments->base, &names[count - 1], 0, -1, &next) &&
+				segment_start(segments, next, false);
+	}
+	free(names);
+	if(!started)
+		goto fail;
+
+	// Old segments from an earlier run may be due for retention or compression already
+	segments->pending = true;
+	segments->maintaining = pthread_create(&segments->maintainer, NULL, segment_maintain, segments) == 0;
+	if(!segments->maintaining)
+		goto fail;
+	return segments;
+
+fail:
+	if(ENABLE_LOGGING)
+		writer_log(LOG_ERR, "Unable to open the segments of %s", options->path);
+	segment_finish(segments);
+	if(segments->dir_fd >= 0)
+		close(segments->dir_fd);
+	free(segments->dir);
+	free(segments->base);
+	free(segments->entries);
+	free(segments);
+	return NULL;
+}
+
+bool writer_segments_write(struct writer_segments *segments, struct iovec *iov, int count)
+{
+	size_t length = 0;
+	int i;
+
+	for(i = 0; i < count; i++)
+		length += iov[i].iov_len;
+
+	// Segments only ever end between lines, a partial line is finished where it was started
+	if(segments->at_line_start && segments->size > 0)
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		bool full = segments->options.segment_bytes > 0 && (size_t)segments->size + length > segments->options.segment_bytes;
+		bool old = segments->options.segment_seconds > 0 && now.tv_sec - segments->opened.tv_sec >= segments->options.segment_seconds;
+		if(full || old)
+		{
+			uint64_t next = segments->first_line + segments->lines;
+			if(!segment_finish(segments) || !segment_start(segments, next, false))
+				return false;
+
+			pthread_mutex_lock(&segments->lock);
+			segments->pending = true;
+			pthread_cond_signal(&segments->cond);
+			pthread_mutex_unlock(&segments->lock);
+		}
+	}
+
+	segments->entry_count = 0;
+	for(i = 0; i < count; i++)
+	{
+		if(!segment_account(segments, iov[i].iov_base, iov[i].iov_len))
+			return false;
+	}
+
+	while(count > 0)
+	{
+		ssize_t put = writev(segments->fd, iov, count);
+		if(put < 0 && errno == EINTR)
+			continue;
+		if(put <= 0)
+			return false;
+
+		while(count > 0 && (size_t)put >= iov->iov_len)
+		{
+			put -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + put;
+			iov->iov_len -= put;
+		}
+	}
+
+	// The index only ever points at bytes that made it into the segment
+	size_t bytes = segments->entry_count * sizeof(*segments->entries);
+	return bytes == 0 || write(segments->index_fd, segments->entries, bytes) == (ssize_t)bytes;
+}
+
+int writer_segments_close(struct writer_segments *segments)
+{
+	int result = 0;
+
+	if(segments == NULL)
+		return 1;
+
+	// Let the maintainer finish its last pass, what it leaves is picked up by the next run
+	pthread_mutex_lock(&segments->lock);
+	segments->stop = true;
+	pthread_cond_signal(&segments->cond);
+	pthread_mutex_unlock(&segments->lock);
+	if(segments->maintaining)
+		pthread_join(segments->maintainer, NULL);
+
+	if(!segment_finish(segments))
+		result = 1;
+
+	close(segments->dir_fd);
+	pthread_mutex_destroy(&segments->lock);
+	pthread_cond_destroy(&segments->cond);
+	free(segments->dir);
+	free(segments->base);
+	free(segments->entries);
+	free(segments);
+	return result;
+}
+
+int writer_segments_main(int argc, char *argv[])
+{
+	uint64_t line = WRITER_SEGMENT_TAIL_LINES;
+	bool tail = true;
+	int opt;
+
+	// Skip "--tail" itself
+	optind = 1;
+	while((opt = getopt(argc, argv, "n:f:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n':
+				line = strtoull(optarg, NULL, 10);
+				tail = true;
+				break;
+			case 'f':
+				line = strtoull(optarg, NULL, 10);
+				tail = false;
+				break;
+			default:
+				goto usage;
+		}
+	}
+
+	if(optind != argc - 1)
+		goto usage;
+	return writer_segments_read(argv[optind], line, tail, STDOUT_FILENO);
+
+usage:
+	fprintf(stderr, "Usage: writer --tail [-n lines] [-f fromLine] writeFile\n");
+	return 1;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+/**
+ * @brief - Split path into the directory it is in and its name
+ */
+static bool split_path(const char *path, char **dir, char **base)
+{
+	const char *slash = strrchr(path, '/');
+
+	if(slash == NULL)
+		*dir = strdup(".");
+	else if(slash == path)
+		*dir = strdup("/");
+	else
+		*dir = strndup(path, slash - path);
+	*base = strdup(slash ? slash + 1 : path);
+	return *dir != NULL && *base != NULL && **base != '\0';
+}
+
+/**
+ * @brief - Name of the segment starting at line first, plus suffix
+ */
+static void segment_file(char *name, size_t size, const char *base, uint64_t first, const char *suffix)
+{
+	snprintf(name, size, "%s.%0*" PRIu64 "%s", base, SEGMENT_DIGITS, first, suffix);
+}
+
+static int compare_segments(const void *a, const void *b)
+{
+	const struct segment_name *x = a;
+	const struct segment_name *y = b;
+	if(x->first != y->first)
+		return x->first < y->first ? -1 : 1;
+	return (int)x->compressed - (int)y->compressed;
+}
+
+/**
+ * @brief - Find the segments of base in the directory, oldest first
+ * @return - false if the directory can not be read
+ */
+static bool list_segments(int dir_fd, const char *base, struct segment_name **names, size_t *count)
+{
+	size_t base_length = strlen(base);
+	size_t capacity = 0;
+	struct dirent *entry;
+
+	*names = NULL;
+	*count = 0;
+
+	int fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+	if(dir == NULL)
+	{
+		if(fd >= 0)
+			close(fd);
+		return false;
+	}
+
+	while((entry = readdir(dir)) != NULL)
+	{
+		// base, a dot, the digits and nothing but an optional .gz after them
+		const char *name = entry->d_name;
+		if(strncmp(name, base, base_length) != 0 || name[base_length] != '.')
+			continue;
+		const char *digits = name + base_length + 1;
+		size_t i;
+		for(i = 0; i < SEGMENT_DIGITS && digits[i] >= '0' && digits[i] <= '9'; i++)
+			;
+		if(i != SEGMENT_DIGITS || (digits[i] != '\0' && strcmp(digits + i, ".gz") != 0))
+			continue;
+
+		if(*count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 64;
+			struct segment_name *grown = realloc(*names, capacity * sizeof(*grown));
+			if(grown == NULL)
+			{
+				closedir(dir);
+				return false;
+			}
+			*names = grown;
+		}
+		(*names)[*count].first = strtoull(digits, NULL, 10);
+		(*names)[*count].compressed = digits[i] != '\0';
+		(*count)++;
+	}
+	closedir(dir);
+
+	// A segment found both ways was being compressed when we stopped, the plain one is still whole
+	qsort(*names, *count, sizeof(**names), compare_segments);
+	size_t kept = 0;
+	size_t i;
+	for(i = 0; i < *count; i++)
+	{
+		if(kept == 0 || (*names)[kept - 1].first != (*names)[i].first)
+			(*names)[kept++] = (*names)[i];
+	}
+	*count = kept;
+	return true;
+}
+
+/**
+ * @brief - Open the segment starting at line first and point the link at it
+ * @param - existing - Carry on with a segment from an earlier run, its index is rebuilt
+ */
+static bool segment_start(struct writer_segments *segments, uint64_t first, bool existing)
+{
+	char name[NAME_MAX + 1];
+	char index_name[NAME_MAX + 1];
+	char link_name[NAME_MAX + 1];
+
+	segment_file(name, sizeof(name), segments->base, first, "");
+	segment_file(index_name, sizeof(index_name), segments->base, first, ".idx");
+	segments->fd = openat(segments->dir_fd, name, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+	segments->index_fd = openat(segments->dir_fd, index_name, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if(segments->fd < 0 || segments->index_fd < 0)
+		return false;
+
+	segments->first_line = first;
+	segments->lines = 0;
+	segments->size = 0;
+	segments->next_index = 0;
+	segments->at_line_start = true;
+	clock_gettime(CLOCK_MONOTONIC, &segments->opened);
+
+	if(existing)
+	{
+		// Count the lines already there, indexing them as if they were being written
+		char buffer[SEGMENT_COPY_SIZE];
+		ssize_t got;
+		while((got = pread(segments->fd, buffer, sizeof(buffer), segments->size)) != 0)
+		{
+			if(got < 0 && errno == EINTR)
+				continue;
+			if(got < 0)
+				return false;
+			segments->entry_count = 0;
+			if(!segment_account(segments, buffer, got))
+				return false;
+			size_t bytes = segments->entry_count * sizeof(*segments->entries);
+			if(bytes > 0 && write(segments->index_fd, segments->entries, bytes) != (ssize_t)bytes)
+				return false;
+		}
+	}
+	else if(segments->options.preallocate > 0)
+	{
+		// Reserved without moving EOF, whatever is left unused is given back in segment_finish()
+		if(fallocate(segments->fd, FALLOC_FL_KEEP_SIZE, 0, segments->options.preallocate) < 0)
+			segments->options.preallocate = 0;
+	}
+
+	// Swap the link over in one rename, readers of writeFile never find it missing
+	snprintf(link_name, sizeof(link_name), ".%s.%d.link.tmp", segments->base, (int)getpid());
+	unlinkat(segments->dir_fd, link_name, 0);
+	if(symlinkat(name, segments->dir_fd, link_name) < 0 ||
+	   renameat(segments->dir_fd, link_name, segments->dir_fd, segments->base) < 0)
+	{
+		unlinkat(segments->dir_fd, link_name, 0);
+		return false;
+	}
+
+	pthread_mutex_lock(&segments->lock);
+	segments->current = first;
+	pthread_mutex_unlock(&segments->lock);
+
+	if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_SEGMENT, name, 0))
+		writer_log(LOG_DEBUG, "Appending to segment %s", name);
+	return true;
+}
+
+/**
+ * @brief - Close the current segment, giving back its unused preallocation
+ * @return - false if closing the segment failed
+ */
+static bool segment_finish(struct writer_segments *segments)
+{
+	bool success = true;
+
+	if(segments->fd >= 0)
+	{
+		if(segments->options.preallocate > 0 && ftruncate(segments->fd, segments->size) < 0 && ENABLE_LOGGING)
+			writer_log(LOG_ERR, "Unable to trim the preallocation of %s", segments->options.path);
+		success = close(segments->fd) == 0;
+	}
+	if(segments->index_fd >= 0)
+		close(segments->index_fd);
+	segments->fd = -1;
+	segments->index_fd = -1;
+	return success;
+}
+
+/**
+ * @brief - Count the lines in the next length bytes of the segment, queueing the index entries due
+ */
+static bool segment_account(struct writer_segments *segments, const char *data, size_t length)
+{
+	const char *cursor = data;
+	const char *end = data + length;
+
+	while(cursor < end)
+	{
+		off_t position = segments->size + (cursor - data);
+		if(segments->at_line_start && position >= segments->next_index)
+		{
+			if(segments->entry_count == segments->entry_capacity)
+			{
+				size_t grown_capacity = segments->entry_capacity ? segments->entry_capacity * 2 : 64;
+				struct writer_segment_index_entry *grown = realloc(segments->entries, grown_capacity * sizeof(*grown));
+				if(grown == NULL)
+					return false;
+				segments->entries = grown;
+				segments->entry_capacity = grown_capacity;
+			}
+			segments->entries[segments->entry_count].line = segments->first_line + segments->lines;
+			segments->entries[segments->entry_count].position = position;
+			segments->entry_count++;
+			segments->next_index = position + WRITER_SEGMENT_INDEX_INTERVAL;
+		}
+
+		const char *newline = memchr(cursor, '\n', end - cursor);
+		segments->at_line_start = newline != NULL;
+		if(newline == NULL)
+			break;
+		segments->lines++;
+		cursor = newline + 1;
+	}
+
+	segments->size += length;
+	return true;
+}
+
+/**
+ * @brief - Run gzip with option on in_fd, writing to out_fd
+ */
+static bool gzip_spawn(const char *option, int in_fd, int out_fd, pid_t *pid)
+{
+	posix_spawn_file_actions_t actions;
+	char *argv[] = { "gzip", (char *)option, NULL };
+
+	if(posix_spawn_file_actions_init(&actions) != 0)
+		return false;
+	posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+	int error = posix_spawnp(pid, "gzip", &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+
+	errno = error;
+	return error == 0;
+}
+
+/**
+ * @brief - gzip a closed segment into name.gz and drop the original and its index
+ * @return - false if gzip could not be run or failed
+ */
+static bool segment_compress(struct writer_segments *segments, uint64_t first)
+{
+	char name[NAME_MAX + 1];
+	char temp_name[NAME_MAX + 1];
+	char compressed_name[NAME_MAX + 1];
+	char index_name[NAME_MAX + 1];
+	bool success = false;
+	pid_t pid;
+
+	segment_file(name, sizeof(name), segments->base, first, "");
+	segment_file(temp_name, sizeof(temp_name), segments->base, first, ".gz.tmp");
+	segment_file(compressed_name, sizeof(compressed_name), segments->base, first, ".gz");
+	segment_file(index_name, sizeof(index_name), segments->base, first, ".idx");
+
+	int in_fd = openat(segments->dir_fd, name, O_RDONLY | O_CLOEXEC);
+	int out_fd = openat(segments->dir_fd, temp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if(in_fd >= 0 && out_fd >= 0 && gzip_spawn("-c", in_fd, out_fd, &pid))
+	{
+		int status;
+		while(waitpid(pid, &status, 0) < 0 && errno == EINTR)
+			;
+
+		// The .gz is whole on disk before the only other copy goes
+		success = WIFEXITED(status) && WEXITSTATUS(status) == 0 && fsync(out_fd) == 0 &&
+				renameat(segments->dir_fd, temp_name, segments->dir_fd, compressed_name) == 0;
+	}
+	if(in_fd >= 0)
+		close(in_fd);
+	if(out_fd >= 0)
+		close(out_fd);
+
+	if(success)
+	{
+		unlinkat(segments->dir_fd, name, 0);
+		unlinkat(segments->dir_fd, index_name, 0);
+	}
+	else
+		unlinkat(segments->dir_fd, temp_name, 0);
+	return success;
+}
+
+/**
+ * @brief - Delete closed segments past the retention count and compress the rest
+ */
+static void segment_maintain_once(struct writer_segments *segments, uint64_t current)
+{
+	struct segment_name *names;
+	size_t count;
+	size_t i;
+
+	if(!list_segments(segments->dir_fd, segments->base, &names, &count))
+		return;
+
+	// Everything but the segment being written is closed, they all sort before it
+	size_t closed = 0;
+	while(closed < count && names[closed].first < current)
+		closed++;
+
+	size_t doomed = segments->options.keep > 0 && closed > (size_t)segments->options.keep ?
+			closed - segments->options.keep : 0;
+	for(i = 0; i < doomed; i++)
+	{
+		char name[NAME_MAX + 1];
+		segment_file(name, sizeof(name), segments->base, names[i].first, names[i].compressed ? ".gz" : "");
+		unlinkat(segments->dir_fd, name, 0);
+		segment_file(name, sizeof(name), segments->base, names[i].first, ".idx");
+		unlinkat(segments->dir_fd, name, 0);
+	}
+
+	for(i = doomed; segments->options.compress && i < closed; i++)
+	{
+		if(names[i].compressed || segment_compress(segments, names[i].first))
+			continue;
+
+		if(ENABLE_LOGGING)
+			writer_log(LOG_ERR, "Unable to compress the segments of %s, leaving them as they are", segments->options.path);
+		segments->options.compress = false;
+	}
+	free(names);
+}
+
+static void *segment_maintain(void *arg)
+{
+	struct writer_segments *segments = arg;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&segments->lock);
+		while(!segments->pending && !segments->stop)
+			pthread_cond_wait(&segments->cond, &segments->lock);
+		bool pending = segments->pending;
+		bool stop = segments->stop;
+		uint64_t current = segments->current;
+		segments->pending = false;
+		pthread_mutex_unlock(&segments->lock);
+
+		if(pending)
+			segment_maintain_once(segments, current);
+		if(stop)
+			return NULL;
+	}
+}
+
+/**
+ * @brief - Copy in_fd to out_fd from after its first skip lines
+ * @return - false on a read or write error
+ */
+static bool copy_lines(int in_fd, uint64_t skip, int out_fd)
+{
+	char buffer[SEGMENT_COPY_SIZE];
+
+	for(;;)
+	{
+		ssize_t got = read(in_fd, buffer, sizeof(buffer));
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got < 0)
+			return false;
+		if(got == 0)
+			return true;
+
+		char *cursor = buffer;
+		char *end = buffer + got;
+		while(skip > 0 && cursor < end)
+		{
+			char *newline = memchr(cursor, '\n', end - cursor);
+			if(newline == NULL)
+			{
+				cursor = end;
+				break;
+			}
+			cursor = newline + 1;
+			skip--;
+		}
+
+		while(cursor < end)
+		{
+			ssize_t put = write(out_fd, cursor, end - cursor);
+			if(put < 0 && errno == EINTR)
+				continue;
+			if(put <= 0)
+				return false;
+			cursor += put;
+		}
+	}
+}
+
+/**
+ * @brief - Load the index of the segment starting at first, empty if it has none
+ */
+static void load_index(int dir_fd, const char *base, uint64_t first, struct writer_segment_index_entry **entries, size_t *count)
+{
+	char name[NAME_MAX + 1];
+	struct stat st;
+
+	*entries = NULL;
+	*count = 0;
+	segment_file(name, sizeof(name), base, first, ".idx");
+	int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return;
+
+	size_t bytes = fstat(fd, &st) == 0 ? (size_t)st.st_size / sizeof(**entries) * sizeof(**entries) : 0;
+	*entries = bytes ? malloc(bytes) : NULL;
+	if(*entries != NULL && pread(fd, *entries, bytes, 0) == (ssize_t)bytes)
+		*count = bytes / sizeof(**entries);
+	close(fd);
+}
+
+/**
+ * @brief - The indexed line nearest before line, or the segment start
+ */
+static struct writer_segment_index_entry nearest_entry(const struct writer_segment_index_entry *entries, size_t count,
+		uint64_t first, uint64_t line)
+{
+	struct writer_segment_index_entry nearest = { first, 0 };
+	size_t low = 0;
+	size_t high = count;
+
+	while(low < high)
+	{
+		size_t middle = low + (high - low) / 2;
+		if(entries[middle].line <= line)
+		{
+			nearest = entries[middle];
+			low = middle + 1;
+		}
+		else
+			high = middle;
+	}
+	return nearest;
+}
+
+/**
+ * @brief - Copy a segment to out_fd from after its first skip lines
+ * @param - end_line - If not NULL, count the segment's lines instead and store the number of the line after them
+ * @return - false on an error
+ */
+static bool segment_copy(int dir_fd, const char *base, const struct segment_name *segment, uint64_t skip, int out_fd, uint64_t *end_line)
+{
+	char name[NAME_MAX + 1];
+	bool success = false;
+
+	segment_file(name, sizeof(name), base, segment->first, segment->compressed ? ".gz" : "");
+	int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return false;
+
+	int in_fd = fd;
+	int pipe_fds[2] = { -1, -1 };
+	pid_t pid = -1;
+	uint64_t line = segment->first;
+
+	if(segment->compressed)
+	{
+		// Compressed segments are streamed through gzip from the start, they have no index
+		if(pipe2(pipe_fds, O_CLOEXEC) < 0 || !gzip_spawn("-dc", fd, pipe_fds[1], &pid))
+			goto out;
+		close(pipe_fds[1]);
+		pipe_fds[1] = -1;
+		in_fd = pipe_fds[0];
+	}
+	else
+	{
+		// Jump to the nearest indexed line, the rest is at most an index interval of scanning, when
+		// counting that is the last indexed line
+		struct writer_segment_index_entry *entries;
+		size_t count;
+		uint64_t target = end_line ? UINT64_MAX : segment->first + skip;
+		load_index(dir_fd, base, segment->first, &entries, &count);
+		struct writer_segment_index_entry nearest = nearest_entry(entries, count, segment->first, target);
+		free(entries);
+		if(lseek(fd, nearest.position, SEEK_SET) < 0)
+			goto out;
+		line = nearest.line;
+		if(end_line == NULL)
+			skip = target - line;
+	}
+
+	if(end_line == NULL)
+		success = copy_lines(in_fd, skip, out_fd);
+	else
+	{
+		char buffer[SEGMENT_COPY_SIZE];
+		ssize_t got;
+		while((got = read(in_fd, buffer, sizeof(buffer))) > 0 || (got < 0 && errno == EINTR))
+		{
+			char *cursor = buffer;
+			while(got > 0 && (cursor = memchr(cursor, '\n', buffer + got - cursor)) != NULL)
+			{
+				line++;
+				cursor++;
+			}
+		}
+		*end_line = line;
+		success = got == 0;
+	}
+
+out:
+	if(pipe_fds[0] >= 0)
+		close(pipe_fds[0]);
+	if(pipe_fds[1] >= 0)
+		close(pipe_fds[1]);
+	if(pid > 0)
+	{
+		int status;
+		while(waitpid(pid, &status, 0) < 0 && errno == EINTR)
+			;
+		success = success && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+	close(fd);
+	return success;
+}
+
+int writer_segments_read(const char *path, uint64_t line, bool tail, int out_fd)
+{
+	struct segment_name *names = NULL;
+	size_t count = 0;
+	char *dir = NULL;
+	char *base = NULL;
+	int dir_fd = -1;
+	int result = 1;
+	size_t i;
+
+	if(!split_path(path, &dir, &base) || (dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 ||
+	   !list_segments(dir_fd, base, &names, &count) || count == 0)
+	{
+		if(ENABLE_PRINTING)
+			fprintf(stdout, "Error opening file %s", path);
+		if(ENABLE_LOGGING)
+			writer_log(LOG_ERR, "Unable to read the segments of %s", path);
+		goto out;
+	}
+
+	// The last lines are counted back from the end of the newest segment, only it is read
+	uint64_t start = line;
+	if(tail)
+	{
+		uint64_t end;
+		if(!segment_copy(dir_fd, base, &names[count - 1], 0, -1, &end))
+			goto out;
+		start = end > line ? end - line : 0;
+	}
+
+	// Lines already deleted are skipped, the copy starts in the segment holding start
+	size_t first = 0;
+	for(i = 0; i < count && names[i].first <= start; i++)
+		first = i;
+	if(start < names[first].first)
+		start = names[first].first;
+
+	result = 0;
+	for(i = first; i < count && result == 0; i++)
+	{
+		if(!segment_copy(dir_fd, base, &names[i], i == first ? start - names[i].first : 0, out_fd, NULL))
+			result = 1;
+	}
+
+out:
+	if(dir_fd >= 0)
+		close(dir_fd);
+	free(dir);
+	free(base);
+	free(names);
+	return result;
+}
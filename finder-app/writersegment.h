@@ -0,0 +1,113 @@
+// Segmented output for the Writer
+//
+// Instead of one file that grows without bound, writer --append -S size or -R seconds
+// writes writeFile as a run of segments next to it, writeFile.<first line> where <first
+// line> is the 20 digit number of the first line the segment holds, counted from the
+// first line ever written.  A new segment is started at a line boundary once the current
+// one reaches the size or has been open for the time.  writeFile itself becomes a
+// symbolic link to the newest segment, so anything reading the file as before sees the
+// current data.
+//
+// Each segment has a sparse index, writeFile.<first line>.idx, with one entry per
+// WRITER_SEGMENT_INDEX_INTERVAL bytes giving the number and position of a line.  Finding
+// a line is picking its segment by name, then its nearest indexed line, then scanning at
+// most an interval of bytes, so reading recent lines only touches the newest segment.
+//
+// Closed segments are compressed with gzip (-z), into writeFile.<first line>.gz, and the
+// oldest deleted past a retention count (-k), on a background thread so appends never
+// wait for either.
+//
+// writer --tail [-n lines] [-f fromLine] writeFile prints the last lines, or every line
+// from a line number on, across segments, compressed or not.
+//
+// A segmented file has a single appender, the line numbers and the index are its own.
+//
+
+#ifndef WRITERSEGMENT_H
+#define WRITERSEGMENT_H
+
+//------------------------------------INCLUDES------------------------------------
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Bytes of segment between two index entries
+#define WRITER_SEGMENT_INDEX_INTERVAL 4096
+
+// Lines writer --tail prints by default
+#define WRITER_SEGMENT_TAIL_LINES 10
+
+//------------------------------PUBLIC DECLARATIONS-------------------------------
+
+/**
+ * @brief - Options for writer_segments_open()
+ */
+struct writer_segment_options
+{
+	// The file the segments stand for, it becomes a link to the newest one
+	const char *path;
+
+	// Start a new segment past this many bytes, 0 for no size limit
+	size_t segment_bytes;
+
+	// Start a new segment once the current one is this old, 0 for no time limit
+	int segment_seconds;
+
+	// Closed segments kept, older ones are deleted, 0 keeps them all
+	int keep;
+
+	// gzip closed segments
+	bool compress;
+
+	// Bytes preallocated at the start of each segment, 0 disables preallocation
+	size_t preallocate;
+};
+
+/**
+ * @brief - One line of a segment index
+ */
+struct writer_segment_index_entry
+{
+	// Line number, counted across segments, and where it starts in the segment
+	uint64_t line;
+	uint64_t position;
+};
+
+struct writer_segments;
+
+/**
+ * @brief - Carry on with the newest existing segment, or start the first
+ * @return - The segments, NULL on failure
+ */
+struct writer_segments *writer_segments_open(const struct writer_segment_options *options);
+
+/**
+ * @brief - Append iov to the current segment, starting a new one first if it is due
+ * @param - iov - Consumed as it is written
+ * @return - false on a write error
+ */
+bool writer_segments_write(struct writer_segments *segments, struct iovec *iov, int count);
+
+/**
+ * @brief - Close the current segment, after the background thread finishes what is queued
+ * @return - 0 for Success, 1 Otherwise
+ */
+int writer_segments_close(struct writer_segments *segments);
+
+/**
+ * @brief - Copy lines of a segmented file to out_fd
+ * @param - tail - line counts back from the end rather than being a line number
+ * @return - 0 for Success, 1 Otherwise
+ */
+int writer_segments_read(const char *path, uint64_t line, bool tail, int out_fd);
+
+/**
+ * @brief - Parse the reader command line, argv[0] being "--tail", and run it
+ * @return - 0 for Success, 1 Otherwise
+ */
+int writer_segments_main(int argc, char *argv[]);
+
+#endif
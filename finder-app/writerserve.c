@@ -0,0 +1,739 @@
+// This is a C File for the Writer daemon and its client shim, see writerserve.h
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "writer.h"
+#include "writerserve.h"
+#include "writerlog.h"
+#include "writerevent.h"
+#include "writeruring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Hash chains for the open file cache
+#define FILE_CHAINS 512
+
+// Events handled per epoll_wait()
+#define SERVE_EVENTS 64
+
+// Connection buffers start this big and grow to fit the largest request seen
+#define SERVE_BUFFER_SIZE (64 * 1024)
+
+// Overwrites collected into one io_uring batch at most
+#define SERVE_URING_BATCH 32
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * @brief - An output file kept open between requests
+ */
+struct cached_file
+{
+	char *path;
+	bool append;
+	int fd;
+
+	// Identity of the file when it was opened, a different inode at path means it was replaced
+	dev_t dev;
+	ino_t ino;
+
+	struct cached_file *chain_next;
+	struct cached_file *lru_prev;
+	struct cached_file *lru_next;
+};
+
+/**
+ * @brief - One client connection
+ */
+struct connection
+{
+	int fd;
+
+	// Received bytes, requests are parsed from the front
+	char *in;
+	size_t in_used;
+	size_t in_capacity;
+
+	// Replies not yet accepted by the socket
+	struct writer_reply *out;
+	size_t out_count;
+	size_t out_capacity;
+	size_t out_sent_bytes;
+	bool want_write;
+
+	// The client has finished sending, close once the replies are out
+	bool eof;
+};
+
+static struct cached_file *file_chains[FILE_CHAINS];
+static struct cached_file *lru_head;
+static struct cached_file *lru_tail;
+static size_t file_count;
+
+static volatile sig_atomic_t serve_stop = 0;
+
+// With -u, the ring and the overwrites collected for it, each with its request and reply slot
+static struct writer_uring *serve_ring;
+static struct writer_uring_file batch_files[SERVE_URING_BATCH];
+static struct writer_request batch_requests[SERVE_URING_BATCH];
+static size_t batch_replies[SERVE_URING_BATCH];
+static char batch_paths[SERVE_URING_BATCH][WRITER_REQUEST_MAX_PATH + 1];
+static size_t batch_count;
+
+static void serve_signal(int signal);
+static bool peer_allowed(int client_fd);
+static int cached_open(const char *path, bool append, bool *owned);
+static void cached_drop(struct cached_file *file);
+static void cache_clear(void);
+static struct writer_reply handle_request(const struct writer_request *request, const char *path_bytes, const char *data);
+static bool connection_read(struct connection *connection);
+static bool connection_flush(struct connection *connection);
+static void connection_close(int epoll_fd, struct connection *connection);
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+int writer_serve_main(int argc, char *argv[])
+{
+	bool uring = false;
+	int opt;
+
+	// Skip "--serve" itself
+	optind = 1;
+	while((opt = getopt(argc, argv, "u")) != -1)
+	{
+		switch(opt)
+		{
+			case 'u':
+				uring = true;
+				break;
+			default:
+				goto usage;
+		}
+	}
+
+	if(optind != argc - 1)
+		goto usage;
+	return writer_serve(argv[optind], uring);
+
+usage:
+	fprintf(stderr, "Usage: writer --serve [-u] socketPath\n");
+	return 1;
+}
+
+int writer_serve(const char *socket_path, bool uring)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	int listen_fd;
+	int epoll_fd;
+
+	if(strlen(socket_path) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "Socket path %s is too long\n", socket_path);
+		return 1;
+	}
+	strcpy(address.sun_path, socket_path);
+
+	if(ENABLE_LOGGING)
+		writer_log_open(true);
+
+	// A socket left behind by a daemon that did not shut down cleanly would make bind() fail
+	unlink(socket_path);
+
+	// The socket is created 0600, only our own user may connect, see peer_allowed()
+	mode_t old_umask = umask(0177);
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	int bound = listen_fd < 0 ? -1 : bind(listen_fd, (struct sockaddr *)&address, sizeof(address));
+	umask(old_umask);
+	if(bound < 0 || chmod(socket_path, 0600) < 0 || listen(listen_fd, SOMAXCONN) < 0)
+	{
+		if(ENABLE_PRINTING)
+			fprintf(stdout, "Error listening on %s", socket_path);
+		if(ENABLE_LOGGING)
+			writer_log(LOG_ERR, "Unable to listen on %s", socket_path);
+		if(listen_fd >= 0)
+			close(listen_fd);
+		return 1;
+	}
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event listen_event = { .events = EPOLLIN, .data.ptr = NULL };
+	if(epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) < 0)
+	{
+		close(listen_fd);
+		unlink(socket_path);
+		return 1;
+	}
+
+	// SIGINT and SIGTERM stop the loop, without SA_RESTART so epoll_wait() returns
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = serve_signal;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if(uring)
+	{
+		serve_ring = writer_uring_open(0);
+		if(serve_ring == NULL && ENABLE_LOGGING)
+			writer_log(LOG_DEBUG, "io_uring unavailable, serving writes synchronously");
+	}
+
+	if(ENABLE_LOGGING)
+		writer_log(LOG_DEBUG, "Serving write requests on %s", socket_path);
+
+	while(!serve_stop)
+	{
+		struct epoll_event events[SERVE_EVENTS];
+		int ready = epoll_wait(epoll_fd, events, SERVE_EVENTS, -1);
+		if(ready < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+
+		int i;
+		for(i = 0; i < ready; i++)
+		{
+			struct connection *connection = events[i].data.ptr;
+
+			// New clients, take everything that is waiting
+			if(connection == NULL)
+			{
+				int client_fd;
+				while((client_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+				{
+					if(!peer_allowed(client_fd))
+					{
+						close(client_fd);
+						continue;
+					}
+					connection = calloc(1, sizeof(*connection));
+					if(connection != NULL)
+					{
+						struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = connection };
+						connection->fd = client_fd;
+						if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event) == 0)
+							continue;
+					}
+					free(connection);
+					close(client_fd);
+				}
+				continue;
+			}
+
+			bool open = true;
+			if(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+				open = connection_read(connection);
+			if(open)
+				open = connection_flush(connection);
+			if(!open || (connection->eof && connection->out_count == 0))
+			{
+				connection_close(epoll_fd, connection);
+				continue;
+			}
+
+			// Only ask for EPOLLOUT while replies are backed up
+			bool want_write = connection->out_count > 0;
+			if(want_write != connection->want_write)
+			{
+				struct epoll_event event = {
+					.events = EPOLLIN | EPOLLRDHUP | (want_write ? EPOLLOUT : 0),
+					.data.ptr = connection
+				};
+				epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+				connection->want_write = want_write;
+			}
+		}
+	}
+
+	if(ENABLE_LOGGING)
+		writer_log(LOG_DEBUG, "Stopped serving write requests on %s", socket_path);
+
+	// Open connections are simply dropped, their clients fall back to writing themselves
+	cache_clear();
+	writer_uring_close(serve_ring);
+	serve_ring = NULL;
+	close(epoll_fd);
+	close(listen_fd);
+	unlink(socket_path);
+	return 0;
+}
+
+int writer_client_write(const char *socket_path, enum writer_request_op op, const char *path,
+		const void *data, size_t length, enum writer_durability durability)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	char absolute[PATH_MAX];
+
+	if(strlen(socket_path) >= sizeof(address.sun_path) || length > WRITER_REQUEST_MAX_DATA)
+		return -1;
+	strcpy(address.sun_path, socket_path);
+
+	// The daemon has its own working directory
+	if(path[0] != '/')
+	{
+		if(getcwd(absolute, sizeof(absolute)) == NULL ||
+		   strlen(absolute) + 1 + strlen(path) >= sizeof(absolute))
+			return -1;
+		strcat(absolute, "/");
+		strcat(absolute, path);
+		path = absolute;
+	}
+	if(strlen(path) > WRITER_REQUEST_MAX_PATH)
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+		return -1;
+	if(connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	struct writer_request request = {
+		WRITER_REQUEST_MAGIC, (uint16_t)op, (uint16_t)durability, (uint32_t)strlen(path), (uint32_t)length
+	};
+	struct iovec iov[3] = {
+		{ &request, sizeof(request) },
+		{ (void *)path, request.path_length },
+		{ (void *)data, length },
+	};
+	struct msghdr message = { .msg_iov = iov, .msg_iovlen = 3 };
+
+	// One sendmsg() normally takes it all, pick up after a short send for large data
+	while(message.msg_iovlen > 0)
+	{
+		ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+		if(sent < 0 && errno == EINTR)
+			continue;
+		if(sent < 0)
+		{
+			close(fd);
+			return -1;
+		}
+		while(message.msg_iovlen > 0 && (size_t)sent >= message.msg_iov->iov_len)
+		{
+			sent -= message.msg_iov->iov_len;
+			message.msg_iov++;
+			message.msg_iovlen--;
+		}
+		if(message.msg_iovlen > 0)
+		{
+			message.msg_iov->iov_base = (char *)message.msg_iov->iov_base + sent;
+			message.msg_iov->iov_len -= sent;
+		}
+	}
+
+	struct writer_reply reply;
+	size_t got = 0;
+	while(got < sizeof(reply))
+	{
+		ssize_t n = read(fd, (char *)&reply + got, sizeof(reply) - got);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+		{
+			// The request may or may not have been done, but writing it again is harmless
+			close(fd);
+			return -1;
+		}
+		got += n;
+	}
+	close(fd);
+
+	errno = reply.error;
+	return reply.status == 0 ? 0 : 1;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+static void serve_signal(int signal)
+{
+	(void)signal;
+	serve_stop = 1;
+}
+
+/**
+ * @brief - Only a client running as our own user may write through us, anyone else would be
+ * writing with our permissions.  A rejected client sees the connection closed and writes itself.
+ */
+static bool peer_allowed(int client_fd)
+{
+	struct ucred peer = { .pid = 0, .uid = (uid_t)-1, .gid = (gid_t)-1 };
+	socklen_t length = sizeof(peer);
+
+	if(getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) == 0 && peer.uid == geteuid())
+		return true;
+	if(ENABLE_LOGGING)
+		writer_log(LOG_ERR, "Rejecting client with uid %d", (int)peer.uid);
+	return false;
+}
+
+static unsigned int file_chain(const char *path, bool append)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u ^ append;
+	for(; *path; path++)
+		hash = (hash ^ (unsigned char)*path) * 16777619u;
+	return hash % FILE_CHAINS;
+}
+
+static void lru_unlink(struct cached_file *file)
+{
+	if(file->lru_prev)
+		file->lru_prev->lru_next = file->lru_next;
+	else
+		lru_head = file->lru_next;
+	if(file->lru_next)
+		file->lru_next->lru_prev = file->lru_prev;
+	else
+		lru_tail = file->lru_prev;
+}
+
+static void lru_push(struct cached_file *file)
+{
+	file->lru_prev = NULL;
+	file->lru_next = lru_head;
+	if(lru_head)
+		lru_head->lru_prev = file;
+	lru_head = file;
+	if(lru_tail == NULL)
+		lru_tail = file;
+}
+
+/**
+ * @brief - An fd for path, from the cache if the file there is still the one we have open
+ * @param - owned - Set if the fd could not be cached and the caller must close it
+ * @return - The fd, -1 on failure
+ */
+static int cached_open(const char *path, bool append, bool *owned)
+{
+	unsigned int chain = file_chain(path, append);
+	struct cached_file *file;
+	struct stat st;
+
+	*owned = false;
+
+	for(file = file_chains[chain]; file != NULL; file = file->chain_next)
+	{
+		if(file->append == append && strcmp(file->path, path) == 0)
+			break;
+	}
+
+	if(file != NULL)
+	{
+		// Someone renamed or deleted the file since, the new one has to be opened
+		if(stat(path, &st) == 0 && st.st_dev == file->dev && st.st_ino == file->ino)
+		{
+			lru_unlink(file);
+			lru_push(file);
+			return file->fd;
+		}
+		cached_drop(file);
+	}
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : 0), 0666);
+	if(fd < 0)
+		return -1;
+
+	file = calloc(1, sizeof(*file));
+	if(file == NULL || fstat(fd, &st) < 0 || (file->path = strdup(path)) == NULL)
+	{
+		// Still usable for this one request, it just is not kept
+		free(file);
+		*owned = true;
+		return fd;
+	}
+
+	file->append = append;
+	file->fd = fd;
+	file->dev = st.st_dev;
+	file->ino = st.st_ino;
+	file->chain_next = file_chains[chain];
+	file_chains[chain] = file;
+	lru_push(file);
+
+	if(++file_count > WRITER_SERVE_MAX_FILES)
+		cached_drop(lru_tail);
+	return fd;
+}
+
+static void cached_drop(struct cached_file *file)
+{
+	struct cached_file **link = &file_chains[file_chain(file->path, file->append)];
+	while(*link != file)
+		link = &(*link)->chain_next;
+	*link = file->chain_next;
+
+	lru_unlink(file);
+	close(file->fd);
+	free(file->path);
+	free(file);
+	file_count--;
+}
+
+static void cache_clear(void)
+{
+	while(lru_head != NULL)
+		cached_drop(lru_head);
+}
+
+static bool write_at(int fd, const char *data, size_t length, off_t offset, bool append)
+{
+	size_t done = 0;
+
+	while(done < length)
+	{
+		ssize_t put = append ? write(fd, data + done, length - done) :
+				pwrite(fd, data + done, length - done, offset + done);
+		if(put < 0 && errno == EINTR)
+			continue;
+		if(put <= 0)
+		{
+			if(put == 0)
+				errno = EIO;
+			return false;
+		}
+		done += put;
+	}
+	return true;
+}
+
+static struct writer_reply handle_request(const struct writer_request *request, const char *path_bytes, const char *data)
+{
+	struct writer_reply reply = { 0, 0 };
+	char path[WRITER_REQUEST_MAX_PATH + 1];
+	enum writer_durability durability = (enum writer_durability)request->durability;
+	bool append = request->op == WRITER_OP_APPEND;
+	bool success;
+
+	memcpy(path, path_bytes, request->path_length);
+	path[request->path_length] = '\0';
+
+	// A new file every time, there is nothing to keep open
+	if(!append && (durability == WRITER_DURABILITY_ATOMIC || durability == WRITER_DURABILITY_GROUP))
+		success = writer_file_write(path, data, request->data_length, durability);
+	else
+	{
+		bool owned;
+		int fd = cached_open(path, append, &owned);
+
+		success = fd >= 0 &&
+				(append || ftruncate(fd, 0) == 0) &&
+				write_at(fd, data, request->data_length, 0, append) &&
+				(durability != WRITER_DURABILITY_FDATASYNC || fdatasync(fd) == 0);
+		int saved_errno = errno;
+		if(owned)
+			close(fd);
+		errno = saved_errno;
+	}
+
+	if(!success)
+	{
+		reply.status = 1;
+		reply.error = errno;
+		if(ENABLE_PRINTING)
+			fprintf(stdout, "Error opening file %s", path);
+		if(ENABLE_LOGGING &&
+		   !writer_event(append ? WRITER_EVENT_APPEND_FAILED : WRITER_EVENT_WRITE_FAILED, path, request->data_length))
+			writer_log(LOG_ERR, "Unable to create the requested writeFile - %s", path);
+	}
+	else if(ENABLE_LOGGING && !writer_event(append ? WRITER_EVENT_APPEND : WRITER_EVENT_WRITE, path, request->data_length))
+		writer_log(LOG_DEBUG, "Writing writeStr to writeFile");
+	return reply;
+}
+
+/**
+ * @brief - Queue a reply for the connection
+ */
+static bool queue_reply(struct connection *connection, struct writer_reply reply)
+{
+	if(connection->out_count == connection->out_capacity)
+	{
+		size_t grown_capacity = connection->out_capacity ? connection->out_capacity * 2 : 16;
+		struct writer_reply *grown = realloc(connection->out, grown_capacity * sizeof(*grown));
+		if(grown == NULL)
+			return false;
+		connection->out = grown;
+		connection->out_capacity = grown_capacity;
+	}
+	connection->out[connection->out_count++] = reply;
+	return true;
+}
+
+/**
+ * @brief - Write the collected overwrites through the ring and fill in their replies
+ */
+static void batch_flush(struct connection *connection)
+{
+	size_t i;
+
+	if(batch_count == 0)
+		return;
+
+	// Anything the ring could not do is redone synchronously, which also reports the failure
+	writer_uring_write(serve_ring, batch_files, batch_count);
+	for(i = 0; i < batch_count; i++)
+	{
+		struct writer_reply reply = { 0, 0 };
+		if(batch_files[i].error != 0)
+			reply = handle_request(&batch_requests[i], batch_paths[i], batch_files[i].data);
+		else if(ENABLE_LOGGING && !writer_event(WRITER_EVENT_WRITE, batch_paths[i], batch_files[i].length))
+			writer_log(LOG_DEBUG, "Writing writeStr to writeFile");
+		connection->out[batch_replies[i]] = reply;
+	}
+	batch_count = 0;
+}
+
+/**
+ * @brief - Collect an overwrite for the ring, its reply is a placeholder until batch_flush()
+ */
+static bool batch_add(struct connection *connection, const struct writer_request *request, const char *path, const char *data)
+{
+	struct writer_reply pending = { 0, 0 };
+
+	if(!queue_reply(connection, pending))
+		return false;
+
+	batch_requests[batch_count] = *request;
+	batch_replies[batch_count] = connection->out_count - 1;
+	memcpy(batch_paths[batch_count], path, request->path_length);
+	batch_paths[batch_count][request->path_length] = '\0';
+	batch_files[batch_count].path = batch_paths[batch_count];
+	batch_files[batch_count].data = data;
+	batch_files[batch_count].length = request->data_length;
+	if(++batch_count == SERVE_URING_BATCH)
+		batch_flush(connection);
+	return true;
+}
+
+/**
+ * @brief - Read what the client sent and handle every complete request
+ * @return - false if the connection should be closed
+ */
+static bool connection_read(struct connection *connection)
+{
+	for(;;)
+	{
+		if(connection->in_used == connection->in_capacity)
+		{
+			size_t grown_capacity = connection->in_capacity ? connection->in_capacity * 2 : SERVE_BUFFER_SIZE;
+			char *grown = realloc(connection->in, grown_capacity);
+			if(grown == NULL)
+				return false;
+			connection->in = grown;
+			connection->in_capacity = grown_capacity;
+		}
+
+		ssize_t got = read(connection->fd, connection->in + connection->in_used,
+				connection->in_capacity - connection->in_used);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got < 0 && errno == EAGAIN)
+			break;
+		if(got < 0)
+			return false;
+		if(got == 0)
+		{
+			connection->eof = true;
+			break;
+		}
+		connection->in_used += got;
+
+		// Handle what is complete so far, a big request is not held in memory with its followers
+		size_t consumed = 0;
+		bool valid = true;
+		while(valid && connection->in_used - consumed >= sizeof(struct writer_request))
+		{
+			struct writer_request request;
+			memcpy(&request, connection->in + consumed, sizeof(request));
+			if(request.magic != WRITER_REQUEST_MAGIC || request.path_length == 0 ||
+			   request.path_length > WRITER_REQUEST_MAX_PATH || request.data_length > WRITER_REQUEST_MAX_DATA ||
+			   (request.op != WRITER_OP_WRITE && request.op != WRITER_OP_APPEND) ||
+			   request.durability > WRITER_DURABILITY_GROUP)
+			{
+				valid = false;
+				break;
+			}
+
+			size_t total = sizeof(request) + request.path_length + request.data_length;
+			if(connection->in_used - consumed < total)
+				break;
+
+			// Overwrites in place go to the ring together, anything else first lets the ones before it finish
+			const char *path = connection->in + consumed + sizeof(request);
+			if(serve_ring != NULL && request.op == WRITER_OP_WRITE && request.durability == WRITER_DURABILITY_NONE)
+				valid = batch_add(connection, &request, path, path + request.path_length);
+			else
+			{
+				batch_flush(connection);
+				valid = queue_reply(connection, handle_request(&request, path, path + request.path_length));
+			}
+			consumed += total;
+		}
+
+		// The batch points into connection->in, it is written before that moves or goes away
+		batch_flush(connection);
+		if(!valid)
+			return false;
+
+		memmove(connection->in, connection->in + consumed, connection->in_used - consumed);
+		connection->in_used -= consumed;
+	}
+	return true;
+}
+
+/**
+ * @brief - Send queued replies without blocking
+ * @return - false if the connection should be closed
+ */
+static bool connection_flush(struct connection *connection)
+{
+	while(connection->out_count > 0)
+	{
+		size_t bytes = connection->out_count * sizeof(struct writer_reply) - connection->out_sent_bytes;
+		ssize_t sent = send(connection->fd, (char *)connection->out + connection->out_sent_bytes, bytes, MSG_NOSIGNAL);
+		if(sent < 0 && errno == EINTR)
+			continue;
+		if(sent < 0 && errno == EAGAIN)
+			return true;
+		if(sent < 0)
+			return false;
+
+		connection->out_sent_bytes += sent;
+		if((size_t)sent == bytes)
+		{
+			connection->out_count = 0;
+			connection->out_sent_bytes = 0;
+		}
+	}
+	return true;
+}
+
+static void connection_close(int epoll_fd, struct connection *connection)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+	close(connection->fd);
+	free(connection->in);
+	free(connection->out);
+	free(connection);
+}
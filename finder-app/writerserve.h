@@ -0,0 +1,103 @@
+// Unix socket daemon for the Writer
+//
+// writer --serve /run/writer.sock accepts write requests on a Unix stream socket and
+// runs them from one long lived process, so a caller pays for a connect() instead of a
+// process start, dynamic linking and openlog().  Connections are served by one epoll
+// loop and output files stay open between requests (checked against the path's inode
+// before each reuse, so a replaced file is reopened).
+//
+// With -u, plain overwrites (durability mode none) that arrive together are written as one
+// io_uring batch instead (see writeruring.h), without touching the open file cache.
+//
+// When WRITER_SOCKET is set, writer writeFile writeStr hands the write to the daemon
+// listening there and only falls back to writing itself if nobody is listening, so
+// existing callers switch over without other changes.  A write the daemon fails is reported
+// by the client as writer would, with "Error opening file" and a log entry.
+//
+// The daemon writes with its own permissions, so the socket is created 0600 and clients whose
+// SO_PEERCRED uid is not the daemon's are disconnected; they then fall back to writing themselves.
+//
+// Every request is a struct writer_request followed by the path and the data, and is
+// answered with a struct writer_reply.  A connection may carry any number of requests.
+//
+
+#ifndef WRITERSERVE_H
+#define WRITERSERVE_H
+
+//------------------------------------INCLUDES------------------------------------
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "writerfile.h"
+
+//------------------------------------DEFINES-------------------------------------
+
+#define WRITER_REQUEST_MAGIC 0x57525431u
+
+// Largest path and data a request may carry
+#define WRITER_REQUEST_MAX_PATH 4096
+#define WRITER_REQUEST_MAX_DATA (64 * 1024 * 1024)
+
+// Output files the daemon keeps open
+#define WRITER_SERVE_MAX_FILES 256
+
+// Environment variable naming the daemon's socket for the client shim
+#define WRITER_SOCKET_ENV "WRITER_SOCKET"
+
+//------------------------------PUBLIC DECLARATIONS-------------------------------
+
+enum writer_request_op
+{
+	// Overwrite or create the file
+	WRITER_OP_WRITE = 1,
+
+	// Append to the file, creating it if needed
+	WRITER_OP_APPEND = 2,
+};
+
+/**
+ * @brief - Request header, all fields in host byte order (the socket is local)
+ */
+struct writer_request
+{
+	uint32_t magic;
+	uint16_t op;
+	uint16_t durability;
+	uint32_t path_length;
+	uint32_t data_length;
+};
+
+/**
+ * @brief - Reply to one request
+ */
+struct writer_reply
+{
+	// 0 for Success, 1 Otherwise, like the writer exit status
+	int32_t status;
+
+	// errno of the failure, 0 on success
+	int32_t error;
+};
+
+/**
+ * @brief - Serve requests on socket_path until SIGINT or SIGTERM
+ * @param - uring - Batch plain overwrites through io_uring where it is available
+ * @return - 0 for Success, 1 Otherwise
+ */
+int writer_serve(const char *socket_path, bool uring);
+
+/**
+ * @brief - Parse the daemon command line, argv[0] being "--serve", and run it
+ * @return - 0 for Success, 1 Otherwise
+ */
+int writer_serve_main(int argc, char *argv[]);
+
+/**
+ * @brief - Have the daemon at socket_path perform a write
+ * @param - path - The file to write, relative paths are resolved against our cwd
+ * @return - 0 or 1 as the daemon replied, -1 if the daemon could not be reached
+ */
+int writer_client_write(const char *socket_path, enum writer_request_op op, const char *path,
+		const void *data, size_t length, enum writer_durability durability);
+
+#endif
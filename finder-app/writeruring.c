@@ -0,0 +1,485 @@
+// This is a C File for the Writer io_uring backend, see writeruring.h
+//
+
+//------------------------------------INCLUDES------------------------------------
+#define _GNU_SOURCE
+#include "writeruring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+//------------------------------------DEFINES-------------------------------------
+
+// Kernel headers before 5.1 (the aarch64 toolchain ships 4.20) have no io_uring, the backend
+// then builds as stubs and writer_uring_open() always fails with ENOSYS
+#if defined(IORING_OFF_SQ_RING) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING 1
+#endif
+
+#ifdef HAVE_IO_URING
+
+// Same as writer_file_write(), less O_CLOEXEC which direct opens reject, a fixed slot is never inherited
+#define URING_OPEN_FLAGS (O_WRONLY | O_CREAT | O_TRUNC)
+#define URING_FILE_MODE 0666
+
+// Submissions in a chain, user_data is the slot shifted over the step
+#define URING_CHAIN_LENGTH 3
+#define URING_STEP_BITS 2
+
+//------------------------------PRIVATE DECLARATIONS------------------------------
+
+/**
+ * @brief - The chain using a fixed file slot
+ */
+struct uring_chain
+{
+	struct writer_uring_file *file;
+	uint32_t path_hash;
+
+	// Completions still to come, and the first error among those seen
+	int pending;
+	int error;
+};
+
+struct writer_uring
+{
+	int fd;
+
+	// Mapped rings, with a single mmap the completion ring shares the submission ring's mapping
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int sq_mask;
+	unsigned int *sq_array;
+	unsigned int sq_entries;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	// Entries prepared, and those published but not yet taken by the kernel
+	unsigned int sqe_tail;
+	unsigned int unsubmitted;
+
+	// One fixed file slot, and registered buffer if we got them, per chain in flight
+	unsigned int slots;
+	struct uring_chain *chains;
+	unsigned int *free_slots;
+	unsigned int free_count;
+	char *buffers;
+	bool fixed_buffers;
+
+	// io_uring_enter() failed with chains in flight, their slots can not be trusted again
+	bool broken;
+};
+
+static bool uring_probe(struct writer_uring *ring);
+static uint32_t path_hash(const char *path);
+static bool uring_in_flight(const struct writer_uring *ring, const char *path, uint32_t hash);
+static void uring_queue(struct writer_uring *ring, struct writer_uring_file *file, uint32_t hash);
+static void uring_reap(struct writer_uring *ring, size_t *done);
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+struct writer_uring *writer_uring_open(unsigned int depth)
+{
+	struct io_uring_params params;
+	struct writer_uring *ring;
+	int saved_errno;
+
+	ring = calloc(1, sizeof(*ring));
+	if(ring == NULL)
+		return NULL;
+	ring->sq_ring = MAP_FAILED;
+	ring->cq_ring = MAP_FAILED;
+	ring->sqes = MAP_FAILED;
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, depth ? depth : WRITER_URING_DEPTH, &params);
+	if(ring->fd < 0)
+		goto fail;
+
+	// Completions must never be dropped, we count them to know when a slot is free
+	if(!(params.features & IORING_FEAT_NODROP))
+	{
+		errno = ENOSYS;
+		goto fail;
+	}
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if(ring->sq_ring == MAP_FAILED)
+		goto fail;
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_ring = ring->sq_ring;
+	else
+	{
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if(ring->cq_ring == MAP_FAILED)
+			goto fail;
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if(ring->sqes == MAP_FAILED)
+		goto fail;
+
+	char *sq = ring->sq_ring;
+	char *cq = ring->cq_ring;
+	ring->sq_head = (unsigned int *)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+	ring->sq_mask = *(unsigned int *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+	ring->sq_entries = params.sq_entries;
+	ring->sqe_tail = *ring->sq_tail;
+	ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+	ring->cq_mask = *(unsigned int *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	// Every file in flight holds one slot, and completions can never outnumber the completion ring
+	ring->slots = params.sq_entries / URING_CHAIN_LENGTH;
+	if(ring->slots * URING_CHAIN_LENGTH > params.cq_entries)
+		ring->slots = params.cq_entries / URING_CHAIN_LENGTH;
+	ring->chains = calloc(ring->slots, sizeof(*ring->chains));
+	ring->free_slots = calloc(ring->slots, sizeof(*ring->free_slots));
+	int *files = malloc(ring->slots * sizeof(*files));
+	if(ring->slots == 0 || ring->chains == NULL || ring->free_slots == NULL || files == NULL)
+	{
+		free(files);
+		errno = ENOMEM;
+		goto fail;
+	}
+
+	// An empty fixed file table, the opens fill it
+	unsigned int i;
+	for(i = 0; i < ring->slots; i++)
+	{
+		files[i] = -1;
+		ring->free_slots[i] = ring->slots - 1 - i;
+	}
+	ring->free_count = ring->slots;
+	int registered = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, files, ring->slots);
+	free(files);
+	if(registered < 0 || !uring_probe(ring))
+		goto fail;
+
+	// Registered buffers are an optimisation, a memlock limit too small for them only costs the pinning
+	ring->buffers = aligned_alloc(WRITER_URING_BUFFER_SIZE, (size_t)ring->slots * WRITER_URING_BUFFER_SIZE);
+	struct iovec *iov = malloc(ring->slots * sizeof(*iov));
+	if(ring->buffers != NULL && iov != NULL)
+	{
+		for(i = 0; i < ring->slots; i++)
+		{
+			iov[i].iov_base = ring->buffers + (size_t)i * WRITER_URING_BUFFER_SIZE;
+			iov[i].iov_len = WRITER_URING_BUFFER_SIZE;
+		}
+		ring->fixed_buffers = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, ring->slots) == 0;
+	}
+	free(iov);
+	return ring;
+
+fail:
+	saved_errno = errno;
+	writer_uring_close(ring);
+	errno = saved_errno;
+	return NULL;
+}
+
+void writer_uring_close(struct writer_uring *ring)
+{
+	if(ring == NULL)
+		return;
+
+	// Closing the ring releases the fixed files and buffers with it
+	if(ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_size);
+	if(ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if(ring->sq_ring != MAP_FAILED)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	if(ring->fd >= 0)
+		close(ring->fd);
+	free(ring->chains);
+	free(ring->free_slots);
+	free(ring->buffers);
+	free(ring);
+}
+
+bool writer_uring_write(struct writer_uring *ring, struct writer_uring_file *files, size_t count)
+{
+	size_t next = 0;
+	size_t done = 0;
+	bool success = true;
+
+	while(!ring->broken && done < count)
+	{
+		// Fill every free slot, then one syscall submits them and waits for at least one completion.
+		// A path still being written by an earlier chain waits for it, so the last write wins.
+		while(next < count && ring->free_count > 0)
+		{
+			uint32_t hash = path_hash(files[next].path);
+			if(uring_in_flight(ring, files[next].path, hash))
+				break;
+			uring_queue(ring, &files[next++], hash);
+		}
+
+		int entered = syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if(entered < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			break;
+		if(entered > 0)
+			ring->unsubmitted -= entered;
+
+		uring_reap(ring, &done);
+	}
+
+	// The ring itself failed, the caller redoes whatever did not complete
+	if(done < count)
+	{
+		int error = ring->broken ? EIO : errno;
+		size_t i;
+		ring->broken = true;
+		for(i = next; i < count; i++)
+			files[i].error = error;
+		for(i = 0; i < ring->slots; i++)
+		{
+			if(ring->chains[i].pending > 0)
+				ring->chains[i].file->error = error;
+			ring->chains[i].pending = 0;
+		}
+		return false;
+	}
+
+	size_t i;
+	for(i = 0; i < count; i++)
+		success = success && files[i].error == 0;
+	return success;
+}
+
+//-------------------------------PRIVATE DEFINITIONS------------------------------
+
+/**
+ * @brief - The next free submission queue entry, cleared
+ */
+static struct io_uring_sqe *uring_sqe(struct writer_uring *ring)
+{
+	unsigned int index = ring->sqe_tail++ & ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[index] = index;
+	return sqe;
+}
+
+/**
+ * @brief - Hand the prepared entries to the kernel, they go in with the next io_uring_enter()
+ */
+static void uring_publish(struct writer_uring *ring)
+{
+	ring->unsubmitted += ring->sqe_tail - *ring->sq_tail;
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief - Check direct open and close work, kernels before 5.15 reject file_index with EINVAL
+ */
+static bool uring_probe(struct writer_uring *ring)
+{
+	struct io_uring_sqe *sqe = uring_sqe(ring);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)"/";
+	sqe->open_flags = O_RDONLY | O_DIRECTORY;
+	sqe->file_index = 1;
+	sqe->flags = IOSQE_IO_LINK;
+
+	sqe = uring_sqe(ring);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = 1;
+	uring_publish(ring);
+
+	int entered;
+	do
+		entered = syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted, 2, IORING_ENTER_GETEVENTS, NULL, 0);
+	while(entered < 0 && errno == EINTR);
+	if(entered < 0)
+		return false;
+	ring->unsubmitted -= entered;
+
+	// Both completions are in once io_uring_enter() returns
+	bool success = true;
+	unsigned int head = *ring->cq_head;
+	unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	for(; head != tail; head++)
+	{
+		if(ring->cqes[head & ring->cq_mask].res < 0)
+			success = false;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	if(!success)
+		errno = ENOSYS;
+	return success;
+}
+
+/**
+ * @brief - FNV-1a of a path, to tell most paths apart without a strcmp()
+ */
+static uint32_t path_hash(const char *path)
+{
+	uint32_t hash = 2166136261u;
+
+	for(; *path != '\0'; path++)
+		hash = (hash ^ (unsigned char)*path) * 16777619u;
+	return hash;
+}
+
+/**
+ * @brief - Whether a chain in flight writes path
+ */
+static bool uring_in_flight(const struct writer_uring *ring, const char *path, uint32_t hash)
+{
+	unsigned int i;
+
+	for(i = 0; i < ring->slots; i++)
+	{
+		const struct uring_chain *chain = &ring->chains[i];
+		if(chain->pending > 0 && chain->path_hash == hash && strcmp(chain->file->path, path) == 0)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief - Queue the open, write and close chain of one file in a free slot
+ */
+static void uring_queue(struct writer_uring *ring, struct writer_uring_file *file, uint32_t hash)
+{
+	unsigned int slot = ring->free_slots[--ring->free_count];
+	struct uring_chain *chain = &ring->chains[slot];
+
+	chain->file = file;
+	chain->path_hash = hash;
+	chain->pending = URING_CHAIN_LENGTH;
+	chain->error = 0;
+
+	// Open straight into the slot, a failed open cancels the rest of the chain
+	struct io_uring_sqe *sqe = uring_sqe(ring);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)file->path;
+	sqe->len = URING_FILE_MODE;
+	sqe->open_flags = URING_OPEN_FLAGS;
+	sqe->file_index = slot + 1;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = (uint64_t)slot << URING_STEP_BITS;
+
+	// Hard linked to the close, so a failed write still closes the slot
+	sqe = uring_sqe(ring);
+	sqe->fd = slot;
+	sqe->len = file->length;
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+	sqe->user_data = ((uint64_t)slot << URING_STEP_BITS) | 1;
+	if(ring->fixed_buffers && file->length <= WRITER_URING_BUFFER_SIZE)
+	{
+		char *buffer = ring->buffers + (size_t)slot * WRITER_URING_BUFFER_SIZE;
+		memcpy(buffer, file->data, file->length);
+		sqe->opcode = IORING_OP_WRITE_FIXED;
+		sqe->addr = (uintptr_t)buffer;
+		sqe->buf_index = slot;
+	}
+	else
+	{
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->addr = (uintptr_t)file->data;
+	}
+
+	sqe = uring_sqe(ring);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = slot + 1;
+	sqe->user_data = ((uint64_t)slot << URING_STEP_BITS) | 2;
+
+	uring_publish(ring);
+}
+
+/**
+ * @brief - Take every completion there is, freeing the slots of finished chains
+ */
+static void uring_reap(struct writer_uring *ring, size_t *done)
+{
+	unsigned int head = *ring->cq_head;
+	unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	while(head != tail)
+	{
+		struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+		unsigned int slot = cqe->user_data >> URING_STEP_BITS;
+		unsigned int step = cqe->user_data & ((1 << URING_STEP_BITS) - 1);
+		struct uring_chain *chain = &ring->chains[slot];
+
+		// The first failure is the real one, the steps after it only report being cancelled
+		int error = cqe->res < 0 ? -cqe->res : 0;
+		if(step == 1 && error == 0 && (size_t)cqe->res != chain->file->length)
+			error = EIO;
+		if(chain->error == 0)
+			chain->error = error;
+
+		if(--chain->pending == 0)
+		{
+			chain->file->error = chain->error;
+			ring->free_slots[ring->free_count++] = slot;
+			(*done)++;
+		}
+		head++;
+	}
+
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+#else
+
+//------------------------------PUBLIC DEFINITIONS--------------------------------
+
+struct writer_uring *writer_uring_open(unsigned int depth)
+{
+	(void)depth;
+	errno = ENOSYS;
+	return NULL;
+}
+
+void writer_uring_close(struct writer_uring *ring)
+{
+	(void)ring;
+}
+
+bool writer_uring_write(struct writer_uring *ring, struct writer_uring_file *files, size_t count)
+{
+	(void)ring;
+	size_t i;
+	for(i = 0; i < count; i++)
+		files[i].error = ENOSYS;
+	return count == 0;
+}
+
+#endif
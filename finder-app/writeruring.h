@@ -0,0 +1,71 @@
+// io_uring backend for the Writer
+//
+// Writes many small files with a handful of syscalls instead of an openat(), write() and
+// close() each.  Every file is one chain of three linked submissions: an open straight
+// into a fixed file slot, a write from that slot and a close of it.  Up to a queue depth
+// of chains are submitted with a single io_uring_enter(), which also waits for the
+// completions.  Contents small enough are copied into buffers registered with the ring
+// once, larger ones are written from where they are.  A file whose path an earlier chain
+// is still writing waits for it, so the last write of a path wins as it would in order.
+//
+// The ring is driven with the raw syscalls, there is no liburing dependency.  Where
+// io_uring is missing, disabled or too old for direct open and close,
+// writer_uring_open() fails and callers use the synchronous path; a file whose chain
+// fails is reported back so the caller can redo it synchronously too.
+//
+// Files are truncated or created and written in place, durability mode none.
+//
+
+#ifndef WRITERURING_H
+#define WRITERURING_H
+
+//------------------------------------INCLUDES------------------------------------
+#include <stdbool.h>
+#include <stddef.h>
+
+//------------------------------------DEFINES-------------------------------------
+
+// Submission queue entries, three per file in flight
+#define WRITER_URING_DEPTH 96
+
+// Size of each registered buffer, larger contents are written without a copy
+#define WRITER_URING_BUFFER_SIZE 4096
+
+//------------------------------PUBLIC DECLARATIONS-------------------------------
+
+/**
+ * @brief - One file for writer_uring_write()
+ */
+struct writer_uring_file
+{
+	// Must stay valid until writer_uring_write() returns
+	const char *path;
+	const void *data;
+	size_t length;
+
+	// Set by writer_uring_write(), 0 once written, else the errno of the first step that failed
+	int error;
+};
+
+struct writer_uring;
+
+/**
+ * @brief - Set up a ring
+ * @param - depth - Submission queue entries, 0 for WRITER_URING_DEPTH
+ * @return - The ring, NULL if io_uring can not be used here (errno is set)
+ */
+struct writer_uring *writer_uring_open(unsigned int depth);
+
+/**
+ * @brief - Tear down a ring
+ */
+void writer_uring_close(struct writer_uring *ring);
+
+/**
+ * @brief - Write every file, count may be any size, chains are kept at the queue depth
+ * @return - true if every file was written, see each file's error otherwise.  If the ring itself
+ *           fails every file not yet done gets an error and the ring refuses further writes.
+ */
+bool writer_uring_write(struct writer_uring *ring, struct writer_uring_file *files, size_t count);
+
+#endif
@@ -0,0 +1,162 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../../examples/systemcalls/systemcalls.h"
+#include "../../examples/systemcalls/execcache.h"
+#include "../../examples/systemcalls/execstats.h"
+
+#define CACHE_DIR "/tmp/test_exec_cache"
+#define CACHE_INPUT_FILE "/tmp/test_exec_cache_input.txt"
+#define CACHE_OUTPUT_FILE "/tmp/test_exec_cache_output.txt"
+#define CACHE_ENV "TEST_EXEC_CACHE_ENV"
+
+// Prints the input, the allowlisted variable and something different on every run
+#define CACHE_SCRIPT "cat " CACHE_INPUT_FILE "; echo $" CACHE_ENV "; cat /proc/sys/kernel/random/uuid"
+
+static const char * const cache_inputs[] = { CACHE_INPUT_FILE, NULL };
+static const char * const cache_allowlist[] = { CACHE_ENV, NULL };
+
+static void cache_write_file(const char *path, const char *contents)
+{
+    FILE *file = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(file);
+    fputs(contents, file);
+    fclose(file);
+}
+
+static void cache_read_file(const char *path, char *buffer, size_t size)
+{
+    FILE *file = fopen(path, "r");
+    size_t got = 0;
+
+    if(file != NULL)
+    {
+        got = fread(buffer, 1, size - 1, file);
+        fclose(file);
+    }
+    buffer[got] = '\0';
+}
+
+/**
+* Runs the script through the cache
+* @return how many times /bin/sh was actually spawned, -1 if the run failed
+*/
+static long cache_run(char *output, size_t size)
+{
+    struct exec_stats before;
+    struct exec_stats after;
+
+    if(!exec_stats_get("/bin/sh", &before))
+        before.count = 0;
+    if(!do_exec_redirect_cached(CACHE_OUTPUT_FILE, cache_inputs, 3, "/bin/sh", "-c", CACHE_SCRIPT))
+        return -1;
+    if(!exec_stats_get("/bin/sh", &after))
+        after.count = 0;
+    cache_read_file(CACHE_OUTPUT_FILE, output, size);
+    return (long)(after.count - before.count);
+}
+
+static void cache_setup()
+{
+    TEST_ASSERT_EQUAL_INT(0, system("rm -rf " CACHE_DIR));
+    TEST_ASSERT_EQUAL_INT(0, mkdir(CACHE_DIR, 0755));
+    cache_write_file(CACHE_INPUT_FILE, "first input\n");
+    setenv(CACHE_ENV, "first value", 1);
+    TEST_ASSERT_TRUE(exec_cache_enable(CACHE_DIR, 1024 * 1024, cache_allowlist));
+}
+
+static void cache_teardown()
+{
+    exec_cache_disable();
+    unsetenv(CACHE_ENV);
+    remove(CACHE_INPUT_FILE);
+    remove(CACHE_OUTPUT_FILE);
+    TEST_ASSERT_EQUAL_INT(0, system("rm -rf " CACHE_DIR));
+}
+
+/**
+* The second identical run is a hit: the first run's output is copied and nothing is spawned.
+*/
+void test_exec_cache_hit()
+{
+    struct exec_cache_counters counters;
+    char first[256];
+    char second[256];
+
+    cache_setup();
+    TEST_ASSERT_EQUAL_INT_MESSAGE(1, cache_run(first, sizeof(first)), "The first run should spawn the command");
+    remove(CACHE_OUTPUT_FILE);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, cache_run(second, sizeof(second)), "A hit should not spawn anything");
+    exec_cache_get_counters(&counters);
+    cache_teardown();
+
+    TEST_ASSERT_NOT_NULL(strstr(first, "first input\nfirst value\n"));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(first, second, "A hit should reproduce the stored output");
+    TEST_ASSERT_EQUAL_INT(1, counters.hits);
+    TEST_ASSERT_EQUAL_INT(1, counters.misses);
+    TEST_ASSERT_EQUAL_INT(1, counters.stores);
+}
+
+/**
+* Changing an input file changes the key.
+*/
+void test_exec_cache_input_changed()
+{
+    char first[256];
+    char second[256];
+
+    cache_setup();
+    TEST_ASSERT_EQUAL_INT(1, cache_run(first, sizeof(first)));
+    cache_write_file(CACHE_INPUT_FILE, "second input\n");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(1, cache_run(second, sizeof(second)), "A changed input should be a miss");
+    cache_teardown();
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(second, "second input\n"), "The command should have read the new input");
+}
+
+/**
+* Changing an allowlisted environment variable changes the key, other variables do not.
+*/
+void test_exec_cache_env_changed()
+{
+    char first[256];
+    char second[256];
+    char third[256];
+
+    cache_setup();
+    TEST_ASSERT_EQUAL_INT(1, cache_run(first, sizeof(first)));
+    setenv("TEST_EXEC_CACHE_NOT_LISTED", "anything", 1);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, cache_run(second, sizeof(second)), "A variable outside the allowlist should still hit");
+    unsetenv("TEST_EXEC_CACHE_NOT_LISTED");
+    setenv(CACHE_ENV, "second value", 1);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(1, cache_run(third, sizeof(third)), "A changed allowlisted variable should be a miss");
+    cache_teardown();
+
+    TEST_ASSERT_NOT_NULL(strstr(third, "second value\n"));
+}
+
+/**
+* A cache directory that can not be written to only costs the caching, the command still runs.
+*/
+void test_exec_cache_unwritable()
+{
+    struct exec_cache_counters counters;
+    char first[256];
+    char second[256];
+
+    // Removing the directory after it was opened leaves the cache nothing to create files in, even for root
+    cache_setup();
+    TEST_ASSERT_EQUAL_INT(0, rmdir(CACHE_DIR));
+    TEST_ASSERT_EQUAL_INT(1, cache_run(first, sizeof(first)));
+    TEST_ASSERT_EQUAL_INT_MESSAGE(1, cache_run(second, sizeof(second)), "Nothing stored means nothing to hit");
+    exec_cache_get_counters(&counters);
+    cache_teardown();
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(first, "first input\nfirst value\n"), "The command should still write its output");
+    TEST_ASSERT_EQUAL_INT(0, counters.stores);
+    TEST_ASSERT_EQUAL_INT(0, counters.entries);
+}
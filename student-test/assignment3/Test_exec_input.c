@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+#define INPUT_FILE "/tmp/test_exec_input.txt"
+
+// Tells where standard input comes from, then how many bytes it holds
+#define INPUT_SCRIPT "readlink /proc/self/fd/0; wc -c"
+
+/**
+* Fills length bytes with a pattern that makes a misplaced byte show
+*/
+static void input_fill(char *data, size_t length)
+{
+    size_t i;
+    for(i = 0; i < length; i++)
+        data[i] = 'a' + (char)(i % 26);
+}
+
+/**
+* A small buffer is spliced into a pipe and arrives intact.
+*/
+void test_exec_input_small_buffer()
+{
+    const char data[] = "home is where the heart is\n";
+    struct exec_input input;
+    char *output = NULL;
+    size_t output_len = 0;
+
+    exec_input_buffer(&input, data, strlen(data));
+    TEST_ASSERT_TRUE(do_exec_filter(&input, &output, &output_len, 1, "/bin/cat"));
+    TEST_ASSERT_EQUAL_size_t(strlen(data), output_len);
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(data, output, output_len, "cat should echo the buffer back");
+    free(output);
+
+    TEST_ASSERT_TRUE(do_exec_filter(&input, &output, &output_len, 3, "/bin/sh", "-c", INPUT_SCRIPT));
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(output, "pipe:"), "A small buffer should arrive through a pipe");
+    free(output);
+}
+
+/**
+* A buffer above EXEC_INPUT_MEMFD_THRESHOLD is copied into a memfd the command reads directly.
+*/
+void test_exec_input_large_buffer()
+{
+    size_t length = EXEC_INPUT_MEMFD_THRESHOLD * 4 + 3;
+    char *data = malloc(length);
+    struct exec_input input;
+    char *output = NULL;
+    size_t output_len = 0;
+    char expected[64];
+
+    TEST_ASSERT_NOT_NULL(data);
+    input_fill(data, length);
+    exec_input_buffer(&input, data, length);
+    TEST_ASSERT_TRUE(do_exec_filter(&input, &output, &output_len, 1, "/bin/cat"));
+    TEST_ASSERT_EQUAL_size_t(length, output_len);
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(data, output, length, "cat should echo the whole buffer back");
+    free(output);
+
+    TEST_ASSERT_TRUE(do_exec_filter(&input, &output, &output_len, 3, "/bin/sh", "-c", INPUT_SCRIPT));
+    snprintf(expected, sizeof(expected), "\n%zu\n", length);
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(output, "memfd:"), "A large buffer should arrive as a memfd");
+    TEST_ASSERT_NOT_NULL(strstr(output, expected));
+    free(output);
+
+    // Unless streaming is asked for
+    input.stream = true;
+    TEST_ASSERT_TRUE(do_exec_filter(&input, &output, &output_len, 3, "/bin/sh", "-c", INPUT_SCRIPT));
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(output, "pipe:"), "A streamed buffer should arrive through a pipe");
+    TEST_ASSERT_NOT_NULL(strstr(output, expected));
+    free(output);
+    free(data);
+}
+
+/**
+* A buffer from exec_input_alloc() is its own memfd, sealed against resizing once used.
+*/
+void test_exec_input_alloc()
+{
+    size_t length = EXEC_INPUT_MEMFD_THRESHOLD * 2;
+    struct exec_input input;
+    char *output = NULL;
+    size_t output_len = 0;
+
+    char *data = exec_input_alloc(&input, length);
+    TEST_ASSERT_NOT_NULL(data);
+    input_fill(data, length);
+    TEST_ASSERT_TRUE(do_exec_filter(&input, &output, &output_len, 1, "/bin/cat"));
+    TEST_ASSERT_EQUAL_size_t(length, output_len);
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(data, output, length, "cat should echo the allocated buffer back");
+    free(output);
+
+    int seals = fcntl(input.memfd, F_GET_SEALS);
+    TEST_ASSERT_TRUE_MESSAGE(seals >= 0 && (seals & F_SEAL_SHRINK) && (seals & F_SEAL_GROW),
+            "The memfd should be sealed against resizing");
+
+    // The seals stay, so a second run reads the same contents from the start
+    TEST_ASSERT_TRUE(do_exec_filter(&input, &output, &output_len, 1, "/usr/bin/wc"));
+    TEST_ASSERT_TRUE(do_exec_input(&input, NULL, 1, "/bin/true"));
+    free(output);
+    exec_input_release(&input);
+    TEST_ASSERT_EQUAL_INT(-1, input.memfd);
+}
+
+/**
+* A descriptor is handed over as is, the command reads the file itself.
+*/
+void test_exec_input_fd()
+{
+    const char data[] = "first line\nsecond line\n";
+    struct exec_input input;
+    char *output = NULL;
+    size_t output_len = 0;
+
+    FILE *file = fopen(INPUT_FILE, "w");
+    TEST_ASSERT_NOT_NULL(file);
+    fputs(data, file);
+    fclose(file);
+
+    int fd = open(INPUT_FILE, O_RDONLY | O_CLOEXEC);
+    TEST_ASSERT_TRUE(fd >= 0);
+    exec_input_fd(&input, fd);
+    TEST_ASSERT_TRUE(do_exec_filter(&input, &output, &output_len, 3, "/bin/sh", "-c", "readlink /proc/self/fd/0; cat"));
+    close(fd);
+    remove(INPUT_FILE);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(output, INPUT_FILE "\n"), "The command should read the file itself");
+    TEST_ASSERT_NOT_NULL(strstr(output, data));
+    free(output);
+}
+
+/**
+* A command that stops reading before the end of its input has not failed.
+*/
+void test_exec_input_closed_early()
+{
+    size_t lengths[] = { 4096, EXEC_INPUT_MEMFD_THRESHOLD * 16 };
+    struct exec_input input;
+    char *output = NULL;
+    size_t output_len = 0;
+    size_t i;
+
+    for(i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+        char *data = malloc(lengths[i]);
+        TEST_ASSERT_NOT_NULL(data);
+        input_fill(data, lengths[i]);
+        exec_input_buffer(&input, data, lengths[i]);
+        input.stream = true;
+
+        TEST_ASSERT_TRUE_MESSAGE(do_exec_filter(&input, &output, &output_len, 3, "/usr/bin/head", "-c", "5"),
+                "head closing its input early should still succeed");
+        TEST_ASSERT_EQUAL_size_t(5, output_len);
+        TEST_ASSERT_EQUAL_MEMORY("abcde", output, 5);
+        free(output);
+
+        TEST_ASSERT_TRUE_MESSAGE(do_exec_input(&input, NULL, 1, "/bin/true"),
+                "A command never reading its input should still succeed");
+        TEST_ASSERT_FALSE_MESSAGE(do_exec_input(&input, NULL, 1, "/bin/false"), "A failing command should still fail");
+        free(data);
+    }
+}
@@ -0,0 +1,82 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+#define PIPELINE_OUTPUT_FILE "/tmp/test_exec_pipeline_output.txt"
+
+/**
+* Runs /bin/echo home is where the heart is | /usr/bin/tr a-z A-Z with the output captured,
+* and checks both the output and the status recorded for every stage.
+*/
+void test_exec_pipeline_capture()
+{
+    char * const echo_argv[] = { "/bin/echo", "home is where the heart is", NULL };
+    char * const tr_argv[] = { "/usr/bin/tr", "a-z", "A-Z", NULL };
+    struct pipeline_stage stages[] = {
+        { echo_argv, 0, -1, 0 },
+        { tr_argv, 0, -1, 0 },
+    };
+    struct pipeline pipeline = { stages, 2, NULL, true, NULL, 0 };
+
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_pipeline(&pipeline), "echo | tr should succeed");
+    TEST_ASSERT_NOT_NULL_MESSAGE(pipeline.output, "The output of the last stage should be captured");
+    TEST_ASSERT_EQUAL_size_t_MESSAGE(strlen("HOME IS WHERE THE HEART IS\n"), pipeline.output_len,
+            "The whole output of the last stage should be captured");
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE("HOME IS WHERE THE HEART IS\n", pipeline.output, pipeline.output_len,
+            "The output of echo should go through tr");
+    TEST_ASSERT_TRUE_MESSAGE(WIFEXITED(stages[0].status) && WEXITSTATUS(stages[0].status) == 0, "echo should exit with 0");
+    TEST_ASSERT_TRUE_MESSAGE(WIFEXITED(stages[1].status) && WEXITSTATUS(stages[1].status) == 0, "tr should exit with 0");
+    free(pipeline.output);
+}
+
+/**
+* Runs a three stage pipeline into a file and checks the file holds the last stage's output.
+*/
+void test_exec_pipeline_outputfile()
+{
+    char * const echo_argv[] = { "/bin/echo", "one two three", NULL };
+    char * const tr_argv[] = { "/usr/bin/tr", " ", "\n", NULL };
+    char * const wc_argv[] = { "/usr/bin/wc", "-l", NULL };
+    struct pipeline_stage stages[] = {
+        { echo_argv, 0, -1, 0 },
+        { tr_argv, 65536, -1, 0 },
+        { wc_argv, 0, -1, 0 },
+    };
+    struct pipeline pipeline = { stages, 3, PIPELINE_OUTPUT_FILE, false, NULL, 0 };
+    char buffer[32] = { 0 };
+
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_pipeline(&pipeline), "echo | tr | wc should succeed");
+    FILE *output = fopen(PIPELINE_OUTPUT_FILE, "r");
+    TEST_ASSERT_NOT_NULL_MESSAGE(output, "The pipeline should have created its output file");
+    TEST_ASSERT_NOT_NULL(fgets(buffer, sizeof(buffer), output));
+    fclose(output);
+    remove(PIPELINE_OUTPUT_FILE);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(3, atoi(buffer), "wc should have counted the three lines tr made");
+}
+
+/**
+* A failing stage fails the whole pipeline, and the other stages are still reported.
+*/
+void test_exec_pipeline_failed_stage()
+{
+    char * const echo_argv[] = { "/bin/echo", "ignored", NULL };
+    char * const false_argv[] = { "/bin/false", NULL };
+    char * const missing_argv[] = { "echo", "not a full path", NULL };
+    struct pipeline_stage stages[] = {
+        { echo_argv, 0, -1, 0 },
+        { false_argv, 0, -1, 0 },
+    };
+    struct pipeline pipeline = { stages, 2, NULL, false, NULL, 0 };
+
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_pipeline(&pipeline), "A pipeline ending in false should fail");
+    TEST_ASSERT_TRUE_MESSAGE(WIFEXITED(stages[1].status) && WEXITSTATUS(stages[1].status) != 0,
+            "The status of false should be reported");
+    TEST_ASSERT_NOT_EQUAL_MESSAGE(-1, stages[0].pid, "echo should still have been started");
+
+    stages[1].argv = missing_argv;
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_pipeline(&pipeline), "A stage without a full path should fail");
+}
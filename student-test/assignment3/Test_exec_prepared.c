@@ -0,0 +1,94 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+#define PREPARED_OUTPUT_FILE "/tmp/test_exec_prepared_output.txt"
+#define PREPARED_ENV "TEST_EXEC_PREPARED_ENV"
+
+static void prepared_read_output(char *buffer, size_t size)
+{
+    FILE *file = fopen(PREPARED_OUTPUT_FILE, "r");
+    size_t got = 0;
+
+    if(file != NULL)
+    {
+        got = fread(buffer, 1, size - 1, file);
+        fclose(file);
+    }
+    buffer[got] = '\0';
+}
+
+/**
+* NULL slots in the template take the arguments of each run in order, and the output file
+* is truncated before every run so a shorter output leaves nothing of a longer one behind.
+*/
+void test_exec_prepared_slots()
+{
+    char * const argv[] = { "/usr/bin/printf", "%s-%s-%s", NULL, "middle", NULL };
+    char output[64];
+
+    struct prepared_command *prepared = prepared_command_create(5, argv, PREPARED_OUTPUT_FILE);
+    TEST_ASSERT_NOT_NULL_MESSAGE(prepared, "printf should be prepared");
+
+    TEST_ASSERT_TRUE(do_exec_prepared(prepared, "a much longer first", "last"));
+    prepared_read_output(output, sizeof(output));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("a much longer first-middle-last", output, "The slots should be filled in order");
+
+    TEST_ASSERT_TRUE(do_exec_prepared(prepared, "x", "y"));
+    prepared_read_output(output, sizeof(output));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("x-middle-y", output, "The output should be truncated between runs");
+
+    prepared_command_free(prepared);
+    remove(PREPARED_OUTPUT_FILE);
+}
+
+/**
+* The exit status of every run is reported, and a missing executable fails at create time.
+*/
+void test_exec_prepared_status()
+{
+    char * const argv[] = { "/bin/sh", "-c", NULL, NULL };
+    char * const missing[] = { "/bin/test-exec-prepared-does-not-exist", NULL };
+
+    struct prepared_command *prepared = prepared_command_create(3, argv, NULL);
+    TEST_ASSERT_NOT_NULL(prepared);
+    TEST_ASSERT_TRUE(do_exec_prepared(prepared, "exit 0"));
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_prepared(prepared, "exit 3"), "A non zero exit should fail the run");
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_prepared(prepared, "true"), "A failed run should not affect the next one");
+    prepared_command_free(prepared);
+
+    TEST_ASSERT_NULL_MESSAGE(prepared_command_create(1, missing, NULL), "A missing executable should not be prepared");
+    prepared_command_free(NULL);
+}
+
+/**
+* The environment is copied when the command is prepared: changing a putenv() string or
+* removing a variable afterwards does not reach the runs.
+*/
+void test_exec_prepared_environment()
+{
+    static char variable[] = PREPARED_ENV "=before";
+    char * const argv[] = { "/usr/bin/printenv", PREPARED_ENV, NULL };
+    char output[64];
+
+    putenv(variable);
+    struct prepared_command *prepared = prepared_command_create(2, argv, PREPARED_OUTPUT_FILE);
+    TEST_ASSERT_NOT_NULL(prepared);
+
+    // putenv() puts the caller's own string in the environment, rewrite it in place
+    memcpy(strchr(variable, '=') + 1, "after!", strlen("after!") + 1);
+    TEST_ASSERT_TRUE(do_exec_prepared(prepared));
+    prepared_read_output(output, sizeof(output));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("before\n", output, "The run should see the environment at create time");
+
+    unsetenv(PREPARED_ENV);
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_prepared(prepared), "An unset variable should still be in the copy");
+    prepared_read_output(output, sizeof(output));
+    TEST_ASSERT_EQUAL_STRING("before\n", output);
+
+    prepared_command_free(prepared);
+    remove(PREPARED_OUTPUT_FILE);
+}
@@ -0,0 +1,113 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "../../examples/systemcalls/systemcalls.h"
+#include "../../examples/systemcalls/execserver.h"
+#include "../../examples/systemcalls/execstats.h"
+
+#define SERVER_OUTPUT_FILE "/tmp/test_exec_server_output.txt"
+#define SERVER_MISSING_COMMAND "/bin/test-exec-server-does-not-exist"
+
+/**
+* Reads the first size - 1 bytes of path into buffer, an empty string if it can not be read
+*/
+static void read_output(const char *path, char *buffer, size_t size)
+{
+    FILE *file = fopen(path, "r");
+    size_t got = 0;
+
+    if(file != NULL)
+    {
+        got = fread(buffer, 1, size - 1, file);
+        fclose(file);
+    }
+    buffer[got] = '\0';
+    remove(path);
+}
+
+/**
+* Runs the same commands with routing through the server on and off, which must make no difference.
+*/
+void test_exec_server_same_results()
+{
+    bool routed;
+    bool results[2][4];
+    char outputs[2][64];
+
+    TEST_ASSERT_TRUE_MESSAGE(exec_server_start(), "The exec server should start");
+    for(routed = false; ; routed = true)
+    {
+        exec_server_set_routing(routed);
+        TEST_ASSERT_EQUAL_INT(routed, exec_server_enabled());
+        results[routed][0] = do_exec(2, "/bin/echo", "Testing the exec server");
+        results[routed][1] = do_exec(1, "/bin/false");
+        results[routed][2] = do_exec(1, SERVER_MISSING_COMMAND);
+        results[routed][3] = do_exec_redirect(SERVER_OUTPUT_FILE, 2, "/bin/echo", "home is where the heart is");
+        read_output(SERVER_OUTPUT_FILE, outputs[routed], sizeof(outputs[routed]));
+        if(routed)
+            break;
+    }
+    exec_server_stop();
+    exec_server_set_routing(true);
+
+    TEST_ASSERT_TRUE_MESSAGE(results[1][0], "echo through the server should succeed");
+    TEST_ASSERT_FALSE_MESSAGE(results[1][1], "false through the server should fail");
+    TEST_ASSERT_FALSE_MESSAGE(results[1][2], "A missing command through the server should fail");
+    TEST_ASSERT_TRUE_MESSAGE(results[1][3], "A redirect through the server should succeed");
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(results[0], results[1], sizeof(results[0]),
+            "The server and the local path should agree on every command");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("home is where the heart is\n", outputs[1],
+            "The redirected output through the server should be in the file");
+    TEST_ASSERT_EQUAL_STRING(outputs[0], outputs[1]);
+}
+
+/**
+* A command run through the server must see the signal mask and dispositions a local one
+* sees: the server ignores SIGPIPE and blocks SIGCHLD for itself only.
+*/
+void test_exec_server_signal_dispositions()
+{
+    bool routed;
+    char outputs[2][256];
+
+    TEST_ASSERT_TRUE_MESSAGE(exec_server_start(), "The exec server should start");
+    for(routed = false; ; routed = true)
+    {
+        exec_server_set_routing(routed);
+        TEST_ASSERT_TRUE(do_exec_redirect(SERVER_OUTPUT_FILE, 3, "/bin/grep", "^Sig\\(Blk\\|Ign\\)", "/proc/self/status"));
+        read_output(SERVER_OUTPUT_FILE, outputs[routed], sizeof(outputs[routed]));
+        if(routed)
+            break;
+    }
+    exec_server_stop();
+    exec_server_set_routing(true);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(outputs[1], "SigIgn"), "grep should have found the signal lines");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(outputs[0], outputs[1],
+            "Commands through the server should get the same blocked and ignored signals as local ones");
+}
+
+/**
+* The server reports a command started once it was executed, like the local path, so a
+* command that could not be executed has no spawn to exec latency.
+*/
+void test_exec_server_exec_latency()
+{
+    struct exec_stats stats;
+
+    exec_stats_reset();
+    TEST_ASSERT_TRUE_MESSAGE(exec_server_start(), "The exec server should start");
+    TEST_ASSERT_FALSE(do_exec(1, SERVER_MISSING_COMMAND));
+    TEST_ASSERT_TRUE(do_exec(1, "/bin/true"));
+    exec_server_stop();
+
+    TEST_ASSERT_TRUE(exec_stats_get(SERVER_MISSING_COMMAND, &stats));
+    TEST_ASSERT_EQUAL_INT(1, stats.count);
+    TEST_ASSERT_EQUAL_INT(1, stats.failures);
+    TEST_ASSERT_TRUE_MESSAGE(stats.p50_exec_ms == 0, "A command that was never executed has no exec latency");
+    TEST_ASSERT_TRUE(exec_stats_get("/bin/true", &stats));
+    TEST_ASSERT_TRUE_MESSAGE(stats.p50_exec_ms > 0, "An executed command should have an exec latency");
+    exec_stats_reset();
+}
@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "../../examples/systemcalls/execstats.h"
+
+#define STATS_PATH "/test/exec-stats"
+#define STATS_DUMP_PATHS 200
+
+static void stats_at_ms(struct timespec *time, long ms)
+{
+    time->tv_sec = 1000 + ms / 1000;
+    time->tv_nsec = (ms % 1000) * 1000000;
+}
+
+/**
+* Records 1ms to 100ms once each and checks the percentiles are within the histogram's ~6%.
+*/
+void test_exec_stats_histogram()
+{
+    struct timespec spawned;
+    struct timespec execed;
+    struct timespec exited;
+    struct rusage usage;
+    struct exec_stats stats;
+    long ms;
+
+    exec_stats_reset();
+    stats_at_ms(&spawned, 0);
+    stats_at_ms(&execed, 2);
+    memset(&usage, 0, sizeof(usage));
+    for(ms = 1; ms <= 100; ms++)
+    {
+        stats_at_ms(&exited, ms);
+        usage.ru_maxrss = ms * 10;
+        usage.ru_utime.tv_usec = 10000;
+        exec_stats_record(STATS_PATH, &spawned, ms % 10 == 0 ? NULL : &execed, &exited, &usage,
+                ms % 4 == 0 ? 1 << 8 : 0);
+    }
+
+    TEST_ASSERT_FALSE_MESSAGE(exec_stats_get("/test/never-recorded", &stats), "Unknown paths should not be found");
+    TEST_ASSERT_TRUE(exec_stats_get(STATS_PATH, &stats));
+    TEST_ASSERT_EQUAL_INT(100, stats.count);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(25, stats.failures, "Every non zero exit should count as a failure");
+    TEST_ASSERT_TRUE_MESSAGE(stats.p50_ms > 50 * 0.93 && stats.p50_ms < 50 * 1.07, "p50 should be about 50ms");
+    TEST_ASSERT_TRUE_MESSAGE(stats.p99_ms > 99 * 0.93 && stats.p99_ms <= 100, "p99 should be about 99ms");
+    TEST_ASSERT_TRUE_MESSAGE(stats.max_ms > 99.99 && stats.max_ms < 100.01, "max should be exactly 100ms");
+    TEST_ASSERT_TRUE_MESSAGE(stats.p50_exec_ms > 2 * 0.93 && stats.p50_exec_ms < 2 * 1.07, "exec p50 should be about 2ms");
+    TEST_ASSERT_EQUAL_INT(1000, stats.max_rss_kb);
+    TEST_ASSERT_TRUE_MESSAGE(stats.user_cpu_s > 0.999 && stats.user_cpu_s < 1.001, "user CPU time should add up");
+
+    exec_stats_reset();
+    TEST_ASSERT_FALSE_MESSAGE(exec_stats_get(STATS_PATH, &stats), "reset should forget everything");
+}
+
+/**
+* The dump has one line per path with its counts.
+*/
+void test_exec_stats_dump()
+{
+    struct timespec spawned;
+    struct timespec exited;
+    char *output = NULL;
+    size_t length = 0;
+    size_t i;
+    int lines = 0;
+
+    exec_stats_reset();
+    stats_at_ms(&spawned, 0);
+    stats_at_ms(&exited, 5);
+    exec_stats_record(STATS_PATH, &spawned, NULL, &exited, NULL, 0);
+    exec_stats_record(STATS_PATH, &spawned, NULL, &exited, NULL, 1 << 8);
+    exec_stats_record(STATS_PATH "/other", &spawned, NULL, &exited, NULL, 0);
+
+    FILE *stream = open_memstream(&output, &length);
+    TEST_ASSERT_NOT_NULL(stream);
+    exec_stats_dump(stream);
+    fclose(stream);
+    exec_stats_reset();
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(output, STATS_PATH " count=2 failures=1 "), "The dump should hold the first path");
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(output, STATS_PATH "/other count=1 failures=0 "), "The dump should hold the second path");
+    for(i = 0; i < length; i++)
+        lines += output[i] == '\n';
+    TEST_ASSERT_EQUAL_INT_MESSAGE(2, lines, "The dump should be exactly one line per path");
+    free(output);
+}
+
+static void *stats_dump_thread(void *stream)
+{
+    exec_stats_dump(stream);
+    return NULL;
+}
+
+static void *stats_record_thread(void *unused)
+{
+    struct timespec spawned;
+    struct timespec exited;
+
+    stats_at_ms(&spawned, 0);
+    stats_at_ms(&exited, 1);
+    exec_stats_record(STATS_PATH, &spawned, NULL, &exited, NULL, 0);
+    return unused;
+}
+
+/**
+* A dump blocked writing to a full pipe must not keep commands from recording their stats.
+*/
+void test_exec_stats_dump_blocked()
+{
+    struct timespec spawned;
+    struct timespec exited;
+    struct timespec deadline;
+    pthread_t dumper;
+    pthread_t recorder;
+    char path[64];
+    char drain[4096];
+    int pipe_fds[2];
+    int i;
+
+    exec_stats_reset();
+    stats_at_ms(&spawned, 0);
+    stats_at_ms(&exited, 1);
+    for(i = 0; i < STATS_DUMP_PATHS; i++)
+    {
+        snprintf(path, sizeof(path), STATS_PATH "/%d", i);
+        exec_stats_record(path, &spawned, NULL, &exited, NULL, 0);
+    }
+
+    // Far more output than the pipe holds, nobody reads it until the recorder is done
+    TEST_ASSERT_EQUAL_INT(0, pipe(pipe_fds));
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, 4096);
+    FILE *stream = fdopen(pipe_fds[1], "w");
+    TEST_ASSERT_NOT_NULL(stream);
+    setvbuf(stream, NULL, _IONBF, 0);
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&dumper, NULL, stats_dump_thread, stream));
+    usleep(200000);
+
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&recorder, NULL, stats_record_thread, NULL));
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 2;
+    int joined = pthread_timedjoin_np(recorder, NULL, &deadline);
+
+    // Let the dump finish either way before checking
+    fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+    while(pthread_tryjoin_np(dumper, NULL) == EBUSY)
+    {
+        if(read(pipe_fds[0], drain, sizeof(drain)) <= 0)
+            usleep(1000);
+    }
+    fclose(stream);
+    close(pipe_fds[0]);
+    if(joined != 0)
+        pthread_join(recorder, NULL);
+    exec_stats_reset();
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, joined, "Recording should not wait for a blocked dump");
+}
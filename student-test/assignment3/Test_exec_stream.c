@@ -0,0 +1,116 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+#define STREAM_MAX_LINES 8
+
+/**
+* Collects what do_exec_stream() delivers, one entry per callback
+*/
+struct stream_record
+{
+    char lines[STREAM_MAX_LINES][32];
+    enum exec_stream_channel channels[STREAM_MAX_LINES];
+    size_t count;
+    size_t bytes;
+    size_t stop_after;
+};
+
+static bool stream_record_callback(enum exec_stream_channel channel, const char *data, size_t length, void *context)
+{
+    struct stream_record *record = context;
+
+    record->bytes += length;
+    if(record->count < STREAM_MAX_LINES)
+    {
+        size_t copy = length < sizeof(record->lines[0]) - 1 ? length : sizeof(record->lines[0]) - 1;
+        memcpy(record->lines[record->count], data, copy);
+        record->lines[record->count][copy] = '\0';
+        record->channels[record->count] = channel;
+    }
+    record->count++;
+    return record->stop_after == 0 || record->count < record->stop_after;
+}
+
+/**
+* In line mode every line arrives on its own without its newline, the last one even without
+* a newline, and lines longer than the buffer arrive in buffer sized pieces.
+*/
+void test_exec_stream_lines()
+{
+    struct stream_record record;
+    struct exec_stream stream = { stream_record_callback, &record, 0, true, false };
+
+    memset(&record, 0, sizeof(record));
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_stream(&stream, 3, "/usr/bin/printf", "%s", "one\ntwo\n\nthree"),
+            "printf should succeed");
+    TEST_ASSERT_EQUAL_size_t_MESSAGE(4, record.count, "Every line should be delivered once");
+    TEST_ASSERT_EQUAL_STRING("one", record.lines[0]);
+    TEST_ASSERT_EQUAL_STRING("two", record.lines[1]);
+    TEST_ASSERT_EQUAL_STRING("", record.lines[2]);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("three", record.lines[3], "The last line should arrive without a newline");
+
+    memset(&record, 0, sizeof(record));
+    stream.buffer_size = 4;
+    TEST_ASSERT_TRUE(do_exec_stream(&stream, 3, "/usr/bin/printf", "%s", "abcdefghij\n"));
+    TEST_ASSERT_EQUAL_size_t_MESSAGE(3, record.count, "A long line should arrive in buffer sized pieces");
+    TEST_ASSERT_EQUAL_STRING("abcd", record.lines[0]);
+    TEST_ASSERT_EQUAL_STRING("efgh", record.lines[1]);
+    TEST_ASSERT_EQUAL_STRING("ij", record.lines[2]);
+}
+
+/**
+* With capture_stderr set standard error arrives on its own channel.
+*/
+void test_exec_stream_stderr()
+{
+    struct stream_record record;
+    struct exec_stream stream = { stream_record_callback, &record, 0, true, true };
+    size_t i;
+    bool seen_stdout = false;
+    bool seen_stderr = false;
+
+    memset(&record, 0, sizeof(record));
+    TEST_ASSERT_TRUE(do_exec_stream(&stream, 3, "/bin/sh", "-c", "echo out; echo err >&2"));
+    TEST_ASSERT_EQUAL_size_t(2, record.count);
+    for(i = 0; i < record.count; i++)
+    {
+        if(record.channels[i] == EXEC_STREAM_STDOUT)
+            seen_stdout = strcmp(record.lines[i], "out") == 0;
+        else
+            seen_stderr = strcmp(record.lines[i], "err") == 0;
+    }
+    TEST_ASSERT_TRUE_MESSAGE(seen_stdout, "out should arrive on EXEC_STREAM_STDOUT");
+    TEST_ASSERT_TRUE_MESSAGE(seen_stderr, "err should arrive on EXEC_STREAM_STDERR");
+}
+
+/**
+* A callback returning false stops a command that would otherwise never end.
+*/
+void test_exec_stream_stop()
+{
+    struct stream_record record;
+    struct exec_stream stream = { stream_record_callback, &record, 0, true, false };
+
+    memset(&record, 0, sizeof(record));
+    record.stop_after = 3;
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_stream(&stream, 1, "/usr/bin/yes"), "A stopped stream should report false");
+    TEST_ASSERT_EQUAL_size_t_MESSAGE(3, record.count, "Nothing should be delivered after the callback stopped");
+    TEST_ASSERT_EQUAL_STRING("y", record.lines[0]);
+}
+
+/**
+* Chunk mode hands over whatever each read returns, all of it exactly once.
+*/
+void test_exec_stream_chunks()
+{
+    struct stream_record record;
+    struct exec_stream stream = { stream_record_callback, &record, 0, false, false };
+
+    memset(&record, 0, sizeof(record));
+    TEST_ASSERT_TRUE(do_exec_stream(&stream, 3, "/usr/bin/printf", "%s", "home is where the heart is\n"));
+    TEST_ASSERT_EQUAL_size_t(strlen("home is where the heart is\n"), record.bytes);
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_stream(&stream, 1, "/bin/false"), "A failing command should report false");
+}
@@ -0,0 +1,83 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+#define TIMEOUT_OUTPUT_FILE "/tmp/test_exec_timeout_output.txt"
+#define TIMEOUT_LATE_FILE "/tmp/test_exec_timeout_late.txt"
+
+static double elapsed_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+* Commands that finish before their deadline report how they exited.
+*/
+void test_exec_timeout_before_deadline()
+{
+    TEST_ASSERT_EQUAL_INT_MESSAGE(EXEC_RESULT_SUCCESS, do_exec_timeout(5000, 100, 1, "/bin/true"),
+            "true should succeed well before its deadline");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(EXEC_RESULT_FAILED, do_exec_timeout(5000, 100, 1, "/bin/false"),
+            "false should fail, not time out");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(EXEC_RESULT_SUCCESS, do_exec_timeout(-1, 0, 2, "/bin/echo", "no deadline"),
+            "A timeout of -1 should wait forever");
+}
+
+/**
+* A command past its deadline is stopped together with everything it started: the shell's
+* sleep is in the same process group, so the shell never gets to write the late file.
+*/
+void test_exec_timeout_kills_group()
+{
+    struct timespec start;
+
+    remove(TIMEOUT_LATE_FILE);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(EXEC_RESULT_TIMEOUT,
+            do_exec_timeout(200, 100, 3, "/bin/sh", "-c", "sleep 5; echo late > " TIMEOUT_LATE_FILE),
+            "A command sleeping past its deadline should time out");
+    TEST_ASSERT_TRUE_MESSAGE(elapsed_since(&start) < 2.0, "The command should be stopped at its deadline");
+
+    sleep(1);
+    TEST_ASSERT_NOT_EQUAL_MESSAGE(0, access(TIMEOUT_LATE_FILE, F_OK),
+            "Nothing the command started should outlive the deadline");
+}
+
+/**
+* A command ignoring SIGTERM is killed grace_ms after its deadline.
+*/
+void test_exec_timeout_grace_kill()
+{
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(EXEC_RESULT_TIMEOUT,
+            do_exec_timeout(200, 200, 3, "/bin/sh", "-c", "trap '' TERM; sleep 5"),
+            "A command ignoring SIGTERM should still time out");
+    TEST_ASSERT_TRUE_MESSAGE(elapsed_since(&start) < 2.0, "SIGKILL should follow after the grace period");
+}
+
+/**
+* The redirecting variant writes the command's output to the file.
+*/
+void test_exec_redirect_timeout_output()
+{
+    char buffer[64] = { 0 };
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(EXEC_RESULT_SUCCESS,
+            do_exec_redirect_timeout(TIMEOUT_OUTPUT_FILE, 5000, 100, 2, "/bin/echo", "home is where the heart is"),
+            "echo should succeed before its deadline");
+    FILE *output = fopen(TIMEOUT_OUTPUT_FILE, "r");
+    TEST_ASSERT_NOT_NULL_MESSAGE(output, "The output file should have been created");
+    TEST_ASSERT_NOT_NULL(fgets(buffer, sizeof(buffer), output));
+    fclose(output);
+    remove(TIMEOUT_OUTPUT_FILE);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("home is where the heart is\n", buffer, "The output of echo should be in the file");
+}